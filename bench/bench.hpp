@@ -0,0 +1,366 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bytestring.hpp"
+#include "cborencoder.hpp"
+#include "dnsmessage.hpp"
+#include "packetstream.hpp"
+#include "queryresponse.hpp"
+#include "workload.hpp"
+
+/**
+ * \struct BenchInput
+ * \brief Benchmark input data, read once from a capture file.
+ */
+struct BenchInput
+{
+    /**
+     * \brief the capture file name, or a description of the generated input.
+     */
+    std::string pcap_file;
+
+    /**
+     * \brief all packets in the capture.
+     */
+    std::vector<std::shared_ptr<PcapItem>> packets;
+
+    /**
+     * \brief the DNS messages found in the capture, in capture order.
+     */
+    std::vector<DNSMessage> messages;
+
+    /**
+     * \brief the wire format of each DNS message.
+     */
+    std::vector<byte_string> wire;
+
+    /**
+     * \brief the query/response pairs made from the DNS messages.
+     */
+    std::vector<std::shared_ptr<QueryResponse>> query_responses;
+
+    /**
+     * \brief Read the input from a capture file.
+     *
+     * \param fname the capture file name.
+     * \throws std::runtime_error if the file can't be read or contains
+     *         no DNS messages.
+     */
+    void load(const std::string& fname);
+
+    /**
+     * \brief Generate the input from a synthetic workload.
+     *
+     * \param params the workload parameters.
+     */
+    void generate(const WorkloadParameters& params);
+};
+
+/**
+ * \class BenchState
+ * \brief The state of a single benchmark run.
+ *
+ * A benchmark function does any setup it needs, and then calls
+ * run() with the operation to time. Only the time spent in run()
+ * is measured.
+ */
+class BenchState
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param iterations the number of iterations to run.
+     * \param input      the benchmark input.
+     */
+    BenchState(uint64_t iterations, const BenchInput& input)
+        : iterations_(iterations), input_(input),
+          items_per_iteration_(1), bytes_per_iteration_(0),
+          elapsed_(std::chrono::nanoseconds::zero()) {}
+
+    /**
+     * \brief Return the number of iterations to run.
+     */
+    uint64_t iterations() const
+    {
+        return iterations_;
+    }
+
+    /**
+     * \brief Return the benchmark input.
+     */
+    const BenchInput& input() const
+    {
+        return input_;
+    }
+
+    /**
+     * \brief Time an operation.
+     *
+     * \param f the operation, called with the iteration number.
+     */
+    template<typename F>
+    void run(F f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for ( uint64_t i = 0; i < iterations_; ++i )
+            f(i);
+        elapsed_ += std::chrono::steady_clock::now() - start;
+    }
+
+    /**
+     * \brief Set the number of items processed by each iteration.
+     *
+     * The default is 1.
+     *
+     * \param items the number of items.
+     */
+    void set_items_per_iteration(double items)
+    {
+        items_per_iteration_ = items;
+    }
+
+    /**
+     * \brief Set the number of bytes processed by each iteration.
+     *
+     * The default is 0, meaning no byte rate is reported.
+     *
+     * \param bytes the number of bytes.
+     */
+    void set_bytes_per_iteration(double bytes)
+    {
+        bytes_per_iteration_ = bytes;
+    }
+
+    /**
+     * \brief Return the number of items processed by each iteration.
+     */
+    double items_per_iteration() const
+    {
+        return items_per_iteration_;
+    }
+
+    /**
+     * \brief Return the number of bytes processed by each iteration.
+     */
+    double bytes_per_iteration() const
+    {
+        return bytes_per_iteration_;
+    }
+
+    /**
+     * \brief Return the time spent in run().
+     */
+    std::chrono::nanoseconds elapsed() const
+    {
+        return elapsed_;
+    }
+
+private:
+    /**
+     * \brief the number of iterations.
+     */
+    uint64_t iterations_;
+
+    /**
+     * \brief the benchmark input.
+     */
+    const BenchInput& input_;
+
+    /**
+     * \brief items processed per iteration.
+     */
+    double items_per_iteration_;
+
+    /**
+     * \brief bytes processed per iteration.
+     */
+    double bytes_per_iteration_;
+
+    /**
+     * \brief time spent in run().
+     */
+    std::chrono::nanoseconds elapsed_;
+};
+
+/**
+ * \class MemoryCborEncoder
+ * \brief A CBOR file encoder that writes to memory.
+ *
+ * Output is appended to a string, if one is given, or discarded.
+ * The file name given on opening is ignored.
+ */
+class MemoryCborEncoder : public CborBaseStreamFileEncoder
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param out the string to append output to, or `nullptr` to discard it.
+     */
+    explicit MemoryCborEncoder(std::string* out = nullptr)
+        : out_(out), open_(false), bytes_(0) {}
+
+    /**
+     * \brief Open the output.
+     */
+    virtual void open(const std::string&, bool = false)
+    {
+        open_ = true;
+    }
+
+    /**
+     * \brief Close the output.
+     */
+    virtual void close()
+    {
+        flush();
+        open_ = false;
+    }
+
+    /**
+     * \brief Return whether the output is open.
+     */
+    virtual bool is_open() const
+    {
+        return open_;
+    }
+
+    /**
+     * \brief Return the file extension.
+     */
+    virtual const char* suggested_extension()
+    {
+        return "";
+    }
+
+    /**
+     * \brief Return the number of bytes written.
+     */
+    virtual std::uintmax_t bytes_written()
+    {
+        return bytes_;
+    }
+
+protected:
+    /**
+     * \brief Write output.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes number of bytes in the buffer.
+     */
+    virtual void writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes)
+    {
+        if ( out_ )
+            out_->append(reinterpret_cast<const char*>(p), n_bytes);
+        bytes_ += n_bytes;
+    }
+
+private:
+    /**
+     * \brief the output string.
+     */
+    std::string* out_;
+
+    /**
+     * \brief is the output open?
+     */
+    bool open_;
+
+    /**
+     * \brief the number of bytes written.
+     */
+    std::uintmax_t bytes_;
+};
+
+/**
+ * \brief Prevent the compiler optimising away a computed value.
+ *
+ * \param value the value.
+ */
+template<typename T>
+inline void do_not_optimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * \typedef BenchFunction
+ * \brief A benchmark function.
+ */
+using BenchFunction = std::function<void (BenchState&)>;
+
+/**
+ * \struct Benchmark
+ * \brief A registered benchmark.
+ */
+struct Benchmark
+{
+    /**
+     * \brief the benchmark name, <component>/<operation>.
+     */
+    std::string name;
+
+    /**
+     * \brief the benchmark function.
+     */
+    BenchFunction fn;
+};
+
+/**
+ * \brief Return all registered benchmarks.
+ */
+std::vector<Benchmark>& benchmarks();
+
+/**
+ * \class BenchRegistration
+ * \brief Register a benchmark at static initialisation.
+ */
+class BenchRegistration
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param name the benchmark name.
+     * \param fn   the benchmark function.
+     */
+    BenchRegistration(const char* name, BenchFunction fn)
+    {
+        benchmarks().push_back(Benchmark{name, fn});
+    }
+};
+
+#define BENCH_CONCAT_(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_(a, b)
+
+/**
+ * \brief Define and register a benchmark.
+ *
+ * Use as a function head; the body has a `BenchState& state` parameter.
+ */
+#define BENCHMARK(name)                                                 \
+    static void BENCH_CONCAT(bench_fn_, __LINE__)(BenchState& state);   \
+    static BenchRegistration BENCH_CONCAT(bench_reg_, __LINE__)(name, BENCH_CONCAT(bench_fn_, __LINE__)); \
+    static void BENCH_CONCAT(bench_fn_, __LINE__)(BenchState& state)
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/log/core.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <tins/tins.h>
+
+#include "config.h"
+
+#include "configuration.hpp"
+#include "makeunique.hpp"
+#include "matcher.hpp"
+#include "packetstatistics.hpp"
+
+#include "bench.hpp"
+
+namespace po = boost::program_options;
+
+const std::string PROGNAME = "compactor-bench";
+
+namespace {
+    /**
+     * \brief the most iterations a benchmark will be run for.
+     */
+    const uint64_t MAX_ITERATIONS = 1000000000;
+
+    /**
+     * \struct BenchResult
+     * \brief The results of repeated runs of one benchmark.
+     */
+    struct BenchResult
+    {
+        /**
+         * \brief the benchmark name.
+         */
+        std::string name;
+
+        /**
+         * \brief the iterations in each run.
+         */
+        uint64_t iterations;
+
+        /**
+         * \brief nanoseconds per iteration in each run, sorted.
+         */
+        std::vector<double> ns_per_op;
+
+        /**
+         * \brief items processed per iteration.
+         */
+        double items_per_iteration;
+
+        /**
+         * \brief bytes processed per iteration.
+         */
+        double bytes_per_iteration;
+
+        /**
+         * \brief Return the median nanoseconds per iteration.
+         */
+        double median() const
+        {
+            std::size_t n = ns_per_op.size();
+            if ( n % 2 == 1 )
+                return ns_per_op[n / 2];
+            return ( ns_per_op[n / 2 - 1] + ns_per_op[n / 2] ) / 2;
+        }
+    };
+
+    /**
+     * \brief Run a benchmark once.
+     *
+     * \param b          the benchmark.
+     * \param iterations the number of iterations.
+     * \param input      the benchmark input.
+     * \param[out] res   the items and bytes processed per iteration.
+     * \returns nanoseconds per iteration.
+     */
+    double run_once(const Benchmark& b, uint64_t iterations,
+                    const BenchInput& input, BenchResult& res)
+    {
+        BenchState state(iterations, input);
+        b.fn(state);
+        res.items_per_iteration = state.items_per_iteration();
+        res.bytes_per_iteration = state.bytes_per_iteration();
+        return double(state.elapsed().count()) / iterations;
+    }
+
+    /**
+     * \brief Run a benchmark.
+     *
+     * First find the number of iterations needed to run for at least
+     * the minimum time. Then do the specified number of runs of that
+     * many iterations.
+     *
+     * \param b           the benchmark.
+     * \param input       the benchmark input.
+     * \param min_time    the minimum run time, in seconds.
+     * \param repetitions the number of runs.
+     * \returns the results.
+     */
+    BenchResult run_benchmark(const Benchmark& b, const BenchInput& input,
+                              double min_time, unsigned repetitions)
+    {
+        BenchResult res;
+        res.name = b.name;
+
+        uint64_t iterations = 1;
+        for (;;)
+        {
+            double secs = run_once(b, iterations, input, res) * iterations / 1e9;
+            if ( secs >= min_time || iterations >= MAX_ITERATIONS )
+                break;
+
+            // Aim a little over the minimum time, but don't grow
+            // too fast on the strength of a very short run.
+            double mult = ( secs > 0 ) ? min_time * 1.4 / secs : 10;
+            mult = std::min(std::max(mult, 2.0), 10.0);
+            iterations = std::min(uint64_t(iterations * mult), MAX_ITERATIONS);
+        }
+
+        res.iterations = iterations;
+        for ( unsigned r = 0; r < repetitions; ++r )
+            res.ns_per_op.push_back(run_once(b, iterations, input, res));
+        std::sort(res.ns_per_op.begin(), res.ns_per_op.end());
+        return res;
+    }
+
+    /**
+     * \brief Quote a string for JSON output.
+     *
+     * \param s the string.
+     */
+    std::string json_string(const std::string& s)
+    {
+        std::ostringstream oss;
+        oss << '"';
+        for ( char c : s )
+        {
+            if ( c == '"' || c == '\\' )
+                oss << '\\' << c;
+            else if ( static_cast<unsigned char>(c) < 0x20 )
+                oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                    << int(c) << std::dec;
+            else
+                oss << c;
+        }
+        oss << '"';
+        return oss.str();
+    }
+
+    /**
+     * \brief Write results as JSON.
+     *
+     * \param os          the output stream.
+     * \param input       the benchmark input.
+     * \param results     the results.
+     * \param min_time    the minimum run time.
+     * \param repetitions the number of runs.
+     */
+    void write_json(std::ostream& os, const BenchInput& input,
+                    const std::vector<BenchResult>& results,
+                    double min_time, unsigned repetitions)
+    {
+        char date[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        os.precision(15);
+        os << "{\n"
+           << "  \"program\": " << json_string(PROGNAME) << ",\n"
+           << "  \"version\": " << json_string(PACKAGE_VERSION) << ",\n"
+           << "  \"date\": " << json_string(date) << ",\n"
+           << "  \"input\": " << json_string(input.pcap_file) << ",\n"
+           << "  \"input_packets\": " << input.packets.size() << ",\n"
+           << "  \"input_messages\": " << input.messages.size() << ",\n"
+           << "  \"min_time\": " << min_time << ",\n"
+           << "  \"repetitions\": " << repetitions << ",\n"
+           << "  \"benchmarks\": [";
+
+        bool first = true;
+        for ( const auto& r : results )
+        {
+            double ns = r.median();
+            os << ( first ? "\n" : ",\n" )
+               << "    {\n"
+               << "      \"name\": " << json_string(r.name) << ",\n"
+               << "      \"iterations\": " << r.iterations << ",\n"
+               << "      \"ns_per_op\": " << ns << ",\n"
+               << "      \"ns_per_op_min\": " << r.ns_per_op.front() << ",\n"
+               << "      \"ns_per_op_max\": " << r.ns_per_op.back() << ",\n"
+               << "      \"items_per_second\": "
+               << ( ns > 0 ? r.items_per_iteration * 1e9 / ns : 0 ) << ",\n"
+               << "      \"bytes_per_second\": "
+               << ( ns > 0 ? r.bytes_per_iteration * 1e9 / ns : 0 ) << "\n"
+               << "    }";
+            first = false;
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    /**
+     * \brief Compare results with a baseline.
+     *
+     * \param fname         the baseline JSON file, written by an earlier run.
+     * \param results       the results.
+     * \param max_regression the largest acceptable slowdown, in percent.
+     *                       0 means any slowdown is acceptable.
+     * \returns <code>true</code> if no benchmark slowed by more than allowed.
+     */
+    bool compare_baseline(const std::string& fname,
+                          const std::vector<BenchResult>& results,
+                          double max_regression)
+    {
+        boost::property_tree::ptree baseline;
+        boost::property_tree::read_json(fname, baseline);
+
+        std::map<std::string, double> base_ns;
+        for ( const auto& b : baseline.get_child("benchmarks") )
+            base_ns[b.second.get<std::string>("name")] = b.second.get<double>("ns_per_op");
+
+        bool ok = true;
+        std::cerr << "\nComparison with " << fname << " ("
+                  << baseline.get<std::string>("version", "unknown version") << "):\n";
+        for ( const auto& r : results )
+        {
+            auto base = base_ns.find(r.name);
+            std::cerr << std::left << std::setw(40) << r.name << std::right;
+            if ( base == base_ns.end() || base->second <= 0 )
+            {
+                std::cerr << "  (not in baseline)\n";
+                continue;
+            }
+
+            double change = ( r.median() - base->second ) * 100 / base->second;
+            bool regressed = ( max_regression > 0 && change > max_regression );
+            std::cerr << std::fixed << std::setprecision(1)
+                      << std::setw(12) << base->second << " ->"
+                      << std::setw(12) << r.median() << " ns/op "
+                      << std::showpos << std::setw(7) << change << "%"
+                      << std::noshowpos << std::defaultfloat
+                      << ( regressed ? "  REGRESSION" : "" ) << "\n";
+            if ( regressed )
+                ok = false;
+        }
+        return ok;
+    }
+
+    /**
+     * \brief Fill benchmark input from a source of packets.
+     *
+     * \param input the benchmark input.
+     * \param next  function returning the next packet, or an empty
+     *              packet at the end of input.
+     * \throws std::runtime_error if there are no DNS messages.
+     */
+    template<typename Next>
+    void read_packets(BenchInput& input, Next next)
+    {
+        Configuration config;
+        PacketStatistics stats{};
+        PacketStream packet_stream(
+            config,
+            [&input](std::unique_ptr<DNSMessage>& m)
+            {
+                Tins::PDU::serialization_type buf = m->dns.serialize();
+                input.wire.emplace_back(buf.data(), buf.size());
+                input.messages.push_back(*m);
+            },
+            [](std::shared_ptr<AddressEvent>&) {},
+            stats);
+
+        // Only keep packets that yield DNS messages. Benchmarking the
+        // exception paths for other packets is not of interest.
+        for ( Tins::Packet pkt = next(); pkt; pkt = next() )
+        {
+            auto item = std::make_shared<PcapItem>(pkt);
+            try
+            {
+                packet_stream.process_packet(item);
+                input.packets.push_back(item);
+            }
+            catch (const unhandled_packet&)
+            {
+            }
+            catch (const malformed_packet&)
+            {
+            }
+        }
+
+        if ( input.messages.empty() )
+            throw std::runtime_error(input.pcap_file + " contains no DNS messages");
+
+        QueryResponseMatcher matcher(
+            [&input](std::shared_ptr<QueryResponse> qr)
+            {
+                input.query_responses.push_back(qr);
+            });
+        for ( const auto& m : input.messages )
+            matcher.add(make_unique<DNSMessage>(m));
+        matcher.flush();
+    }
+}
+
+std::vector<Benchmark>& benchmarks()
+{
+    static std::vector<Benchmark> all;
+    return all;
+}
+
+void BenchInput::load(const std::string& fname)
+{
+    pcap_file = fname;
+
+    Tins::FileSniffer sniffer(fname);
+    read_packets(*this, [&sniffer]() { return sniffer.next_packet(); });
+}
+
+void BenchInput::generate(const WorkloadParameters& params)
+{
+    pcap_file = "generated workload, seed " + std::to_string(params.seed);
+
+    WorkloadGenerator gen(params);
+    WorkloadMessage msg;
+    std::vector<WorkloadPacket> frames;
+    std::size_t next_frame = 0;
+    read_packets(*this,
+                 [&]()
+                 {
+                     while ( next_frame == frames.size() )
+                     {
+                         frames.clear();
+                         next_frame = 0;
+                         if ( !gen.next(msg) )
+                             return Tins::Packet();
+                         gen.packets(msg, frames);
+                     }
+                     const WorkloadPacket& p = frames[next_frame++];
+                     return Tins::Packet(
+                         Tins::EthernetII(p.data.data(), p.data.size()),
+                         std::chrono::duration_cast<std::chrono::microseconds>(p.timestamp.time_since_epoch()));
+                 });
+}
+
+int main(int ac, char *av[])
+{
+    std::string pcap_file;
+    std::string output_file;
+    std::string baseline_file;
+    std::vector<std::string> filters;
+    double min_time;
+    unsigned repetitions;
+    double max_regression;
+    WorkloadParameters workload;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("list,l", "list the benchmarks and exit.")
+        ("filter,f",
+         po::value<std::vector<std::string>>(&filters),
+         "run only benchmarks whose name contains this text. May be repeated.")
+        ("pcap,p",
+         po::value<std::string>(&pcap_file)->default_value("gold.pcap"),
+         "capture file supplying the benchmark input.")
+        ("workload,w",
+         "generate a synthetic workload as the benchmark input, "
+         "instead of reading a capture file.")
+        ("min-time,t",
+         po::value<double>(&min_time)->default_value(0.5),
+         "minimum time for each run, in seconds.")
+        ("repetitions,r",
+         po::value<unsigned>(&repetitions)->default_value(5),
+         "number of runs of each benchmark.")
+        ("output,o",
+         po::value<std::string>(&output_file)->default_value("-"),
+         "JSON results file, '-' for standard output.")
+        ("baseline,b",
+         po::value<std::string>(&baseline_file),
+         "compare results with this earlier JSON results file.")
+        ("max-regression",
+         po::value<double>(&max_regression)->default_value(0),
+         "fail if any benchmark is slower than the baseline by more than "
+         "this percentage. 0 means never fail.")
+        ;
+    options.add(workload.options());
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::command_line_parser(ac, av).options(options).run(), vm);
+        po::notify(vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr << "Usage: " << PROGNAME << " [options]\n" << options;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        if ( repetitions == 0 )
+            throw po::error("repetitions must be at least 1");
+        workload.check();
+
+        std::vector<Benchmark> selected;
+        for ( const auto& b : benchmarks() )
+        {
+            bool match = filters.empty();
+            for ( const auto& f : filters )
+                if ( b.name.find(f) != std::string::npos )
+                    match = true;
+            if ( match )
+                selected.push_back(b);
+        }
+        std::sort(selected.begin(), selected.end(),
+                  [](const Benchmark& a, const Benchmark& b)
+                  {
+                      return a.name < b.name;
+                  });
+
+        if ( vm.count("list") )
+        {
+            for ( const auto& b : selected )
+                std::cout << b.name << "\n";
+            return 0;
+        }
+
+        // Writers log file rotation. Don't let that mix with results.
+        boost::log::core::get()->set_logging_enabled(false);
+
+        BenchInput input;
+        if ( vm.count("workload") )
+            input.generate(workload);
+        else
+            input.load(pcap_file);
+        std::cerr << PROGNAME << ": " << input.pcap_file << ": "
+                  << input.packets.size() << " packets, "
+                  << input.messages.size() << " DNS messages, "
+                  << input.query_responses.size() << " query/responses\n";
+
+        std::vector<BenchResult> results;
+        for ( const auto& b : selected )
+        {
+            results.push_back(run_benchmark(b, input, min_time, repetitions));
+            const BenchResult& r = results.back();
+            std::cerr << std::left << std::setw(40) << r.name << std::right
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(12) << r.median() << " ns/op"
+                      << std::setw(14) << std::setprecision(0)
+                      << r.items_per_iteration * 1e9 / r.median() << " items/s\n"
+                      << std::defaultfloat;
+        }
+
+        if ( output_file == "-" )
+            write_json(std::cout, input, results, min_time, repetitions);
+        else
+        {
+            std::ofstream ofs(output_file);
+            if ( !ofs.is_open() )
+                throw std::runtime_error("can't create " + output_file);
+            write_json(ofs, input, results, min_time, repetitions);
+        }
+
+        if ( !baseline_file.empty() &&
+             !compare_baseline(baseline_file, results, max_regression) )
+            return 2;
+    }
+    catch (const po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << ".\n"
+                  << "Run '" << PROGNAME << " -h' for help.\n";
+        return 1;
+    }
+    catch (const boost::property_tree::ptree_error& err)
+    {
+        std::cerr << PROGNAME << ": Error reading baseline: " << err.what() << std::endl;
+        return 1;
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "blockcbordata.hpp"
+#include "blockcborreader.hpp"
+#include "blockcborview.hpp"
+#include "blockcborwriter.hpp"
+#include "cbordecoder.hpp"
+#include "configuration.hpp"
+#include "makeunique.hpp"
+#include "packetstatistics.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("headerlist/add_names")
+{
+    // Add query names to a header list as a block is built. The list
+    // is cleared when a block would be full, as it is in a writer.
+    std::vector<block_cbor::ByteStringItem> names;
+    for ( const auto& m : state.input().messages )
+        for ( const auto& q : m.dns.queries() )
+            names.push_back(block_cbor::ByteStringItem{q.dname()});
+
+    block_cbor::HeaderList<block_cbor::ByteStringItem, byte_string> list;
+    const uint64_t block_size = 5000;
+    state.run([&](uint64_t i)
+              {
+                  if ( i % block_size == 0 )
+                      list.clear();
+                  do_not_optimize(list.add(names[i % names.size()]));
+              });
+}
+
+BENCHMARK("headerlist/add_addresses")
+{
+    std::vector<block_cbor::ByteStringItem> addresses;
+    for ( const auto& m : state.input().messages )
+        if ( m.clientIP )
+            addresses.push_back(block_cbor::ByteStringItem{m.clientIP->asNetworkBinary()});
+
+    block_cbor::HeaderList<block_cbor::ByteStringItem, byte_string> list;
+    const uint64_t block_size = 5000;
+    state.run([&](uint64_t i)
+              {
+                  if ( i % block_size == 0 )
+                      list.clear();
+                  do_not_optimize(list.add(addresses[i % addresses.size()]));
+              });
+}
+
+BENCHMARK("blockcborwriter/writeQR")
+{
+    Configuration config;
+    PacketStatistics stats{};
+    auto enc = make_unique<MemoryCborEncoder>();
+    MemoryCborEncoder* mem = enc.get();
+    BlockCborWriter writer(config, std::move(enc), false);
+    const std::vector<std::shared_ptr<QueryResponse>>& qrs = state.input().query_responses;
+
+    state.run([&](uint64_t i)
+              {
+                  writer.writeQR(qrs[i % qrs.size()], stats);
+              });
+    writer.close();
+    state.set_bytes_per_iteration(double(mem->bytes_written()) / state.iterations());
+}
+
+BENCHMARK("blockcborreader/readQRData")
+{
+    // Write the input to C-DNS in memory, and read it back repeatedly,
+    // starting again from the file header at the end of the input.
+    Configuration config;
+    std::string cdns;
+    {
+        PacketStatistics stats{};
+        BlockCborWriter writer(config, make_unique<MemoryCborEncoder>(&cdns), false);
+        for ( const auto& qr : state.input().query_responses )
+            writer.writeQR(qr, stats);
+        writer.close();
+    }
+    state.set_bytes_per_iteration(double(cdns.size()) / state.input().query_responses.size());
+
+    Defaults defaults;
+    std::unique_ptr<std::istringstream> is;
+    std::unique_ptr<CborStreamDecoder> dec;
+    std::unique_ptr<BlockCborReader> reader;
+    state.run([&](uint64_t)
+              {
+                  bool eof = true;
+                  QueryResponseData qr;
+                  if ( reader )
+                      qr = reader->readQRData(eof);
+                  if ( eof )
+                  {
+                      is = make_unique<std::istringstream>(cdns);
+                      dec = make_unique<CborStreamDecoder>(*is);
+                      reader = make_unique<BlockCborReader>(*dec, config, defaults);
+                      qr = reader->readQRData(eof);
+                  }
+                  do_not_optimize(qr);
+              });
+}
+
+BENCHMARK("blockcborreader/visitBlock")
+{
+    // As blockcborreader/readQRData, but visiting whole blocks. Each
+    // iteration is a block, so report rates per record for comparison.
+    Configuration config;
+    std::string cdns;
+    {
+        PacketStatistics stats{};
+        BlockCborWriter writer(config, make_unique<MemoryCborEncoder>(&cdns), false);
+        for ( const auto& qr : state.input().query_responses )
+            writer.writeQR(qr, stats);
+        writer.close();
+    }
+
+    class QNameVisitor : public block_cbor::BlockVisitor
+    {
+    public:
+        QNameVisitor() : records(0), bytes(0) {}
+
+        virtual void block(const block_cbor::BlockView& block)
+        {
+            auto names = block.names_rdatas();
+            for ( const auto& qri : block.query_response_items() )
+                if ( qri.qname )
+                    bytes += names.get(qri.qname).str.size();
+            records += block.query_response_items().size();
+        }
+
+        uint64_t records;
+        uint64_t bytes;
+    };
+
+    Defaults defaults;
+    QNameVisitor visitor;
+    uint64_t blocks = 0;
+    std::unique_ptr<std::istringstream> is;
+    std::unique_ptr<CborStreamDecoder> dec;
+    std::unique_ptr<BlockCborReader> reader;
+    state.run([&](uint64_t)
+              {
+                  if ( !reader || !reader->visitBlock(visitor) )
+                  {
+                      is = make_unique<std::istringstream>(cdns);
+                      dec = make_unique<CborStreamDecoder>(*is);
+                      reader = make_unique<BlockCborReader>(*dec, config, defaults);
+                      reader->visitBlock(visitor);
+                  }
+                  ++blocks;
+              });
+    do_not_optimize(visitor.bytes);
+    if ( blocks > 0 && visitor.records > 0 )
+    {
+        double records_per_block = double(visitor.records) / blocks;
+        state.set_items_per_iteration(records_per_block);
+        state.set_bytes_per_iteration(records_per_block * cdns.size() / state.input().query_responses.size());
+    }
+}
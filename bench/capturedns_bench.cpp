@@ -0,0 +1,31 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include "capturedns.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("capturedns/parse")
+{
+    const std::vector<byte_string>& wire = state.input().wire;
+    double bytes = 0;
+    for ( const auto& w : wire )
+        bytes += w.size();
+    state.set_bytes_per_iteration(bytes / wire.size());
+
+    state.run([&](uint64_t i)
+              {
+                  const byte_string& w = wire[i % wire.size()];
+                  CaptureDNS dns(w.data(), w.size());
+                  do_not_optimize(dns);
+              });
+}
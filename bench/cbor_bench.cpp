@@ -0,0 +1,107 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+#include "makeunique.hpp"
+
+#include "bench.hpp"
+
+namespace {
+    /**
+     * \brief Encode a summary of a DNS message.
+     *
+     * This is a representative mix of items written to C-DNS: an
+     * array of integers of various sizes and a byte string.
+     *
+     * \param enc the encoder.
+     * \param m   the message.
+     */
+    void encode_message(CborBaseEncoder& enc, const DNSMessage& m)
+    {
+        enc.writeArrayHeader(5);
+        enc.write(static_cast<unsigned long long>(
+                      std::chrono::duration_cast<std::chrono::microseconds>(
+                          m.timestamp.time_since_epoch()).count()));
+        enc.write(static_cast<unsigned>(m.dns.id()));
+        enc.write(static_cast<unsigned>(m.dns.rcode()));
+        if ( m.dns.queries().empty() )
+        {
+            enc.write(0);
+            enc.write(byte_string());
+        }
+        else
+        {
+            enc.write(static_cast<unsigned>(m.dns.queries().front().query_type()));
+            enc.write(m.dns.queries().front().dname());
+        }
+    }
+
+    /**
+     * \brief Decode a summary of a DNS message.
+     *
+     * \param dec the decoder.
+     */
+    void decode_message(CborBaseDecoder& dec)
+    {
+        bool indef;
+        dec.readArrayHeader(indef);
+        do_not_optimize(dec.read_unsigned());
+        do_not_optimize(dec.read_unsigned());
+        do_not_optimize(dec.read_unsigned());
+        do_not_optimize(dec.read_unsigned());
+        byte_string name = dec.read_binary();
+        do_not_optimize(name);
+    }
+}
+
+BENCHMARK("cbor/encode")
+{
+    const std::vector<DNSMessage>& messages = state.input().messages;
+    MemoryCborEncoder enc;
+
+    state.run([&](uint64_t i)
+              {
+                  encode_message(enc, messages[i % messages.size()]);
+              });
+    enc.flush();
+    state.set_bytes_per_iteration(double(enc.bytes_written()) / state.iterations());
+}
+
+BENCHMARK("cbor/decode")
+{
+    // Encode one summary of each message, and decode them
+    // repeatedly, starting again at the end of the input.
+    const std::vector<DNSMessage>& messages = state.input().messages;
+    std::string encoded;
+    MemoryCborEncoder enc(&encoded);
+    for ( const auto& m : messages )
+        encode_message(enc, m);
+    enc.flush();
+    state.set_bytes_per_iteration(double(encoded.size()) / messages.size());
+
+    std::unique_ptr<std::istringstream> is;
+    std::unique_ptr<CborStreamDecoder> dec;
+    state.run([&](uint64_t i)
+              {
+                  if ( i % messages.size() == 0 )
+                  {
+                      is = make_unique<std::istringstream>(encoded);
+                      dec = make_unique<CborStreamDecoder>(*is);
+                  }
+                  decode_message(*dec);
+              });
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <thread>
+
+#include "channel.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("channel/put_get")
+{
+    Channel<std::shared_ptr<QueryResponse>> chan;
+    const std::vector<std::shared_ptr<QueryResponse>>& qrs = state.input().query_responses;
+
+    state.run([&](uint64_t i)
+              {
+                  std::shared_ptr<QueryResponse> qr;
+                  chan.put(qrs[i % qrs.size()]);
+                  chan.get(qr);
+                  do_not_optimize(qr);
+              });
+}
+
+BENCHMARK("channel/threaded")
+{
+    Channel<std::shared_ptr<QueryResponse>> chan(10000);
+    const std::vector<std::shared_ptr<QueryResponse>>& qrs = state.input().query_responses;
+    uint64_t received = 0;
+
+    // Each iteration is one item passed from this thread to a consumer
+    // thread, through a bounded channel as used between compactor threads.
+    std::thread consumer([&]()
+                         {
+                             std::shared_ptr<QueryResponse> qr;
+                             while ( chan.get(qr) )
+                                 ++received;
+                         });
+    state.run([&](uint64_t i)
+              {
+                  chan.put(qrs[i % qrs.size()]);
+              });
+    chan.close();
+    consumer.join();
+    do_not_optimize(received);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+#include "makeunique.hpp"
+#include "matcher.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("matcher/add")
+{
+    const std::vector<DNSMessage>& messages = state.input().messages;
+    if ( messages.empty() )
+        throw std::runtime_error(state.input().pcap_file + " contains no DNS messages");
+
+    uint64_t matched = 0;
+    QueryResponseMatcher matcher(
+        [&](std::shared_ptr<QueryResponse> qr)
+        {
+            do_not_optimize(qr);
+            ++matched;
+        });
+
+    // Each pass over the input is moved on in time past the end of
+    // the previous pass, so the matcher sees time advance steadily
+    // and expires unmatched queries as it would with live traffic.
+    auto span = messages.back().timestamp - messages.front().timestamp +
+        std::chrono::seconds(1);
+
+    state.run([&](uint64_t i)
+              {
+                  std::unique_ptr<DNSMessage> m =
+                      make_unique<DNSMessage>(messages[i % messages.size()]);
+                  int64_t pass = i / messages.size();
+                  m->timestamp += span * pass;
+                  matcher.add(std::move(m));
+              });
+    matcher.flush();
+    do_not_optimize(matched);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include "configuration.hpp"
+#include "packetstatistics.hpp"
+#include "packetstream.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("packetstream/process_packet")
+{
+    Configuration config;
+    PacketStatistics stats{};
+    uint64_t messages = 0;
+    PacketStream packet_stream(
+        config,
+        [&](std::unique_ptr<DNSMessage>& m)
+        {
+            do_not_optimize(m);
+            ++messages;
+        },
+        [](std::shared_ptr<AddressEvent>&) {},
+        stats);
+    std::vector<std::shared_ptr<PcapItem>> packets = state.input().packets;
+
+    // Packets that are part of a TCP stream or fragmented datagram
+    // may not produce a message when seen again, so they may throw.
+    state.run([&](uint64_t i)
+              {
+                  try
+                  {
+                      packet_stream.process_packet(packets[i % packets.size()]);
+                  }
+                  catch (const unhandled_packet&)
+                  {
+                  }
+                  catch (const malformed_packet&)
+                  {
+                  }
+              });
+    do_not_optimize(messages);
+}
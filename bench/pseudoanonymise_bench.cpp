@@ -0,0 +1,40 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include "config.h"
+
+#if ENABLE_PSEUDOANONYMISATION
+
+#include <stdexcept>
+
+#include "ipaddress.hpp"
+#include "pseudoanonymise.hpp"
+
+#include "bench.hpp"
+
+BENCHMARK("pseudoanonymise/address")
+{
+    std::vector<IPAddress> addresses;
+    for ( const auto& m : state.input().messages )
+        if ( m.clientIP )
+            addresses.push_back(*m.clientIP);
+    if ( addresses.empty() )
+        throw std::runtime_error(state.input().pcap_file + " contains no client addresses");
+
+    PseudoAnonymise pseudo_anon("bench-passphrase");
+    state.run([&](uint64_t i)
+              {
+                  do_not_optimize(pseudo_anon.address(addresses[i % addresses.size()]));
+              });
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "config.h"
+
+#include "makeunique.hpp"
+#include "streamwriter.hpp"
+#include "workload.hpp"
+
+#if ENABLE_DNSTAP
+#include "dnstap/dnstap.pb.h"
+#endif
+
+namespace po = boost::program_options;
+
+const std::string PROGNAME = "compactor-workload";
+
+namespace {
+    /**
+     * \brief Write a 32 bit value in host order.
+     */
+    void write_host32(StreamWriter& out, uint32_t v)
+    {
+        out.writeBytes(reinterpret_cast<const uint8_t*>(&v), sizeof(v));
+    }
+
+    /**
+     * \brief Write a 32 bit value in network order.
+     */
+    void write_net32(StreamWriter& out, uint32_t v)
+    {
+        uint8_t buf[4] = {
+            static_cast<uint8_t>(v >> 24),
+            static_cast<uint8_t>(v >> 16),
+            static_cast<uint8_t>(v >> 8),
+            static_cast<uint8_t>(v)
+        };
+        out.writeBytes(buf, sizeof(buf));
+    }
+
+    /**
+     * \brief Write the workload as a PCAP file of Ethernet frames.
+     *
+     * \param gen the workload generator.
+     * \param out the output.
+     * \returns the number of packets written.
+     */
+    uint64_t write_pcap(WorkloadGenerator& gen, StreamWriter& out)
+    {
+        const uint32_t DLT_EN10MB_VALUE = 1;
+
+        write_host32(out, 0xa1b2c3d4);
+        write_host32(out, 2 | ( 4 << 16 ));     // Version 2.4.
+        write_host32(out, 0);
+        write_host32(out, 0);
+        write_host32(out, 65535);
+        write_host32(out, DLT_EN10MB_VALUE);
+
+        uint64_t count = 0;
+        WorkloadMessage msg;
+        std::vector<WorkloadPacket> packets;
+        while ( gen.next(msg) )
+        {
+            packets.clear();
+            gen.packets(msg, packets);
+            for ( const auto& p : packets )
+            {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(p.timestamp.time_since_epoch()).count();
+                write_host32(out, us / 1000000);
+                write_host32(out, us % 1000000);
+                write_host32(out, p.data.size());
+                write_host32(out, p.data.size());
+                out.writeBytes(p.data.data(), p.data.size());
+                ++count;
+            }
+        }
+        return count;
+    }
+
+#if ENABLE_DNSTAP
+    /**
+     * \brief Write the workload as a DNSTAP Frame Streams file.
+     *
+     * Messages are recorded as seen by a resolver, as client queries
+     * and responses.
+     *
+     * \param gen the workload generator.
+     * \param out the output.
+     * \returns the number of messages written.
+     */
+    uint64_t write_dnstap(WorkloadGenerator& gen, StreamWriter& out)
+    {
+        const std::string CONTENT_TYPE_DNSTAP("protobuf:dnstap.Dnstap");
+        const uint32_t FSTRM_START = 2;
+        const uint32_t FSTRM_STOP = 3;
+        const uint32_t FSTRM_CONTENT_TYPE = 1;
+
+        write_net32(out, 0);
+        write_net32(out, 12 + CONTENT_TYPE_DNSTAP.size());
+        write_net32(out, FSTRM_START);
+        write_net32(out, FSTRM_CONTENT_TYPE);
+        write_net32(out, CONTENT_TYPE_DNSTAP.size());
+        out.writeBytes(CONTENT_TYPE_DNSTAP);
+
+        uint64_t count = 0;
+        WorkloadMessage msg;
+        dnstap::Dnstap tap;
+        std::string frame;
+        while ( gen.next(msg) )
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(msg.timestamp.time_since_epoch()).count();
+            std::string wire(msg.wire.begin(), msg.wire.end());
+
+            tap.Clear();
+            tap.set_identity(PROGNAME);
+            tap.set_version(PACKAGE_VERSION);
+            tap.set_type(dnstap::Dnstap_Type::Dnstap_Type_MESSAGE);
+            dnstap::Message* m = tap.mutable_message();
+            m->set_socket_family(msg.ipv6 ? dnstap::SocketFamily::INET6 : dnstap::SocketFamily::INET);
+            m->set_socket_protocol(msg.tcp ? dnstap::SocketProtocol::TCP : dnstap::SocketProtocol::UDP);
+            m->set_query_address(msg.client_address.data(), msg.client_address.size());
+            m->set_query_port(msg.client_port);
+            m->set_response_address(msg.server_address.data(), msg.server_address.size());
+            m->set_response_port(msg.server_port);
+            if ( msg.query )
+            {
+                m->set_type(dnstap::Message_Type::Message_Type_CLIENT_QUERY);
+                m->set_query_time_sec(ns / 1000000000);
+                m->set_query_time_nsec(ns % 1000000000);
+                m->set_query_message(wire);
+            }
+            else
+            {
+                m->set_type(dnstap::Message_Type::Message_Type_CLIENT_RESPONSE);
+                m->set_response_time_sec(ns / 1000000000);
+                m->set_response_time_nsec(ns % 1000000000);
+                m->set_response_message(wire);
+            }
+
+            tap.SerializeToString(&frame);
+            write_net32(out, frame.size());
+            out.writeBytes(frame);
+            ++count;
+        }
+
+        write_net32(out, 0);
+        write_net32(out, 4);
+        write_net32(out, FSTRM_STOP);
+        return count;
+    }
+#endif
+}
+
+int main(int ac, char *av[])
+{
+    WorkloadParameters params;
+    std::string output_file;
+    std::string format;
+    bool gzip;
+    bool xz;
+    unsigned level;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("output,o",
+         po::value<std::string>(&output_file)->default_value(StreamWriter::STDOUT_FILE_NAME),
+         "output file, '-' for standard output.")
+        ("format,f",
+         po::value<std::string>(&format)->default_value("pcap"),
+#if ENABLE_DNSTAP
+         "output format, pcap or dnstap."
+#else
+         "output format. Only pcap is available in this build."
+#endif
+            )
+        ("gzip,z",
+         po::value<bool>(&gzip)->implicit_value(true)->default_value(false),
+         "compress output using gzip.")
+        ("xz,x",
+         po::value<bool>(&xz)->implicit_value(true)->default_value(false),
+         "compress output using xz.")
+        ("level,l",
+         po::value<unsigned>(&level)->default_value(6),
+         "compression level.")
+        ;
+    options.add(params.options());
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::command_line_parser(ac, av).options(options).run(), vm);
+        po::notify(vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr << "Usage: " << PROGNAME << " [options]\n" << options;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        params.check();
+        if ( gzip && xz )
+            throw po::error("You cannot select more than one compression method.");
+        if ( level > 9 )
+            throw po::error("compression level must be in the range 0-9.");
+#if ENABLE_DNSTAP
+        if ( format != "pcap" && format != "dnstap" )
+#else
+        if ( format != "pcap" )
+#endif
+            throw po::error("unknown output format " + format);
+
+        std::unique_ptr<StreamWriter> out;
+        if ( gzip )
+            out = make_unique<GzipStreamWriter>(output_file, level);
+        else if ( xz )
+            out = make_unique<XzStreamWriter>(output_file, level);
+        else
+            out = make_unique<StreamWriter>(output_file, level);
+
+        WorkloadGenerator gen(params);
+        uint64_t count;
+#if ENABLE_DNSTAP
+        if ( format == "dnstap" )
+            count = write_dnstap(gen, *out);
+        else
+#endif
+            count = write_pcap(gen, *out);
+        out.reset();
+
+        std::cerr << PROGNAME << ": " << gen.query_count() << " queries, "
+                  << gen.response_count() << " responses, "
+                  << count << ( format == "pcap" ? " packets\n" : " messages\n" );
+    }
+    catch (const po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << "\n"
+                  << "Run '" << PROGNAME << " -h' for help.\n";
+        return 1;
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -15,15 +15,20 @@
 #include "baseoutputwriter.hpp"
 
 BaseOutputWriter::BaseOutputWriter(const Configuration& config)
-    : config_(config)
+    : config_(std::make_shared<const Configuration>(config))
 {
 }
 
+void BaseOutputWriter::set_configuration(std::shared_ptr<const Configuration> config)
+{
+    config_ = std::move(config);
+}
+
 void BaseOutputWriter::writeQR(const std::shared_ptr<QueryResponse>& qr,
                                const PacketStatistics& stats)
 {
     const DNSMessage &d(qr->has_query() ? qr->query() : qr->response());
-    if ( !config_.output_opcode(d.dns.opcode()) )
+    if ( !config_->output_opcode(d.dns.opcode()) )
          return;
 
     checkForRotation(qr->timestamp());
@@ -32,19 +37,19 @@ void BaseOutputWriter::writeQR(const std::shared_ptr<QueryResponse>& qr,
     writeBasic(qr, stats);
 
     if ( qr->has_query() &&
-         ( !config_.exclude_hints.query_question_section ||
-           !config_.exclude_hints.query_answer_section ||
-           !config_.exclude_hints.query_authority_section ||
-           !config_.exclude_hints.query_additional_section ) )
+         ( !config_->exclude_hints.query_question_section ||
+           !config_->exclude_hints.query_answer_section ||
+           !config_->exclude_hints.query_authority_section ||
+           !config_->exclude_hints.query_additional_section ) )
     {
         startExtendedQueryGroup();
         writeSections(qr->query(), true);
         endExtendedGroup();
     }
     if ( qr->has_response() &&
-         ( !config_.exclude_hints.response_answer_section ||
-           !config_.exclude_hints.response_authority_section ||
-           !config_.exclude_hints.response_additional_section ) )
+         ( !config_->exclude_hints.response_answer_section ||
+           !config_->exclude_hints.response_authority_section ||
+           !config_->exclude_hints.response_additional_section ) )
     {
         startExtendedResponseGroup();
         writeSections(qr->response(), false);
@@ -58,7 +63,7 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
 {
     if ( dm.dns.questions_count() > 1 &&
          is_query &&
-         !config_.exclude_hints.query_question_section )
+         !config_->exclude_hints.query_question_section )
     {
         bool found_one = false;
         bool skip = true;
@@ -72,7 +77,7 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
                 continue;
             }
 
-            if ( !config_.output_rr_type(q.query_type()) )
+            if ( !config_->output_rr_type(q.query_type()) )
                 continue;
 
             if ( !found_one )
@@ -88,13 +93,13 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
 
     if ( dm.dns.answers_count() > 0 &&
          is_query
-         ? !config_.exclude_hints.query_answer_section
-         : !config_.exclude_hints.response_answer_section )
+         ? !config_->exclude_hints.query_answer_section
+         : !config_->exclude_hints.response_answer_section )
     {
         bool found_one = false;
         for ( const auto& r : dm.dns.answers() )
         {
-            if ( !config_.output_rr_type(r.query_type()) )
+            if ( !config_->output_rr_type(r.query_type()) )
                 continue;
 
             if ( !found_one )
@@ -109,13 +114,13 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
 
     if ( dm.dns.authority_count() > 0 &&
          is_query
-         ? !config_.exclude_hints.query_authority_section
-         : !config_.exclude_hints.response_authority_section )
+         ? !config_->exclude_hints.query_authority_section
+         : !config_->exclude_hints.response_authority_section )
     {
         bool found_one = false;
         for ( const auto& r : dm.dns.authority() )
         {
-            if ( !config_.output_rr_type(r.query_type()) )
+            if ( !config_->output_rr_type(r.query_type()) )
                 continue;
 
             if ( !found_one )
@@ -130,8 +135,8 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
 
     if ( dm.dns.additional_count() > 0 &&
          is_query
-         ? !config_.exclude_hints.query_additional_section
-         : !config_.exclude_hints.response_additional_section )
+         ? !config_->exclude_hints.query_additional_section
+         : !config_->exclude_hints.response_additional_section )
     {
         bool found_one = false;
         for ( const auto& r : dm.dns.additional() )
@@ -140,7 +145,7 @@ void BaseOutputWriter::writeSections(const DNSMessage& dm, bool is_query)
                  dm.dns.type() == CaptureDNS::QRType::QUERY )
                 continue;
 
-            if ( !config_.output_rr_type(r.query_type()) )
+            if ( !config_->output_rr_type(r.query_type()) )
                 continue;
 
             if ( !found_one )
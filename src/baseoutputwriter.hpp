@@ -14,10 +14,12 @@
 #define BASEOUTPUTWRITER_HPP
 
 #include <cstdint>
+#include <memory>
 
 #include "addressevent.hpp"
 #include "configuration.hpp"
 #include "dnsmessage.hpp"
+#include "malformedmessage.hpp"
 #include "packetstatistics.hpp"
 #include "queryresponse.hpp"
 #include "rotatingfilename.hpp"
@@ -42,6 +44,13 @@ public:
      */
     explicit BaseOutputWriter(const Configuration& config);
 
+    /**
+     * \brief Replace the output configuration.
+     *
+     * \param config the new configuration.
+     */
+    virtual void set_configuration(std::shared_ptr<const Configuration> config);
+
     /**
      * \brief Write out a single Query/Response pair.
      *
@@ -60,6 +69,15 @@ public:
     virtual void writeAE(const std::shared_ptr<AddressEvent>& ae,
                          const PacketStatistics& stats) = 0;
 
+    /**
+     * \brief Write out a single malformed message.
+     *
+     * \param mm        malformed message to write.
+     * \param stats     statistics at time of message.
+     */
+    virtual void writeMM(const std::shared_ptr<MalformedMessage>& mm,
+                         const PacketStatistics& stats) = 0;
+
     /**
      * \brief See if the output file needs rotating.
      *
@@ -165,7 +183,7 @@ protected:
     /**
      * \brief configuration options.
      */
-    const Configuration config_;
+    std::shared_ptr<const Configuration> config_;
 };
 
 #endif
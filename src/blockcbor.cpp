@@ -305,19 +305,32 @@ namespace block_cbor {
         return res;
     }
 
+    namespace {
+        /**
+         * \brief Return the Transport flags for a transport type.
+         *
+         * \param transport_type the transport type.
+         * \return transport flags value.
+         */
+        uint8_t transport_type_flags(TransportType transport_type)
+        {
+            switch ( transport_type )
+            {
+            case TransportType::UDP:  return UDP;
+            case TransportType::TCP:  return TCP;
+            case TransportType::DOT:  return TLS;
+            case TransportType::DDOT: return DTLS;
+            case TransportType::DOH:  return DOH;
+            }
+            return 0;
+        }
+    }
+
     uint8_t transport_flags(const QueryResponse& qr)
     {
-        uint8_t res = 0;
         const DNSMessage& d(qr.has_query() ? qr.query() : qr.response());
+        uint8_t res = transport_type_flags(d.transport_type);
 
-        switch ( d.transport_type )
-        {
-        case TransportType::UDP:  res |= UDP; break;
-        case TransportType::TCP:  res |= TCP; break;
-        case TransportType::DOT:  res |= TLS; break;
-        case TransportType::DDOT: res |= DTLS; break;
-        case TransportType::DOH:  res |= DOH; break;
-        }
         if ( d.is_ipv6() )
             res |= IPV6;
 
@@ -327,6 +340,16 @@ namespace block_cbor {
         return res;
     }
 
+    uint8_t transport_flags(const MalformedMessage& mm)
+    {
+        uint8_t res = transport_type_flags(mm.transport_type());
+
+        if ( mm.is_ipv6() )
+            res |= IPV6;
+
+        return res;
+    }
+
     uint8_t convert_transport_flags(uint8_t flags, FileFormatVersion from_version)
     {
         enum TransportFlags05
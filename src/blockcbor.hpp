@@ -17,6 +17,7 @@
 
 #include <boost/optional.hpp>
 
+#include "malformedmessage.hpp"
 #include "queryresponse.hpp"
 
 /**
@@ -476,6 +477,8 @@ namespace block_cbor {
         pcap_packets,
         pcap_missing_if,
         pcap_missing_os,
+        compactor_client_sketch,
+        compactor_qname_sketch,
 
         // Obsolete
         partially_malformed_packets,
@@ -993,6 +996,8 @@ namespace block_cbor {
         BlockStatisticsField::pcap_packets,
         BlockStatisticsField::pcap_missing_if,
         BlockStatisticsField::pcap_missing_os,
+        BlockStatisticsField::compactor_client_sketch,
+        BlockStatisticsField::compactor_qname_sketch,
     };
 
     /**
@@ -1319,6 +1324,14 @@ namespace block_cbor {
      */
     uint8_t transport_flags(const QueryResponse& qr);
 
+    /**
+     * \brief Calculate the Transport flags for a malformed message.
+     *
+     * \param mm    the malformed message.
+     * \return transport flags value.
+     */
+    uint8_t transport_flags(const MalformedMessage& mm);
+
     /**
      * \brief Convert possibly older format transport flags to current.
      *
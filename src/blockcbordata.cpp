@@ -1308,15 +1308,12 @@ namespace block_cbor {
         constexpr int mm_transport_flags_index = find_malformed_message_data_index(MalformedMessageDataField::mm_transport_flags);
         constexpr int mm_payload_index = find_malformed_message_data_index(MalformedMessageDataField::mm_payload);
 
-        enc.writeMapHeader(4);
-        enc.write(server_address_index_index);
-        enc.write(server_address);
-        enc.write(server_port_index);
-        enc.write(server_port);
-        enc.write(mm_transport_flags_index);
-        enc.write(mm_transport_flags);
-        enc.write(mm_payload_index);
-        enc.write(mm_payload);
+        enc.writeMapHeader(!!server_address + !!server_port +
+                           !!mm_transport_flags + !!mm_payload);
+        enc.write(server_address_index_index, server_address);
+        enc.write(server_port_index, server_port);
+        enc.write(mm_transport_flags_index, mm_transport_flags);
+        enc.write(mm_payload_index, mm_payload);
     }
 
     void MalformedMessageItem::clear()
@@ -1387,19 +1384,18 @@ namespace block_cbor {
         constexpr int client_port_index = find_malformed_message_index(MalformedMessageField::client_port);
         constexpr int message_data_index_index = find_malformed_message_index(MalformedMessageField::message_data_index);
 
-        enc.writeMapHeader(4);
-        enc.write(time_offset_index);
-        enc.write(std::chrono::duration_cast<std::chrono::nanoseconds>(*tstamp - earliest_time).count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
-        enc.write(client_address_index_index);
-        enc.write(client_address);
-        enc.write(client_port_index);
-        enc.write(client_port);
-        enc.write(message_data_index_index);
-        enc.write(message_data);
+        enc.writeMapHeader(!!tstamp + !!client_address +
+                           !!client_port + !!message_data);
+        if ( tstamp )
+            enc.write(time_offset_index, std::chrono::duration_cast<std::chrono::nanoseconds>(*tstamp - earliest_time).count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
+        enc.write(client_address_index_index, client_address);
+        enc.write(client_port_index, client_port);
+        enc.write(message_data_index_index, message_data);
     }
 
     void BlockData::readCbor(CborBaseDecoder& dec,
-                             const FileVersionFields& fields)
+                             const FileVersionFields& fields,
+                             bool read_records)
     {
         bool indef;
         uint64_t n_elems = dec.readMapHeader(indef);
@@ -1418,7 +1414,10 @@ namespace block_cbor {
                 break;
 
             case BlockField::tables:
-                readHeaders(dec, fields);
+                if ( read_records )
+                    readHeaders(dec, fields);
+                else
+                    dec.skip();
                 break;
 
             case BlockField::statistics:
@@ -1426,13 +1425,23 @@ namespace block_cbor {
                 break;
 
             case BlockField::queries:
-                readItems(dec, fields);
+                if ( read_records )
+                    readItems(dec, fields);
+                else
+                    dec.skip();
                 break;
 
             case BlockField::address_event_counts:
                 readAddressEventCounts(dec, fields);
                 break;
 
+            case BlockField::malformed_messages:
+                if ( read_records )
+                    readMalformedMessageItems(dec, fields);
+                else
+                    dec.skip();
+                break;
+
             default:
                 dec.skip();
                 break;
@@ -1442,8 +1451,9 @@ namespace block_cbor {
 
     void BlockData::readBlockPreamble(CborBaseDecoder& dec, const FileVersionFields& fields)
     {
-        uint64_t ticks_per_second = block_parameters_[block_parameters_index].storage_parameters.ticks_per_second;
-        Timestamp ts;
+        boost::optional<Timestamp> earliest_ts;
+        boost::optional<Timestamp> end_ts;
+        boost::optional<Timestamp> start_ts;
         bool indef;
         uint64_t n_elems = dec.readMapHeader(indef);
         block_parameters_index = 0; // Default value if not read.
@@ -1458,18 +1468,18 @@ namespace block_cbor {
             switch(fields.block_preamble_field(dec.read_signed()))
             {
             case BlockPreambleField::earliest_time:
-                ts.readCbor(dec);
-                earliest_time = ts.getTimePoint(ticks_per_second);
+                earliest_ts = Timestamp();
+                earliest_ts->readCbor(dec);
                 break;
 
             case BlockPreambleField::compactor_end_time:
-                ts.readCbor(dec);
-                end_time = ts.getTimePoint(ticks_per_second);
+                end_ts = Timestamp();
+                end_ts->readCbor(dec);
                 break;
 
             case BlockPreambleField::compactor_start_time:
-                ts.readCbor(dec);
-                start_time = ts.getTimePoint(ticks_per_second);
+                start_ts = Timestamp();
+                start_ts->readCbor(dec);
                 break;
 
             case BlockPreambleField::block_parameters_index:
@@ -1481,6 +1491,16 @@ namespace block_cbor {
                 break;
             }
         }
+
+        // Times are in the ticks of the block's parameters, which
+        // may follow them in the preamble.
+        uint64_t ticks_per_second = block_parameters_[block_parameters_index].storage_parameters.ticks_per_second;
+        if ( earliest_ts )
+            earliest_time = earliest_ts->getTimePoint(ticks_per_second);
+        if ( end_ts )
+            end_time = end_ts->getTimePoint(ticks_per_second);
+        if ( start_ts )
+            start_time = start_ts->getTimePoint(ticks_per_second);
     }
 
     void BlockData::readHeaders(CborBaseDecoder& dec,
@@ -1651,6 +1671,28 @@ namespace block_cbor {
                 last_packet_statistics.pcap_drop_count += dec.read_unsigned();
                 break;
 
+            case BlockStatisticsField::compactor_client_sketch:
+                {
+                    HyperLogLog sketch;
+                    sketch.readCbor(dec);
+                    if ( client_sketch )
+                        client_sketch->merge(sketch);
+                    else
+                        client_sketch = sketch;
+                }
+                break;
+
+            case BlockStatisticsField::compactor_qname_sketch:
+                {
+                    HeavyHitters sketch;
+                    sketch.readCbor(dec);
+                    if ( qname_sketch )
+                        qname_sketch->merge(sketch);
+                    else
+                        qname_sketch = sketch;
+                }
+                break;
+
             default:
                 dec.skip();
                 break;
@@ -1774,6 +1816,9 @@ namespace block_cbor {
         // Address event items.
         writeAddressEventCounts(enc);
 
+        // Malformed message items.
+        writeMalformedMessageItems(enc);
+
         // Block terminator.
         enc.writeBreak();
     }
@@ -1788,6 +1833,7 @@ namespace block_cbor {
         constexpr int question_rr_index = find_block_tables_index(BlockTablesField::question_rr);
         constexpr int rr_list_index = find_block_tables_index(BlockTablesField::rr_list);
         constexpr int rr_index = find_block_tables_index(BlockTablesField::rr);
+        constexpr int malformed_message_data_index = find_block_tables_index(BlockTablesField::malformed_message_data);
 
         enc.writeMapHeader();
         if ( ip_addresses.size() > 0 )
@@ -1830,6 +1876,11 @@ namespace block_cbor {
             enc.write(rr_index);
             resource_records.writeCbor(enc);
         }
+        if ( malformed_message_data.size() > 0 )
+        {
+            enc.write(malformed_message_data_index);
+            malformed_message_data.writeCbor(enc);
+        }
         enc.writeBreak();
     }
 
@@ -1867,6 +1918,8 @@ namespace block_cbor {
         constexpr int pcap_packets_index = find_block_statistics_index(BlockStatisticsField::pcap_packets);
         constexpr int pcap_missing_if_index = find_block_statistics_index(BlockStatisticsField::pcap_missing_if);
         constexpr int pcap_missing_os_index = find_block_statistics_index(BlockStatisticsField::pcap_missing_os);
+        constexpr int client_sketch_index = find_block_statistics_index(BlockStatisticsField::compactor_client_sketch);
+        constexpr int qname_sketch_index = find_block_statistics_index(BlockStatisticsField::compactor_qname_sketch);
 
         enc.writeMapHeader();
         enc.write(processed_messages_index);
@@ -1905,6 +1958,16 @@ namespace block_cbor {
         enc.write(last_packet_statistics.pcap_ifdrop_count - start_packet_statistics.pcap_ifdrop_count);
         enc.write(pcap_missing_os_index);
         enc.write(last_packet_statistics.pcap_drop_count - start_packet_statistics.pcap_drop_count);
+        if ( client_sketch )
+        {
+            enc.write(client_sketch_index);
+            client_sketch->writeCbor(enc);
+        }
+        if ( qname_sketch )
+        {
+            enc.write(qname_sketch_index);
+            qname_sketch->writeCbor(enc);
+        }
         enc.writeBreak();
     }
 
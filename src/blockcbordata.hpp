@@ -30,6 +30,7 @@
 #include "ipaddress.hpp"
 #include "makeunique.hpp"
 #include "packetstatistics.hpp"
+#include "sketch.hpp"
 
 namespace boost {
     /**
@@ -1538,6 +1539,20 @@ namespace block_cbor {
             throw cbor_file_format_error("Block index out of range");
         }
 
+        /**
+         * \brief Get the item at a position in the list.
+         *
+         * Unlike indexing, positions always start at 0, whatever
+         * the file format.
+         *
+         * \param pos the position.
+         * \throws std::out_of_range if the position is out of range.
+         */
+        const T& at(std::size_t pos) const
+        {
+            return items_.at(pos);
+        }
+
         /**
          * \brief Get the number of items stored.
          */
@@ -1711,6 +1726,16 @@ namespace block_cbor {
          */
         PacketStatistics last_packet_statistics;
 
+        /**
+         * \brief sketch of the distinct client addresses in the block, if kept.
+         */
+        boost::optional<HyperLogLog> client_sketch;
+
+        /**
+         * \brief summary of the most frequent query names in the block, if kept.
+         */
+        boost::optional<HeavyHitters> qname_sketch;
+
         // Header items.
 
         /**
@@ -1792,6 +1817,8 @@ namespace block_cbor {
             address_event_counts.clear();
             malformed_message_data.clear();
             malformed_messages.clear();
+            client_sketch = boost::none;
+            qname_sketch = boost::none;
         }
 
         /**
@@ -1975,14 +2002,20 @@ namespace block_cbor {
         /**
          * \brief Read the object contents from CBOR.
          *
-         * \param dec      CBOR stream to read from.
-         * \param fields   translate map keys to internal values.
+         * If records are not read, the block header tables and
+         * Query/Response items are skipped, leaving the preamble,
+         * statistics and address event counts.
+         *
+         * \param dec          CBOR stream to read from.
+         * \param fields       translate map keys to internal values.
+         * \param read_records `false` to skip the block records.
          * \throws cbor_file_format_error on unexpected CBOR content.
          * \throws cbor_decode_error on malformed CBOR items.
          * \throws cbor_end_of_input on end of CBOR file.
          */
         void readCbor(CborBaseDecoder& dec,
-                      const FileVersionFields& fields);
+                      const FileVersionFields& fields,
+                      bool read_records = true);
 
         /**
          * \brief Read the block preamble.
@@ -0,0 +1,728 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "makeunique.hpp"
+
+#include "blockcbormerger.hpp"
+
+namespace {
+    const int64_t NS_PER_SEC = INT64_C(1000000000);
+
+    /**
+     * \class ByteStringCborDecoder
+     * \brief A CBOR decoder that reads from a string.
+     */
+    class ByteStringCborDecoder : public CborBaseDecoder
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param in the string to read.
+         */
+        explicit ByteStringCborDecoder(const byte_string& in) : in_(in), pos_(0) {}
+
+    protected:
+        /**
+         * \brief Read more input from the string.
+         *
+         * \param p       pointer to the buffer.
+         * \param n_bytes maximum number of bytes to read.
+         * \return the number of bytes read.
+         * \throws cbor_end_of_input when at the end of the string.
+         */
+        virtual unsigned readBytes(uint8_t* p, std::ptrdiff_t n_bytes)
+        {
+            if ( pos_ == in_.size() )
+                throw cbor_end_of_input();
+
+            std::size_t n = std::min<std::size_t>(n_bytes, in_.size() - pos_);
+            std::copy(in_.data() + pos_, in_.data() + pos_ + n, p);
+            pos_ += n;
+            return n;
+        }
+
+    private:
+        /**
+         * \brief the input string.
+         */
+        const byte_string& in_;
+
+        /**
+         * \brief the read position.
+         */
+        std::size_t pos_;
+    };
+}
+
+BlockCborMerger::BlockCborMerger(CborBaseEncoder& enc)
+    : enc_(enc), major_version_(0), minor_version_(0), private_version_(0),
+      max_block_items_(0), block_period_(0), encode_threads_(1),
+      select_times_(false), blocks_(0), blocks_trimmed_(0)
+{
+}
+
+void BlockCborMerger::set_time_range(const std::chrono::system_clock::time_point& start,
+                                     const std::chrono::system_clock::time_point& end)
+{
+    select_times_ = true;
+    start_time_ = start;
+    end_time_ = end;
+}
+
+void BlockCborMerger::set_rewriter(const BlockCborRewriter& rewriter)
+{
+    if ( !inputs_.empty() )
+        throw std::logic_error("Rewriter must be set before adding inputs");
+    rewriter_ = rewriter;
+}
+
+void BlockCborMerger::set_block_size(unsigned max_items,
+                                     const std::chrono::seconds& period,
+                                     unsigned threads)
+{
+    if ( !inputs_.empty() )
+        throw std::logic_error("Block size must be set before adding inputs");
+    max_block_items_ = max_items;
+    block_period_ = period;
+    encode_threads_ = std::max(threads, 1U);
+
+    // Re-blocking moves records through a rewriter to rebuild the
+    // block tables. If not otherwise rewriting, keep everything.
+    if ( reblocking() && !rewriter_ )
+        rewriter_ = BlockCborRewriter();
+}
+
+void BlockCborMerger::add_input(CborBaseDecoder& dec, const std::string& name)
+{
+    std::unique_ptr<Input> input = make_unique<Input>(dec, name);
+    try
+    {
+        readFileHeader(*input);
+    }
+    catch (const cbor_file_format_error& e)
+    {
+        throw cbor_file_format_error(name + ": " + e.what());
+    }
+    catch (const std::logic_error& e)
+    {
+        throw cbor_file_format_error(name + ": Unexpected item reading header");
+    }
+    catch (const cbor_end_of_input& e)
+    {
+        throw cbor_file_format_error(name + ": Unexpected end of input reading header");
+    }
+    inputs_.push_back(std::move(input));
+}
+
+void BlockCborMerger::readFileHeader(Input& input)
+{
+    CborBaseDecoder& dec = input.dec;
+    bool indef;
+    uint64_t n_elems = dec.readArrayHeader(indef);
+    if ( dec.type() != CborBaseDecoder::TYPE_STRING ||
+         dec.read_string() != block_cbor::FILE_FORMAT_ID )
+        throw cbor_file_format_error("This is not a C-DNS file");
+    if ( n_elems != 3 )
+        throw cbor_file_format_error("Unexpected initial array length");
+
+    unsigned major_version = 0;
+    unsigned minor_version = 0;
+    unsigned private_version = 0;
+    n_elems = dec.readMapHeader(indef);
+    while ( indef || n_elems-- > 0 )
+    {
+        if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec.readBreak();
+            break;
+        }
+
+        switch(block_cbor::file_preamble_field(dec.read_unsigned(), block_cbor::FileFormatVersion::format_10))
+        {
+        case block_cbor::FilePreambleField::major_format_version:
+            major_version = dec.read_unsigned();
+            break;
+
+        case block_cbor::FilePreambleField::minor_format_version:
+            minor_version = dec.read_unsigned();
+            break;
+
+        case block_cbor::FilePreambleField::private_version:
+            private_version = dec.read_unsigned();
+            break;
+
+        case block_cbor::FilePreambleField::block_parameters:
+            if ( major_version != block_cbor::FILE_FORMAT_10_MAJOR_VERSION )
+                throw cbor_file_format_error("Only C-DNS format 1 files can be merged");
+            if ( input.fields )
+                throw cbor_file_format_error("Unexpected block parameters reading header");
+            if ( inputs_.empty() )
+            {
+                major_version_ = major_version;
+                minor_version_ = minor_version;
+                private_version_ = private_version;
+            }
+            else if ( major_version != major_version_ ||
+                      minor_version != minor_version_ ||
+                      private_version != private_version_ )
+                throw cbor_file_format_error("File format version differs from first input");
+            input.fields = make_unique<block_cbor::FileVersionFields>(major_version, minor_version, private_version);
+            readBlockParameters(input);
+            break;
+
+        default:
+            dec.skip();
+            break;
+        }
+    }
+
+    if ( !input.fields )
+        throw cbor_file_format_error("No block parameters in header");
+
+    input.n_blocks = dec.readArrayHeader(input.blocks_indef);
+}
+
+void BlockCborMerger::readBlockParameters(Input& input)
+{
+    CborBaseDecoder& dec = input.dec;
+    bool indef;
+    uint64_t n_elems = dec.readArrayHeader(indef);
+    while ( indef || n_elems-- > 0 )
+    {
+        if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec.readBreak();
+            break;
+        }
+
+        // Decode the parameters to find the tick rate, and record
+        // the encoding to copy to the output.
+        block_cbor::BlockParameters bp;
+        byte_string cbor;
+        dec.startRecording(cbor);
+        bp.readCbor(dec, *input.fields);
+        dec.stopRecording();
+
+        if ( rewriter_ )
+        {
+            rewriter_->rewriteBlockParameters(bp);
+            if ( max_block_items_ > 0 )
+                bp.storage_parameters.max_block_items = max_block_items_;
+            cbor.clear();
+            ByteStringCborEncoder enc(cbor);
+            bp.writeCbor(enc);
+            enc.flush();
+        }
+
+        auto it = std::find(block_parameters_.begin(), block_parameters_.end(), cbor);
+        input.output_index.push_back(it - block_parameters_.begin());
+        if ( it == block_parameters_.end() )
+        {
+            block_parameters_.push_back(std::move(cbor));
+            output_block_parameters_.push_back(bp);
+        }
+        input.ticks_per_second.push_back(bp.storage_parameters.ticks_per_second);
+    }
+
+    if ( input.output_index.empty() )
+        throw cbor_file_format_error("No block parameters in header");
+}
+
+void BlockCborMerger::merge(bool interleave)
+{
+    writeFileHeader();
+
+    if ( interleave )
+    {
+        for ( auto& input : inputs_ )
+            nextBlock(*input);
+
+        for (;;)
+        {
+            Input* next = nullptr;
+            for ( auto& input : inputs_ )
+                if ( input->have_block &&
+                     ( !next || input->earliest_time < next->earliest_time ) )
+                    next = input.get();
+            if ( !next )
+                break;
+            writeBlock(*next);
+            nextBlock(*next);
+        }
+    }
+    else
+    {
+        for ( auto& input : inputs_ )
+            while ( nextBlock(*input) )
+                writeBlock(*input);
+    }
+
+    if ( out_block_ )
+        flushOutputBlock();
+    while ( !encoded_blocks_.empty() )
+        writeEncodedBlock();
+
+    enc_.writeBreak();
+    enc_.flush();
+}
+
+void BlockCborMerger::writeFileHeader()
+{
+    constexpr int major_format_index = block_cbor::find_file_preamble_index(block_cbor::FilePreambleField::major_format_version);
+    constexpr int minor_format_index = block_cbor::find_file_preamble_index(block_cbor::FilePreambleField::minor_format_version);
+    constexpr int private_format_index = block_cbor::find_file_preamble_index(block_cbor::FilePreambleField::private_version);
+    constexpr int block_parameters_index = block_cbor::find_file_preamble_index(block_cbor::FilePreambleField::block_parameters);
+
+    enc_.writeArrayHeader(3);
+    enc_.write(block_cbor::FILE_FORMAT_ID);
+
+    enc_.writeMapHeader(4);
+    enc_.write(major_format_index);
+    enc_.write(major_version_);
+    enc_.write(minor_format_index);
+    enc_.write(minor_version_);
+    enc_.write(private_format_index);
+    enc_.write(private_version_);
+    enc_.write(block_parameters_index);
+    enc_.writeArrayHeader(block_parameters_.size());
+    for ( const auto& bp : block_parameters_ )
+        enc_.writeRaw(bp);
+
+    enc_.writeArrayHeader();
+}
+
+void BlockCborMerger::writeBlock(Input& input)
+{
+    if ( input.data )
+    {
+        reblock(*input.data);
+        input.data.reset();
+    }
+    else
+    {
+        enc_.writeRaw(input.block);
+        ++blocks_;
+    }
+    input.have_block = false;
+}
+
+void BlockCborMerger::reblock(block_cbor::BlockData& in)
+{
+    const block_cbor::BlockParameters& bp = output_block_parameters_[in.block_parameters_index];
+    std::size_t n_items = in.query_response_items.size();
+
+    auto item_time = [&](std::size_t i)
+    {
+        const block_cbor::QueryResponseItem& qri = in.query_response_items[i];
+        return qri.tstamp ? *qri.tstamp : in.earliest_time;
+    };
+    auto start_block = [&](const std::chrono::system_clock::time_point& t)
+    {
+        out_block_ = make_unique<block_cbor::BlockData>(output_block_parameters_,
+                                                        block_cbor::FileFormatVersion::format_10,
+                                                        in.block_parameters_index);
+        out_block_->earliest_time = t;
+        out_block_begin_ = t;
+    };
+    // The collection period of an output block covers those of
+    // all the input blocks it has records from.
+    auto add_collection_times = [&]()
+    {
+        if ( in.start_time &&
+             ( !out_block_->start_time || *in.start_time < *out_block_->start_time ) )
+            out_block_->start_time = in.start_time;
+        if ( in.end_time &&
+             ( !out_block_->end_time || *in.end_time > *out_block_->end_time ) )
+            out_block_->end_time = in.end_time;
+    };
+
+    if ( out_block_ && out_block_->block_parameters_index != in.block_parameters_index )
+        flushOutputBlock();
+    if ( !out_block_ )
+        start_block(n_items > 0 ? item_time(0) : in.earliest_time);
+
+    // Address event counts and statistics aren't timed, so go in
+    // the output block with the first record of the input block.
+    // Malformed messages are rare, so go there too rather than
+    // being merged by time. Decoded statistics are all in
+    // last_packet_statistics.
+    add_collection_times();
+    rewriter_->moveAddressEvents(in, *out_block_, bp);
+    rewriter_->moveMalformedMessages(in, *out_block_, bp);
+    for ( const auto& mm : out_block_->malformed_messages )
+        if ( mm.tstamp && *mm.tstamp < out_block_->earliest_time )
+            out_block_->earliest_time = *mm.tstamp;
+    rewriter_->moveSketches(in, *out_block_);
+    out_block_->last_packet_statistics += in.last_packet_statistics;
+
+    std::size_t pos = 0;
+    for (;;)
+    {
+        std::size_t room = n_items - pos;
+        if ( max_block_items_ > 0 )
+            room = std::min<std::size_t>(room, max_block_items_ - out_block_->query_response_items.size());
+
+        std::size_t end = pos;
+        while ( end < pos + room &&
+                ( block_period_.count() == 0 || item_time(end) < out_block_begin_ + block_period_ ) )
+        {
+            if ( item_time(end) < out_block_->earliest_time )
+                out_block_->earliest_time = item_time(end);
+            ++end;
+        }
+
+        if ( end > pos )
+        {
+            add_collection_times();
+            rewriter_->moveItems(in, pos, end, *out_block_, bp);
+            pos = end;
+        }
+        if ( pos == n_items )
+            break;
+
+        flushOutputBlock();
+        start_block(item_time(pos));
+    }
+    in.query_response_items.clear();
+}
+
+void BlockCborMerger::flushOutputBlock()
+{
+    if ( encoded_blocks_.size() >= encode_threads_ )
+        writeEncodedBlock();
+
+    std::shared_ptr<block_cbor::BlockData> block(std::move(out_block_));
+    encoded_blocks_.push_back(std::async(std::launch::async, [block]()
+    {
+        byte_string res;
+        ByteStringCborEncoder enc(res);
+        block->writeCbor(enc);
+        enc.flush();
+        return res;
+    }));
+}
+
+void BlockCborMerger::writeEncodedBlock()
+{
+    byte_string block = encoded_blocks_.front().get();
+    encoded_blocks_.pop_front();
+    enc_.writeRaw(block);
+    ++blocks_;
+}
+
+bool BlockCborMerger::nextBlock(Input& input)
+{
+    input.have_block = false;
+    while ( readBlock(input) )
+        if ( selectBlock(input) )
+        {
+            input.have_block = true;
+            return true;
+        }
+    return false;
+}
+
+bool BlockCborMerger::readBlock(Input& input)
+{
+    CborBaseDecoder& dec = input.dec;
+    input.block.clear();
+    input.data.reset();
+    input.items = 0;
+    input.items_in_range = 0;
+    input.item_times_known = false;
+
+    try
+    {
+        if ( input.blocks_indef )
+        {
+            if ( dec.type() == CborBaseDecoder::TYPE_BREAK )
+            {
+                dec.readBreak();
+                return false;
+            }
+        }
+        else if ( input.n_blocks == 0 )
+            return false;
+        else
+            --input.n_blocks;
+
+        // Copy the block as read, apart from the preamble.
+        bool indef;
+        dec.startRecording(input.block);
+        uint64_t n_elems = dec.readMapHeader(indef);
+        bool have_preamble = false;
+        while ( indef || n_elems-- > 0 )
+        {
+            if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+            {
+                dec.readBreak();
+                break;
+            }
+
+            block_cbor::BlockField field = block_cbor::BlockField::unknown;
+            if ( dec.type() == CborBaseDecoder::TYPE_UNSIGNED )
+                field = input.fields->block_field(dec.read_unsigned());
+            else
+                dec.skip();
+
+            if ( field == block_cbor::BlockField::preamble )
+            {
+                dec.stopRecording();
+                ByteStringCborEncoder enc(input.block);
+                rewriteBlockPreamble(input, enc);
+                enc.flush();
+                dec.startRecording(input.block);
+                have_preamble = true;
+            }
+            else if ( field == block_cbor::BlockField::queries &&
+                      select_times_ && have_preamble )
+                scanItemTimes(input, false);
+            else if ( field == block_cbor::BlockField::malformed_messages &&
+                      select_times_ && have_preamble )
+                scanItemTimes(input, true);
+            else
+                dec.skip();
+        }
+        dec.stopRecording();
+
+        if ( !have_preamble )
+            throw cbor_file_format_error("Block has no preamble");
+    }
+    catch (const cbor_file_format_error& e)
+    {
+        dec.stopRecording();
+        throw cbor_file_format_error(input.name + ": " + e.what());
+    }
+    catch (const std::logic_error& e)
+    {
+        dec.stopRecording();
+        throw cbor_file_format_error(input.name + ": Unexpected item reading block");
+    }
+    catch (const cbor_end_of_input& e)
+    {
+        dec.stopRecording();
+        throw cbor_file_format_error(input.name + ": Unexpected end of input reading block");
+    }
+
+    return true;
+}
+
+void BlockCborMerger::scanItemTimes(Input& input, bool malformed)
+{
+    CborBaseDecoder& dec = input.dec;
+    bool indef;
+    uint64_t n_elems = dec.readArrayHeader(indef);
+    while ( indef || n_elems-- > 0 )
+    {
+        if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec.readBreak();
+            break;
+        }
+
+        // Items without a time are taken to be at the block earliest time.
+        std::chrono::system_clock::time_point t = input.earliest_time;
+        bool item_indef;
+        uint64_t n_item_elems = dec.readMapHeader(item_indef);
+        while ( item_indef || n_item_elems-- > 0 )
+        {
+            if ( item_indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+            {
+                dec.readBreak();
+                break;
+            }
+
+            unsigned key = dec.read_unsigned();
+            bool is_time = malformed
+                ? input.fields->malformed_message_field(key) == block_cbor::MalformedMessageField::time_offset
+                : input.fields->query_response_field(key) == block_cbor::QueryResponseField::time_offset;
+            if ( is_time )
+            {
+                std::chrono::nanoseconds ns(dec.read_signed() * NS_PER_SEC / input.block_ticks_per_second);
+                t = input.earliest_time + std::chrono::duration_cast<std::chrono::system_clock::duration>(ns);
+            }
+            else
+                dec.skip();
+        }
+
+        ++input.items;
+        if ( in_time_range(t) )
+            ++input.items_in_range;
+    }
+    input.item_times_known = true;
+}
+
+bool BlockCborMerger::selectBlock(Input& input)
+{
+    bool trim = false;
+    if ( select_times_ )
+    {
+        // No item is earlier than the block earliest time.
+        if ( input.earliest_time >= end_time_ )
+            return false;
+
+        if ( input.item_times_known )
+        {
+            if ( input.items_in_range == 0 )
+                return false;
+            trim = ( input.items_in_range != input.items );
+        }
+        else
+            // The block layout prevented checking.
+            trim = true;
+    }
+
+    if ( !trim && !rewriter_ )
+        return true;
+
+    // Decode the block to write it with only the items in range,
+    // or to rewrite or re-block it.
+    ByteStringCborDecoder dec(input.block);
+    std::unique_ptr<block_cbor::BlockData> data = make_unique<block_cbor::BlockData>(output_block_parameters_);
+    try
+    {
+        data->readCbor(dec, *input.fields);
+    }
+    catch (const cbor_file_format_error& e)
+    {
+        throw cbor_file_format_error(input.name + ": " + e.what());
+    }
+
+    if ( trim )
+    {
+        std::size_t n_items = data->query_response_items.size() + data->malformed_messages.size();
+        auto out_of_range = [&](const block_cbor::QueryResponseItem& qri)
+        {
+            return !in_time_range(qri.tstamp ? *qri.tstamp : data->earliest_time);
+        };
+        auto mm_out_of_range = [&](const block_cbor::MalformedMessageItem& mm)
+        {
+            return !in_time_range(mm.tstamp ? *mm.tstamp : data->earliest_time);
+        };
+        data->query_response_items.erase(std::remove_if(data->query_response_items.begin(),
+                                                       data->query_response_items.end(),
+                                                       out_of_range),
+                                        data->query_response_items.end());
+        data->malformed_messages.erase(std::remove_if(data->malformed_messages.begin(),
+                                                     data->malformed_messages.end(),
+                                                     mm_out_of_range),
+                                      data->malformed_messages.end());
+        if ( data->query_response_items.empty() && data->malformed_messages.empty() )
+            return false;
+        trim = ( data->query_response_items.size() + data->malformed_messages.size() != n_items );
+        if ( !trim && !rewriter_ )
+            return true;
+    }
+
+    if ( trim )
+    {
+        boost::optional<std::chrono::system_clock::time_point> earliest;
+        for ( const auto& qri : data->query_response_items )
+            if ( qri.tstamp && ( !earliest || *qri.tstamp < *earliest ) )
+                earliest = qri.tstamp;
+        for ( const auto& mm : data->malformed_messages )
+            if ( mm.tstamp && ( !earliest || *mm.tstamp < *earliest ) )
+                earliest = mm.tstamp;
+        if ( earliest )
+            data->earliest_time = *earliest;
+        if ( data->start_time && *data->start_time < start_time_ )
+            data->start_time = start_time_;
+        if ( data->end_time && *data->end_time > end_time_ )
+            data->end_time = end_time_;
+        ++blocks_trimmed_;
+    }
+
+    input.earliest_time = data->earliest_time;
+    if ( reblocking() )
+    {
+        input.data = std::move(data);
+        return true;
+    }
+
+    input.block.clear();
+    ByteStringCborEncoder enc(input.block);
+    if ( rewriter_ )
+    {
+        block_cbor::BlockData out(output_block_parameters_);
+        rewriter_->rewriteBlock(*data, out, output_block_parameters_[data->block_parameters_index]);
+        out.writeCbor(enc);
+    }
+    else
+        data->writeCbor(enc);
+    enc.flush();
+    return true;
+}
+
+void BlockCborMerger::rewriteBlockPreamble(Input& input, CborBaseEncoder& enc)
+{
+    constexpr int block_parameters_index_index = block_cbor::find_block_preamble_index(block_cbor::BlockPreambleField::block_parameters_index);
+
+    CborBaseDecoder& dec = input.dec;
+    std::vector<std::pair<int, byte_string>> items;
+    uint64_t bp_index = 0;
+    block_cbor::Timestamp earliest_ts;
+    bool indef;
+    uint64_t n_elems = dec.readMapHeader(indef);
+    while ( indef || n_elems-- > 0 )
+    {
+        if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec.readBreak();
+            break;
+        }
+
+        int key = dec.read_signed();
+        switch(input.fields->block_preamble_field(key))
+        {
+        case block_cbor::BlockPreambleField::block_parameters_index:
+            bp_index = dec.read_unsigned();
+            break;
+
+        case block_cbor::BlockPreambleField::earliest_time:
+            items.emplace_back(key, byte_string());
+            dec.startRecording(items.back().second);
+            earliest_ts.readCbor(dec);
+            dec.stopRecording();
+            break;
+
+        default:
+            items.emplace_back(key, byte_string());
+            dec.readRaw(items.back().second);
+            break;
+        }
+    }
+
+    if ( bp_index >= input.output_index.size() )
+        throw cbor_file_format_error("Block parameters index out of range");
+    unsigned output_index = input.output_index[bp_index];
+    input.block_ticks_per_second = input.ticks_per_second[bp_index];
+    input.earliest_time = earliest_ts.getTimePoint(input.block_ticks_per_second);
+
+    // Index 0 is the default, and need not be written.
+    enc.writeMapHeader(items.size() + ( output_index > 0 ));
+    for ( const auto& item : items )
+    {
+        enc.write(item.first);
+        enc.writeRaw(item.second);
+    }
+    if ( output_index > 0 )
+    {
+        enc.write(block_parameters_index_index);
+        enc.write(output_index);
+    }
+}
@@ -0,0 +1,456 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef BLOCKCBORMERGER_HPP
+#define BLOCKCBORMERGER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "blockcbor.hpp"
+#include "blockcbordata.hpp"
+#include "blockcborrewriter.hpp"
+#include "bytestring.hpp"
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+
+/**
+ * \class BlockCborMerger
+ * \brief Merge C-DNS files block by block.
+ *
+ * Blocks are copied from the inputs without being decoded and
+ * encoded again. Only the block preamble is rewritten, so that
+ * its block parameters index refers to the merged list of block
+ * parameters in the output file preamble. Identical block parameters
+ * from different inputs appear only once in the output.
+ *
+ * All inputs must be C-DNS format 1.x files with the same format
+ * version.
+ *
+ * Optionally, only records in a time range are written. Blocks with
+ * all their records in the range are still copied, and blocks with
+ * none are dropped. Only blocks with some records in the range are
+ * decoded, and encoded again with just those records.
+ *
+ * Optionally, every block is decoded and passed through a
+ * BlockCborRewriter before being encoded again.
+ *
+ * Optionally, the records are re-blocked. Every block is decoded,
+ * and its records are appended to an output block that is written
+ * when it reaches a maximum number of records or time span. The
+ * output block tables are rebuilt from the records it contains.
+ * Output blocks are encoded on worker threads, and written in order.
+ */
+class BlockCborMerger
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param enc the encoder for the merged output.
+     */
+    explicit BlockCborMerger(CborBaseEncoder& enc);
+
+    /**
+     * \brief Add an input file.
+     *
+     * The file header is read immediately.
+     *
+     * \param dec  the decoder for the input.
+     * \param name the input name, for error messages.
+     * \throws cbor_file_format_error if the input can't be merged.
+     */
+    void add_input(CborBaseDecoder& dec, const std::string& name);
+
+    /**
+     * \brief Only write records in a time range.
+     *
+     * \param start the start of the range.
+     * \param end   the end of the range. Records at this time are not written.
+     */
+    void set_time_range(const std::chrono::system_clock::time_point& start,
+                        const std::chrono::system_clock::time_point& end);
+
+    /**
+     * \brief Rewrite every block.
+     *
+     * This must be set before any input is added, as it also
+     * rewrites the block parameters in the file header.
+     *
+     * \param rewriter the rewriter.
+     * \throws std::logic_error if inputs have already been added.
+     */
+    void set_rewriter(const BlockCborRewriter& rewriter);
+
+    /**
+     * \brief Re-block the records into new blocks.
+     *
+     * This must be set before any input is added, as it also
+     * sets the maximum block size in the output block parameters.
+     *
+     * A new block is started when the current block has the maximum
+     * number of records, when a record is at least the maximum
+     * period later than the first record in the block, or when the
+     * block parameters change.
+     *
+     * \param max_items the maximum records in a block, 0 for no maximum.
+     * \param period    the maximum block time span, 0 for no maximum.
+     * \param threads   the number of threads encoding output blocks.
+     * \throws std::logic_error if inputs have already been added.
+     */
+    void set_block_size(unsigned max_items,
+                        const std::chrono::seconds& period,
+                        unsigned threads = 1);
+
+    /**
+     * \brief Write the merged output.
+     *
+     * By default all blocks of the first input are written, then
+     * all blocks of the second input, and so on. If interleaving,
+     * the next block written is always the block with the earliest
+     * time of the next blocks in each input. If each input is in
+     * time order, so is the output.
+     *
+     * \param interleave interleave the input blocks by time.
+     * \throws cbor_file_format_error if an input can't be merged.
+     */
+    void merge(bool interleave = false);
+
+    /**
+     * \brief Return the number of block parameters in the output.
+     */
+    std::size_t block_parameters_count() const
+    {
+        return block_parameters_.size();
+    }
+
+    /**
+     * \brief Return the number of blocks written.
+     */
+    uint64_t block_count() const
+    {
+        return blocks_;
+    }
+
+    /**
+     * \brief Return the number of blocks written with records removed.
+     */
+    uint64_t trimmed_block_count() const
+    {
+        return blocks_trimmed_;
+    }
+
+private:
+    /**
+     * \struct Input
+     * \brief The state of an input file.
+     */
+    struct Input
+    {
+        /**
+         * \brief Constructor.
+         *
+         * \param dec  the decoder for the input.
+         * \param name the input name.
+         */
+        Input(CborBaseDecoder& dec, const std::string& name)
+            : dec(dec), name(name), n_blocks(0), blocks_indef(false),
+              have_block(false), block_ticks_per_second(1), items(0),
+              items_in_range(0), item_times_known(false) {}
+
+        /**
+         * \brief the decoder for the input.
+         */
+        CborBaseDecoder& dec;
+
+        /**
+         * \brief the input name.
+         */
+        std::string name;
+
+        /**
+         * \brief the field mapping for the input format version.
+         */
+        std::unique_ptr<block_cbor::FileVersionFields> fields;
+
+        /**
+         * \brief the output index of each input block parameters.
+         */
+        std::vector<unsigned> output_index;
+
+        /**
+         * \brief the ticks per second of each input block parameters.
+         */
+        std::vector<int64_t> ticks_per_second;
+
+        /**
+         * \brief the number of blocks remaining, if not indefinite.
+         */
+        uint64_t n_blocks;
+
+        /**
+         * \brief is the block array of indefinite length?
+         */
+        bool blocks_indef;
+
+        /**
+         * \brief is there a block waiting to be written?
+         */
+        bool have_block;
+
+        /**
+         * \brief the block waiting to be written.
+         */
+        byte_string block;
+
+        /**
+         * \brief the decoded block waiting to be re-blocked, if re-blocking.
+         */
+        std::unique_ptr<block_cbor::BlockData> data;
+
+        /**
+         * \brief the earliest time of the block waiting to be written.
+         */
+        std::chrono::system_clock::time_point earliest_time;
+
+        /**
+         * \brief the ticks per second of the block waiting to be written.
+         */
+        int64_t block_ticks_per_second;
+
+        /**
+         * \brief the number of records in the block.
+         */
+        uint64_t items;
+
+        /**
+         * \brief the number of records in the block in the time range.
+         */
+        uint64_t items_in_range;
+
+        /**
+         * \brief have the records in the block been counted?
+         */
+        bool item_times_known;
+    };
+
+    /**
+     * \brief Read the header of an input file.
+     *
+     * \param input the input.
+     */
+    void readFileHeader(Input& input);
+
+    /**
+     * \brief Read the block parameters of an input file.
+     *
+     * \param input the input.
+     */
+    void readBlockParameters(Input& input);
+
+    /**
+     * \brief Make the next block to write the pending block of an input.
+     *
+     * \param input the input.
+     * \returns `false` if there are no more blocks to write.
+     */
+    bool nextBlock(Input& input);
+
+    /**
+     * \brief Read the next block of an input, rewriting its preamble.
+     *
+     * If selecting by time, count the records in the time range.
+     *
+     * \param input the input. On success, its block is set.
+     * \returns `false` if there are no more blocks.
+     */
+    bool readBlock(Input& input);
+
+    /**
+     * \brief Read the records of a block, counting those in the time range.
+     *
+     * \param input     the input.
+     * \param malformed `true` if the records are malformed messages,
+     *                  `false` if they are query/response items.
+     */
+    void scanItemTimes(Input& input, bool malformed);
+
+    /**
+     * \brief Decide whether to write a block, trimming or rewriting it if necessary.
+     *
+     * \param input the input.
+     * \returns `false` if the block should not be written.
+     */
+    bool selectBlock(Input& input);
+
+    /**
+     * \brief Is a time in the selected time range?
+     *
+     * \param t the time.
+     */
+    bool in_time_range(const std::chrono::system_clock::time_point& t) const
+    {
+        return t >= start_time_ && t < end_time_;
+    }
+
+    /**
+     * \brief Read a block preamble, and write it with the output index.
+     *
+     * \param input the input.
+     * \param enc   the encoder for the rewritten preamble.
+     */
+    void rewriteBlockPreamble(Input& input, CborBaseEncoder& enc);
+
+    /**
+     * \brief Write the output file header.
+     */
+    void writeFileHeader();
+
+    /**
+     * \brief Write the pending block of an input.
+     *
+     * \param input the input.
+     */
+    void writeBlock(Input& input);
+
+    /**
+     * \brief Are the records being re-blocked?
+     */
+    bool reblocking() const
+    {
+        return max_block_items_ > 0 || block_period_.count() > 0;
+    }
+
+    /**
+     * \brief Append the records of a decoded block to the output blocks.
+     *
+     * \param in the decoded block. Its records are moved out.
+     */
+    void reblock(block_cbor::BlockData& in);
+
+    /**
+     * \brief Start encoding the current output block.
+     *
+     * If the maximum number of blocks are already being encoded,
+     * wait for the oldest and write it first.
+     */
+    void flushOutputBlock();
+
+    /**
+     * \brief Wait for the oldest block being encoded, and write it.
+     */
+    void writeEncodedBlock();
+
+    /**
+     * \brief the output encoder.
+     */
+    CborBaseEncoder& enc_;
+
+    /**
+     * \brief the inputs.
+     */
+    std::vector<std::unique_ptr<Input>> inputs_;
+
+    /**
+     * \brief the encoded output block parameters.
+     */
+    std::vector<byte_string> block_parameters_;
+
+    /**
+     * \brief the decoded output block parameters.
+     */
+    std::vector<block_cbor::BlockParameters> output_block_parameters_;
+
+    /**
+     * \brief the major format version of the inputs.
+     */
+    unsigned major_version_;
+
+    /**
+     * \brief the minor format version of the inputs.
+     */
+    unsigned minor_version_;
+
+    /**
+     * \brief the private format version of the inputs.
+     */
+    unsigned private_version_;
+
+    /**
+     * \brief the rewriter, if rewriting blocks.
+     */
+    boost::optional<BlockCborRewriter> rewriter_;
+
+    /**
+     * \brief the maximum records in a re-blocked block, 0 for no maximum.
+     */
+    unsigned max_block_items_;
+
+    /**
+     * \brief the maximum time span of a re-blocked block, 0 for no maximum.
+     */
+    std::chrono::seconds block_period_;
+
+    /**
+     * \brief the maximum number of blocks being encoded at once.
+     */
+    unsigned encode_threads_;
+
+    /**
+     * \brief the re-blocked block being filled, if any.
+     */
+    std::unique_ptr<block_cbor::BlockData> out_block_;
+
+    /**
+     * \brief the time of the first record in the block being filled.
+     */
+    std::chrono::system_clock::time_point out_block_begin_;
+
+    /**
+     * \brief the re-blocked blocks being encoded, oldest first.
+     */
+    std::deque<std::future<byte_string>> encoded_blocks_;
+
+    /**
+     * \brief are records being selected by time?
+     */
+    bool select_times_;
+
+    /**
+     * \brief the start of the selected time range.
+     */
+    std::chrono::system_clock::time_point start_time_;
+
+    /**
+     * \brief the end of the selected time range.
+     */
+    std::chrono::system_clock::time_point end_time_;
+
+    /**
+     * \brief the number of blocks written.
+     */
+    uint64_t blocks_;
+
+    /**
+     * \brief the number of blocks written with records removed.
+     */
+    uint64_t blocks_trimmed_;
+};
+
+#endif
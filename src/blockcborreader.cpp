@@ -51,6 +51,7 @@ BlockCborReader::BlockCborReader(CborBaseDecoder& dec,
       defaults_(defaults),
       next_item_(0),
       need_block_(true),
+      skip_records_(false),
       file_format_version_(block_cbor::FileFormatVersion::format_10),
       current_block_num_(0),
       pseudo_anon_(pseudo_anon)
@@ -404,7 +405,7 @@ bool BlockCborReader::readBlock()
         return false;
 
     block_->clear();
-    block_->readCbor(dec_, *fields_);
+    block_->readCbor(dec_, *fields_, !skip_records_);
 
     // If any block does not have an end time, there is no end time.
     // Otherwise it's the latest of the end times.
@@ -442,6 +443,22 @@ bool BlockCborReader::readBlock()
     return true;
 }
 
+bool BlockCborReader::visitBlock(block_cbor::BlockVisitor& visitor)
+{
+    if ( !readBlock() )
+        return false;
+
+    // The visitor gets all the block records.
+    need_block_ = true;
+
+    block_cbor::BlockView view(*block_, block_parameters_[block_->block_parameters_index]);
+    visitor.block(view);
+    for ( const auto& aec : block_->address_event_counts )
+        visitor.address_event(aec.first, aec.second, view);
+    visitor.statistics(block_->last_packet_statistics, view);
+    return true;
+}
+
 QueryResponseData BlockCborReader::readQRData(bool& eof)
 {
     QueryResponseData res{};
@@ -25,6 +25,7 @@
 #include "cbordecoder.hpp"
 #include "blockcbor.hpp"
 #include "blockcbordata.hpp"
+#include "blockcborview.hpp"
 #include "configuration.hpp"
 #include "pseudoanonymise.hpp"
 #include "queryresponse.hpp"
@@ -336,6 +337,46 @@ public:
      */
     QueryResponseData readQRData(bool& eof);
 
+    /**
+     * \brief Read the next block, and pass its contents to a visitor.
+     *
+     * This gives direct access to the block records and header tables,
+     * without constructing QueryResponseData for each record. It is
+     * much faster when processing large numbers of records.
+     *
+     * Any records in the current block not yet returned by readQRData()
+     * are skipped. Records are not pseudo-anonymised.
+     *
+     * \param visitor the visitor.
+     * \returns `false` if there are no more blocks.
+     * \throws cbor_decode_error if the CBOR is invalid.
+     * \throws cbor_file_format_error on unexpected CBOR content.
+     */
+    bool visitBlock(block_cbor::BlockVisitor& visitor);
+
+    /**
+     * \brief Set whether block records are to be read.
+     *
+     * When records are skipped, blocks appear to contain no
+     * Query/Response items, but block statistics, sketches and
+     * address events are still read. This is much faster when only
+     * those are wanted.
+     *
+     * \param skip `true` to skip block records.
+     */
+    void skip_records(bool skip)
+    {
+        skip_records_ = skip;
+    }
+
+    /**
+     * \brief Return the block parameters in the file.
+     */
+    const std::vector<block_cbor::BlockParameters>& block_parameters() const
+    {
+        return block_parameters_;
+    }
+
     /**
      * \brief Dump the statistics for the block to the stream provided
      *
@@ -545,6 +586,11 @@ private:
      */
     bool need_block_;
 
+    /**
+     * \brief `true` if block records are not to be read.
+     */
+    bool skip_records_;
+
     /**
      * \brief is the block size indefinite?
      */
@@ -0,0 +1,650 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "blockcborrewriter.hpp"
+
+using block_cbor::index_t;
+
+namespace {
+#if ENABLE_PSEUDOANONYMISATION
+    const char ANONYMISATION_METHOD[] =
+        "AES-128 pseudo-anonymisation of IP addresses and EDNS Client Subnet";
+#endif
+
+    /**
+     * \class BlockRebuilder
+     * \brief Copy a block to a new block, rewriting table entries.
+     *
+     * Each input table entry is rewritten at most once. The new index
+     * of each entry is remembered, and used for all later references.
+     */
+    class BlockRebuilder
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param in          the input block.
+         * \param out         the output block.
+         * \param bp          the block parameters of the input block.
+         * \param hints       the fields to keep.
+         * \param pseudo_anon pseudo-anonymisation, if to use.
+         */
+        BlockRebuilder(const block_cbor::BlockData& in,
+                       block_cbor::BlockData& out,
+                       const block_cbor::BlockParameters& bp,
+                       const block_cbor::StorageHints& hints,
+                       const boost::optional<PseudoAnonymise>& pseudo_anon)
+            : in_(in), out_(out), bp_(bp), hints_(hints), pseudo_anon_(pseudo_anon),
+              addresses_(in.ip_addresses.size()),
+              class_types_(in.class_types.size()),
+              questions_(in.questions.size()),
+              resource_records_(in.resource_records.size()),
+              names_rdatas_(in.names_rdatas.size()),
+              opt_rdatas_(in.names_rdatas.size()),
+              signatures_(in.query_response_signatures.size()),
+              questions_lists_(in.questions_lists.size()),
+              rrs_lists_(in.rrs_lists.size()),
+              malformed_message_data_(in.malformed_message_data.size())
+        {
+        }
+
+        /**
+         * \brief Rewrite a query/response item in place.
+         *
+         * \param qri the item.
+         */
+        void item(block_cbor::QueryResponseItem& qri)
+        {
+            unsigned h = hints_.query_response_hints;
+
+            if ( !( h & block_cbor::TIME_OFFSET ) )
+                qri.tstamp = boost::none;
+            qri.client_address = ( h & block_cbor::CLIENT_ADDRESS_INDEX ) ? address(qri.client_address) : index_t();
+            if ( !( h & block_cbor::CLIENT_PORT ) )
+                qri.client_port = boost::none;
+            if ( !( h & block_cbor::TRANSACTION_ID ) )
+                qri.id = boost::none;
+            qri.signature = ( h & block_cbor::QR_SIGNATURE_INDEX ) ? signature(qri.signature) : index_t();
+            if ( !( h & block_cbor::CLIENT_HOPLIMIT ) )
+                qri.hoplimit = boost::none;
+            if ( !( h & block_cbor::RESPONSE_DELAY ) )
+                qri.response_delay = boost::none;
+            qri.qname = ( h & block_cbor::QUERY_NAME_INDEX ) ? name_rdata(qri.qname) : index_t();
+            if ( !( h & block_cbor::QUERY_SIZE ) )
+                qri.query_size = boost::none;
+            if ( !( h & block_cbor::RESPONSE_SIZE ) )
+                qri.response_size = boost::none;
+
+            extra_info(qri.query_extra_info,
+                       h & block_cbor::QUERY_QUESTION_SECTIONS,
+                       h & block_cbor::QUERY_ANSWER_SECTIONS,
+                       h & block_cbor::QUERY_AUTHORITY_SECTIONS,
+                       h & block_cbor::QUERY_ADDITIONAL_SECTIONS);
+            extra_info(qri.response_extra_info,
+                       true,
+                       h & block_cbor::RESPONSE_ANSWER_SECTIONS,
+                       h & block_cbor::RESPONSE_AUTHORITY_SECTIONS,
+                       h & block_cbor::RESPONSE_ADDITIONAL_SECTIONS);
+        }
+
+        /**
+         * \brief Rewrite a malformed message item in place.
+         *
+         * \param mm the item.
+         */
+        void malformed_message(block_cbor::MalformedMessageItem& mm)
+        {
+            if ( !keep_qr(block_cbor::TIME_OFFSET) )
+                mm.tstamp = boost::none;
+            mm.client_address = keep_qr(block_cbor::CLIENT_ADDRESS_INDEX) ? address(mm.client_address) : index_t();
+            if ( !keep_qr(block_cbor::CLIENT_PORT) )
+                mm.client_port = boost::none;
+            mm.message_data = malformed_message_data(mm.message_data);
+        }
+
+        /**
+         * \brief Rewrite an IP address reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t address(const index_t& i)
+        {
+            return remap(addresses_, i, [this](std::size_t n) -> index_t
+            {
+                const byte_string& addr = in_.ip_addresses[n].str;
+#if ENABLE_PSEUDOANONYMISATION
+                if ( pseudo_anon_ )
+                    return out_.add_address(anonymise_address(addr));
+#endif
+                return out_.add_address(addr);
+            });
+        }
+
+    private:
+        /**
+         * \brief Look up or make the output index for an input index.
+         *
+         * \param map  the output indexes already made.
+         * \param i    the input index.
+         * \param make make the output entry for an input index.
+         * \returns the output index.
+         */
+        template<typename F>
+        index_t remap(std::vector<index_t>& map, const index_t& i, F make)
+        {
+            if ( !i )
+                return i;
+            if ( *i < map.size() && map[*i] )
+                return map[*i];
+
+            // An index out of range throws when the input table is read.
+            index_t res = make(*i);
+            map[*i] = res;
+            return res;
+        }
+
+        /**
+         * \brief Rewrite a NAME or RDATA reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t name_rdata(const index_t& i)
+        {
+            return remap(names_rdatas_, i, [this](std::size_t n) -> index_t
+            {
+                return out_.add_name_rdata(in_.names_rdatas[n].str);
+            });
+        }
+
+        /**
+         * \brief Rewrite a query OPT RDATA reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t opt_rdata(const index_t& i)
+        {
+            return remap(opt_rdatas_, i, [this](std::size_t n) -> index_t
+            {
+                const byte_string& rdata = in_.names_rdatas[n].str;
+#if ENABLE_PSEUDOANONYMISATION
+                if ( pseudo_anon_ )
+                    return out_.add_name_rdata(pseudo_anon_->edns0(rdata));
+#endif
+                return out_.add_name_rdata(rdata);
+            });
+        }
+
+        /**
+         * \brief Rewrite a CLASS/TYPE reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t classtype(const index_t& i)
+        {
+            return remap(class_types_, i, [this](std::size_t n) -> index_t
+            {
+                return out_.add_classtype(in_.class_types[n]);
+            });
+        }
+
+        /**
+         * \brief Rewrite a question reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t question(const index_t& i)
+        {
+            return remap(questions_, i, [this](std::size_t n) -> index_t
+            {
+                block_cbor::Question q = in_.questions[n];
+                q.qname = keep_qr(block_cbor::QUERY_NAME_INDEX) ? name_rdata(q.qname) : index_t();
+                q.classtype = keep_sig(block_cbor::QUERY_CLASS_TYPE) ? classtype(q.classtype) : index_t();
+                return out_.add_question(q);
+            });
+        }
+
+        /**
+         * \brief Rewrite a resource record reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t resource_record(const index_t& i)
+        {
+            return remap(resource_records_, i, [this](std::size_t n) -> index_t
+            {
+                block_cbor::ResourceRecord rr = in_.resource_records[n];
+                rr.name = keep_qr(block_cbor::QUERY_NAME_INDEX) ? name_rdata(rr.name) : index_t();
+                rr.classtype = keep_sig(block_cbor::QUERY_CLASS_TYPE) ? classtype(rr.classtype) : index_t();
+                if ( !( hints_.rr_hints & block_cbor::TTL ) )
+                    rr.ttl = boost::none;
+                rr.rdata = ( hints_.rr_hints & block_cbor::RDATA_INDEX ) ? name_rdata(rr.rdata) : index_t();
+                return out_.add_resource_record(rr);
+            });
+        }
+
+        /**
+         * \brief Rewrite a questions list reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t questions_list(const index_t& i)
+        {
+            return remap(questions_lists_, i, [this](std::size_t n) -> index_t
+            {
+                std::vector<index_t> ql = in_.questions_lists[n].vec;
+                for ( auto& q : ql )
+                    q = question(q);
+                return out_.add_questions_list(ql);
+            });
+        }
+
+        /**
+         * \brief Rewrite a RR list reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t rrs_list(const index_t& i)
+        {
+            return remap(rrs_lists_, i, [this](std::size_t n) -> index_t
+            {
+                std::vector<index_t> rl = in_.rrs_lists[n].vec;
+                for ( auto& rr : rl )
+                    rr = resource_record(rr);
+                return out_.add_rrs_list(rl);
+            });
+        }
+
+        /**
+         * \brief Rewrite a query/response signature reference.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t signature(const index_t& i)
+        {
+            return remap(signatures_, i, [this](std::size_t n) -> index_t
+            {
+                block_cbor::QueryResponseSignature qs = in_.query_response_signatures[n];
+
+                qs.server_address = keep_sig(block_cbor::SERVER_ADDRESS) ? address(qs.server_address) : index_t();
+                if ( !keep_sig(block_cbor::SERVER_PORT) )
+                    qs.server_port = boost::none;
+                if ( !keep_sig(block_cbor::QR_TRANSPORT_FLAGS) )
+                    qs.qr_transport_flags = boost::none;
+                if ( !keep_sig(block_cbor::QR_TYPE) )
+                    qs.qr_type = boost::none;
+                if ( !keep_sig(block_cbor::QR_SIG_FLAGS) )
+                    qs.qr_flags = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_OPCODE) )
+                    qs.query_opcode = boost::none;
+                if ( !keep_sig(block_cbor::DNS_FLAGS) )
+                    qs.dns_flags = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_RCODE) )
+                    qs.query_rcode = boost::none;
+                qs.query_classtype = keep_sig(block_cbor::QUERY_CLASS_TYPE) ? classtype(qs.query_classtype) : index_t();
+                if ( !keep_sig(block_cbor::QUERY_QDCOUNT) )
+                    qs.qdcount = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_ANCOUNT) )
+                    qs.query_ancount = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_NSCOUNT) )
+                    qs.query_nscount = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_ARCOUNT) )
+                    qs.query_arcount = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_EDNS_VERSION) )
+                    qs.query_edns_version = boost::none;
+                if ( !keep_sig(block_cbor::QUERY_UDP_SIZE) )
+                    qs.query_edns_payload_size = boost::none;
+                qs.query_opt_rdata = keep_sig(block_cbor::QUERY_OPT_RDATA) ? opt_rdata(qs.query_opt_rdata) : index_t();
+                if ( !keep_sig(block_cbor::RESPONSE_RCODE) )
+                    qs.response_rcode = boost::none;
+
+                return out_.add_query_response_signature(qs);
+            });
+        }
+
+        /**
+         * \brief Rewrite a malformed message data reference.
+         *
+         * The message data can't be relied on to be DNS, so any
+         * addresses in it can't be found. When pseudo-anonymising,
+         * it is dropped.
+         *
+         * \param i the input index.
+         * \returns the output index.
+         */
+        index_t malformed_message_data(const index_t& i)
+        {
+            return remap(malformed_message_data_, i, [this](std::size_t n) -> index_t
+            {
+                block_cbor::MalformedMessageData mmd = in_.malformed_message_data[n];
+
+                mmd.server_address = keep_sig(block_cbor::SERVER_ADDRESS) ? address(mmd.server_address) : index_t();
+                if ( !keep_sig(block_cbor::SERVER_PORT) )
+                    mmd.server_port = boost::none;
+                if ( !keep_sig(block_cbor::QR_TRANSPORT_FLAGS) )
+                    mmd.mm_transport_flags = boost::none;
+                if ( pseudo_anon_ )
+                    mmd.mm_payload = boost::none;
+
+                return out_.add_malformed_message_data(mmd);
+            });
+        }
+
+        /**
+         * \brief Rewrite query or response extra information in place.
+         *
+         * \param info       the extra information.
+         * \param questions  keep the questions?
+         * \param answers    keep the answers?
+         * \param authority  keep the authority RRs?
+         * \param additional keep the additional RRs?
+         */
+        void extra_info(std::unique_ptr<block_cbor::QueryResponseExtraInfo>& info,
+                        bool questions, bool answers, bool authority, bool additional)
+        {
+            if ( !info )
+                return;
+
+            info->questions_list = questions ? questions_list(info->questions_list) : index_t();
+            info->answers_list = answers ? rrs_list(info->answers_list) : index_t();
+            info->authority_list = authority ? rrs_list(info->authority_list) : index_t();
+            info->additional_list = additional ? rrs_list(info->additional_list) : index_t();
+
+            if ( !info->questions_list && !info->answers_list &&
+                 !info->authority_list && !info->additional_list )
+                info.reset();
+        }
+
+        /**
+         * \brief Is a query/response field kept?
+         *
+         * \param flag the field hint flag.
+         */
+        bool keep_qr(block_cbor::QueryResponseHintFlags flag) const
+        {
+            return hints_.query_response_hints & flag;
+        }
+
+        /**
+         * \brief Is a query/response signature field kept?
+         *
+         * \param flag the field hint flag.
+         */
+        bool keep_sig(block_cbor::QueryResponseSignatureHintFlags flag) const
+        {
+            return hints_.query_response_signature_hints & flag;
+        }
+
+#if ENABLE_PSEUDOANONYMISATION
+        /**
+         * \brief Pseudo-anonymise a stored address.
+         *
+         * Stored addresses may be a prefix of the full address.
+         * The prefix is padded to a full address, pseudo-anonymised,
+         * and cut back to the original length. Addresses of 4 bytes
+         * or less are taken to be IPv4.
+         *
+         * \param addr the stored address.
+         * \returns the pseudo-anonymised address.
+         */
+        byte_string anonymise_address(const byte_string& addr) const
+        {
+            bool ipv6 = ( addr.size() > 4 );
+            byte_string full = addr;
+            full.resize(ipv6 ? 16 : 4, 0);
+            byte_string res = pseudo_anon_->address(IPAddress(full)).asNetworkBinary();
+            res.resize(addr.size());
+
+            // If the address is shorter than a configured prefix length
+            // rounded up to a byte, keep the bits beyond the prefix zero.
+            const block_cbor::StorageParameters& sp = bp_.storage_parameters;
+            unsigned unused_bits = 0;
+            for ( unsigned prefix_len : { ipv6 ? sp.client_address_prefix_ipv6 : sp.client_address_prefix_ipv4,
+                                          ipv6 ? sp.server_address_prefix_ipv6 : sp.server_address_prefix_ipv4 } )
+                if ( ( prefix_len + 7 ) / 8 == res.size() )
+                    unused_bits = std::max(unused_bits, static_cast<unsigned>(res.size() * 8 - prefix_len));
+            if ( !res.empty() )
+                res.back() &= 0xff << unused_bits;
+            return res;
+        }
+#endif
+
+        /**
+         * \brief the input block.
+         */
+        const block_cbor::BlockData& in_;
+
+        /**
+         * \brief the output block.
+         */
+        block_cbor::BlockData& out_;
+
+        /**
+         * \brief the block parameters of the input block.
+         */
+        const block_cbor::BlockParameters& bp_;
+
+        /**
+         * \brief the fields to keep.
+         */
+        const block_cbor::StorageHints& hints_;
+
+        /**
+         * \brief pseudo-anonymisation, if to use.
+         */
+        const boost::optional<PseudoAnonymise>& pseudo_anon_;
+
+        /**
+         * \brief the output index of each input IP address.
+         */
+        std::vector<index_t> addresses_;
+
+        /**
+         * \brief the output index of each input CLASS/TYPE.
+         */
+        std::vector<index_t> class_types_;
+
+        /**
+         * \brief the output index of each input question.
+         */
+        std::vector<index_t> questions_;
+
+        /**
+         * \brief the output index of each input RR.
+         */
+        std::vector<index_t> resource_records_;
+
+        /**
+         * \brief the output index of each input NAME or RDATA.
+         */
+        std::vector<index_t> names_rdatas_;
+
+        /**
+         * \brief the output index of each input NAME or RDATA used as OPT RDATA.
+         */
+        std::vector<index_t> opt_rdatas_;
+
+        /**
+         * \brief the output index of each input query/response signature.
+         */
+        std::vector<index_t> signatures_;
+
+        /**
+         * \brief the output index of each input questions list.
+         */
+        std::vector<index_t> questions_lists_;
+
+        /**
+         * \brief the output index of each input RR list.
+         */
+        std::vector<index_t> rrs_lists_;
+
+        /**
+         * \brief the output index of each input malformed message data.
+         */
+        std::vector<index_t> malformed_message_data_;
+    };
+}
+
+BlockCborRewriter::BlockCborRewriter()
+{
+    hints_.query_response_hints = block_cbor::QueryResponseHintFlags(
+        ( block_cbor::RESPONSE_ADDITIONAL_SECTIONS << 1 ) - 1);
+    hints_.query_response_signature_hints = block_cbor::QueryResponseSignatureHintFlags(
+        ( block_cbor::RESPONSE_RCODE << 1 ) - 1);
+    hints_.rr_hints = block_cbor::RRHintFlags(block_cbor::TTL | block_cbor::RDATA_INDEX);
+    hints_.other_data_hints = block_cbor::OtherDataHintFlags(
+        block_cbor::MALFORMED_MESSAGES | block_cbor::ADDRESS_EVENT_COUNTS);
+}
+
+BlockCborRewriter::BlockCborRewriter(const block_cbor::StorageHints& hints,
+                                     boost::optional<PseudoAnonymise> pseudo_anon)
+    : hints_(hints), pseudo_anon_(pseudo_anon)
+{
+}
+
+void BlockCborRewriter::rewriteBlockParameters(block_cbor::BlockParameters& bp) const
+{
+    block_cbor::StorageParameters& sp = bp.storage_parameters;
+    block_cbor::StorageHints& sh = sp.storage_hints;
+
+    sh.query_response_hints = block_cbor::QueryResponseHintFlags(
+        sh.query_response_hints & hints_.query_response_hints);
+    sh.query_response_signature_hints = block_cbor::QueryResponseSignatureHintFlags(
+        sh.query_response_signature_hints & hints_.query_response_signature_hints);
+    sh.rr_hints = block_cbor::RRHintFlags(sh.rr_hints & hints_.rr_hints);
+    sh.other_data_hints = block_cbor::OtherDataHintFlags(
+        sh.other_data_hints & hints_.other_data_hints);
+
+#if ENABLE_PSEUDOANONYMISATION
+    if ( pseudo_anon_ )
+    {
+        block_cbor::CollectionParameters& cp = bp.collection_parameters;
+
+        sp.storage_flags = block_cbor::StorageFlags(sp.storage_flags | block_cbor::ANONYMISED_DATA);
+        sp.anonymisation_method = ANONYMISATION_METHOD;
+        cp.host_id.clear();
+        cp.filter.clear();
+        for ( auto& a : cp.server_addresses )
+            a = pseudo_anon_->address(a);
+    }
+#endif
+}
+
+void BlockCborRewriter::rewriteBlock(block_cbor::BlockData& in,
+                                     block_cbor::BlockData& out,
+                                     const block_cbor::BlockParameters& bp) const
+{
+    out.earliest_time = in.earliest_time;
+    out.start_time = in.start_time;
+    out.end_time = in.end_time;
+    out.block_parameters_index = in.block_parameters_index;
+    out.start_packet_statistics = in.start_packet_statistics;
+    out.last_packet_statistics = in.last_packet_statistics;
+
+    moveItems(in, 0, in.query_response_items.size(), out, bp);
+    in.query_response_items.clear();
+    moveAddressEvents(in, out, bp);
+    moveMalformedMessages(in, out, bp);
+    moveSketches(in, out);
+}
+
+void BlockCborRewriter::moveItems(block_cbor::BlockData& in,
+                                  std::size_t begin, std::size_t end,
+                                  block_cbor::BlockData& out,
+                                  const block_cbor::BlockParameters& bp) const
+{
+    BlockRebuilder rebuilder(in, out, bp, hints_, pseudo_anon_);
+
+    out.query_response_items.reserve(out.query_response_items.size() + end - begin);
+    for ( std::size_t i = begin; i < end; ++i )
+    {
+        block_cbor::QueryResponseItem& qri = in.query_response_items[i];
+        rebuilder.item(qri);
+        out.query_response_items.push_back(std::move(qri));
+    }
+}
+
+void BlockCborRewriter::moveAddressEvents(block_cbor::BlockData& in,
+                                          block_cbor::BlockData& out,
+                                          const block_cbor::BlockParameters& bp) const
+{
+    if ( hints_.other_data_hints & block_cbor::ADDRESS_EVENT_COUNTS )
+    {
+        BlockRebuilder rebuilder(in, out, bp, hints_, pseudo_anon_);
+
+        for ( const auto& aec : in.address_event_counts )
+        {
+            block_cbor::AddressEventItem aei = aec.first;
+            aei.address = rebuilder.address(aei.address);
+            out.address_event_counts[aei] += aec.second;
+        }
+    }
+    in.address_event_counts.clear();
+}
+
+void BlockCborRewriter::moveMalformedMessages(block_cbor::BlockData& in,
+                                              block_cbor::BlockData& out,
+                                              const block_cbor::BlockParameters& bp) const
+{
+    if ( hints_.other_data_hints & block_cbor::MALFORMED_MESSAGES )
+    {
+        BlockRebuilder rebuilder(in, out, bp, hints_, pseudo_anon_);
+
+        out.malformed_messages.reserve(out.malformed_messages.size() + in.malformed_messages.size());
+        for ( auto& mm : in.malformed_messages )
+        {
+            rebuilder.malformed_message(mm);
+            out.malformed_messages.push_back(std::move(mm));
+        }
+    }
+    in.malformed_messages.clear();
+}
+
+void BlockCborRewriter::moveSketches(block_cbor::BlockData& in,
+                                     block_cbor::BlockData& out) const
+{
+    // Sketches are kept only while the field they summarise is kept.
+    // The client sketch holds hashes of the original addresses, so
+    // is not kept when pseudo-anonymising.
+    if ( in.client_sketch && !pseudo_anon_ &&
+         ( hints_.query_response_hints & block_cbor::CLIENT_ADDRESS_INDEX ) )
+    {
+        if ( out.client_sketch )
+            out.client_sketch->merge(*in.client_sketch);
+        else
+            out.client_sketch = std::move(in.client_sketch);
+    }
+    if ( in.qname_sketch && ( hints_.query_response_hints & block_cbor::QUERY_NAME_INDEX ) )
+    {
+        if ( out.qname_sketch )
+            out.qname_sketch->merge(*in.qname_sketch);
+        else
+            out.qname_sketch = std::move(in.qname_sketch);
+    }
+    in.client_sketch = boost::none;
+    in.qname_sketch = boost::none;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef BLOCKCBORREWRITER_HPP
+#define BLOCKCBORREWRITER_HPP
+
+#include <cstddef>
+
+#include <boost/optional.hpp>
+
+#include "config.h"
+
+#include "blockcbordata.hpp"
+#include "pseudoanonymise.hpp"
+
+/**
+ * \class BlockCborRewriter
+ * \brief Rewrite decoded C-DNS blocks, removing or pseudo-anonymising data.
+ *
+ * Fields not in the given storage hints are removed from the block,
+ * and the storage hints in the block parameters are reduced to match.
+ *
+ * If pseudo-anonymising, each IP address in the block address table,
+ * and each query OPT RDATA containing an EDNS Client Subnet option,
+ * is pseudo-anonymised once, however many records refer to it.
+ * Addresses stored as a prefix stay a prefix of the same length.
+ * The payload of malformed messages can't be searched for addresses,
+ * so is removed.
+ *
+ * The block tables are rebuilt as the records are rewritten, so
+ * table entries no longer used by any record are dropped.
+ */
+class BlockCborRewriter
+{
+public:
+    /**
+     * \brief Default constructor.
+     *
+     * Keep all fields, and don't pseudo-anonymise. The block tables
+     * are still rebuilt, so unused table entries are dropped.
+     */
+    BlockCborRewriter();
+
+    /**
+     * \brief Constructor.
+     *
+     * \param hints       the fields to keep.
+     * \param pseudo_anon pseudo-anonymisation, if to use.
+     */
+    explicit BlockCborRewriter(const block_cbor::StorageHints& hints,
+                               boost::optional<PseudoAnonymise> pseudo_anon = {});
+
+    /**
+     * \brief Rewrite block parameters.
+     *
+     * Reduce the storage hints to the fields kept. If pseudo-anonymising,
+     * mark the data as anonymised and remove identifying collection
+     * parameters.
+     *
+     * \param bp the block parameters.
+     */
+    void rewriteBlockParameters(block_cbor::BlockParameters& bp) const;
+
+    /**
+     * \brief Rewrite a block.
+     *
+     * The records are moved from the input block, which is left empty.
+     *
+     * \param in  the block to rewrite.
+     * \param out an empty block to receive the rewritten data.
+     * \param bp  the block parameters of the input block.
+     */
+    void rewriteBlock(block_cbor::BlockData& in,
+                      block_cbor::BlockData& out,
+                      const block_cbor::BlockParameters& bp) const;
+
+    /**
+     * \brief Rewrite some records of a block, appending them to another block.
+     *
+     * The records are moved from the input block. Table entries are
+     * added to the output block tables, using existing entries where
+     * the same data is already present. The output block earliest time
+     * is not changed.
+     *
+     * \param in    the block to take records from.
+     * \param begin the index of the first record to move.
+     * \param end   the index after the last record to move.
+     * \param out   the block to append rewritten records to.
+     * \param bp    the block parameters of the input block.
+     */
+    void moveItems(block_cbor::BlockData& in,
+                   std::size_t begin, std::size_t end,
+                   block_cbor::BlockData& out,
+                   const block_cbor::BlockParameters& bp) const;
+
+    /**
+     * \brief Rewrite the address event counts of a block, adding them to another block.
+     *
+     * The counts are moved from the input block.
+     *
+     * \param in  the block to take address event counts from.
+     * \param out the block to add rewritten address event counts to.
+     * \param bp  the block parameters of the input block.
+     */
+    void moveAddressEvents(block_cbor::BlockData& in,
+                           block_cbor::BlockData& out,
+                           const block_cbor::BlockParameters& bp) const;
+
+    /**
+     * \brief Rewrite the malformed messages of a block, adding them to another block.
+     *
+     * The messages are moved from the input block.
+     *
+     * \param in  the block to take malformed messages from.
+     * \param out the block to add rewritten malformed messages to.
+     * \param bp  the block parameters of the input block.
+     */
+    void moveMalformedMessages(block_cbor::BlockData& in,
+                               block_cbor::BlockData& out,
+                               const block_cbor::BlockParameters& bp) const;
+
+    /**
+     * \brief Move the sketches of a block, merging them into those of another block.
+     *
+     * A sketch is dropped if the field it summarises is not kept.
+     * The client sketch is dropped if pseudo-anonymising. The
+     * sketches are moved from the input block.
+     *
+     * \param in  the block to take sketches from.
+     * \param out the block to add sketches to.
+     */
+    void moveSketches(block_cbor::BlockData& in,
+                      block_cbor::BlockData& out) const;
+
+private:
+    /**
+     * \brief the fields to keep.
+     */
+    block_cbor::StorageHints hints_;
+
+    /**
+     * \brief pseudo-anonymisation, if to use.
+     */
+    boost::optional<PseudoAnonymise> pseudo_anon_;
+};
+
+#endif
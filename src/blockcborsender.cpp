@@ -0,0 +1,533 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "blockcborsender.hpp"
+#include "log.hpp"
+#include "util.hpp"
+
+namespace {
+    /**
+     * \brief the time allowed for a single socket operation.
+     */
+    const boost::posix_time::seconds IO_TIMEOUT(30);
+
+    /**
+     * \brief the name of the spool file in the spool directory.
+     */
+    const std::string SPOOL_FILE_NAME = "cdns-stream.spool";
+
+    /**
+     * \class IoHandler
+     * \brief Record the result of an IO operation and cancel its timer.
+     */
+    class IoHandler
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param res   where to record the result.
+         * \param timer the operation timer.
+         */
+        IoHandler(boost::system::error_code& res, boost::asio::deadline_timer& timer)
+            : res_(res), timer_(timer) {}
+
+        /**
+         * \brief Handle completion of the operation.
+         *
+         * \param err the operation result.
+         */
+        void operator()(const boost::system::error_code& err, std::size_t = 0) const
+        {
+            res_ = err;
+            boost::system::error_code ec;
+            timer_.cancel(ec);
+        }
+
+    private:
+        /**
+         * \brief where to record the result.
+         */
+        boost::system::error_code& res_;
+
+        /**
+         * \brief the operation timer.
+         */
+        boost::asio::deadline_timer& timer_;
+    };
+
+    uint32_t get_uint32(const uint8_t* p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+            (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    void put_uint32(uint8_t* p, uint32_t val)
+    {
+        p[0] = val >> 24;
+        p[1] = val >> 16;
+        p[2] = val >> 8;
+        p[3] = val;
+    }
+}
+
+namespace block_cbor {
+    bool write_frame(std::ostream& os,
+                     const byte_string& header,
+                     const byte_string& block)
+    {
+        uint8_t prefix[FRAME_PREFIX_SIZE];
+        write_frame_prefix(prefix, header.size(), block.size());
+        os.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+        os.write(reinterpret_cast<const char*>(header.data()), header.size());
+        os.write(reinterpret_cast<const char*>(block.data()), block.size());
+        os.flush();
+        return static_cast<bool>(os);
+    }
+
+    void write_frame_prefix(uint8_t* buf, std::size_t header_size, std::size_t block_size)
+    {
+        if ( header_size > FRAME_MAX_SIZE || block_size > FRAME_MAX_SIZE )
+            throw std::length_error("C-DNS frame too large");
+        put_uint32(buf, header_size);
+        put_uint32(buf + 4, block_size);
+    }
+
+    void read_frame_prefix(const uint8_t* buf, std::size_t& header_size, std::size_t& block_size)
+    {
+        header_size = get_uint32(buf);
+        block_size = get_uint32(buf + 4);
+        if ( header_size > FRAME_MAX_SIZE || block_size > FRAME_MAX_SIZE )
+            throw std::length_error("C-DNS frame too large");
+    }
+
+    boost::asio::generic::stream_protocol::endpoint
+    stream_endpoint(boost::asio::io_service& service, const std::string& address)
+    {
+        if ( address.find('/') != std::string::npos )
+            return boost::asio::local::stream_protocol::endpoint(address);
+
+        std::string::size_type colon = address.rfind(':');
+        if ( colon == std::string::npos || colon == 0 || colon + 1 == address.size() )
+            throw std::invalid_argument("Bad stream address " + address);
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if ( host.size() > 2 && host.front() == '[' && host.back() == ']' )
+            host = host.substr(1, host.size() - 2);
+
+        boost::asio::ip::tcp::resolver resolver(service);
+        boost::asio::ip::tcp::resolver::query query(host, port);
+        return resolver.resolve(query)->endpoint();
+    }
+}
+
+BlockCborSender::BlockCborSender(const std::string& address,
+                                 const std::string& spool_dir,
+                                 std::size_t max_queue,
+                                 std::chrono::seconds retry_period)
+    : address_(address), max_queue_(max_queue), retry_period_(retry_period),
+      socket_(service_), timer_(service_), spooling_(false),
+      spool_size_(0), spool_pos_(0), stop_(false), connected_(false),
+      sent_(0), spooled_(0), dropped_(0)
+{
+    if ( !spool_dir.empty() )
+    {
+        spool_name_ = spool_dir + "/" + SPOOL_FILE_NAME;
+        boost::system::error_code ec;
+        spool_size_ = boost::filesystem::file_size(spool_name_, ec);
+        if ( ec )
+            spool_size_ = 0;
+        if ( spool_size_ > 0 )
+        {
+            LOG_INFO << "Replaying " << spool_size_ << " bytes spooled to " << spool_name_;
+            spooling_ = true;
+            spool_out_.open(spool_name_, std::ios::binary | std::ios::app);
+            spool_in_.open(spool_name_, std::ios::binary);
+            if ( !spool_out_.is_open() || !spool_in_.is_open() )
+                throw std::runtime_error("Can't open spool file " + spool_name_);
+        }
+    }
+
+    thread_ = std::thread(&BlockCborSender::run, this);
+}
+
+BlockCborSender::~BlockCborSender()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if ( thread_.joinable() )
+        thread_.join();
+}
+
+void BlockCborSender::send(const std::shared_ptr<const byte_string>& header, byte_string block)
+{
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    frame->header = header;
+    frame->block = std::move(block);
+
+    // Hold the spool lock so the spool file can't be finished
+    // while this frame is being appended to it.
+    std::lock_guard<std::mutex> spool_lock(spool_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ( !spooling_ && queue_.size() < max_queue_ )
+        {
+            queue_.push_back(frame);
+            cond_.notify_all();
+            return;
+        }
+
+        if ( spool_name_.empty() )
+        {
+            if ( dropped_++ == 0 )
+                LOG_ERROR << "C-DNS stream to " << address_ << " is full, dropping blocks";
+            return;
+        }
+
+        if ( !spooling_ )
+        {
+            LOG_INFO << "C-DNS stream to " << address_ << " spooling to " << spool_name_;
+            spooling_ = true;
+            cond_.notify_all();
+        }
+    }
+    spoolFrame(*frame);
+}
+
+BlockCborSender::Stats BlockCborSender::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats res;
+    res.queued = queue_.size();
+    res.spooled_bytes = spool_size_ - spool_pos_;
+    res.sent = sent_;
+    res.spooled = spooled_;
+    res.dropped = dropped_;
+    res.connected = connected_;
+    return res;
+}
+
+void BlockCborSender::run()
+{
+    set_thread_name("comp:sender");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        cond_.wait(lock, [this]() { return stop_ || spooling_ || !queue_.empty(); });
+
+        // Don't send any more once stopping. Frames not sent are
+        // saved to the spool file for the next sender.
+        if ( stop_ )
+            break;
+
+        // Queued frames are older than those in the spool file.
+        std::shared_ptr<Frame> frame;
+        bool from_spool = queue_.empty();
+        if ( from_spool )
+        {
+            if ( spool_pos_ >= spool_size_ )
+            {
+                lock.unlock();
+                endSpool();
+                lock.lock();
+                continue;
+            }
+
+            std::uintmax_t pos = spool_pos_;
+            lock.unlock();
+            frame = std::make_shared<Frame>();
+            bool read = readSpool(*frame, pos);
+            lock.lock();
+            if ( !read )
+            {
+                LOG_ERROR << "Spool file " << spool_name_ << " is truncated";
+                spool_pos_ = spool_size_;
+                continue;
+            }
+        }
+        else
+            frame = queue_.front();
+
+        lock.unlock();
+        bool ok = ( socket_.is_open() || connect() ) && transmit(*frame);
+        lock.lock();
+
+        connected_ = ok;
+        if ( ok )
+        {
+            if ( from_spool )
+                spool_pos_ += block_cbor::FRAME_PREFIX_SIZE + frame->header->size() + frame->block.size();
+            else
+                queue_.pop_front();
+            ++sent_;
+            continue;
+        }
+
+        boost::system::error_code ec;
+        socket_.close(ec);
+        if ( stop_ )
+            break;
+        cond_.wait_for(lock, retry_period_, [this]() { return stop_; });
+    }
+
+    lock.unlock();
+    saveUnsent();
+}
+
+bool BlockCborSender::connect()
+{
+    try
+    {
+        boost::asio::generic::stream_protocol::endpoint endpoint =
+            block_cbor::stream_endpoint(service_, address_);
+        boost::system::error_code res = boost::asio::error::would_block;
+        socket_.async_connect(endpoint, IoHandler(res, timer_));
+        if ( !complete(res) )
+        {
+            LOG_INFO << "C-DNS stream connected to " << address_;
+            return true;
+        }
+        LOG_ERROR << "C-DNS stream can't connect to " << address_ << ": " << res.message();
+    }
+    catch (const std::exception& err)
+    {
+        LOG_ERROR << "C-DNS stream can't connect to " << address_ << ": " << err.what();
+    }
+
+    boost::system::error_code ec;
+    socket_.close(ec);
+    return false;
+}
+
+bool BlockCborSender::transmit(const Frame& frame)
+{
+    uint8_t prefix[block_cbor::FRAME_PREFIX_SIZE];
+    block_cbor::write_frame_prefix(prefix, frame.header->size(), frame.block.size());
+
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.push_back(boost::asio::buffer(prefix, sizeof(prefix)));
+    buffers.push_back(boost::asio::buffer(frame.header->data(), frame.header->size()));
+    buffers.push_back(boost::asio::buffer(frame.block.data(), frame.block.size()));
+
+    boost::system::error_code res = boost::asio::error::would_block;
+    boost::asio::async_write(socket_, buffers, IoHandler(res, timer_));
+    if ( !complete(res) )
+    {
+        uint8_t ack = 0;
+        res = boost::asio::error::would_block;
+        boost::asio::async_read(socket_, boost::asio::buffer(&ack, 1), IoHandler(res, timer_));
+        if ( !complete(res) )
+        {
+            if ( ack == block_cbor::FRAME_ACK )
+                return true;
+            LOG_ERROR << "C-DNS stream to " << address_ << ": bad acknowledgement";
+            return false;
+        }
+    }
+
+    LOG_ERROR << "C-DNS stream to " << address_ << ": " << res.message();
+    return false;
+}
+
+boost::system::error_code BlockCborSender::complete(boost::system::error_code& res)
+{
+    timer_.expires_from_now(IO_TIMEOUT);
+    timer_.async_wait(
+        [this](const boost::system::error_code& err)
+        {
+            if ( err != boost::asio::error::operation_aborted )
+            {
+                boost::system::error_code ec;
+                socket_.close(ec);
+            }
+        });
+
+    // Run until both the operation and the timer are done.
+    service_.reset();
+    service_.run();
+    return res;
+}
+
+void BlockCborSender::spoolFrame(const Frame& frame)
+{
+    if ( !spool_out_.is_open() )
+    {
+        spool_out_.open(spool_name_, std::ios::binary | std::ios::app);
+        if ( !spool_out_.is_open() )
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++dropped_;
+            LOG_ERROR << "Can't open spool file " << spool_name_;
+            return;
+        }
+    }
+
+    if ( !block_cbor::write_frame(spool_out_, *frame.header, frame.block) )
+    {
+        // Forget any partial frame.
+        spool_out_.clear();
+        boost::system::error_code ec;
+        boost::filesystem::resize_file(spool_name_, spool_size_, ec);
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++dropped_;
+        LOG_ERROR << "Can't write spool file " << spool_name_;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    spool_size_ += block_cbor::FRAME_PREFIX_SIZE + frame.header->size() + frame.block.size();
+    ++spooled_;
+    cond_.notify_all();
+}
+
+bool BlockCborSender::readSpool(Frame& frame, std::uintmax_t pos)
+{
+    if ( !spool_in_.is_open() )
+    {
+        spool_in_.open(spool_name_, std::ios::binary);
+        if ( !spool_in_.is_open() )
+            return false;
+    }
+
+    uint8_t prefix[block_cbor::FRAME_PREFIX_SIZE];
+    std::size_t header_size, block_size;
+    byte_string header;
+
+    spool_in_.clear();
+    spool_in_.seekg(pos);
+    if ( !spool_in_.read(reinterpret_cast<char*>(prefix), sizeof(prefix)) )
+        return false;
+
+    block_cbor::read_frame_prefix(prefix, header_size, block_size);
+    header.resize(header_size);
+    frame.block.resize(block_size);
+    if ( !spool_in_.read(reinterpret_cast<char*>(&header[0]), header_size) ||
+         !spool_in_.read(reinterpret_cast<char*>(&frame.block[0]), block_size) )
+        return false;
+
+    frame.header = std::make_shared<const byte_string>(std::move(header));
+    return true;
+}
+
+void BlockCborSender::endSpool()
+{
+    std::lock_guard<std::mutex> spool_lock(spool_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // A frame may have been spooled while waiting for the lock.
+        if ( spool_pos_ < spool_size_ )
+            return;
+        spool_size_ = spool_pos_ = 0;
+        spooling_ = false;
+    }
+
+    // All spooled frames are sent.
+    spool_in_.close();
+    spool_out_.close();
+    std::remove(spool_name_.c_str());
+}
+
+void BlockCborSender::saveUnsent()
+{
+    std::lock_guard<std::mutex> spool_lock(spool_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if ( queue_.empty() && spool_pos_ == 0 )
+        return;
+
+    if ( spool_name_.empty() )
+    {
+        dropped_ += queue_.size();
+        LOG_ERROR << "C-DNS stream to " << address_ << ": " << queue_.size() << " blocks not sent";
+        queue_.clear();
+        return;
+    }
+
+    std::string tmp_name = spool_name_ + ".tmp";
+    std::ofstream out(tmp_name, std::ios::binary | std::ios::trunc);
+    for ( const auto& frame : queue_ )
+        block_cbor::write_frame(out, *frame->header, frame->block);
+    if ( spool_pos_ < spool_size_ )
+    {
+        if ( !spool_in_.is_open() )
+            spool_in_.open(spool_name_, std::ios::binary);
+        spool_in_.clear();
+        spool_in_.seekg(spool_pos_);
+        out << spool_in_.rdbuf();
+    }
+    out.close();
+    spool_in_.close();
+    spool_out_.close();
+
+    if ( out.fail() || std::rename(tmp_name.c_str(), spool_name_.c_str()) != 0 )
+    {
+        dropped_ += queue_.size();
+        LOG_ERROR << "Can't save unsent blocks to " << spool_name_;
+        std::remove(tmp_name.c_str());
+    }
+    queue_.clear();
+}
+
+void CborSenderEncoder::open(const std::string&, bool)
+{
+    if ( open_ )
+        throw std::runtime_error("Can't open file when one already open.");
+
+    open_ = true;
+    header_.reset();
+    pending_.clear();
+    bytes_written_ = 0;
+}
+
+void CborSenderEncoder::close()
+{
+    if ( !open_ )
+        throw std::runtime_error("Can't close file when not open.");
+
+    // Anything not synced is the end of the file.
+    flush();
+    pending_.clear();
+    open_ = false;
+}
+
+void CborSenderEncoder::sync()
+{
+    flush();
+    if ( pending_.empty() )
+        return;
+
+    if ( !header_ )
+        header_ = std::make_shared<const byte_string>(std::move(pending_));
+    else
+        sender_->send(header_, std::move(pending_));
+    pending_.clear();
+}
+
+void CborSenderEncoder::writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes)
+{
+    if ( !open_ )
+        throw std::runtime_error("Can't write to file when not open.");
+
+    pending_.append(p, n_bytes);
+    bytes_written_ += n_bytes;
+}
@@ -0,0 +1,509 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef BLOCKCBORSENDER_HPP
+#define BLOCKCBORSENDER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "bytestring.hpp"
+#include "cborencoder.hpp"
+
+/**
+ * \brief Functions and constants describing C-DNS block frames.
+ *
+ * A C-DNS stream sends each block of a C-DNS file as a separate frame.
+ * The frame starts with the lengths of the file header and the block
+ * as 32 bit network order values. The file header follows, encoded
+ * exactly as at the start of a C-DNS file and ending with the start
+ * of the indefinite length block array. Finally comes the encoded
+ * block. A file header, the blocks that follow it and a CBOR break
+ * form a standard C-DNS file.
+ *
+ * The receiver acknowledges each frame by sending FRAME_ACK once
+ * it has stored the frame.
+ */
+namespace block_cbor {
+    /**
+     * \brief the size of the frame lengths at the start of a frame.
+     */
+    constexpr std::size_t FRAME_PREFIX_SIZE = 8;
+
+    /**
+     * \brief the byte sent to acknowledge a frame.
+     */
+    constexpr uint8_t FRAME_ACK = 0x06;
+
+    /**
+     * \brief the largest header or block accepted in a frame.
+     */
+    constexpr std::size_t FRAME_MAX_SIZE = 0x7fffffff;
+
+    /**
+     * \brief Encode the frame lengths.
+     *
+     * \param buf         buffer of at least FRAME_PREFIX_SIZE bytes.
+     * \param header_size the size of the file header.
+     * \param block_size  the size of the block.
+     * \throws std::length_error if a size is larger than FRAME_MAX_SIZE.
+     */
+    void write_frame_prefix(uint8_t* buf, std::size_t header_size, std::size_t block_size);
+
+    /**
+     * \brief Decode the frame lengths.
+     *
+     * \param buf         buffer of at least FRAME_PREFIX_SIZE bytes.
+     * \param header_size the size of the file header.
+     * \param block_size  the size of the block.
+     * \throws std::length_error if a size is larger than FRAME_MAX_SIZE.
+     */
+    void read_frame_prefix(const uint8_t* buf, std::size_t& header_size, std::size_t& block_size);
+
+    /**
+     * \brief Write a frame to a stream.
+     *
+     * \param os     the stream.
+     * \param header the C-DNS file header.
+     * \param block  the encoded block.
+     * \returns `true` if the frame was written.
+     * \throws std::length_error if the header or block is too large.
+     */
+    bool write_frame(std::ostream& os, const byte_string& header, const byte_string& block);
+
+    /**
+     * \brief Find the socket endpoint for a stream address.
+     *
+     * An address containing a `/` is the path of a Unix socket.
+     * Otherwise it is a TCP address in the form `host:port`; an
+     * IPv6 host address may be enclosed in `[]`.
+     *
+     * \param service the IO service to use for name lookups.
+     * \param address the address.
+     * \returns the endpoint.
+     * \throws std::invalid_argument if the address is not valid.
+     * \throws boost::system::system_error if a host name can't be found.
+     */
+    boost::asio::generic::stream_protocol::endpoint
+    stream_endpoint(boost::asio::io_service& service, const std::string& address);
+}
+
+/**
+ * \class BlockCborSender
+ * \brief Send C-DNS block frames to a stream receiver.
+ *
+ * Frames are queued and sent in order by a sender thread, which
+ * waits for each frame to be acknowledged before sending the next.
+ * If the receiver can't be reached, the thread tries again after a
+ * retry period.
+ *
+ * If the queue is full, because the receiver is not reachable or is
+ * not keeping up, further frames are appended to a spool file. The
+ * queue is sent first, followed by the spool file, after which
+ * frames are queued again. The spool file is written by the thread
+ * sending the frame, but not while holding the lock shared with the
+ * sender thread. When the sender is destroyed, the frame being sent
+ * is finished, and frames waiting are saved to the spool file, to
+ * be sent when a sender next uses the spool directory. Without a
+ * spool directory, frames that don't fit in the queue are dropped.
+ *
+ * A frame interrupted by a lost connection is sent again, so the
+ * receiver may receive a frame more than once.
+ */
+class BlockCborSender
+{
+public:
+    /**
+     * \brief Sender statistics.
+     */
+    struct Stats
+    {
+        /**
+         * \brief frames waiting in the queue.
+         */
+        std::size_t queued;
+
+        /**
+         * \brief bytes of frames waiting in the spool file.
+         */
+        std::uintmax_t spooled_bytes;
+
+        /**
+         * \brief frames sent and acknowledged.
+         */
+        uint64_t sent;
+
+        /**
+         * \brief frames written to the spool file.
+         */
+        uint64_t spooled;
+
+        /**
+         * \brief frames dropped.
+         */
+        uint64_t dropped;
+
+        /**
+         * \brief `true` if connected to the receiver.
+         */
+        bool connected;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * \param address      the receiver address; see block_cbor::stream_endpoint().
+     * \param spool_dir    directory for the spool file, or empty for no spool.
+     * \param max_queue    the maximum number of frames to queue.
+     * \param retry_period the time to wait before trying the receiver again.
+     * \throws std::runtime_error if the spool file can't be opened.
+     */
+    BlockCborSender(const std::string& address,
+                    const std::string& spool_dir,
+                    std::size_t max_queue,
+                    std::chrono::seconds retry_period = std::chrono::seconds(5));
+
+    /**
+     * \brief Destructor.
+     *
+     * Finish sending any frame being sent, and spool the rest.
+     */
+    ~BlockCborSender();
+
+    /**
+     * \brief Send a frame.
+     *
+     * This does not wait for the frame to be sent.
+     *
+     * \param header the C-DNS file header.
+     * \param block  the encoded block.
+     */
+    void send(const std::shared_ptr<const byte_string>& header, byte_string block);
+
+    /**
+     * \brief Return current statistics.
+     */
+    Stats stats() const;
+
+private:
+    /**
+     * \brief A frame waiting to be sent.
+     */
+    struct Frame
+    {
+        /**
+         * \brief the C-DNS file header.
+         */
+        std::shared_ptr<const byte_string> header;
+
+        /**
+         * \brief the encoded block.
+         */
+        byte_string block;
+    };
+
+    /**
+     * \brief The sender thread.
+     */
+    void run();
+
+    /**
+     * \brief Connect to the receiver.
+     *
+     * \returns `true` if connected.
+     */
+    bool connect();
+
+    /**
+     * \brief Send a frame and wait for acknowledgement.
+     *
+     * \param frame the frame.
+     * \returns `true` if the frame was acknowledged.
+     */
+    bool transmit(const Frame& frame);
+
+    /**
+     * \brief Wait for an IO operation on the socket to complete.
+     *
+     * The socket is closed if the operation times out.
+     *
+     * \param res the result of the operation, set on completion.
+     * \returns the result of the operation.
+     */
+    boost::system::error_code complete(boost::system::error_code& res);
+
+    /**
+     * \brief Append a frame to the spool file.
+     *
+     * Call with the spool lock held, and without the lock.
+     *
+     * \param frame the frame.
+     */
+    void spoolFrame(const Frame& frame);
+
+    /**
+     * \brief Read a frame from the spool file.
+     *
+     * Call from the sender thread, without the lock.
+     *
+     * \param frame the frame read.
+     * \param pos   the position of the frame in the spool file.
+     * \returns `true` if a frame was read.
+     */
+    bool readSpool(Frame& frame, std::uintmax_t pos);
+
+    /**
+     * \brief Remove the spool file and stop spooling, if all
+     * spooled frames have been sent.
+     *
+     * Call from the sender thread, without either lock.
+     */
+    void endSpool();
+
+    /**
+     * \brief Save unsent frames to the spool file.
+     *
+     * The queued frames are older than the unsent part of the
+     * spool file, so write a new spool file with the queue first.
+     * Call from the sender thread, without either lock.
+     */
+    void saveUnsent();
+
+    /**
+     * \brief the receiver address.
+     */
+    std::string address_;
+
+    /**
+     * \brief the spool file name, or empty if no spool.
+     */
+    std::string spool_name_;
+
+    /**
+     * \brief the maximum number of frames to queue.
+     */
+    std::size_t max_queue_;
+
+    /**
+     * \brief the time to wait before trying the receiver again.
+     */
+    std::chrono::seconds retry_period_;
+
+    /**
+     * \brief the IO service for the socket.
+     */
+    boost::asio::io_service service_;
+
+    /**
+     * \brief the socket connected to the receiver.
+     */
+    boost::asio::generic::stream_protocol::socket socket_;
+
+    /**
+     * \brief timer for IO operations.
+     */
+    boost::asio::deadline_timer timer_;
+
+    /**
+     * \brief lock for state shared with the sender thread.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * \brief signal changes to shared state.
+     */
+    std::condition_variable cond_;
+
+    /**
+     * \brief lock for appending to the spool file, and for ending
+     * or replacing it. Take before the lock if both are needed.
+     */
+    std::mutex spool_mutex_;
+
+    /**
+     * \brief frames waiting to be sent.
+     */
+    std::deque<std::shared_ptr<Frame>> queue_;
+
+    /**
+     * \brief `true` if new frames are going to the spool file.
+     */
+    bool spooling_;
+
+    /**
+     * \brief stream appending to the spool file. Guarded by the spool lock.
+     */
+    std::ofstream spool_out_;
+
+    /**
+     * \brief stream reading from the spool file. Only used by the
+     * sender thread.
+     */
+    std::ifstream spool_in_;
+
+    /**
+     * \brief size of the spool file. Only changed with both locks held.
+     */
+    std::uintmax_t spool_size_;
+
+    /**
+     * \brief position of the next unsent frame in the spool file.
+     */
+    std::uintmax_t spool_pos_;
+
+    /**
+     * \brief `true` if the sender is stopping.
+     */
+    bool stop_;
+
+    /**
+     * \brief `true` if connected to the receiver.
+     */
+    bool connected_;
+
+    /**
+     * \brief frames sent and acknowledged.
+     */
+    uint64_t sent_;
+
+    /**
+     * \brief frames written to the spool file.
+     */
+    uint64_t spooled_;
+
+    /**
+     * \brief frames dropped.
+     */
+    uint64_t dropped_;
+
+    /**
+     * \brief the sender thread.
+     */
+    std::thread thread_;
+};
+
+/**
+ * \class CborSenderEncoder
+ * \brief Send encoder output to a BlockCborSender.
+ *
+ * The output of a C-DNS writer is divided into frames at each
+ * sync(). The first output synced after opening is the file header,
+ * and each later sync() is a block. BlockCborWriter syncs after
+ * writing the file header and each block. The CBOR break at the end
+ * of the file is not sent.
+ */
+class CborSenderEncoder : public CborBaseStreamFileEncoder
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param sender the sender.
+     */
+    explicit CborSenderEncoder(std::shared_ptr<BlockCborSender> sender)
+        : sender_(sender), open_(false), bytes_written_(0) {}
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~CborSenderEncoder() {}
+
+    /**
+     * \brief Start a new C-DNS file.
+     *
+     * \param name    the output name. Unused.
+     * \param logging unused.
+     */
+    virtual void open(const std::string& name, bool logging = false);
+
+    /**
+     * \brief End the current C-DNS file.
+     */
+    virtual void close();
+
+    /**
+     * \brief Returns `true` if a file is open.
+     */
+    virtual bool is_open() const
+    {
+        return open_;
+    }
+
+    /**
+     * \brief Return additional extension suggested for output file type.
+     */
+    virtual const char* suggested_extension()
+    {
+        return "";
+    }
+
+    /**
+     * \brief Count of the bytes written since opening.
+     */
+    virtual std::uintmax_t bytes_written()
+    {
+        return bytes_written_;
+    }
+
+    /**
+     * \brief Send the output since the last sync.
+     */
+    virtual void sync();
+
+protected:
+    /**
+     * \brief Accumulate output until the next sync.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes number of bytes in the buffer.
+     */
+    virtual void writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes);
+
+private:
+    /**
+     * \brief the sender.
+     */
+    std::shared_ptr<BlockCborSender> sender_;
+
+    /**
+     * \brief the file header, if written.
+     */
+    std::shared_ptr<const byte_string> header_;
+
+    /**
+     * \brief output since the last sync.
+     */
+    byte_string pending_;
+
+    /**
+     * \brief `true` if a file is open.
+     */
+    bool open_;
+
+    /**
+     * \brief count of bytes written since opening.
+     */
+    std::uintmax_t bytes_written_;
+};
+
+#endif
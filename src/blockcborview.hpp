@@ -0,0 +1,389 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef BLOCKCBORVIEW_HPP
+#define BLOCKCBORVIEW_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "blockcbordata.hpp"
+#include "packetstatistics.hpp"
+
+namespace block_cbor {
+
+    /**
+     * \class Span
+     * \brief A read-only view of a contiguous array of block records.
+     *
+     * The view does not own the records, and is only valid while
+     * the block it came from is unchanged.
+     */
+    template<typename T>
+    class Span
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param items the records to view.
+         */
+        explicit Span(const std::vector<T>& items)
+            : data_(items.data()), size_(items.size()) {}
+
+        /**
+         * \brief Return the number of records.
+         */
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        /**
+         * \brief Return `true` if there are no records.
+         */
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        /**
+         * \brief Return a record.
+         *
+         * \param pos the position of the record. This is not checked.
+         */
+        const T& operator[](std::size_t pos) const
+        {
+            return data_[pos];
+        }
+
+        /**
+         * \brief Return a pointer to the first record.
+         */
+        const T* begin() const
+        {
+            return data_;
+        }
+
+        /**
+         * \brief Return a pointer after the last record.
+         */
+        const T* end() const
+        {
+            return data_ + size_;
+        }
+
+    private:
+        /**
+         * \brief the first record.
+         */
+        const T* data_;
+
+        /**
+         * \brief the number of records.
+         */
+        std::size_t size_;
+    };
+
+    /**
+     * \class TableSpan
+     * \brief A read-only view of a block header table.
+     *
+     * Entries can be read by position, from 0 to `size() - 1`, or
+     * by the table reference held in a record. References start at 1
+     * in pre-format 1.0 files, and at 0 otherwise.
+     *
+     * The view does not own the table, and is only valid while
+     * the block it came from is unchanged.
+     */
+    template<typename T, typename K = T>
+    class TableSpan
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param table the table to view.
+         */
+        explicit TableSpan(const HeaderList<T, K>& table)
+            : table_(table) {}
+
+        /**
+         * \brief Return the number of table entries.
+         */
+        std::size_t size() const
+        {
+            return table_.size();
+        }
+
+        /**
+         * \brief Return `true` if the table is empty.
+         */
+        bool empty() const
+        {
+            return table_.size() == 0;
+        }
+
+        /**
+         * \brief Return the entry at a position.
+         *
+         * \param pos the position of the entry.
+         * \throws std::out_of_range if the position is out of range.
+         */
+        const T& operator[](std::size_t pos) const
+        {
+            return table_.at(pos);
+        }
+
+        /**
+         * \brief Return the entry for a table reference from a record.
+         *
+         * \param ref the table reference.
+         * \throws std::out_of_range if the reference is not set.
+         * \throws cbor_file_format_error if the reference is out of range.
+         */
+        const T& get(const index_t& ref) const
+        {
+            if ( !ref )
+                throw std::out_of_range("Block table reference not set");
+            return table_[ref];
+        }
+
+    private:
+        /**
+         * \brief the table.
+         */
+        const HeaderList<T, K>& table_;
+    };
+
+    /**
+     * \class BlockView
+     * \brief A read-only view of a decoded block.
+     *
+     * The records and header tables of the block are accessed directly,
+     * without constructing an object for each record. Records refer to
+     * table entries by table reference; use TableSpan::get() to look
+     * them up.
+     *
+     * The view is only valid until the next block is read.
+     */
+    class BlockView
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param block            the block.
+         * \param block_parameters the block parameters of the block.
+         */
+        BlockView(const BlockData& block, const BlockParameters& block_parameters)
+            : block_(block), block_parameters_(block_parameters) {}
+
+        /**
+         * \brief Return the block parameters of the block.
+         */
+        const BlockParameters& block_parameters() const
+        {
+            return block_parameters_;
+        }
+
+        /**
+         * \brief Return the earliest time of any record in the block.
+         */
+        const std::chrono::system_clock::time_point& earliest_time() const
+        {
+            return block_.earliest_time;
+        }
+
+        /**
+         * \brief Return the start time of the period covered by the block, if known.
+         */
+        const boost::optional<std::chrono::system_clock::time_point>& start_time() const
+        {
+            return block_.start_time;
+        }
+
+        /**
+         * \brief Return the end time of the period covered by the block, if known.
+         */
+        const boost::optional<std::chrono::system_clock::time_point>& end_time() const
+        {
+            return block_.end_time;
+        }
+
+        /**
+         * \brief Return the Q/R records.
+         */
+        Span<QueryResponseItem> query_response_items() const
+        {
+            return Span<QueryResponseItem>(block_.query_response_items);
+        }
+
+        /**
+         * \brief Return the malformed message records.
+         */
+        Span<MalformedMessageItem> malformed_messages() const
+        {
+            return Span<MalformedMessageItem>(block_.malformed_messages);
+        }
+
+        /**
+         * \brief Return the IP address table.
+         */
+        TableSpan<ByteStringItem, byte_string> ip_addresses() const
+        {
+            return TableSpan<ByteStringItem, byte_string>(block_.ip_addresses);
+        }
+
+        /**
+         * \brief Return the CLASS/TYPE table.
+         */
+        TableSpan<ClassType> class_types() const
+        {
+            return TableSpan<ClassType>(block_.class_types);
+        }
+
+        /**
+         * \brief Return the Question table.
+         */
+        TableSpan<Question> questions() const
+        {
+            return TableSpan<Question>(block_.questions);
+        }
+
+        /**
+         * \brief Return the Resource Record table.
+         */
+        TableSpan<ResourceRecord> resource_records() const
+        {
+            return TableSpan<ResourceRecord>(block_.resource_records);
+        }
+
+        /**
+         * \brief Return the NAME and RDATA table.
+         */
+        TableSpan<ByteStringItem, byte_string> names_rdatas() const
+        {
+            return TableSpan<ByteStringItem, byte_string>(block_.names_rdatas);
+        }
+
+        /**
+         * \brief Return the Q/R signature table.
+         */
+        TableSpan<QueryResponseSignature> query_response_signatures() const
+        {
+            return TableSpan<QueryResponseSignature>(block_.query_response_signatures);
+        }
+
+        /**
+         * \brief Return the Question list table.
+         */
+        TableSpan<IndexVectorItem, std::vector<index_t>> questions_lists() const
+        {
+            return TableSpan<IndexVectorItem, std::vector<index_t>>(block_.questions_lists);
+        }
+
+        /**
+         * \brief Return the Resource Record list table.
+         */
+        TableSpan<IndexVectorItem, std::vector<index_t>> rrs_lists() const
+        {
+            return TableSpan<IndexVectorItem, std::vector<index_t>>(block_.rrs_lists);
+        }
+
+        /**
+         * \brief Return the malformed message data table.
+         */
+        TableSpan<MalformedMessageData> malformed_message_data() const
+        {
+            return TableSpan<MalformedMessageData>(block_.malformed_message_data);
+        }
+
+        /**
+         * \brief Return the block distinct client sketch, if present.
+         */
+        const boost::optional<HyperLogLog>& client_sketch() const
+        {
+            return block_.client_sketch;
+        }
+
+        /**
+         * \brief Return the block query name sketch, if present.
+         */
+        const boost::optional<HeavyHitters>& qname_sketch() const
+        {
+            return block_.qname_sketch;
+        }
+
+    private:
+        /**
+         * \brief the block.
+         */
+        const BlockData& block_;
+
+        /**
+         * \brief the block parameters of the block.
+         */
+        const BlockParameters& block_parameters_;
+    };
+
+    /**
+     * \class BlockVisitor
+     * \brief Receive the contents of each block read.
+     *
+     * Override the methods for the block contents of interest. For
+     * each block, block() is called first, then address_event() for
+     * each address event count, and finally statistics().
+     */
+    class BlockVisitor
+    {
+    public:
+        /**
+         * \brief Destructor.
+         */
+        virtual ~BlockVisitor() {}
+
+        /**
+         * \brief Receive a block.
+         *
+         * \param block the block.
+         */
+        virtual void block(const BlockView& block) {}
+
+        /**
+         * \brief Receive an address event count from the current block.
+         *
+         * \param event the address event. Its address is a reference
+         *              to the block IP address table.
+         * \param count the number of times the event occurred.
+         * \param block the block.
+         */
+        virtual void address_event(const AddressEventItem& event,
+                                   unsigned count,
+                                   const BlockView& block) {}
+
+        /**
+         * \brief Receive the packet statistics of the current block.
+         *
+         * \param stats the statistics for the period covered by the block.
+         * \param block the block.
+         */
+        virtual void statistics(const PacketStatistics& stats,
+                                const BlockView& block) {}
+    };
+}
+
+#endif
@@ -10,8 +10,12 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <chrono>
 #include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <limits.h>
 #include <unistd.h>
@@ -26,6 +30,8 @@
 #include "blockcbordata.hpp"
 #include "blockcborwriter.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
+#include "perfcounters.hpp"
 
 namespace {
     byte_string addr_to_string(const IPAddress& addr, const Configuration& config, bool is_client = true)
@@ -41,6 +47,30 @@ namespace {
             res[prefix_nbytes - 1] &= 0xff << (prefix_nbytes * 8 - prefix_len);
         return res;
     }
+
+    /**
+     * \brief Compare block parameters as written to the file header.
+     *
+     * \param a first block parameters.
+     * \param b second block parameters.
+     * \returns <code>true</code> if both encode identically.
+     */
+    bool same_block_parameters(block_cbor::BlockParameters& a,
+                               block_cbor::BlockParameters& b)
+    {
+        byte_string a_cbor, b_cbor;
+        {
+            ByteStringCborEncoder enc(a_cbor);
+            a.writeCbor(enc);
+            enc.flush();
+        }
+        {
+            ByteStringCborEncoder enc(b_cbor);
+            b.writeCbor(enc);
+            enc.flush();
+        }
+        return a_cbor == b_cbor;
+    }
 }
 
 BlockCborWriter::BlockCborWriter(const Configuration& config,
@@ -52,7 +82,8 @@ BlockCborWriter::BlockCborWriter(const Configuration& config,
       enc_(std::move(enc)),
       live_(live),
       query_response_(), ext_rr_(nullptr), ext_group_(nullptr),
-      last_end_block_statistics_(), need_start_block_stats_(true)
+      last_end_block_statistics_(), need_start_block_stats_(true),
+      block_latency_(nullptr), perf_(nullptr)
 {
     block_cbor::BlockParameters bp;
     config.populate_block_parameters(bp);
@@ -61,6 +92,7 @@ BlockCborWriter::BlockCborWriter(const Configuration& config,
     data_ = make_unique<block_cbor::BlockData>(block_parameters_);
     if ( live_ )
         data_->start_time = std::chrono::system_clock::now();
+    set_rewriter();
 }
 
 BlockCborWriter::~BlockCborWriter()
@@ -80,23 +112,109 @@ void BlockCborWriter::close()
     }
 }
 
+void BlockCborWriter::set_configuration(std::shared_ptr<const Configuration> config)
+{
+    block_cbor::BlockParameters bp;
+    config->populate_block_parameters(bp);
+
+    if ( config->output_pattern == config_->output_pattern &&
+         config->rotation_period == config_->rotation_period &&
+         same_block_parameters(bp, block_parameters_[0]) )
+    {
+        // Nothing in the file header or file naming has changed.
+        // Carry on with the current file and block.
+        BaseOutputWriter::set_configuration(config);
+        set_rewriter();
+        return;
+    }
+
+    close();
+    BaseOutputWriter::set_configuration(config);
+
+    output_pattern_ = RotatingFileName(config->output_pattern + enc_->suggested_extension(),
+                                       std::chrono::seconds(config->rotation_period));
+
+    block_parameters_.clear();
+    block_parameters_.push_back(bp);
+
+    data_ = make_unique<block_cbor::BlockData>(block_parameters_);
+    if ( live_ )
+        data_->start_time = std::chrono::system_clock::now();
+    qname_counts_.clear();
+    set_rewriter();
+}
+
 void BlockCborWriter::writeAE(const std::shared_ptr<AddressEvent>& ae,
                               const PacketStatistics& stats)
 {
-    if ( !config_.exclude_hints.address_events )
+    if ( !config_->exclude_hints.address_events )
         data_->count_address_event(ae->type(),
                                    ae->code(),
-                                   addr_to_string(ae->address(), config_),
+                                   addr_to_string(ae->address(), *config_),
                                    ae->address().is_ipv6());
     updateBlockStats(stats);
 }
 
+void BlockCborWriter::writeMM(const std::shared_ptr<MalformedMessage>& mm,
+                              const PacketStatistics& stats)
+{
+    const HintsExcluded& exclude = config_->exclude_hints;
+
+    if ( exclude.malformed_messages )
+    {
+        updateBlockStats(stats);
+        return;
+    }
+
+    checkForRotation(mm->timestamp(), false);
+    if ( data_->is_full() )
+    {
+        data_->end_time = mm->timestamp();
+        writeBlock();
+        data_->start_time = mm->timestamp();
+    }
+    updateBlockStats(stats);
+
+    if ( ( data_->query_response_items.empty() && data_->malformed_messages.empty() ) ||
+         mm->timestamp() < data_->earliest_time )
+        data_->earliest_time = mm->timestamp();
+
+    if ( config_->start_end_times_from_data )
+    {
+        if ( !data_->end_time || mm->timestamp() > *(data_->end_time) )
+            data_->end_time = mm->timestamp();
+        if ( !data_->start_time || mm->timestamp() < *(data_->start_time) )
+            data_->start_time = mm->timestamp();
+    }
+
+    // Identical messages to and from the same server share
+    // message data, so repeated junk payloads are stored once.
+    block_cbor::MalformedMessageData mmd;
+    if ( !exclude.server_address )
+        mmd.server_address = data_->add_address(addr_to_string(mm->server_address(), *config_, false));
+    if ( !exclude.server_port )
+        mmd.server_port = mm->server_port();
+    if ( !exclude.transport )
+        mmd.mm_transport_flags = block_cbor::transport_flags(*mm);
+    mmd.mm_payload = mm->payload();
+
+    block_cbor::MalformedMessageItem mmi;
+    if ( !exclude.timestamp )
+        mmi.tstamp = mm->timestamp();
+    if ( !exclude.client_address )
+        mmi.client_address = data_->add_address(addr_to_string(mm->client_address(), *config_));
+    if ( !exclude.client_port )
+        mmi.client_port = mm->client_port();
+    mmi.message_data = data_->add_malformed_message_data(mmd);
+    data_->malformed_messages.push_back(std::move(mmi));
+}
+
 void BlockCborWriter::checkForRotation(const std::chrono::system_clock::time_point& timestamp, bool force)
 {
     if ( !enc_->is_open() ||
-         ( config_.max_output_size.size > 0 &&
-           enc_->bytes_written() >= config_.max_output_size.size ) ||
-           output_pattern_.need_rotate(timestamp, config_) ||
+         ( config_->max_output_size.size > 0 &&
+           enc_->bytes_written() >= config_->max_output_size.size ) ||
+           output_pattern_.need_rotate(timestamp, *config_) ||
            force )
     {
         if ( enc_->is_open() )
@@ -105,10 +223,11 @@ void BlockCborWriter::checkForRotation(const std::chrono::system_clock::time_poi
             close();
             data_->start_time = timestamp;
         }
-        filename_ = output_pattern_.filename(timestamp, config_);
+        filename_ = output_pattern_.filename(timestamp, *config_);
         LOG_INFO << "Rotating C_DNS file to " << filename_;
-        enc_->open(filename_, config_.log_file_handling);
+        enc_->open(filename_, config_->log_file_handling);
         writeFileHeader();
+        enc_->sync();
     }
 }
 
@@ -137,17 +256,17 @@ void BlockCborWriter::writeBasic(const std::shared_ptr<QueryResponse>& qr,
     const DNSMessage &d(qr->has_query() ? qr->query() : qr->response());
     block_cbor::QueryResponseItem& qri = query_response_;
     block_cbor::QueryResponseSignature qs;
-    const HintsExcluded& exclude = config_.exclude_hints;
+    const HintsExcluded& exclude = config_->exclude_hints;
 
     qri.qr_flags = 0;
 
     updateBlockStats(stats);
 
-    if ( data_->query_response_items.size() == 0 ||
+    if ( ( data_->query_response_items.empty() && data_->malformed_messages.empty() ) ||
          d.timestamp < data_->earliest_time )
         data_->earliest_time = d.timestamp;
 
-    if ( config_.start_end_times_from_data )
+    if ( config_->start_end_times_from_data )
     {
         if ( !data_->end_time || d.timestamp > *(data_->end_time) )
             data_->end_time = d.timestamp;
@@ -157,7 +276,7 @@ void BlockCborWriter::writeBasic(const std::shared_ptr<QueryResponse>& qr,
 
     // Basic query signature info.
     if ( !exclude.server_address && d.serverIP)
-        qs.server_address = data_->add_address(addr_to_string(*d.serverIP, config_, false));
+        qs.server_address = data_->add_address(addr_to_string(*d.serverIP, *config_, false));
     if ( !exclude.server_port && d.serverPort)
         qs.server_port = *d.serverPort;
     if ( !exclude.transport )
@@ -171,7 +290,16 @@ void BlockCborWriter::writeBasic(const std::shared_ptr<QueryResponse>& qr,
     if ( !exclude.timestamp )
         qri.tstamp = d.timestamp;
     if ( !exclude.client_address && d.clientIP )
-        qri.client_address = data_->add_address(addr_to_string(*d.clientIP, config_));
+    {
+        byte_string addr = addr_to_string(*d.clientIP, *config_);
+        if ( config_->block_sketches )
+        {
+            if ( !data_->client_sketch )
+                data_->client_sketch = HyperLogLog();
+            data_->client_sketch->add(addr);
+        }
+        qri.client_address = data_->add_address(addr);
+    }
     if ( !exclude.client_port && d.clientPort )
         qri.client_port = *d.clientPort;
     if ( !exclude.transaction_id )
@@ -192,7 +320,15 @@ void BlockCborWriter::writeBasic(const std::shared_ptr<QueryResponse>& qr,
         if ( !exclude.query_class_type )
             qs.query_classtype = data_->add_classtype(ct);
         if ( !exclude.query_name )
+        {
             qri.qname = data_->add_name_rdata(query.dname());
+            if ( config_->block_sketches )
+            {
+                if ( *qri.qname >= qname_counts_.size() )
+                    qname_counts_.resize(*qri.qname + 1);
+                ++qname_counts_[*qri.qname];
+            }
+        }
     }
 
     if ( qr->has_query() )
@@ -302,11 +438,11 @@ void BlockCborWriter::writeQuestionRecord(const CaptureDNS::query& question)
     block_cbor::ClassType ct;
     block_cbor::Question q;
 
-    if ( !config_.exclude_hints.query_name )
+    if ( !config_->exclude_hints.query_name )
         q.qname = data_->add_name_rdata(question.dname());
     ct.qtype = question.query_type();
     ct.qclass = question.query_class();
-    if ( !config_.exclude_hints.query_class_type )
+    if ( !config_->exclude_hints.query_class_type )
         q.classtype = data_->add_classtype(ct);
     extra_questions_.push_back(data_->add_question(q));
 }
@@ -325,15 +461,15 @@ void BlockCborWriter::writeResourceRecord(const CaptureDNS::resource& resource)
     block_cbor::ClassType ct;
     block_cbor::ResourceRecord rr;
 
-    if ( !config_.exclude_hints.query_name )
+    if ( !config_->exclude_hints.query_name )
         rr.name = data_->add_name_rdata(resource.dname());
     ct.qtype = resource.query_type();
     ct.qclass = resource.query_class();
-    if ( !config_.exclude_hints.query_class_type )
+    if ( !config_->exclude_hints.query_class_type )
         rr.classtype = data_->add_classtype(ct);
-    if ( !config_.exclude_hints.rr_ttl )
+    if ( !config_->exclude_hints.rr_ttl )
         rr.ttl = resource.ttl();
-    if ( !config_.exclude_hints.rr_rdata )
+    if ( !config_->exclude_hints.rr_rdata )
         rr.rdata = data_->add_name_rdata(resource.data());
     ext_rr_->push_back(data_->add_resource_record(rr));
 }
@@ -378,7 +514,9 @@ void BlockCborWriter::writeBlockParameters()
 {
     block_cbor::BlockParameters block_parameters;
 
-    config_.populate_block_parameters(block_parameters);
+    config_->populate_block_parameters(block_parameters);
+    if ( rewriter_ )
+        rewriter_->rewriteBlockParameters(block_parameters);
 
     // Currently we only write one block parameter item.
     enc_->writeArrayHeader(1);
@@ -392,12 +530,89 @@ void BlockCborWriter::writeFileFooter()
 
 void BlockCborWriter::writeBlock()
 {
+    std::chrono::steady_clock::time_point block_start;
+    if ( block_latency_ )
+        block_start = std::chrono::steady_clock::now();
     data_->last_packet_statistics = last_end_block_statistics_;
-    data_->writeCbor(*enc_);
+    bool has_items = !data_->query_response_items.empty();
+    if ( !qname_counts_.empty() )
+        summariseQueryNames();
+    {
+        PerfStageScope encode(perf_, PerfCounters::ENCODE);
+        if ( rewriter_ )
+        {
+            // Pseudo-anonymise each table entry once per block,
+            // rather than each time a record refers to it.
+            block_cbor::BlockData anon(block_parameters_);
+            rewriter_->rewriteBlock(*data_, anon, block_parameters_[0]);
+            anon.writeCbor(*enc_);
+        }
+        else
+            data_->writeCbor(*enc_);
+    }
+    // Make each complete block visible to readers following the file.
+    enc_->sync();
+    if ( block_latency_ && has_items )
+        block_latency_->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - block_start));
     data_->clear();
+    qname_counts_.clear();
     need_start_block_stats_ = true;
 }
 
+void BlockCborWriter::set_rewriter()
+{
+    rewriter_ = boost::none;
+    if ( config_->pseudo_anon )
+        rewriter_ = BlockCborRewriter(block_parameters_[0].storage_parameters.storage_hints,
+                                      config_->pseudo_anon);
+}
+
+void BlockCborWriter::summariseQueryNames()
+{
+    // Names differing only in case are the same name. Label lengths
+    // are below 64, so are not changed.
+    std::unordered_map<byte_string, uint64_t, boost::hash<byte_string>> counts;
+    for ( std::size_t i = 0; i < qname_counts_.size(); ++i )
+    {
+        if ( qname_counts_[i] == 0 )
+            continue;
+        byte_string name = data_->names_rdatas.at(i).str;
+        for ( auto& c : name )
+            if ( c >= 'A' && c <= 'Z' )
+                c += 'a' - 'A';
+        counts[name] += qname_counts_[i];
+    }
+
+    std::vector<std::pair<uint64_t, const byte_string*>> sorted;
+    sorted.reserve(counts.size());
+    for ( const auto& c : counts )
+        sorted.emplace_back(c.second, &c.first);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<uint64_t, const byte_string*>& a,
+                 const std::pair<uint64_t, const byte_string*>& b)
+              {
+                  if ( a.first != b.first )
+                      return a.first > b.first;
+                  return *a.second < *b.second;
+              });
+
+    // Counts are exact, so the names kept have no error, and any
+    // other name occurred no more often than the least frequent kept.
+    HeavyHitters sketch(config_->block_sketch_qnames);
+    uint64_t untracked = 0;
+    for ( std::size_t i = 0; i < sorted.size(); ++i )
+    {
+        if ( i < sketch.capacity() )
+            sketch.add(*sorted[i].second, sorted[i].first);
+        else
+            untracked += sorted[i].first;
+    }
+    if ( sorted.size() > sketch.capacity() )
+        sketch.add_untracked(untracked, sorted[sketch.capacity()].first);
+    data_->qname_sketch = std::move(sketch);
+}
+
 void BlockCborWriter::updateBlockStats(const PacketStatistics& stats)
 {
     if ( need_start_block_stats_ )
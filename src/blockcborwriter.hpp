@@ -16,12 +16,19 @@
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <vector>
+
+#include <boost/optional.hpp>
 
 #include "baseoutputwriter.hpp"
 #include "cborencoder.hpp"
 #include "blockcbordata.hpp"
+#include "blockcborrewriter.hpp"
 #include "packetstatistics.hpp"
 
+class LatencyHistogram;
+class PerfCounters;
+
 /**
  * \class BlockCborWriter
  * \brief Write CBOR output in a space-efficient block format.
@@ -61,6 +68,50 @@ public:
      */
     void close();
 
+    /**
+     * \brief Replace the output configuration.
+     *
+     * The configuration is recorded in the file header. If the
+     * block parameters, output pattern or rotation period change,
+     * any open file is closed and the next item written starts a
+     * new file. Otherwise the current file and block continue
+     * under the new configuration.
+     *
+     * \param config the new configuration.
+     */
+    virtual void set_configuration(std::shared_ptr<const Configuration> config);
+
+    /**
+     * \brief Record block latencies.
+     *
+     * When a block is written, record the time from the block being
+     * handed to the encoder to it being written.
+     *
+     * \param latency the histogram to record to, or `nullptr` to stop recording.
+     */
+    void set_block_latency(LatencyHistogram* latency)
+    {
+        block_latency_ = latency;
+    }
+
+    /**
+     * \brief Count hardware events while encoding blocks.
+     *
+     * \param perf the counters, or `nullptr` to stop counting.
+     */
+    void set_perf_counters(PerfCounters* perf)
+    {
+        perf_ = perf;
+    }
+
+    /**
+     * \brief Return the number of query/responses in the current block.
+     */
+    std::size_t block_items() const
+    {
+        return data_->query_response_items.size();
+    }
+
     /**
      * \brief Write out a single address event.
      *
@@ -70,6 +121,15 @@ public:
     virtual void writeAE(const std::shared_ptr<AddressEvent>& ae,
                          const PacketStatistics& stats);
 
+    /**
+     * \brief Write out a single malformed message.
+     *
+     * \param mm        malformed message to write.
+     * \param stats     statistics at time of message.
+     */
+    virtual void writeMM(const std::shared_ptr<MalformedMessage>& mm,
+                         const PacketStatistics& stats);
+
     /**
      * \brief See if the output file needs rotating.
      *
@@ -221,6 +281,17 @@ private:
      */
     std::unique_ptr<block_cbor::BlockData> data_;
 
+    /**
+     * \brief rewriter for pseudo-anonymising blocks, if configured.
+     */
+    boost::optional<BlockCborRewriter> rewriter_;
+
+    /**
+     * \brief the number of records in the block with each query name,
+     * by query name table index. Only kept if recording block sketches.
+     */
+    std::vector<uint64_t> qname_counts_;
+
     /**
      * \brief the current in-progress query/response item.
      */
@@ -266,6 +337,33 @@ private:
      */
     bool need_start_block_stats_;
 
+    /**
+     * \brief histogram for block latencies, if recording.
+     */
+    LatencyHistogram* block_latency_;
+
+    /**
+     * \brief hardware event counters, if counting.
+     */
+    PerfCounters* perf_;
+
+    /**
+     * \brief Set the block rewriter from the current configuration.
+     *
+     * Blocks are only rewritten if pseudo-anonymising. The fields
+     * kept are those in the block parameters.
+     */
+    void set_rewriter();
+
+    /**
+     * \brief Add the query name summary to the block sketches.
+     *
+     * Query names are counted exactly while the block is filled.
+     * The most frequent are kept, with names differing only in
+     * case counted together.
+     */
+    void summariseQueryNames();
+
     /**
      * \brief Clear in-progress extras info.
      */
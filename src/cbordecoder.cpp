@@ -10,6 +10,8 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
+
 #include "cbordecoder.hpp"
 
 namespace {
@@ -237,13 +239,7 @@ void CborBaseDecoder::skip()
             {
                 read_type_unsigned(major, minor, uint_val);
                 if ( major == this_major )
-                {
-                    while ( uint_val-- > 0 )
-                    {
-                        needRead();
-                        ++p_;
-                    }
-                }
+                    skip_bytes(uint_val);
                 else if ( major == BREAK_MAJOR && minor == BREAK_MINOR )
                     break;
                 else
@@ -251,11 +247,7 @@ void CborBaseDecoder::skip()
             }
         }
         else
-            while ( uint_val-- > 0 )
-            {
-                needRead();
-                ++p_;
-            }
+            skip_bytes(uint_val);
         break;
 
     case TYPE_ARRAY:
@@ -317,6 +309,17 @@ void CborBaseDecoder::skip()
     }
 }
 
+void CborBaseDecoder::skip_bytes(uint64_t n_bytes)
+{
+    while ( n_bytes > 0 )
+    {
+        needRead();
+        uint64_t n = std::min<uint64_t>(n_bytes, bufend_ - p_);
+        p_ += n;
+        n_bytes -= n;
+    }
+}
+
 void CborBaseDecoder::read_type_unsigned(unsigned& major, unsigned& minor, uint64_t& value)
 {
     major_minor(major, minor);
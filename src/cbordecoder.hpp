@@ -13,10 +13,13 @@
 #ifndef CBORDECODER_HPP
 #define CBORDECODER_HPP
 
+#include <chrono>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
 
 #include <boost/optional.hpp>
@@ -95,7 +98,8 @@ public:
      * \brief Constructor.
      */
     CborBaseDecoder()
-        : buf_(), bufend_(&buf_[0]), p_(bufend_) {}
+        : buf_(), bufend_(&buf_[0]), p_(bufend_),
+          recording_(nullptr), record_start_(p_) {}
 
     /**
      * \brief Returns the type of the current basic CBOR record.
@@ -269,6 +273,44 @@ public:
      */
     void skip();
 
+    /**
+     * \brief Start recording the input read.
+     *
+     * Until recording is stopped, the encoded CBOR of all items read
+     * or skipped is appended to the given string. This allows items
+     * to be copied without being decoded and encoded again.
+     *
+     * \param cbor the string to receive the input.
+     */
+    void startRecording(byte_string& cbor)
+    {
+        recording_ = &cbor;
+        record_start_ = p_;
+    }
+
+    /**
+     * \brief Stop recording the input read.
+     */
+    void stopRecording()
+    {
+        if ( recording_ )
+            recording_->append(record_start_, p_ - record_start_);
+        recording_ = nullptr;
+    }
+
+    /**
+     * \brief Read the current CBOR item without decoding it.
+     *
+     * \param cbor the encoded CBOR item is appended here.
+     * \throws cbor_decode_error if the CBOR is invalid.
+     */
+    void readRaw(byte_string& cbor)
+    {
+        startRecording(cbor);
+        skip();
+        stopRecording();
+    }
+
 protected:
     /**
      * Read more CBOR input values into the buffer.
@@ -318,9 +360,12 @@ private:
     {
         if ( p_ == bufend_ )
         {
+            if ( recording_ )
+                recording_->append(record_start_, bufend_ - record_start_);
             unsigned nread = readBytes(buf_, sizeof(buf_));
             p_ = &buf_[0];
             bufend_ = &buf_[nread];
+            record_start_ = p_;
         }
     }
 
@@ -335,6 +380,13 @@ private:
      */
     void read_type_unsigned(unsigned& major, unsigned& minor, uint64_t& value);
 
+    /**
+     * \brief Skip over input bytes.
+     *
+     * \param n_bytes the number of bytes to skip.
+     */
+    void skip_bytes(uint64_t n_bytes);
+
     /**
      * \brief Get the CBOR item identifier.
      *
@@ -364,6 +416,16 @@ private:
      * \brief Pointer to the current buffer position.
      */
     uint8_t* p_;
+
+    /**
+     * \brief The string recording input, if recording.
+     */
+    byte_string* recording_;
+
+    /**
+     * \brief The start of the buffer contents not yet recorded.
+     */
+    uint8_t* record_start_;
 };
 
 /**
@@ -405,4 +467,88 @@ protected:
     std::istream& is_;
 };
 
+/**
+ * \class CborFollowDecoder
+ * \brief A class for decoding CBOR from a file that is still being written.
+ *
+ * At the end of the input available so far, wait for more input
+ * to be written instead of stopping, until the input is finished.
+ * A block is then decoded as soon as all of it has been written.
+ */
+class CborFollowDecoder : public CborBaseDecoder
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param is       the input stream.
+     * \param finished function returning `true` once no more input
+     *                 will be written, or reading should stop.
+     * \param poll     interval between checks for more input.
+     */
+    CborFollowDecoder(std::istream& is,
+                      std::function<bool()> finished,
+                      std::chrono::milliseconds poll = std::chrono::milliseconds(100))
+        : is_(is), finished_(finished), poll_(poll)
+    {
+        is_.exceptions(std::istream::badbit);
+    }
+
+protected:
+    /**
+     * Read more CBOR input values into the buffer.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes maximum number of bytes to read.
+     * \return the number of bytes read.
+     * \throws cbor_end_of_input when finished and all input is read.
+     */
+    virtual unsigned readBytes(uint8_t* p, std::ptrdiff_t n_bytes)
+    {
+        for (;;)
+        {
+            if ( read(p, n_bytes) )
+                return is_.gcount();
+
+            // Read again after checking, so input written just
+            // before finishing is still read.
+            bool finished = finished_();
+            if ( read(p, n_bytes) )
+                return is_.gcount();
+            if ( finished )
+                throw cbor_end_of_input();
+            std::this_thread::sleep_for(poll_);
+        }
+    }
+
+    /**
+     * \brief Read from the input, even if previously at the end.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes maximum number of bytes to read.
+     * \return `true` if any bytes were read.
+     */
+    bool read(uint8_t* p, std::ptrdiff_t n_bytes)
+    {
+        is_.clear();
+        is_.read(reinterpret_cast<char *>(p), n_bytes);
+        return is_.gcount() > 0;
+    }
+
+    /**
+     * \brief The input stream.
+     */
+    std::istream& is_;
+
+    /**
+     * \brief Function returning `true` when the input is finished.
+     */
+    std::function<bool()> finished_;
+
+    /**
+     * \brief Interval between checks for more input.
+     */
+    std::chrono::milliseconds poll_;
+};
+
 #endif
@@ -10,6 +10,7 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
 #include <limits>
@@ -194,6 +195,23 @@ void CborBaseEncoder::writeBreak()
     writeByte((7 << 5) | 31);
 }
 
+void CborBaseEncoder::writeRaw(const byte_string& cbor)
+{
+    // Buffer small items, but write large ones directly.
+    if ( cbor.size() <= static_cast<std::size_t>(&buf_[sizeof(buf_)] - p_) )
+    {
+        std::copy(cbor.begin(), cbor.end(), p_);
+        p_ += cbor.size();
+        if ( p_ == &buf_[sizeof(buf_)] )
+            flush();
+    }
+    else
+    {
+        flush();
+        writeBytes(cbor.data(), cbor.size());
+    }
+}
+
 template<>
 void ParallelWriterPool<StreamWriter>::compressFile(const std::string& input, const std::string& output)
 {
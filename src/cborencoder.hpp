@@ -14,20 +14,24 @@
 #define CBORENCODER_HPP
 
 #include <array>
+#include <chrono>
 #include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <thread>
 #include <vector>
 
+#include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
 
 #include "bytestring.hpp"
+#include "compressionworkers.hpp"
 #include "log.hpp"
 #include "makeunique.hpp"
 #include "streamwriter.hpp"
@@ -223,6 +227,13 @@ public:
      */
     void writeBreak();
 
+    /**
+     * \brief Write items that are already CBOR encoded.
+     *
+     * \param cbor the encoded items.
+     */
+    void writeRaw(const byte_string& cbor);
+
     /**
      * \brief Force writing of any accumulated output.
      */
@@ -286,6 +297,39 @@ private:
     uint8_t *p_;
 };
 
+/**
+ * \class ByteStringCborEncoder
+ * \brief A CBOR encoder that appends its output to a string.
+ */
+class ByteStringCborEncoder : public CborBaseEncoder
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param out the string to append output to.
+     */
+    explicit ByteStringCborEncoder(byte_string& out) : out_(out) {}
+
+protected:
+    /**
+     * \brief Append output to the string.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes number of bytes in the buffer.
+     */
+    virtual void writeBytes(const uint8_t* p, std::ptrdiff_t n_bytes)
+    {
+        out_.append(p, n_bytes);
+    }
+
+private:
+    /**
+     * \brief the output string.
+     */
+    byte_string& out_;
+};
+
 /**
  * \class CborBaseStreamFileEncoder
  * \brief A virtual base class for encoding basic CBOR values to an output file.
@@ -330,6 +374,16 @@ public:
      */
     virtual std::uintmax_t bytes_written() = 0;
 
+    /**
+     * \brief Write all accumulated output through to the file.
+     *
+     * Afterwards, readers of the file see all output so far.
+     */
+    virtual void sync()
+    {
+        flush();
+    }
+
 protected:
     /**
      * \brief Write all accumulated output to the file.
@@ -419,6 +473,16 @@ public:
         return bytes_written_;
     }
 
+    /**
+     * \brief Write all accumulated output through to the file.
+     */
+    virtual void sync()
+    {
+        flush();
+        if ( writer_ )
+            writer_->flush();
+    }
+
 protected:
     /**
      * \brief Write all accumulated output to the file.
@@ -475,13 +539,36 @@ public:
      * \brief Compress input file to output file.
      *
      * Start compressing input file to output file. Typically this happens
-     * in a thread managed by the pool.
+     * in a thread managed by the pool. This does not wait for a
+     * thread to be available.
      *
      * \param input  name of input file.
      * \param output name of output file.
      */
     virtual void compressFile(const std::string& input, const std::string& output) = 0;
 
+    /**
+     * \brief Set the compression level for files not yet started.
+     *
+     * If the level is adaptive, this is the highest level used.
+     *
+     * \param level the compression level.
+     */
+    virtual void set_level(unsigned level) = 0;
+
+    /**
+     * \brief Adapt the compression level to the compression backlog.
+     *
+     * \param min_level the lowest level to use.
+     * \param period    the output file rotation period.
+     */
+    virtual void set_min_level(unsigned min_level, std::chrono::seconds period) = 0;
+
+    /**
+     * \brief Return the compression level for the next file.
+     */
+    virtual unsigned level() = 0;
+
     /**
      * \brief Signal the compression to abort.
      */
@@ -567,7 +654,7 @@ private:
 
 /**
  * \class ParallelWriterPool
- * \brief Compress files, one file per thread.
+ * \brief Compress files using a set of compression workers.
  */
 template<typename Writer>
 class ParallelWriterPool : public BaseParallelWriterPool
@@ -581,12 +668,11 @@ public:
     /**
      * \brief Constructor.
      *
-     * \param max_threads maximum number of threads to use when
-     * compressing.
-     * \param level       the compression level to use.
+     * \param workers the compression workers to use.
+     * \param level   the compression level to use.
      */
-    ParallelWriterPool(unsigned max_threads, unsigned level, bool logging = false)
-        : level_(level), max_threads_(max_threads), nthreads_(0), abort_(false), logging_(logging)
+    ParallelWriterPool(std::shared_ptr<CompressionWorkers> workers, unsigned level, bool logging = false)
+        : workers_(workers), level_(level), npending_(0), logging_(logging)
     {
     }
 
@@ -601,30 +687,77 @@ public:
     }
 
     /**
-     * \brief Compress input file to output file in a separate thread.
+     * \brief Queue compression of input file to output file.
      *
      * When the compression is finished, delete the input file.
      *
-     * If the maximum number of compression threads are already in use,
-     * wait until one is finished before starting.
+     * If the compression queue is full, leave the input file on
+     * disk uncompressed and log an error. The rejection is counted
+     * in the compression worker statistics.
      *
      * \param input  path of input file.
      * \param output path of output file.
      */
     virtual void compressFile(const std::string& input, const std::string& output)
     {
-        if (abort_)
+        if ( workers_->aborted() )
         {
             LOG_WARN << "Aborting compression of " << input.c_str();
             // Leave the input file on disk so it can be recovered.
             return;
         }
-        std::unique_lock<std::mutex> lock(m_);
-        if ( nthreads_ >= max_threads_ )
-            thread_finished_.wait(lock, [&](){ return nthreads_ < max_threads_; });
-        std::thread t([=]{ compressFileThread(input, output); });
-        t.detach();
-        ++nthreads_;
+
+        boost::system::error_code ec;
+        uintmax_t bytes = boost::filesystem::file_size(input, ec);
+        if ( ec )
+            bytes = 0;
+
+        unsigned level;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            unsigned old_level = level_.level();
+            level = level_.next_level(workers_->stats(), workers_->threads(), bytes);
+            if ( level != old_level )
+                LOG_INFO << "Compression level changed from " << old_level << " to " << level;
+            ++npending_;
+        }
+        if ( !workers_->submit([=]{ compressFileJob(input, output, level); }, bytes) )
+        {
+            LOG_ERROR << "Compression queue full, leaving " << input.c_str() << " uncompressed";
+            job_finished();
+        }
+    }
+
+    /**
+     * \brief Set the compression level for files not yet started.
+     *
+     * \param level the compression level.
+     */
+    virtual void set_level(unsigned level)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        level_.set_max_level(level);
+    }
+
+    /**
+     * \brief Adapt the compression level to the compression backlog.
+     *
+     * \param min_level the lowest level to use.
+     * \param period    the output file rotation period.
+     */
+    virtual void set_min_level(unsigned min_level, std::chrono::seconds period)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        level_.set_min_level(min_level, period);
+    }
+
+    /**
+     * \brief Return the compression level for the next file.
+     */
+    virtual unsigned level()
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return level_.level();
     }
 
     /**
@@ -632,17 +765,17 @@ public:
      */
     virtual void abort()
     {
-        abort_ = true;
+        workers_->abort();
     }
 
     /**
-     * \brief Wait for all current compressions to finish.
+     * \brief Wait for all compressions queued by this pool to finish.
      */
     virtual void wait()
     {
         std::unique_lock<std::mutex> lock(m_);
-        if ( nthreads_ > 0 )
-            thread_finished_.wait(lock, [&](){ return nthreads_ == 0; });
+        if ( npending_ > 0 )
+            job_finished_.wait(lock, [&](){ return npending_ == 0; });
     }
 
     /**
@@ -655,33 +788,40 @@ public:
 
 private:
     /**
-     * \brief Compression thread function.
+     * \brief Compression job function.
      *
      * Read input file, compress to output file, and when done delete
-     * input file. If the compression is aborted, delete both input
-     * and output files.
+     * input file. If the compression is aborted, delete the output
+     * file and leave the input file.
      *
      * \param input  path of input file.
      * \param output path of output file.
+     * \param level  the compression level.
      */
-    void compressFileThread(const std::string& input, const std::string& output)
+    void compressFileJob(const std::string& input, const std::string& output, unsigned level)
     {
-        set_thread_name("comp:compress");
+        if ( workers_->aborted() )
+        {
+            LOG_WARN << "Aborting compression of " << input.c_str();
+            // Leave the input file on disk so it can be recovered.
+            job_finished();
+            return;
+        }
 
         try
         {
             if (logging_)
-                LOG_INFO << "File handling: Starting compression of:            " << input.c_str() << " to " << output.c_str();
+                LOG_INFO << "File handling: Starting compression of:            " << input.c_str() << " to " << output.c_str() << " at level " << level;
             std::ifstream ifs(input, std::ios::binary);
             if ( !ifs.is_open() )
                 throw std::runtime_error("Can't open file " + input);
             ifs.exceptions(std::ifstream::badbit);
 
             {
-                Writer writer(output, level_, logging_);
+                Writer writer(output, level, logging_);
                 uint8_t buf[OUTPUT_BUFFER_SIZE];
 
-                while ( !abort_ && !ifs.eof() )
+                while ( !workers_->aborted() && !ifs.eof() )
                 {
                     ifs.read(reinterpret_cast<char *>(buf), sizeof(buf));
                     writer.writeBytes(buf, ifs.gcount());
@@ -689,7 +829,7 @@ private:
             }
 
             ifs.close();
-            if ( !abort_)
+            if ( !workers_->aborted() )
             {
                 if (logging_)
                     LOG_INFO << "File handling: Removing:                           " << input.c_str();
@@ -711,33 +851,33 @@ private:
             LOG_ERROR << err.what();
         }
 
-        std::unique_lock<std::mutex> lock(m_);
-        --nthreads_;
-        thread_finished_.notify_one();
+        job_finished();
     }
 
     /**
-     * \brief compression level.
+     * \brief Note that a job queued by this pool has finished.
      */
-    unsigned level_;
+    void job_finished()
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        --npending_;
+        job_finished_.notify_all();
+    }
 
     /**
-     * \brief maximum number of simultaneous compression threads.
-     *
-     * In other words, maximum number of files that can be compressed
-     * at once.
+     * \brief the compression workers.
      */
-    unsigned max_threads_;
+    std::shared_ptr<CompressionWorkers> workers_;
 
     /**
-     * \brief current number of simultaneously compression threads.
+     * \brief compression level.
      */
-    unsigned nthreads_;
+    CompressionLevelController level_;
 
     /**
-     * \brief flag indicating whether compression should abort.
+     * \brief number of jobs queued by this pool and not yet finished.
      */
-    std::atomic_bool abort_;
+    unsigned npending_;
 
     /**
      * \brief mutex guarding state.
@@ -745,9 +885,9 @@ private:
     std::mutex m_;
 
     /**
-     * \brief condition variable to signal when a thread finishes.
+     * \brief condition variable to signal when a job finishes.
      */
-    std::condition_variable thread_finished_;
+    std::condition_variable job_finished_;
 
    /**
     * \brief logging
@@ -757,7 +897,7 @@ private:
 };
 
 /**
- * \brief Compress input file to output file in a separate thread.
+ * \brief Compress input file to output file.
  *
  * When the output writer is a plain stream with no compression,
  * then just rename the input to the output.
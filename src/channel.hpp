@@ -13,10 +13,12 @@
 #ifndef CHANNEL_HPP
 #define CHANNEL_HPP
 
+#include <chrono>
 #include <condition_variable>
 #include <queue>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 // This implementation of something vaguely like a Go channel is
 // based on https://st.xorian.net/blog/2012/08/go-style-channel-in-c/.
@@ -137,7 +139,7 @@ public:
         if ( closed_ )
             throw std::logic_error("put to closed channel");
 
-        queue_.push(i);
+        queue_.push(std::move(i));
         cv_.notify_one();
         return true;
     }
@@ -163,6 +165,27 @@ public:
         return true;
     }
 
+    /**
+     * \brief Retrieve an item from the channel, waiting a limited time.
+     *
+     * \param out     set to the retrieved item.
+     * \param timeout the longest time to wait if the channel is empty.
+     * \returns `false` if channel is closed or the channel is still
+     *          empty after the timeout.
+     */
+    template<typename Rep, typename Period>
+    bool get(item &out, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait_for(lock, timeout, [this](){ return closed_ || !queue_.empty(); });
+        if ( queue_.empty() )
+            return false;
+        out = std::move(queue_.front());
+        queue_.pop();
+        cv_.notify_one();
+        return true;
+    }
+
     /**
      * \brief Set the maximum number of items in the channel.
      *
@@ -176,6 +199,16 @@ public:
         max_len_ = max_items;
     }
 
+    /**
+     * \brief Return the maximum number of items in the channel.
+     *
+     * \returns the maximum number of items, or 0 if there is no maximum.
+     */
+    unsigned get_max_items() const
+    {
+        return max_len_;
+    }
+
 private:
     /**
      * \brief the channel item queue.
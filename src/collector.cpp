@@ -0,0 +1,470 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "config.h"
+
+#include "blockcborsender.hpp"
+#include "cborencoder.hpp"
+#include "log.hpp"
+#include "makeunique.hpp"
+#include "streamwriter.hpp"
+
+namespace po = boost::program_options;
+
+const std::string PROGNAME = "compactor-collector";
+
+namespace {
+    /**
+     * \class CollectorOutput
+     * \brief Write received blocks to C-DNS files.
+     *
+     * A new file is started when the file header changes and when
+     * the rotation period has passed.
+     */
+    class CollectorOutput
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param pattern the output filename pattern, passed through `strftime()`.
+         * \param period  the rotation period.
+         * \param enc     the file encoder.
+         */
+        CollectorOutput(const std::string& pattern,
+                        std::chrono::seconds period,
+                        std::unique_ptr<CborBaseStreamFileEncoder> enc)
+            : pattern_(pattern), period_(period), enc_(std::move(enc)), blocks_(0) {}
+
+        /**
+         * \brief Destructor.
+         */
+        ~CollectorOutput()
+        {
+            close();
+        }
+
+        /**
+         * \brief Write a block.
+         *
+         * \param header the C-DNS file header for the block.
+         * \param block  the encoded block.
+         */
+        void write(const byte_string& header, const byte_string& block)
+        {
+            std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+            if ( enc_->is_open() && ( header != header_ || now >= opened_ + period_ ) )
+                close();
+
+            if ( !enc_->is_open() )
+            {
+                std::string name = filename(now);
+                LOG_INFO << "Writing C-DNS file " << name;
+                enc_->open(name);
+                enc_->writeRaw(header);
+                header_ = header;
+                opened_ = now;
+            }
+
+            enc_->writeRaw(block);
+            enc_->sync();
+            ++blocks_;
+        }
+
+        /**
+         * \brief Close any open file.
+         */
+        void close()
+        {
+            if ( enc_->is_open() )
+            {
+                enc_->writeBreak();
+                enc_->close();
+            }
+        }
+
+        /**
+         * \brief Return the number of blocks written.
+         */
+        uint64_t blocks() const
+        {
+            return blocks_;
+        }
+
+    private:
+        /**
+         * \brief Return an unused filename for a new file.
+         *
+         * \param t the time the file is started.
+         */
+        std::string filename(const std::chrono::system_clock::time_point& t)
+        {
+            char buf[4096];
+            std::time_t tt = std::chrono::system_clock::to_time_t(t);
+            std::tm tm = *std::gmtime(&tt);
+            std::strftime(buf, sizeof(buf), pattern_.c_str(), &tm);
+
+            std::string base(buf);
+            std::string ext = enc_->suggested_extension();
+            std::string res = base;
+            for ( unsigned i = 1; boost::filesystem::exists(res + ext); ++i )
+                res = base + "-" + std::to_string(i);
+            return res + ext;
+        }
+
+        /**
+         * \brief the output filename pattern.
+         */
+        std::string pattern_;
+
+        /**
+         * \brief the rotation period.
+         */
+        std::chrono::seconds period_;
+
+        /**
+         * \brief the file encoder.
+         */
+        std::unique_ptr<CborBaseStreamFileEncoder> enc_;
+
+        /**
+         * \brief the header of the current file.
+         */
+        byte_string header_;
+
+        /**
+         * \brief when the current file was opened.
+         */
+        std::chrono::system_clock::time_point opened_;
+
+        /**
+         * \brief the number of blocks written.
+         */
+        uint64_t blocks_;
+    };
+
+    /**
+     * \class Collector
+     * \brief Receive C-DNS frames from a sender.
+     *
+     * Senders are served one at a time. Each frame is written to the
+     * output and then acknowledged.
+     */
+    class Collector
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param service  the IO service.
+         * \param endpoint the endpoint on which to listen.
+         * \param output   the output.
+         */
+        Collector(boost::asio::io_service& service,
+                  const boost::asio::generic::stream_protocol::endpoint& endpoint,
+                  CollectorOutput& output)
+            : acceptor_(service, endpoint), socket_(service), output_(output)
+        {
+            accept();
+        }
+
+        /**
+         * \brief Stop receiving.
+         */
+        void stop()
+        {
+            boost::system::error_code ec;
+            acceptor_.close(ec);
+            socket_.close(ec);
+        }
+
+    private:
+        /**
+         * \brief Wait for a sender.
+         */
+        void accept()
+        {
+            acceptor_.async_accept(
+                socket_,
+                [this](const boost::system::error_code& err)
+                {
+                    if ( err == boost::asio::error::operation_aborted )
+                        return;
+
+                    if ( err )
+                    {
+                        LOG_ERROR << "Accept failed: " << err.message();
+                        accept();
+                        return;
+                    }
+
+                    LOG_INFO << "Sender connected";
+                    readPrefix();
+                });
+        }
+
+        /**
+         * \brief End the connection with the current sender.
+         *
+         * \param err the reason.
+         */
+        void disconnect(const boost::system::error_code& err)
+        {
+            if ( err == boost::asio::error::operation_aborted )
+                return;
+
+            if ( err && err != boost::asio::error::eof )
+                LOG_ERROR << "Sender error: " << err.message();
+            LOG_INFO << "Sender disconnected";
+            boost::system::error_code ec;
+            socket_.close(ec);
+            output_.close();
+            accept();
+        }
+
+        /**
+         * \brief Read the lengths of the next frame.
+         */
+        void readPrefix()
+        {
+            boost::asio::async_read(
+                socket_,
+                boost::asio::buffer(prefix_, sizeof(prefix_)),
+                [this](const boost::system::error_code& err, std::size_t)
+                {
+                    if ( err )
+                    {
+                        disconnect(err);
+                        return;
+                    }
+
+                    std::size_t header_size, block_size;
+                    try
+                    {
+                        block_cbor::read_frame_prefix(prefix_, header_size, block_size);
+                    }
+                    catch (const std::length_error&)
+                    {
+                        disconnect(boost::asio::error::message_size);
+                        return;
+                    }
+                    header_.resize(header_size);
+                    block_.resize(block_size);
+                    readFrame();
+                });
+        }
+
+        /**
+         * \brief Read the header and block of a frame, store and acknowledge it.
+         */
+        void readFrame()
+        {
+            std::vector<boost::asio::mutable_buffer> buffers;
+            buffers.push_back(boost::asio::buffer(&header_[0], header_.size()));
+            buffers.push_back(boost::asio::buffer(&block_[0], block_.size()));
+            boost::asio::async_read(
+                socket_,
+                buffers,
+                [this](const boost::system::error_code& err, std::size_t)
+                {
+                    if ( err )
+                    {
+                        disconnect(err);
+                        return;
+                    }
+
+                    try
+                    {
+                        output_.write(header_, block_);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // Don't acknowledge; the sender will try again.
+                        LOG_ERROR << "Can't write block: " << e.what();
+                        disconnect(boost::asio::error::broken_pipe);
+                        return;
+                    }
+
+                    boost::asio::async_write(
+                        socket_,
+                        boost::asio::buffer(&block_cbor::FRAME_ACK, 1),
+                        [this](const boost::system::error_code& ack_err, std::size_t)
+                        {
+                            if ( ack_err )
+                                disconnect(ack_err);
+                            else
+                                readPrefix();
+                        });
+                });
+        }
+
+        /**
+         * \brief the listening socket.
+         */
+        boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> acceptor_;
+
+        /**
+         * \brief the socket connected to the current sender.
+         */
+        boost::asio::generic::stream_protocol::socket socket_;
+
+        /**
+         * \brief the output.
+         */
+        CollectorOutput& output_;
+
+        /**
+         * \brief the frame lengths.
+         */
+        uint8_t prefix_[block_cbor::FRAME_PREFIX_SIZE];
+
+        /**
+         * \brief the frame file header.
+         */
+        byte_string header_;
+
+        /**
+         * \brief the frame block.
+         */
+        byte_string block_;
+    };
+}
+
+int main(int ac, char *av[])
+{
+    std::string listen;
+    std::string output_pattern;
+    unsigned rotation_period;
+    bool gzip;
+    bool xz;
+    unsigned level;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("listen,L",
+         po::value<std::string>(&listen),
+         "Unix socket path or host:port on which to receive C-DNS blocks.")
+        ("output,o",
+         po::value<std::string>(&output_pattern),
+         "filename pattern for storing C-DNS output.")
+        ("rotation-period,t",
+         po::value<unsigned>(&rotation_period)->default_value(300),
+         "rotation period for output files in seconds.")
+        ("gzip,z",
+         po::value<bool>(&gzip)->implicit_value(true)->default_value(false),
+         "compress output using gzip.")
+        ("xz,x",
+         po::value<bool>(&xz)->implicit_value(true)->default_value(false),
+         "compress output using xz.")
+        ("level,l",
+         po::value<unsigned>(&level)->default_value(6),
+         "compression level.")
+        ;
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::parse_command_line(ac, av, options), vm);
+        po::notify(vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr << "Usage: " << PROGNAME << " [options]\n" << options;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        if ( listen.empty() )
+            throw po::error("no listen address given.");
+        if ( output_pattern.empty() )
+            throw po::error("no output pattern given.");
+        if ( rotation_period < 1 )
+            throw po::error("rotation period must be at least 1 second.");
+        if ( gzip && xz )
+            throw po::error("You cannot select more than one compression method.");
+        if ( level > 9 )
+            throw po::error("compression level must be in the range 0-9.");
+
+        std::unique_ptr<CborBaseStreamFileEncoder> enc;
+        if ( gzip )
+            enc = make_unique<CborStreamFileEncoder<GzipStreamWriter>>(level);
+        else if ( xz )
+            enc = make_unique<CborStreamFileEncoder<XzStreamWriter>>(level);
+        else
+            enc = make_unique<CborStreamFileEncoder<StreamWriter>>(level);
+        CollectorOutput output(output_pattern, std::chrono::seconds(rotation_period), std::move(enc));
+
+        boost::asio::io_service service;
+        boost::asio::generic::stream_protocol::endpoint endpoint;
+        try
+        {
+            endpoint = block_cbor::stream_endpoint(service, listen);
+        }
+        catch (const std::invalid_argument& err)
+        {
+            throw po::error(err.what());
+        }
+        bool unix_socket = ( endpoint.protocol().family() == AF_UNIX );
+        if ( unix_socket )
+            std::remove(listen.c_str());
+
+        Collector collector(service, endpoint, output);
+        boost::asio::signal_set signals(service, SIGINT, SIGTERM);
+        signals.async_wait(
+            [&](const boost::system::error_code&, int)
+            {
+                collector.stop();
+            });
+
+        LOG_INFO << "Receiving C-DNS blocks on " << listen;
+        service.run();
+        output.close();
+        if ( unix_socket )
+            std::remove(listen.c_str());
+
+        std::cerr << PROGNAME << ": " << output.blocks() << " blocks\n";
+    }
+    catch (const po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << "\n"
+                  << "Run '" << PROGNAME << " -h' for help.\n";
+        return 1;
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
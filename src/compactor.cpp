@@ -11,11 +11,15 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <csignal>
 #include <exception>
 #include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include <iomanip>
 
@@ -37,15 +41,26 @@
 
 #include "addressevent.hpp"
 #include "channel.hpp"
+#include "blockcborsender.hpp"
 #include "blockcborwriter.hpp"
 #include "configuration.hpp"
+#include "controlserver.hpp"
 #include "dnstap.hpp"
+#include "flowsampler.hpp"
+#include "flowworkers.hpp"
+#include "liveconfiguration.hpp"
+#include "loadshedder.hpp"
 #include "log.hpp"
 #include "makeunique.hpp"
+#include "malformedmessage.hpp"
 #include "matcher.hpp"
+#include "metrics.hpp"
+#include "packetretention.hpp"
 #include "packetstream.hpp"
 #include "pcapwriter.hpp"
+#include "perfcounters.hpp"
 #include "queryresponse.hpp"
+#include "replayreport.hpp"
 #include "signalhandler.hpp"
 #include "sniffers.hpp"
 #include "streamwriter.hpp"
@@ -69,8 +84,11 @@ static void sighandler_empty(int /* sig */)
 /**
  * \typedef CborItemPayload
  * \brief A varient type for the different items to be written to C-DNS.
+ *
+ * `boost::blank` marks an item carrying only updated statistics.
+ * A configuration marks a configuration change.
  */
-using CborItemPayload = boost::variant<std::shared_ptr<QueryResponse>, std::shared_ptr<AddressEvent>>;
+using CborItemPayload = boost::variant<std::shared_ptr<QueryResponse>, std::shared_ptr<AddressEvent>, boost::blank, std::shared_ptr<const Configuration>, std::shared_ptr<MalformedMessage>>;
 
 /**
  * \struct CborItem
@@ -82,19 +100,41 @@ struct CborItem
     /**
      * \brief Constructor for query/response.
      */
-    CborItem(const std::shared_ptr<QueryResponse>& qr, const PacketStatistics& stats)
-        : payload(qr), stats(stats) {}
+    CborItem(const std::shared_ptr<QueryResponse>& qr, const PacketStatistics& stats,
+             unsigned source = 0)
+        : payload(qr), stats(stats), source(source) {}
 
     /**
      * \brief Constructor for address event.
      */
-    CborItem(const std::shared_ptr<AddressEvent>& ae, const PacketStatistics& stats)
-        : payload(ae), stats(stats) {}
+    CborItem(const std::shared_ptr<AddressEvent>& ae, const PacketStatistics& stats,
+             unsigned source = 0)
+        : payload(ae), stats(stats), source(source) {}
+
+    /**
+     * \brief Constructor for malformed message.
+     */
+    CborItem(const std::shared_ptr<MalformedMessage>& mm, const PacketStatistics& stats,
+             unsigned source = 0)
+        : payload(mm), stats(stats), source(source) {}
+
+    /**
+     * \brief Constructor for statistics update.
+     */
+    CborItem(const PacketStatistics& stats, unsigned source)
+        : payload(boost::blank()), stats(stats), source(source) {}
+
+    /**
+     * \brief Constructor for configuration change.
+     */
+    CborItem(const std::shared_ptr<const Configuration>& config,
+             const PacketStatistics& stats, unsigned source)
+        : payload(config), stats(stats), source(source) {}
 
     /**
      * \brief Empty constructor.
      */
-    CborItem() {}
+    CborItem() : source(0) {}
 
     /**
      * \brief the item data.
@@ -105,6 +145,20 @@ struct CborItem
      * \brief the statistics as at the time of the item.
      */
     PacketStatistics stats;
+
+    /**
+     * \brief the source of the statistics.
+     *
+     * When packets are processed by worker threads, each worker keeps
+     * its own statistics. Source 0 is the capture thread, and source
+     * _n_ worker _n_.
+     */
+    unsigned source;
+
+    /**
+     * \brief when the item was queued for output, if measuring latency.
+     */
+    std::chrono::steady_clock::time_point queued;
 };
 
 /**
@@ -141,6 +195,62 @@ struct OutputChannels
      * \brief Channel for sending items to be written to C-DNS output thread.
      */
     std::shared_ptr<Channel<CborItem>> cbor;
+
+    /**
+     * \brief Channels for sending items to additional C-DNS output threads.
+     */
+    std::vector<std::shared_ptr<Channel<CborItem>>> extra_cbor;
+
+    /**
+     * \brief Send an item to all C-DNS output threads.
+     *
+     * The item payload is shared by all outputs, not copied.
+     *
+     * \param cbi  the item.
+     * \param wait if `true`, wait for room in each channel.
+     * \returns `false` if the item was dropped by any output.
+     */
+    bool put_cbor(const CborItem& cbi, bool wait)
+    {
+        bool res = cbor->put(cbi, wait);
+        for ( auto& c : extra_cbor )
+            if ( !c->put(cbi, wait) )
+                res = false;
+        return res;
+    }
+
+    /**
+     * \brief Return the length of the longest C-DNS output queue.
+     */
+    unsigned cbor_length()
+    {
+        unsigned res = cbor->get_length();
+        for ( auto& c : extra_cbor )
+            res = std::max(res, c->get_length());
+        return res;
+    }
+
+    /**
+     * \brief Set the maximum length of each C-DNS output queue.
+     *
+     * \param max_items the maximum length.
+     */
+    void set_cbor_max_items(unsigned max_items)
+    {
+        cbor->set_max_items(max_items);
+        for ( auto& c : extra_cbor )
+            c->set_max_items(max_items);
+    }
+
+    /**
+     * \brief Close all C-DNS output channels.
+     */
+    void close_cbor()
+    {
+        cbor->close();
+        for ( auto& c : extra_cbor )
+            c->close();
+    }
 };
 
 /**
@@ -149,20 +259,29 @@ struct OutputChannels
  * \param name the thread name.
  * \param out  the output destination.
  * \param chan the channel to receive packets from.
+ * \param live the live configuration.
  */
 static void packet_writer(const char* name,
                           std::unique_ptr<PcapBaseRotatingWriter> out,
                           std::shared_ptr<Channel<std::shared_ptr<PcapItem>>> chan,
-                          const Configuration& config)
+                          std::shared_ptr<LiveConfiguration> live)
 {
     set_thread_name(name);
 
+    unsigned generation = live->generation();
+    std::shared_ptr<const Configuration> config = live->get();
     std::shared_ptr<PcapItem> pcap;
     while ( chan->get(pcap) )
     {
+        if ( live->generation() != generation )
+        {
+            generation = live->generation();
+            config = live->get();
+        }
+
         try
         {
-            out->write_packet(*(pcap->pdu), pcap->timestamp, config);
+            out->write_packet(*(pcap->pdu), pcap->timestamp, *config);
         }
         catch (const std::exception& err)
         {
@@ -171,6 +290,30 @@ static void packet_writer(const char* name,
     }
 }
 
+/**
+ * \brief Return the configuration for a C-DNS output.
+ *
+ * Additional outputs use their output definition, but take settings
+ * that apply to the whole run, such as whether to omit the host ID,
+ * from the main configuration.
+ *
+ * \param config the main configuration.
+ * \param output the output number. 0 is the main output, _n_ the
+ *               _n_th output definition.
+ * \returns the output configuration.
+ */
+static std::shared_ptr<const Configuration> output_configuration(const std::shared_ptr<const Configuration>& config,
+                                                                 std::size_t output)
+{
+    if ( output == 0 )
+        return config;
+
+    std::shared_ptr<Configuration> def =
+        std::make_shared<Configuration>(*config->output_definitions[output - 1]);
+    def->omit_hostid = config->omit_hostid;
+    return def;
+}
+
 /**
  * \class CborItemVisitor
  * \brief Visitor for applying appropriate action to a CBorItem.
@@ -181,10 +324,12 @@ public:
     /**
      * \brief Constructor.
      *
-     * \param out the output writer.
+     * \param out    the output writer.
+     * \param output the output number. 0 is the main output, and
+     *               1 onwards the outputs from output definitions.
      */
-    explicit CborItemVisitor(std::unique_ptr<BlockCborWriter>& out)
-        : out_(std::move(out)), stats_() {}
+    explicit CborItemVisitor(std::unique_ptr<BlockCborWriter>& out, unsigned output = 0)
+        : out_(std::move(out)), output_(output), stats_(), total_stats_() {}
 
     /**
      * \brief Process a query/response.
@@ -206,12 +351,71 @@ public:
         out_->writeAE(ae, *stats_);
     }
 
+    /**
+     * \brief Process a malformed message.
+     */
+    void operator()(const std::shared_ptr<MalformedMessage>& mm)
+    {
+        out_->writeMM(mm, *stats_);
+    }
+
+    /**
+     * \brief Process a statistics update.
+     */
+    void operator()(const boost::blank&)
+    {
+    }
+
+    /**
+     * \brief Process a configuration change.
+     */
+    void operator()(const std::shared_ptr<const Configuration>& config)
+    {
+        if ( output_ <= config->output_definitions.size() )
+            out_->set_configuration(output_configuration(config, output_));
+    }
+
     /**
      * \brief Set the statistics current for the next data.
+     *
+     * If statistics come from more than one source, the statistics
+     * used are the total of the latest from each source. The total
+     * is kept up to date by replacing the previous statistics from
+     * the source, so the cost does not grow with the number of
+     * sources.
+     *
+     * \param stats  the statistics.
+     * \param source the statistics source.
+     */
+    void set_stats(const PacketStatistics* stats, unsigned source)
+    {
+        if ( source >= source_stats_.size() )
+        {
+            source_stats_.resize(source + 1, PacketStatistics{});
+            total_stats_ = PacketStatistics{};
+            for ( const auto& s : source_stats_ )
+                total_stats_ += s;
+        }
+
+        if ( source_stats_.size() == 1 )
+        {
+            source_stats_[0] = *stats;
+            stats_ = stats;
+            return;
+        }
+
+        total_stats_ -= source_stats_[source];
+        total_stats_ += *stats;
+        source_stats_[source] = *stats;
+        stats_ = &total_stats_;
+    }
+
+    /**
+     * \brief Return the number of query/responses in the current block.
      */
-    void set_stats(const PacketStatistics* stats)
+    std::size_t block_items() const
     {
-        stats_ = stats;
+        return out_->block_items();
     }
 
 private:
@@ -220,39 +424,394 @@ private:
      */
     std::unique_ptr<BlockCborWriter> out_;
 
+    /**
+     * \brief the output number.
+     */
+    unsigned output_;
+
     /**
      * \brief statistics for the next item to write.
      */
     const PacketStatistics* stats_;
+
+    /**
+     * \brief latest statistics from each source.
+     */
+    std::vector<PacketStatistics> source_stats_;
+
+    /**
+     * \brief total of latest statistics from all sources.
+     */
+    PacketStatistics total_stats_;
 };
 
 /**
  * \brief Main function for thread writing C-DNS files.
  *
- * \param out the output destination.
- * \param chan the channel to receive packets from.
+ * \param out             the output destination.
+ * \param chan            the channel to receive packets from.
+ * \param metrics         the pipeline metrics, if any.
+ * \param perf            the performance counters, if any.
+ * \param max_block_items the maximum number of items in a block.
+ * \param output          the output number.
  */
 static void cbor_writer(std::unique_ptr<BlockCborWriter> out,
-                        std::shared_ptr<Channel<CborItem>> chan)
+                        std::shared_ptr<Channel<CborItem>> chan,
+                        std::shared_ptr<Metrics> metrics,
+                        PerfCounters* perf,
+                        unsigned max_block_items,
+                        unsigned output)
 {
     set_thread_name("comp:cdns-write");
 
-    CborItemVisitor cbiv(out);
+    if ( metrics )
+        out->set_block_latency(&metrics->latency(Metrics::BLOCK_TO_DISK));
+    out->set_perf_counters(perf);
+
+    CborItemVisitor cbiv(out, output);
     CborItem cbi;
+
+    std::atomic<std::size_t> block_items(0);
+    MetricsSource block_metrics(
+        metrics.get(),
+        [&](MetricsWriter& w)
+        {
+            w.gauge("compactor_block_items", "Query/responses in the C-DNS block being filled.",
+                    block_items.load(std::memory_order_relaxed));
+            w.gauge("compactor_block_max_items", "Maximum query/responses in a C-DNS block.",
+                    max_block_items);
+        });
+
     while ( chan->get(cbi) )
     {
         try
         {
-            cbiv.set_stats(&cbi.stats);
+            PerfStageScope dedup(perf, PerfCounters::DEDUP);
+            cbiv.set_stats(&cbi.stats, cbi.source);
             boost::apply_visitor(cbiv, cbi.payload);
         }
         catch (const std::exception& err)
         {
             LOG_ERROR << err.what();
         }
+
+        if ( metrics && cbi.queued != std::chrono::steady_clock::time_point() )
+        {
+            metrics->latency(Metrics::MATCH_TO_BLOCK).record(
+                cno::duration_cast<cno::microseconds>(cno::steady_clock::now() - cbi.queued));
+            block_items.store(cbiv.block_items(), std::memory_order_relaxed);
+        }
     }
 }
 
+/**
+ * \brief Count a completed query/response and send it for output.
+ *
+ * If measuring latency, the time since the packet completing the
+ * query/response entered the compactor is recorded, and the item is
+ * marked with the time it is queued for output.
+ *
+ * \param qr      the query/response.
+ * \param output  the output channels.
+ * \param config  the current configuration.
+ * \param stats   the statistics to update.
+ * \param shedder the load shedder.
+ * \param source  the statistics source.
+ * \param metrics the pipeline metrics, if any.
+ */
+static void output_qr(const std::shared_ptr<QueryResponse>& qr,
+                      OutputChannels& output,
+                      const Configuration& config,
+                      PacketStatistics& stats,
+                      LoadShedder& shedder,
+                      unsigned source,
+                      Metrics* metrics)
+{
+    if ( metrics && qr->has_response() &&
+         qr->response().received != cno::steady_clock::time_point() )
+        metrics->latency(Metrics::PACKET_TO_MATCH).record(
+            cno::duration_cast<cno::microseconds>(cno::steady_clock::now() - qr->response().received));
+
+    if ( qr->has_query() )
+    {
+        if ( !qr->has_response() )
+            ++stats.query_without_response_count;
+        else
+            ++stats.qr_pair_count;
+    }
+    else
+        ++stats.response_without_query_count;
+
+    if ( config.debug_qr )
+        std::cout << *qr;
+    if ( !config.output_pattern.empty() )
+    {
+        if ( shedder.shed(*qr, output.cbor_length(), output.cbor->get_max_items()) )
+            return;
+
+        CborItem cbi(qr, stats, source);
+        if ( metrics )
+            cbi.queued = cno::steady_clock::now();
+        if ( !output.put_cbor(cbi, false) )
+        {
+            ++stats.output_cbor_drop_count;
+        }
+    }
+}
+
+/**
+ * \brief Send an address event for output.
+ *
+ * \param event  the address event.
+ * \param output the output channels.
+ * \param config the current configuration.
+ * \param stats  the statistics to update.
+ * \param source the statistics source.
+ */
+static void output_address_event(const std::shared_ptr<AddressEvent>& event,
+                                 OutputChannels& output,
+                                 const Configuration& config,
+                                 PacketStatistics& stats,
+                                 unsigned source)
+{
+    if ( !config.output_pattern.empty() )
+    {
+        CborItem cbi(event, stats, source);
+        if ( !output.put_cbor(cbi, false) )
+        {
+            ++stats.output_cbor_drop_count;
+        }
+    }
+}
+
+/**
+ * \brief Send a malformed message for output.
+ *
+ * \param mm     the malformed message.
+ * \param output the output channels.
+ * \param config the current configuration.
+ * \param stats  the statistics to update.
+ * \param source the statistics source.
+ */
+static void output_malformed_message(const std::shared_ptr<MalformedMessage>& mm,
+                                     OutputChannels& output,
+                                     const Configuration& config,
+                                     PacketStatistics& stats,
+                                     unsigned source)
+{
+    if ( !config.output_pattern.empty() )
+    {
+        CborItem cbi(mm, stats, source);
+        if ( !output.put_cbor(cbi, false) )
+        {
+            ++stats.output_cbor_drop_count;
+        }
+    }
+}
+
+/**
+ * \class MatchingProcessor
+ * \brief Decode and match packets on a packet processing worker.
+ *
+ * Each worker has its own packet stream and query/response matcher.
+ * C-DNS items output by a worker carry the worker statistics; the
+ * C-DNS writer combines statistics from all sources.
+ */
+class MatchingProcessor : public FlowWorkers::Processor
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param source  the worker statistics source number.
+     * \param stats   the worker statistics.
+     * \param output  the output channels.
+     * \param config  the current configuration.
+     * \param live    the live configuration.
+     * \param metrics the pipeline metrics, if any.
+     * \param perf    the performance counters, if any.
+     */
+    MatchingProcessor(unsigned source,
+                      PacketStatistics& stats,
+                      OutputChannels& output,
+                      const Configuration& config,
+                      const LiveConfiguration& live,
+                      Metrics* metrics,
+                      PerfCounters* perf)
+        : source_(source), stats_(stats), output_(output), config_(config),
+          live_(live), metrics_(metrics), perf_(perf),
+          do_ignored_pcap_(!config.ignored_pcap_pattern.empty()),
+          shedder_(config.shed_threshold, config.shed_common_rr_types, stats),
+          matcher_([this](std::shared_ptr<QueryResponse> qr)
+                   {
+                       output_qr(qr, output_, config_, stats_, shedder_, source_, metrics_);
+                   }),
+          packet_stream_(config,
+                         [this](std::unique_ptr<DNSMessage>& dns)
+                         {
+                             ++stats_.processed_message_count;
+                             PerfStageScope match(perf_, PerfCounters::MATCH);
+                             matcher_.add(std::move(dns));
+                         },
+                         [this](const std::shared_ptr<AddressEvent>& event)
+                         {
+                             output_address_event(event, output_, config_, stats_, source_);
+                         },
+                         stats,
+                         [this](const std::shared_ptr<MalformedMessage>& mm)
+                         {
+                             output_malformed_message(mm, output_, config_, stats_, source_);
+                         }),
+          generation_(live.generation())
+    {
+        matcher_.set_query_timeout(config.query_timeout);
+        matcher_.set_skew_timeout(config.skew_timeout);
+    }
+
+    /**
+     * \brief Decode and match a batch of packets.
+     *
+     * Changes to the live configuration are picked up at the start
+     * of each batch.
+     *
+     * \param batch the packets.
+     */
+    virtual void process(FlowWorkers::PacketBatch& batch)
+    {
+        if ( live_.generation() != generation_ )
+        {
+            generation_ = live_.generation();
+            packet_stream_.set_configuration(live_.get());
+        }
+
+        for ( auto& pcap : batch )
+        {
+            if ( matcher_.get_length() > config_.max_channel_size * 2 )
+            {
+                ++stats_.matcher_drop_count;
+                matcher_.poke(pcap->timestamp);
+                continue;
+            }
+
+            bool ignored = false;
+
+            try
+            {
+                PerfStageScope decode(perf_, PerfCounters::DECODE);
+                packet_stream_.process_packet(pcap);
+            }
+            catch (const unhandled_packet& e)
+            {
+                ignored = true;
+                ++stats_.unhandled_packet_count;
+            }
+            catch (const malformed_packet& e)
+            {
+                ignored = true;
+                ++stats_.malformed_message_count;
+            }
+
+            if ( ignored && do_ignored_pcap_ &&
+                 !output_.ignored_pcap->put(pcap, false) )
+                ++stats_.output_ignored_pcap_drop_count;
+        }
+    }
+
+    /**
+     * \brief Flush the matcher.
+     */
+    virtual void finish()
+    {
+        PerfStageScope match(perf_, PerfCounters::MATCH);
+        matcher_.flush();
+    }
+
+    /**
+     * \brief Return the matcher length.
+     */
+    virtual unsigned length()
+    {
+        return matcher_.get_length();
+    }
+
+private:
+    /**
+     * \brief the worker statistics source number.
+     */
+    unsigned source_;
+
+    /**
+     * \brief the worker statistics.
+     */
+    PacketStatistics& stats_;
+
+    /**
+     * \brief the output channels.
+     */
+    OutputChannels& output_;
+
+    /**
+     * \brief the current configuration.
+     */
+    const Configuration& config_;
+
+    /**
+     * \brief the live configuration.
+     */
+    const LiveConfiguration& live_;
+
+    /**
+     * \brief the pipeline metrics, if any.
+     */
+    Metrics* metrics_;
+
+    /**
+     * \brief the performance counters, if any.
+     */
+    PerfCounters* perf_;
+
+    /**
+     * \brief `true` if writing ignored packets.
+     */
+    bool do_ignored_pcap_;
+
+    /**
+     * \brief the load shedder.
+     */
+    LoadShedder shedder_;
+
+    /**
+     * \brief the query/response matcher.
+     */
+    QueryResponseMatcher matcher_;
+
+    /**
+     * \brief the packet stream.
+     */
+    PacketStream packet_stream_;
+
+    /**
+     * \brief the live configuration generation in use.
+     */
+    unsigned generation_;
+};
+
+/**
+ * \brief Log a hardware event report, a line at a time.
+ *
+ * \param totals  the event counts.
+ * \param packets the number of packets processed for the counts.
+ */
+static void log_perf_report(const PerfCounters::Totals& totals, uint64_t packets)
+{
+    std::ostringstream os;
+    PerfCounters::write_report(os, totals, packets);
+    std::istringstream is(os.str());
+    std::string line;
+    while ( std::getline(is, line) )
+        LOG_INFO << " Perf    : " << line;
+}
+
 /**
  * \brief The main network capture loop. Read packets from the sniffer
  * and process them.
@@ -261,16 +820,50 @@ static void cbor_writer(std::unique_ptr<BlockCborWriter> out,
  *
  * The loop continues until the sniffer reports EOF.
  *
+ * If there are packet processing workers, packets to be decoded
+ * are passed to the workers. Otherwise they are decoded and matched
+ * in this thread. Partly filled batches of packets for workers are
+ * sent once a second, and when no packet has arrived for
+ * FlowWorkers::FLUSH_TIMEOUT.
+ *
+ * Changes to the live configuration are picked up as packets arrive,
+ * and passed on to the packet stream and the C-DNS writer.
+ *
+ * If there are pipeline metrics, statistics and queue lengths are
+ * published to them once a second. If replaying, they are also
+ * sampled for the replay report once a second. If counting hardware
+ * events, the periodic statistics log includes the events per
+ * million packets in each stage.
+ *
+ * If packets are retained, each packet is added to the retained
+ * packets. If malformed messages arrive faster than the configured
+ * rate, the retained packets are dumped once when the rate is first
+ * exceeded.
+ *
  * \param sniffer the Tins sniffer to read.
  * \param matcher the query/response matcher to use.
+ * \param workers the packet processing workers.
  * \param output  the output channels.
  * \param config  the current configuration.
- * \param stats   collect packet statistics here.
+ * \param live        the live configuration.
+ * \param compression the compression workers, if any.
+ * \param metrics     the pipeline metrics, if any.
+ * \param replay      the replay report, if replaying.
+ * \param perf        the performance counters, if any.
+ * \param retention   the retained packets, if any.
+ * \param stats       collect packet statistics here.
  */
 static void sniff_loop(BaseSniffers* sniffer,
                        QueryResponseMatcher& matcher,
+                       FlowWorkers& workers,
                        OutputChannels& output,
                        const Configuration& config,
+                       const LiveConfiguration& live,
+                       CompressionWorkers* compression,
+                       Metrics* metrics,
+                       ReplayReport* replay,
+                       PerfCounters* perf,
+                       PacketRetention* retention,
                        PacketStatistics& stats)
 {
     bool seen_raw_overflow = false;
@@ -298,8 +891,36 @@ static void sniff_loop(BaseSniffers* sniffer,
     sniffer->sniffer_stats(last_sniffer_stats);
     BaseSniffers::Stats last_drop_check_sniffer_stats = last_sniffer_stats;
 
+    CompressionWorkers::Stats last_compression_stats{};
+    if ( compression )
+        last_compression_stats = compression->stats();
+
+    PerfCounters::Totals last_perf_totals{};
+    if ( perf )
+        last_perf_totals = perf->totals();
+
     bool drops_last_check = false;
     bool sampling = false;
+    bool malformed_spike_last_check = false;
+    uint64_t last_retention_malformed = 0;
+    cno::system_clock::time_point last_retention_check;
+    FlowSampler sampler(config.sampling_rate);
+
+    std::atomic<unsigned> sniffer_queue(0);
+    std::atomic<unsigned> matcher_queue(0);
+    std::atomic<bool> sampling_on(false);
+    MetricsSource capture_metrics(
+        metrics,
+        [&](MetricsWriter& w)
+        {
+            const std::string name = "compactor_queue_length";
+            const std::string help = "Items waiting in a queue between threads.";
+            w.gauge(name, help, sniffer_queue.load(std::memory_order_relaxed), "queue=\"sniffer\"");
+            w.gauge(name, help, matcher_queue.load(std::memory_order_relaxed), "queue=\"matcher\"");
+            w.gauge(name, help, workers.queue_length(), "queue=\"worker\"");
+            w.gauge("compactor_sampling", "1 if sampling because of drops, otherwise 0.",
+                    sampling_on.load(std::memory_order_relaxed));
+        });
 
     auto dns_sink =
         [&](std::unique_ptr<DNSMessage>& dns)
@@ -310,20 +931,22 @@ static void sniff_loop(BaseSniffers* sniffer,
                 std::cout << *dns;
 
             if ( do_match )
+            {
+                PerfStageScope match(perf, PerfCounters::MATCH);
                 matcher.add(std::move(dns));
+            }
         };
 
     auto address_event_sink =
         [&](const std::shared_ptr<AddressEvent>& event)
         {
-            if ( !config.output_pattern.empty() )
-            {
-                CborItem cbi(event, stats);
-                if ( !output.cbor->put(cbi, false) )
-                {
-                    ++stats.output_cbor_drop_count;
-                }
-            }
+            output_address_event(event, output, config, stats, 0);
+        };
+
+    auto malformed_message_sink =
+        [&](const std::shared_ptr<MalformedMessage>& mm)
+        {
+            output_malformed_message(mm, output, config, stats, 0);
         };
 
     auto ignored_sink =
@@ -343,17 +966,39 @@ static void sniff_loop(BaseSniffers* sniffer,
             }
         };
 
-    PacketStream packet_stream(config, dns_sink, address_event_sink);
+    PacketStream packet_stream(config, dns_sink, address_event_sink, stats,
+                               malformed_message_sink);
+    unsigned generation = live.generation();
 
     for (;;)
     {
-        Tins::Packet pkt(sniffer->next_packet());
+        Tins::Packet pkt;
+        if ( workers.empty() )
+            pkt = sniffer->next_packet();
+        else
+        {
+            // Don't leave packets in partly filled worker batches
+            // while input is quiet.
+            while ( !sniffer->next_packet(pkt, FlowWorkers::FLUSH_TIMEOUT) )
+                workers.flush(stats);
+        }
         if ( !pkt.pdu() )
             break;
 
+        if ( live.generation() != generation )
+        {
+            generation = live.generation();
+            std::shared_ptr<const Configuration> snapshot = live.get();
+            packet_stream.set_configuration(snapshot);
+            if ( !config.output_pattern.empty() )
+                output.put_cbor(CborItem(snapshot, stats, 0), true);
+        }
+
         // Get the PDU controlled by a shared_ptr. This will avoid the need
         // to copy it.
         std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+        if ( metrics )
+            pcap->received = cno::steady_clock::now();
 
         ++stats.raw_packet_count;
 
@@ -374,22 +1019,28 @@ static void sniff_loop(BaseSniffers* sniffer,
             }
         }
 
+        if ( retention )
+            retention->add(pcap);
 
         if (matcher.get_length() > (config.max_channel_size * 2)) {
             ++stats.matcher_drop_count;
             matcher.poke(pcap->timestamp);
         }
-        // If we're dropping packets, respond by sampling. 
-        else if ( sampling && (stats.raw_packet_count % config.sampling_rate) != 0 ) {
+        // If we're dropping packets, respond by sampling. Sample by
+        // transaction, so queries and responses stay paired.
+        else if ( sampling && !packet_stream.sample_packet(pcap, sampler) ) {
             ++stats.discarded_sampling_count;
         } 
         else {
-            if ( do_decode )
+            if ( do_decode && !workers.empty() )
+                workers.dispatch(packet_stream.flow_hash(pcap), pcap, stats);
+            else if ( do_decode )
             {
                 bool ignored = false;
 
                 try
                 {
+                    PerfStageScope decode(perf, PerfCounters::DECODE);
                     packet_stream.process_packet(pcap);
                 }
                 catch (const unhandled_packet& e)
@@ -416,11 +1067,22 @@ static void sniff_loop(BaseSniffers* sniffer,
             sniffer->sniffer_stats(sniffer_stats);
             seen_raw_overflow = seen_ignored_overflow = false;
 
+            // Don't leave quiet workers waiting on a partial batch, and
+            // include worker statistics in the checks.
+            PacketStatistics total = stats;
+            if ( !workers.empty() )
+            {
+                workers.flush(stats);
+                workers.add_published_stats(total);
+                if ( !config.output_pattern.empty() )
+                    output.put_cbor(CborItem(stats, 0), false);
+            }
+
             uint64_t new_sniffs       = sniffer_stats.pkts_sniffed   - last_drop_check_sniffer_stats.pkts_sniffed;
-            uint64_t new_raw          = stats.raw_packet_count       - last_drop_check_stats.raw_packet_count;
+            uint64_t new_raw          = total.raw_packet_count       - last_drop_check_stats.raw_packet_count;
             uint64_t new_sniff_drops  = sniffer_stats.pkts_dropped   - last_drop_check_sniffer_stats.pkts_dropped;
-            uint64_t new_cbor_drops   = stats.output_cbor_drop_count - last_drop_check_stats.output_cbor_drop_count;
-            uint64_t new_match_drops  = stats.matcher_drop_count     - last_drop_check_stats.matcher_drop_count;
+            uint64_t new_cbor_drops   = total.output_cbor_drop_count - last_drop_check_stats.output_cbor_drop_count;
+            uint64_t new_match_drops  = total.matcher_drop_count     - last_drop_check_stats.matcher_drop_count;
             bool sniff_dropping = new_sniff_drops > new_sniffs * (config.sampling_threshold/100.0);
             bool cbor_dropping  = new_cbor_drops  > new_raw    * (config.sampling_threshold/100.0);
             bool match_dropping = new_match_drops > new_raw    * (config.sampling_threshold/100.0);
@@ -458,6 +1120,21 @@ static void sniff_loop(BaseSniffers* sniffer,
                 LOG_WARN << "Sampling mode switched off because time limit expired and not dropping above threshold.";
             }
 
+            // Dump retained packets when malformed messages spike.
+            if ( retention && config.retention_malformed_rate > 0 )
+            {
+                uint64_t new_malformed = total.malformed_message_count - last_retention_malformed;
+                cno::milliseconds interval = std::max(cno::duration_cast<cno::milliseconds>(last_recv_timestamp - last_retention_check),
+                                                      cno::milliseconds(1000));
+                bool malformed_spike = new_malformed * 1000 > config.retention_malformed_rate * static_cast<uint64_t>(interval.count());
+                if ( malformed_spike && !malformed_spike_last_check )
+                    retention->dump(std::to_string(new_malformed) + " malformed messages in "
+                                    + std::to_string(interval.count()) + "ms");
+                malformed_spike_last_check = malformed_spike;
+                last_retention_malformed = total.malformed_message_count;
+                last_retention_check = last_recv_timestamp;
+            }
+
             // Retrieve PCAP stats, if available.
             struct pcap_stat pcap_stat;
             if ( sniffer->pcap_stats(pcap_stat) )
@@ -470,6 +1147,23 @@ static void sniff_loop(BaseSniffers* sniffer,
             stats.sniffer_drop_count += new_sniff_drops;
             last_drop_check_sniffer_stats = sniffer_stats;
             last_drop_check_stats = last_stats;
+
+            if ( metrics )
+            {
+                total = stats;
+                workers.add_published_stats(total);
+                metrics->set_statistics(total);
+                sniffer_queue.store(sniffer_stats.channel_length, std::memory_order_relaxed);
+                matcher_queue.store(matcher.get_length() + workers.matcher_length(), std::memory_order_relaxed);
+                sampling_on.store(sampling, std::memory_order_relaxed);
+            }
+
+            if ( replay )
+                replay->sample(sniffer_stats.pkts_sniffed, sniffer_stats.pkts_dropped,
+                               total, sniffer_stats.channel_length,
+                               workers.queue_length(),
+                               matcher.get_length() + workers.matcher_length(),
+                               output.cbor_length());
         }
 
 
@@ -484,6 +1178,8 @@ static void sniff_loop(BaseSniffers* sniffer,
             else if ( next_statslog_timestamp <= last_recv_timestamp )
             {
                 int w = 10; //output width, big enough for interval numbers up to 5 billion pps
+                PacketStatistics total = stats;
+                workers.add_published_stats(total);
                 cno::seconds period = cno::duration_cast<cno::seconds>(last_recv_timestamp - last_statslog_timestamp);
 
                 struct pcap_stat pcap_stats;
@@ -504,36 +1200,70 @@ static void sniff_loop(BaseSniffers* sniffer,
                          << sniffer_stats.pkts_dropped - last_sniffer_stats.pkts_dropped << "/"  << std::setw(w)
                          << sniffer_stats.channel_length;
                 LOG_INFO << " Matcher : recv/dropped/queue     "                         << std::setw(w)
-                         << (stats.raw_packet_count  - last_stats.raw_packet_count)      << "/" << std::setw(w)
-                         << stats.matcher_drop_count - last_stats.matcher_drop_count     << "/" << std::setw(w)
-                         << matcher.get_length();
+                         << (total.raw_packet_count  - last_stats.raw_packet_count)      << "/" << std::setw(w)
+                         << total.matcher_drop_count - last_stats.matcher_drop_count     << "/" << std::setw(w)
+                         << matcher.get_length() + workers.matcher_length();
+                LOG_INFO << " TCP     : mem drop/limit drop    "                                           << std::setw(w)
+                         << total.tcp_flow_memory_drop_count - last_stats.tcp_flow_memory_drop_count << "/" << std::setw(w)
+                         << total.tcp_flow_limit_drop_count  - last_stats.tcp_flow_limit_drop_count;
+                LOG_INFO << " IP frag : reasm/timeout/dropped  "                                             << std::setw(w)
+                         << total.ip_fragment_reassembled_count - last_stats.ip_fragment_reassembled_count << "/" << std::setw(w)
+                         << total.ip_fragment_timeout_count     - last_stats.ip_fragment_timeout_count     << "/" << std::setw(w)
+                         << (total.ip_fragment_memory_drop_count + total.ip_fragment_bad_drop_count)
+                          - (last_stats.ip_fragment_memory_drop_count + last_stats.ip_fragment_bad_drop_count);
                 const char* sampling_text = sampling? "ON":"OFF";
                 if (config.sampling_rate > 0) {
                     LOG_INFO << " Sampling: recv/discard/state     "                                   << std::setw(w)
-                             << (stats.raw_packet_count         - last_stats.raw_packet_count)         << "/" << std::setw(w)
-                             << stats.discarded_sampling_count  - last_stats.discarded_sampling_count  << "/" << std::setw(w)
+                             << (total.raw_packet_count         - last_stats.raw_packet_count)         << "/" << std::setw(w)
+                             << total.discarded_sampling_count  - last_stats.discarded_sampling_count  << "/" << std::setw(w)
                              << sampling_text;
                 }
+                if ( config.shed_threshold > 0 )
+                {
+                    LOG_INFO << " Shed    : low/normal             "                                         << std::setw(w)
+                             << total.shed_low_priority_count    - last_stats.shed_low_priority_count    << "/" << std::setw(w)
+                             << total.shed_normal_priority_count - last_stats.shed_normal_priority_count;
+                }
                 LOG_INFO << " CDNS    : recv/dropped/queue     "                                       << std::setw(w)
-                         << stats.processed_message_count - last_stats.processed_message_count  << "/" << std::setw(w)
-                         << stats.output_cbor_drop_count  - last_stats.output_cbor_drop_count   << "/" << std::setw(w)
-                         << output.cbor->get_length();
-                uint64_t cdns_written = (stats.processed_message_count - last_stats.processed_message_count) -
-                                        (stats.output_cbor_drop_count  - last_stats.output_cbor_drop_count);
+                         << total.processed_message_count - last_stats.processed_message_count  << "/" << std::setw(w)
+                         << total.output_cbor_drop_count  - last_stats.output_cbor_drop_count   << "/" << std::setw(w)
+                         << output.cbor_length();
+                uint64_t cdns_written = (total.processed_message_count - last_stats.processed_message_count) -
+                                        (total.output_cbor_drop_count  - last_stats.output_cbor_drop_count) -
+                                        (total.shed_low_priority_count + total.shed_normal_priority_count) +
+                                        (last_stats.shed_low_priority_count + last_stats.shed_normal_priority_count);
                 int tp = std::lround(cdns_written * 100.0 / (pcap_stats.ps_recv   - last_pcap_stats.ps_recv));
                 LOG_INFO << " CDNS out: writ/% traffic         "                                       << std::setw(w)
                          << cdns_written        << "/" << std::setw(w)
                          << std::min(tp, 100)   << "/" << std::setw(w)
                          << "";
                 LOG_INFO << " PCAP out: raw drop/ignored drop  "                                                     << std::setw(w)
-                         << stats.output_raw_pcap_drop_count     - last_stats.output_raw_pcap_drop_count     << "/"  << std::setw(w)
-                         << stats.output_ignored_pcap_drop_count - last_stats.output_ignored_pcap_drop_count << "/"  << std::setw(w);
+                         << total.output_raw_pcap_drop_count     - last_stats.output_raw_pcap_drop_count     << "/"  << std::setw(w)
+                         << total.output_ignored_pcap_drop_count - last_stats.output_ignored_pcap_drop_count << "/"  << std::setw(w);
+                if ( compression )
+                {
+                    CompressionWorkers::Stats compression_stats = compression->stats();
+                    uint64_t jobs = compression_stats.completed - last_compression_stats.completed;
+                    cno::microseconds job_time = compression_stats.total_time - last_compression_stats.total_time;
+                    LOG_INFO << " Compress: queue/raw/avg ms       "                                   << std::setw(w)
+                             << compression_stats.queue_length                                      << "/" << std::setw(w)
+                             << compression_stats.rejected - last_compression_stats.rejected        << "/" << std::setw(w)
+                             << ( jobs > 0 ? job_time.count() / jobs / 1000 : 0 );
+                    last_compression_stats = compression_stats;
+                }
+                if ( perf )
+                {
+                    PerfCounters::Totals perf_totals = perf->totals();
+                    log_perf_report(perf_totals - last_perf_totals,
+                                    total.raw_packet_count - last_stats.raw_packet_count);
+                    last_perf_totals = perf_totals;
+                }
                 LOG_INFO << "";
 
                 // Update time/state
                 next_statslog_timestamp = last_recv_timestamp + cno::seconds(config.log_network_stats_period);
                 last_statslog_timestamp = last_recv_timestamp;
-                last_stats          = stats;
+                last_stats          = total;
                 last_pcap_stats     = pcap_stats;
                 last_sniffer_stats = sniffer_stats;
             }
@@ -542,6 +1272,51 @@ static void sniff_loop(BaseSniffers* sniffer,
 
 }
 
+/**
+ * \brief Finish a replay report and write it.
+ *
+ * Take a final sample, so short replays are reported, and write the
+ * summary to standard output and the samples to the replay report
+ * file, if any.
+ *
+ * \param replay  the replay report.
+ * \param sniffer the replay sniffer.
+ * \param matcher the query/response matcher.
+ * \param workers the packet processing workers.
+ * \param output  the output channels.
+ * \param config  the current configuration.
+ * \param stats   the packet statistics.
+ */
+static void write_replay_report(ReplayReport& replay,
+                                BaseSniffers& sniffer,
+                                QueryResponseMatcher& matcher,
+                                FlowWorkers& workers,
+                                OutputChannels& output,
+                                const Configuration& config,
+                                const PacketStatistics& stats)
+{
+    BaseSniffers::Stats sniffer_stats;
+    sniffer.sniffer_stats(sniffer_stats);
+    PacketStatistics total = stats;
+    workers.add_published_stats(total);
+    replay.sample(sniffer_stats.pkts_sniffed, sniffer_stats.pkts_dropped,
+                  total, sniffer_stats.channel_length,
+                  workers.queue_length(),
+                  matcher.get_length() + workers.matcher_length(),
+                  output.cbor_length());
+
+    replay.write_summary(std::cout);
+
+    if ( !config.replay_report.empty() )
+    {
+        std::ofstream ofs(config.replay_report);
+        if ( ofs.is_open() )
+            replay.write_samples(ofs);
+        else
+            LOG_ERROR << "Can't write replay report " << config.replay_report;
+    }
+}
+
 #if ENABLE_DNSTAP
 /**
  * \brief The main DNSTAP loop. Read packets from the input stream
@@ -555,17 +1330,22 @@ static void sniff_loop(BaseSniffers* sniffer,
  * \param stream  the input stream to read.
  * \param matcher the query/response matcher to use.
  * \param config  the current configuration.
+ * \param metrics the pipeline metrics, if any.
+ * \param perf    the performance counters, if any.
  * \param stats   collect packet statistics here.
  */
 static void tap_loop(DnsTap& dnstap,
                      std::iostream& stream,
                      QueryResponseMatcher& matcher,
                      const Configuration& config,
+                     Metrics* metrics,
+                     PerfCounters* perf,
                      PacketStatistics& stats)
 {
     cno::system_clock::time_point last_recv_timestamp;
     cno::system_clock::time_point next_statslog_timestamp;
     cno::system_clock::time_point last_statslog_timestamp;
+    cno::system_clock::time_point next_metrics_timestamp;
     PacketStatistics last_stats = stats;
 
     auto sink = [&](std::unique_ptr<DNSMessage>& dns)
@@ -578,7 +1358,16 @@ static void tap_loop(DnsTap& dnstap,
         last_recv_timestamp = dns->timestamp;
         if ( config.debug_dns )
             std::cout << *dns;
-        matcher.add(std::move(dns));
+        {
+            PerfStageScope match(perf, PerfCounters::MATCH);
+            matcher.add(std::move(dns));
+        }
+
+        if ( metrics && next_metrics_timestamp <= last_recv_timestamp )
+        {
+            metrics->set_statistics(stats);
+            next_metrics_timestamp = last_recv_timestamp + std::chrono::seconds(1);
+        }
 
         if ( config.log_network_stats_period > 0 )
         {
@@ -614,24 +1403,35 @@ static void tap_loop(DnsTap& dnstap,
 /**
  * \brief Create an output PCAP writer with configured compression options.
  *
- * \param fname  filename pattern.
- * \param config configuration.
+ * Compressed output is written uncompressed and then compressed
+ * by the compression workers.
+ *
+ * \param fname       filename pattern.
+ * \param config      configuration.
+ * \param compression the compression workers.
  * \returns pointer to new writer.
  */
-static std::unique_ptr<PcapBaseRotatingWriter> make_pcap_writer(const std::string& pattern, const Configuration& config)
+static std::unique_ptr<PcapBaseRotatingWriter> make_pcap_writer(const std::string& pattern,
+                                                                const Configuration& config,
+                                                                std::shared_ptr<CompressionWorkers> compression)
 {
+    std::shared_ptr<BaseParallelWriterPool> pool;
+
     if ( config.xz_pcap )
-        return make_unique<PcapRotatingWriter<XzStreamWriter>>(pattern,
-                                                               std::chrono::seconds(config.rotation_period),
-                                                               config.xz_preset_pcap,
-                                                               config.snaplen,
-                                                               config.log_file_handling);
+        pool = std::make_shared<ParallelWriterPool<XzStreamWriter>>(compression, config.xz_preset_pcap, config.log_file_handling);
     else if ( config.gzip_pcap )
-        return make_unique<PcapRotatingWriter<GzipStreamWriter>>(pattern,
-                                                                 std::chrono::seconds(config.rotation_period),
-                                                                 config.gzip_level_pcap,
-                                                                 config.snaplen,
-                                                                 config.log_file_handling);
+        pool = std::make_shared<ParallelWriterPool<GzipStreamWriter>>(compression, config.gzip_level_pcap, config.log_file_handling);
+
+    if ( pool )
+    {
+        if ( config.min_compression_level )
+            pool->set_min_level(*config.min_compression_level, config.rotation_period);
+        return make_unique<PcapParallelRotatingWriter>(pattern,
+                                                       std::chrono::seconds(config.rotation_period),
+                                                       config.snaplen,
+                                                       pool,
+                                                       config.log_file_handling);
+    }
     else
         return make_unique<PcapRotatingWriter<StreamWriter>>(pattern,
                                                              std::chrono::seconds(config.rotation_period),
@@ -640,26 +1440,250 @@ static std::unique_ptr<PcapBaseRotatingWriter> make_pcap_writer(const std::strin
                                                              config.log_file_handling);
 }
 
+/**
+ * \brief Return the PCAP file extension for the configured compression.
+ *
+ * \param config configuration.
+ */
+static std::string pcap_extension(const Configuration& config)
+{
+    if ( config.xz_pcap )
+        return XzStreamWriter::suggested_extension();
+    else if ( config.gzip_pcap )
+        return GzipStreamWriter::suggested_extension();
+    else
+        return StreamWriter::suggested_extension();
+}
+
+/**
+ * \brief Create a writer for a single PCAP file with configured
+ * compression options.
+ *
+ * Compressed output is compressed by the writing thread.
+ *
+ * \param filename the output filename.
+ * \param config   configuration.
+ * \returns pointer to new writer.
+ */
+static std::unique_ptr<PcapBaseWriter> make_pcap_file_writer(const std::string& filename,
+                                                             const Configuration& config)
+{
+    if ( config.xz_pcap )
+        return make_unique<PcapWriter<XzStreamWriter>>(filename,
+                                                       config.xz_preset_pcap,
+                                                       config.snaplen,
+                                                       config.log_file_handling);
+    else if ( config.gzip_pcap )
+        return make_unique<PcapWriter<GzipStreamWriter>>(filename,
+                                                         config.gzip_level_pcap,
+                                                         config.snaplen,
+                                                         config.log_file_handling);
+    else
+        return make_unique<PcapWriter<StreamWriter>>(filename,
+                                                     0,
+                                                     config.snaplen,
+                                                     config.log_file_handling);
+}
+
+/**
+ * \brief Set the CPUs for each thread role.
+ *
+ * Placements from any previous configuration are replaced, and
+ * running threads moved to their new CPUs.
+ *
+ * \param config the configuration.
+ * \throws std::invalid_argument if the CPUs are not available.
+ * \throws po::error if the CPUs local to the capture interface are not known.
+ */
+static void set_thread_cpus(const Configuration& config)
+{
+    std::map<std::string, std::vector<unsigned>> cpus;
+    for ( const auto& t : config.thread_cpus )
+        cpus["comp:" + t.first] = config.thread_cpu_list(t.first);
+    if ( !set_thread_placements(cpus) )
+        LOG_WARN << "Unable to move running threads to new CPUs";
+}
+
+/**
+ * \brief Create a pool for compressing C-DNS output.
+ *
+ * \param config      the output configuration.
+ * \param compression the compression workers.
+ * \returns pointer to new pool.
+ */
+static std::shared_ptr<BaseParallelWriterPool> make_cdns_writer_pool(const Configuration& config,
+                                                                    std::shared_ptr<CompressionWorkers> compression)
+{
+    std::shared_ptr<BaseParallelWriterPool> pool;
+
+    if ( config.xz_output )
+        pool = std::make_shared<ParallelWriterPool<XzStreamWriter>>(compression, config.xz_preset, config.log_file_handling);
+    else if ( config.gzip_output )
+        pool = std::make_shared<ParallelWriterPool<GzipStreamWriter>>(compression, config.gzip_level, config.log_file_handling);
+    else
+        pool = std::make_shared<ParallelWriterPool<StreamWriter>>(compression, 0, config.log_file_handling);
+
+    if ( config.min_compression_level )
+        pool->set_min_level(*config.min_compression_level, config.rotation_period);
+    return pool;
+}
+
+/**
+ * \brief Make sure there is a C-DNS compression pool for each additional output.
+ *
+ * Pools, like the compression workers, persist over a restart. An
+ * output added by a restart gets a new pool. The compression used
+ * by an existing pool does not change.
+ *
+ * \param config       the configuration.
+ * \param compression  the compression workers, created if needed.
+ * \param writer_pools the pools, the main output pool first.
+ */
+static void add_cdns_writer_pools(const Configuration& config,
+                                  std::shared_ptr<CompressionWorkers>& compression,
+                                  std::vector<std::shared_ptr<BaseParallelWriterPool>>& writer_pools)
+{
+    if ( !config.output_definitions.empty() && !compression )
+        compression = std::make_shared<CompressionWorkers>(config.max_compression_threads,
+                                                           config.max_compression_queue);
+
+    for ( std::size_t i = writer_pools.size(); i <= config.output_definitions.size(); ++i )
+        writer_pools.push_back(make_cdns_writer_pool(*config.output_definitions[i - 1], compression));
+}
+
+/**
+ * \brief Read a new configuration and apply it to a running capture.
+ *
+ * If the new configuration only changes settings that can be
+ * changed while capture continues, make it the live configuration.
+ * Errors reading the new configuration are logged, and capture
+ * continues with the current configuration.
+ *
+ * \param read_config  read the new configuration.
+ * \param live         the live configuration.
+ * \param sniffer      the running sniffer.
+ * \param writer_pools pools of compression threads for each C-DNS output.
+ *                     An entry may be empty.
+ * \returns `false` if the new configuration requires a restart.
+ */
+static bool reload_configuration(const ConfigurationReader& read_config,
+                                 LiveConfiguration& live,
+                                 BaseSniffers& sniffer,
+                                 const std::vector<std::shared_ptr<BaseParallelWriterPool>>& writer_pools)
+{
+    std::shared_ptr<const Configuration> next;
+
+    try
+    {
+        next = read_config();
+    }
+    catch (const po::error& err)
+    {
+        LOG_ERROR << "Configuration not reloaded: " << err.what();
+        return true;
+    }
+
+    std::shared_ptr<const Configuration> current = live.get();
+    if ( current->needs_restart(*next) )
+        return false;
+
+    try
+    {
+        if ( next->filter != current->filter )
+            sniffer.set_filter(next->filter);
+    }
+    catch (const Tins::invalid_pcap_filter& err)
+    {
+        LOG_ERROR << "Configuration not reloaded: Invalid PCAP filter: " << err.what();
+        return true;
+    }
+
+    for ( std::size_t i = 0; i < writer_pools.size() && i <= next->output_definitions.size(); ++i )
+    {
+        if ( !writer_pools[i] )
+            continue;
+
+        // Setting the level resets the adaptive level, so only do
+        // so if the setting has changed.
+        const Configuration& cur = ( i == 0 ) ? *current : *current->output_definitions[i - 1];
+        const Configuration& out = ( i == 0 ) ? *next : *next->output_definitions[i - 1];
+        unsigned cur_level = cur.xz_output ? cur.xz_preset : cur.gzip_level;
+        unsigned level = out.xz_output ? out.xz_preset : out.gzip_level;
+        if ( level != cur_level )
+            writer_pools[i]->set_level(level);
+        if ( level != cur_level ||
+             out.min_compression_level != cur.min_compression_level ||
+             out.rotation_period != cur.rotation_period )
+            writer_pools[i]->set_min_level(out.min_compression_level ? *out.min_compression_level : level,
+                                           out.rotation_period);
+    }
+
+    live.set(next);
+    LOG_INFO << "Configuration reloaded";
+    return true;
+}
+
 /**
  * \brief Do a collection run using the given configuration.
  *
+ * On SIGHUP during network capture, settings that can be changed
+ * without stopping capture are applied live. If other settings
+ * have changed, the run is ended so it can be restarted.
+ *
  * \param vm          the configuration variable map.
  * \param config      the configuration values.
+ * \param read_config read a new configuration.
  * \param threads     a vector for all program threads.
- * \param writer_pool pool of compression threads.
+ * \param compression the compression workers.
+ * \param writer_pools pools for compressing each C-DNS output.
+ * \param sender      sender for C-DNS output to a socket. May be empty.
+ * \param metrics     the pipeline metrics. May be empty.
+ * \param perf        the performance counters. May be empty.
+ * \param retention   the retained packets. May be empty.
  * \returns 0 on normal exit, 1 on SIGHUP, 2 on SIGINT, 3 on sniffer error.
  */
 static int run_configuration(const po::variables_map& vm,
                              const Configuration& config,
+                             const ConfigurationReader& read_config,
                              std::vector<std::thread>& threads,
-                             std::shared_ptr<BaseParallelWriterPool> writer_pool)
+                             std::shared_ptr<CompressionWorkers> compression,
+                             std::vector<std::shared_ptr<BaseParallelWriterPool>>& writer_pools,
+                             std::shared_ptr<BlockCborSender> sender,
+                             std::shared_ptr<Metrics> metrics,
+                             std::shared_ptr<PerfCounters> perf,
+                             std::shared_ptr<PacketRetention> retention)
 {
+    // The configuration for settings that may change during the run.
+    std::shared_ptr<LiveConfiguration> live = std::make_shared<LiveConfiguration>(config);
+
     // Output channels for this run.
     OutputChannels output;
     bool live_capture = false;
 
-    // Signal handling.
-    SignalHandler signal_handler({SIGPIPE, SIGINT, SIGTERM, SIGHUP, SIGUSR1});
+    for ( std::size_t i = 0; i < config.output_definitions.size(); ++i )
+        output.extra_cbor.push_back(std::make_shared<Channel<CborItem>>());
+
+    MetricsSource output_metrics(
+        metrics.get(),
+        [&output](MetricsWriter& w)
+        {
+            const std::string name = "compactor_queue_length";
+            const std::string help = "Items waiting in a queue between threads.";
+            w.gauge(name, help, output.cbor->get_length(), "queue=\"cdns\"");
+            for ( std::size_t i = 0; i < output.extra_cbor.size(); ++i )
+                w.gauge(name, help, output.extra_cbor[i]->get_length(),
+                        "queue=\"cdns-" + std::to_string(i + 1) + "\"");
+            w.gauge(name, help, output.raw_pcap->get_length(), "queue=\"raw_pcap\"");
+            w.gauge(name, help, output.ignored_pcap->get_length(), "queue=\"ignored_pcap\"");
+        });
+
+    // Signal handling. SIGUSR2 dumps retained packets. DNSTAP capture
+    // uses it to interrupt reads, so it is only handled here when
+    // packets are retained.
+    std::vector<int> signals = {SIGPIPE, SIGINT, SIGTERM, SIGHUP, SIGUSR1};
+    if ( retention )
+        signals.push_back(SIGUSR2);
+    SignalHandler signal_handler(signals);
     int signal_received = 0;
 
     // Set output limits only when we're capturing. If we set them
@@ -670,7 +1694,7 @@ static int run_configuration(const po::variables_map& vm,
         live_capture = true;
         output.raw_pcap->set_max_items(config.max_channel_size);
         output.ignored_pcap->set_max_items(config.max_channel_size);
-        output.cbor->set_max_items(config.max_channel_size);
+        output.set_cbor_max_items(config.max_channel_size);
     }
 
 
@@ -678,26 +1702,43 @@ static int run_configuration(const po::variables_map& vm,
          !config.raw_pcap_pattern.empty() )
     {
         std::unique_ptr<PcapBaseRotatingWriter> raw_pcap =
-            make_pcap_writer(config.raw_pcap_pattern, config);
-        threads.emplace_back(packet_writer, "comp:raw-pcap", std::move(raw_pcap), output.raw_pcap, std::ref(config));
+            make_pcap_writer(config.raw_pcap_pattern, config, compression);
+        threads.emplace_back(packet_writer, "comp:raw-pcap", std::move(raw_pcap), output.raw_pcap, live);
     }
 
     if ( vm.count("ignored-pcap") &&
          !config.ignored_pcap_pattern.empty() )
     {
         std::unique_ptr<PcapBaseRotatingWriter> ignored_pcap =
-            make_pcap_writer(config.ignored_pcap_pattern, config);
-        threads.emplace_back(packet_writer, "comp:ign-pcap", std::move(ignored_pcap), output.ignored_pcap, std::ref(config));
+            make_pcap_writer(config.ignored_pcap_pattern, config, compression);
+        threads.emplace_back(packet_writer, "comp:ign-pcap", std::move(ignored_pcap), output.ignored_pcap, live);
     }
 
     if ( vm.count("output") && !config.output_pattern.empty() )
     {
         std::unique_ptr<CborBaseStreamFileEncoder> encoder;
-        encoder = make_unique<CborParallelStreamFileEncoder>(writer_pool);
+        if ( sender )
+            encoder = make_unique<CborSenderEncoder>(sender);
+        else
+            encoder = make_unique<CborParallelStreamFileEncoder>(writer_pools[0]);
 
         std::unique_ptr<BlockCborWriter> cbor =
             make_unique<BlockCborWriter>(config, std::move(encoder), live_capture);
-        threads.emplace_back(cbor_writer, std::move(cbor), output.cbor);
+        threads.emplace_back(cbor_writer, std::move(cbor), output.cbor, metrics, perf.get(), config.max_block_items, 0);
+
+        // Additional outputs share the query/responses sent to the
+        // main output. Pipeline metrics are for the main output only.
+        for ( std::size_t i = 0; i < config.output_definitions.size(); ++i )
+        {
+            std::shared_ptr<const Configuration> def =
+                output_configuration(live->get(), i + 1);
+            std::unique_ptr<BlockCborWriter> extra =
+                make_unique<BlockCborWriter>(*def,
+                                             make_unique<CborParallelStreamFileEncoder>(writer_pools[i + 1]),
+                                             live_capture);
+            threads.emplace_back(cbor_writer, std::move(extra), output.extra_cbor[i],
+                                 std::shared_ptr<Metrics>(), perf.get(), def->max_block_items, i + 1);
+        }
     }
 
     SniffersConfiguration sniff_config;
@@ -710,33 +1751,28 @@ static int run_configuration(const po::variables_map& vm,
 
     PacketStatistics stats{};
 
+    LoadShedder shedder(config.shed_threshold, config.shed_common_rr_types, stats);
     QueryResponseMatcher matcher(
         [&](std::shared_ptr<QueryResponse> qr)
         {
-            if ( qr->has_query() )
-            {
-                if ( !qr->has_response() )
-                    ++stats.query_without_response_count;
-                else
-                    ++stats.qr_pair_count;
-            }
-            else
-                ++stats.response_without_query_count;
-
-            if ( config.debug_qr )
-                std::cout << *qr;
-            if ( !config.output_pattern.empty() )
-            {
-                CborItem cbi(qr, stats);
-                if ( !output.cbor->put(cbi, false) )
-                {
-                    ++stats.output_cbor_drop_count;
-                }
-            }
+            output_qr(qr, output, config, stats, shedder, 0, metrics.get());
         });
     matcher.set_query_timeout(config.query_timeout);
     matcher.set_skew_timeout(config.skew_timeout);
 
+    // Debug output from multiple threads would be interleaved, so
+    // only use workers if not printing debug output.
+    unsigned nworkers = config.worker_threads;
+    if ( config.debug_dns || config.debug_qr )
+        nworkers = 0;
+    FlowWorkers workers(
+        nworkers, config.max_channel_size, live_capture,
+        [&](unsigned source, PacketStatistics& worker_stats)
+        {
+            return make_unique<MatchingProcessor>(source, worker_stats, output, config, *live,
+                                                  metrics.get(), perf.get());
+        });
+
     // We assume that network or DNSTAP capture is typically a daemon
     // process, and log errors. File conversion, on the other hand,
     // is typically a manual process, and so errors go to stderr.
@@ -782,14 +1818,14 @@ static int run_configuration(const po::variables_map& vm,
                         } else {
                           LOG_INFO << "Forcing C-DNS file rotation on SIGUSR1";
                           CborItem empty_cbi;
-                          output.cbor->put(empty_cbi, true);
+                          output.put_cbor(empty_cbi, true);
                         }
                     });
 
                 std::function<void (const boost::system::error_code&)> handle_accept = [&](const boost::system::error_code&)
                 {
                     if ( signal_received == 0 )
-                        tap_loop(dnstap, stream, matcher, config, stats);
+                        tap_loop(dnstap, stream, matcher, config, metrics.get(), perf.get(), stats);
                     acceptor.async_accept(*stream.rdbuf(), handle_accept);
                 };
                 acceptor.async_accept(*stream.rdbuf(), handle_accept);
@@ -799,22 +1835,49 @@ static int run_configuration(const po::variables_map& vm,
             else
 #endif
             {
-                LOG_INFO << "Starting network capture";
-                NetworkSniffers sniffer(config.network_interfaces, sniff_config);
+                std::unique_ptr<BaseSniffers> sniffer;
+                std::unique_ptr<ReplayReport> replay;
+                if ( vm.count("replay-file") )
+                {
+                    LOG_INFO << "Starting replay of " << config.replay_file;
+                    sniffer = make_unique<ReplaySniffer>(config.replay_file, sniff_config,
+                                                         config.replay_rate,
+                                                         config.replay_ramp,
+                                                         config.replay_speedup,
+                                                         cno::seconds(config.replay_duration));
+                    replay = make_unique<ReplayReport>();
+                }
+                else
+                {
+                    LOG_INFO << "Starting network capture";
+                    sniffer = make_unique<NetworkSniffers>(config.network_interfaces, sniff_config);
+                }
                 signal_handler.add_handler(
                     [&](int signal)
                     {
+                        LOG_INFO << "Signal handler: Received - " << strsignal(signal);
+                        if ( signal == SIGUSR2 )
+                        {
+                            retention->dump("SIGUSR2");
+                            return;
+                        }
+                        if ( signal == SIGHUP &&
+                             reload_configuration(read_config, *live, *sniffer, writer_pools) )
+                            return;
+
                         signal_received = signal;
-                        LOG_INFO << "Signal handler: Received - " << strsignal(signal_received);
                         if (signal_received != SIGUSR1)
-                          sniffer.breakloop();
+                          sniffer->breakloop();
                         else {
                           LOG_INFO << "Forcing C-DNS file rotation on SIGUSR1";
                           CborItem empty_cbi;
-                          output.cbor->put(empty_cbi, true);
+                          output.put_cbor(empty_cbi, true);
                         }
                     });
-                sniff_loop(&sniffer, matcher, output, config, stats);
+                sniff_loop(sniffer.get(), matcher, workers, output, config, *live, compression.get(), metrics.get(), replay.get(), perf.get(), retention.get(), stats);
+
+                if ( replay )
+                    write_replay_report(*replay, *sniffer, matcher, workers, output, config, stats);
             }
         }
         else
@@ -833,7 +1896,7 @@ static int run_configuration(const po::variables_map& vm,
                                 signal_received = signal;
                                 dnstap.breakloop();
                             });
-                        tap_loop(dnstap, stream, matcher, config, stats);
+                        tap_loop(dnstap, stream, matcher, config, metrics.get(), perf.get(), stats);
                     }
                     else
                         std::cerr << "Failed to open " << fname << std::endl;
@@ -848,7 +1911,7 @@ static int run_configuration(const po::variables_map& vm,
                             signal_received = signal;
                             sniffer.breakloop();
                         });
-                    sniff_loop(&sniffer, matcher, output, config, stats);
+                    sniff_loop(&sniffer, matcher, workers, output, config, *live, compression.get(), metrics.get(), nullptr, perf.get(), nullptr, stats);
                 }
                 if ( signal_received != 0 )
                     break;
@@ -926,11 +1989,18 @@ static int run_configuration(const po::variables_map& vm,
         break;
     }
 
-    matcher.flush();
+    {
+        PerfStageScope match(perf.get(), PerfCounters::MATCH);
+        matcher.flush();
+    }
+    workers.close();
+    workers.add_stats(stats);
+    if ( perf )
+        perf->add_packets(stats.raw_packet_count);
 
     output.raw_pcap->close();
     output.ignored_pcap->close();
-    output.cbor->close();
+    output.close_cbor();
 
     if ( config.report_info )
     {
@@ -988,6 +2058,7 @@ int main(int ac, char *av[])
 #if ENABLE_DNSTAP
              !!vm.count("dnstap-socket") +
 #endif
+             !!vm.count("replay-file") +
              !!vm.count("capture-file") != 1 )
         {
             std::cerr
@@ -995,6 +2066,7 @@ int main(int ac, char *av[])
 #if ENABLE_DNSTAP
                 << "OR a DNSTAP socket,"
 #endif
+                << "\n\tOR a capture file to replay as live capture,"
                 << "\n\tOR some capture files to replay. Run '"
                 << PROGNAME << " -h' for help.\n";
             return 1;
@@ -1033,6 +2105,12 @@ int main(int ac, char *av[])
                 << "Error:\tSampling time must be greater than 10.\n";
             return 1;
         }
+        if ( configuration.shed_threshold > 100 )
+        {
+            std::cerr
+                << "Error:\tShed threshold must be in range 0 to 100.\n";
+            return 1;
+        }
 
         // Disable collection stats logging and disable logging
         // the hostname if reading from file.
@@ -1043,41 +2121,270 @@ int main(int ac, char *av[])
         }
         LOG_INFO << "Compactor v" << PACKAGE_VERSION << " initializing...";
 
+        // Set thread CPUs before starting any threads, so that
+        // memory allocated by each thread is local to its CPUs.
+        try
+        {
+            set_thread_cpus(configuration);
+        }
+        catch (const std::invalid_argument& err)
+        {
+            std::cerr << "Error:\t" << err.what() << "\n";
+            return 1;
+        }
+        if ( !place_thread("comp:main") )
+            LOG_WARN << "Unable to set CPUs for main thread";
+
+        // Packets are only retained during network capture. SIGUSR2
+        // dumps them, so block it before starting any threads. Only
+        // the signal handling thread will then receive it.
+        bool retain_packets = !configuration.retention_pcap_pattern.empty() &&
+            !vm.count("capture-file") && !vm.count("dnstap-socket");
+
+        if ( retain_packets )
+        {
+            sigset_t usr2;
+            sigemptyset(&usr2);
+            sigaddset(&usr2, SIGUSR2);
+            ::pthread_sigmask(SIG_BLOCK, &usr2, nullptr);
+        }
+
         // To enable a SIGHUP to not lose data, file compression
         // must survive the restart. That means compression
         // management must be outside the individual collection run.
+        std::shared_ptr<CompressionWorkers> compression;
         std::shared_ptr<BaseParallelWriterPool> writer_pool;
 
-        if ( vm.count("output") && !configuration.output_pattern.empty() )
+        bool cdns_files = vm.count("output") && !configuration.output_pattern.empty() &&
+            configuration.output_socket.empty();
+
+        if ( cdns_files || configuration.xz_pcap || configuration.gzip_pcap )
+            compression = std::make_shared<CompressionWorkers>(configuration.max_compression_threads,
+                                                               configuration.max_compression_queue);
+
+        if ( cdns_files )
+            writer_pool = make_cdns_writer_pool(configuration, compression);
+
+        // One pool for each C-DNS output, the main output first.
+        std::vector<std::shared_ptr<BaseParallelWriterPool>> writer_pools = { writer_pool };
+        add_cdns_writer_pools(configuration, compression, writer_pools);
+
+        // The C-DNS output sender also persists over a restart, so
+        // blocks waiting to be sent are not lost.
+        std::shared_ptr<BlockCborSender> sender;
+
+        if ( vm.count("output") && !configuration.output_pattern.empty() &&
+             !configuration.output_socket.empty() )
         {
-            if ( configuration.xz_output )
+            try
             {
-                writer_pool = std::make_shared<ParallelWriterPool<XzStreamWriter>>(configuration.max_compression_threads, configuration.xz_preset, configuration.log_file_handling);
+                sender = std::make_shared<BlockCborSender>(configuration.output_socket,
+                                                           configuration.output_spool,
+                                                           configuration.output_queue);
             }
-            else if ( configuration.gzip_output )
+            catch (const std::runtime_error& err)
             {
-                writer_pool = std::make_shared<ParallelWriterPool<GzipStreamWriter>>(configuration.max_compression_threads, configuration.gzip_level, configuration.log_file_handling);
+                LOG_ERROR << "Can't send C-DNS output to " << configuration.output_socket << ": " << err.what();
+                std::cerr << "Error:\tCan't send C-DNS output to " << configuration.output_socket
+                          << ": " << err.what() << "\n";
+                return 1;
             }
-            else
+        }
+
+        // Metrics, like compression, persist over a restart, and
+        // are only kept when capturing.
+        std::shared_ptr<Metrics> metrics;
+        std::unique_ptr<MetricsServer> metrics_server;
+
+        if ( !configuration.metrics_socket.empty() && !vm.count("capture-file") )
+        {
+            metrics = std::make_shared<Metrics>();
+            try
+            {
+                metrics_server = make_unique<MetricsServer>(metrics, configuration.metrics_socket);
+            }
+            catch (const boost::system::system_error& err)
+            {
+                LOG_ERROR << "Can't serve metrics on " << configuration.metrics_socket << ": " << err.what();
+                std::cerr << "Error:\tCan't serve metrics on " << configuration.metrics_socket
+                          << ": " << err.what() << "\n";
+                return 1;
+            }
+        }
+
+        // Retained packets also persist over a restart, so packets
+        // from before the restart can still be dumped.
+        std::shared_ptr<PacketRetention> retention;
+        if ( retain_packets )
+        {
+            Configuration retention_config(configuration);
+            retention = std::make_shared<PacketRetention>(
+                configuration.retention_period,
+                configuration.retention_size.size,
+                configuration.retention_pcap_pattern + pcap_extension(configuration),
+                [retention_config](const std::string& filename)
+                {
+                    return make_pcap_file_writer(filename, retention_config);
+                },
+                configuration);
+        }
+
+        std::unique_ptr<ControlServer> control_server;
+
+        if ( !configuration.control_socket.empty() && !vm.count("capture-file") )
+        {
+            try
+            {
+                control_server = make_unique<ControlServer>(configuration.control_socket);
+            }
+            catch (const boost::system::system_error& err)
+            {
+                LOG_ERROR << "Can't accept control commands on " << configuration.control_socket << ": " << err.what();
+                std::cerr << "Error:\tCan't accept control commands on " << configuration.control_socket
+                          << ": " << err.what() << "\n";
+                return 1;
+            }
+
+            if ( retention )
+                control_server->add_command(
+                    "dump-packets",
+                    [retention]()
+                    {
+                        return retention->dump("control command")
+                            ? "Dumping retained packets"
+                            : "Retained packets not dumped";
+                    });
+        }
+
+        MetricsSource retention_metrics(
+            retention ? metrics.get() : nullptr,
+            [retention](MetricsWriter& w)
+            {
+                PacketRetention::Stats s = retention->stats();
+                w.gauge("compactor_retained_packets", "Captured packets retained for dumps.", s.packets);
+                w.gauge("compactor_retained_bytes", "Bytes of captured packets retained for dumps.", s.bytes);
+                w.counter("compactor_retention_dumps_total", "Dumps of retained packets written.", s.dumps);
+                w.counter("compactor_retention_dumped_packets_total", "Retained packets written by dumps.", s.dumped_packets);
+            });
+
+        // Hardware event counts, like metrics, persist over a restart.
+        std::shared_ptr<PerfCounters> perf;
+        if ( configuration.perf_counters )
+        {
+            try
+            {
+                perf = std::make_shared<PerfCounters>();
+            }
+            catch (const std::runtime_error& err)
             {
-                writer_pool = std::make_shared<ParallelWriterPool<StreamWriter>>(configuration.max_compression_threads, 0, configuration.log_file_handling);
+                LOG_ERROR << "Can't count hardware events: " << err.what();
+                std::cerr << "Error:\tCan't count hardware events: " << err.what() << "\n";
+                return 1;
             }
         }
 
+        MetricsSource perf_metrics(
+            perf ? metrics.get() : nullptr,
+            [perf](MetricsWriter& w)
+            {
+                PerfCounters::Totals totals = perf->totals();
+                for ( unsigned s = 0; s < PerfCounters::STAGES; ++s )
+                    for ( unsigned c = 0; c < PerfCounters::COUNTERS; ++c )
+                        w.counter("compactor_perf_events_total", "Hardware events counted in a pipeline stage.",
+                                  totals.count[s][c],
+                                  std::string("stage=\"") + PerfCounters::stage_name(static_cast<PerfCounters::Stage>(s)) +
+                                  "\",event=\"" + PerfCounters::counter_name(static_cast<PerfCounters::Counter>(c)) + "\"");
+            });
+
+        MetricsSource compression_metrics(
+            metrics.get(),
+            [compression, writer_pool](MetricsWriter& w)
+            {
+                if ( compression )
+                {
+                    CompressionWorkers::Stats s = compression->stats();
+                    w.gauge("compactor_compression_queue_length", "Files waiting for compression.", s.queue_length);
+                    w.gauge("compactor_compression_queue_bytes", "Bytes in files waiting for compression.", s.queued_bytes);
+                    w.gauge("compactor_compression_running", "Files being compressed.", s.running);
+                    w.counter("compactor_compression_files_total", "Files completed or rejected by compression.",
+                              s.completed, "result=\"completed\"");
+                    w.counter("compactor_compression_files_total", "Files completed or rejected by compression.",
+                              s.rejected, "result=\"rejected\"");
+                    w.counter("compactor_compression_bytes_total", "Bytes in files compressed.", s.completed_bytes);
+                    w.counter("compactor_compression_seconds_total", "Time spent compressing files.",
+                              s.total_time.count() / 1e6);
+                }
+                if ( writer_pool )
+                    w.gauge("compactor_compression_level", "Current C-DNS compression level.", writer_pool->level());
+            });
+
+        MetricsSource sender_metrics(
+            sender ? metrics.get() : nullptr,
+            [sender](MetricsWriter& w)
+            {
+                BlockCborSender::Stats s = sender->stats();
+                w.gauge("compactor_output_socket_queue_length", "C-DNS blocks waiting to be sent.", s.queued);
+                w.gauge("compactor_output_socket_spool_bytes", "Bytes of C-DNS blocks waiting in the spool file.", s.spooled_bytes);
+                w.gauge("compactor_output_socket_connected", "1 if connected to the C-DNS receiver.", s.connected ? 1 : 0);
+                w.counter("compactor_output_socket_blocks_total", "C-DNS blocks sent, spooled or dropped.",
+                          s.sent, "result=\"sent\"");
+                w.counter("compactor_output_socket_blocks_total", "C-DNS blocks sent, spooled or dropped.",
+                          s.spooled, "result=\"spooled\"");
+                w.counter("compactor_output_socket_blocks_total", "C-DNS blocks sent, spooled or dropped.",
+                          s.dropped, "result=\"dropped\"");
+            });
+
         std::vector<std::thread> threads;
         int res;
-        while ( ( res = run_configuration(vm, configuration, threads, writer_pool) ) == 1 )
+        ConfigurationReader read_config =
+            [&]()
+            {
+                std::shared_ptr<Configuration> next = std::make_shared<Configuration>();
+                next->parse_command_line(ac, av);
+                return next;
+            };
+        while ( ( res = run_configuration(vm, configuration, read_config, threads, compression, writer_pools, sender, metrics, perf, retention) ) == 1 )
+        {
             configuration.reread_config_file();
+            add_cdns_writer_pools(configuration, compression, writer_pools);
+
+            // Threads that persist over the restart are moved to
+            // their new CPUs. Threads for the new run are placed as
+            // they start.
+            try
+            {
+                set_thread_cpus(configuration);
+            }
+            catch (const std::exception& err)
+            {
+                LOG_ERROR << "Unable to set thread CPUs, keeping previous CPUs: " << err.what();
+            }
+        }
 
         // On interrupt, abort ongoing compressions.
-        if ( res == 2 && writer_pool )
-            writer_pool->abort();
+        if ( res == 2 && compression )
+            compression->abort();
 
         // Wait for in progress output to complete.
         for ( auto& thread : threads )
             if ( thread.joinable() )
                 thread.join();
 
+        // Report hardware events once all output is complete, to
+        // the log when capturing and to standard output when
+        // converting files.
+        if ( perf )
+        {
+            PerfCounters::Totals perf_totals = perf->totals();
+            if ( vm.count("capture-file") )
+            {
+                std::cout << "\nHARDWARE EVENTS PER MILLION PACKETS:\n";
+                PerfCounters::write_report(std::cout, perf_totals, perf->packets());
+            }
+            else
+                log_perf_report(perf_totals, perf->packets());
+        }
+
         LOG_INFO << "Compactor main thread shutdown complete. Other threads shutting down.";
         if ( res != 0 )
             return 1;
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+
+#include "compressionworkers.hpp"
+#include "util.hpp"
+
+CompressionWorkers::CompressionWorkers(unsigned nthreads, unsigned max_queue)
+    : jobs_(max_queue), abort_(false), stats_()
+{
+    for ( unsigned i = 0; i < std::max(nthreads, 1u); ++i )
+        threads_.emplace_back(&CompressionWorkers::worker_main, this);
+}
+
+CompressionWorkers::~CompressionWorkers()
+{
+    jobs_.close();
+    for ( auto& t : threads_ )
+        t.join();
+}
+
+bool CompressionWorkers::submit(Job job, uintmax_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        stats_.queued_bytes += bytes;
+    }
+
+    if ( jobs_.put(QueuedJob{std::move(job), bytes}, false) )
+        return true;
+
+    std::lock_guard<std::mutex> lock(m_);
+    stats_.queued_bytes -= bytes;
+    ++stats_.rejected;
+    return false;
+}
+
+void CompressionWorkers::abort()
+{
+    abort_ = true;
+}
+
+CompressionWorkers::Stats CompressionWorkers::stats()
+{
+    std::lock_guard<std::mutex> lock(m_);
+    Stats res = stats_;
+    res.queue_length = jobs_.get_length();
+    return res;
+}
+
+void CompressionWorkers::worker_main()
+{
+    set_thread_name("comp:compress");
+
+    QueuedJob qjob;
+    while ( jobs_.get(qjob) )
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            ++stats_.running;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        qjob.job();
+        std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        qjob.job = nullptr;
+
+        std::lock_guard<std::mutex> lock(m_);
+        --stats_.running;
+        ++stats_.completed;
+        stats_.total_time += elapsed;
+        stats_.max_time = std::max(stats_.max_time, elapsed);
+        stats_.queued_bytes -= qjob.bytes;
+        stats_.completed_bytes += qjob.bytes;
+    }
+}
+
+CompressionLevelController::CompressionLevelController(unsigned level)
+    : min_level_(level), max_level_(level), level_(level),
+      period_(0), last_(), us_per_byte_(0)
+{
+}
+
+void CompressionLevelController::set_max_level(unsigned level)
+{
+    max_level_ = level;
+    min_level_ = std::min(min_level_, level);
+    level_ = level;
+    us_per_byte_ = 0;
+}
+
+void CompressionLevelController::set_min_level(unsigned level, std::chrono::seconds period)
+{
+    min_level_ = std::min(level, max_level_);
+    level_ = std::max(level_, min_level_);
+    period_ = period;
+}
+
+unsigned CompressionLevelController::next_level(const CompressionWorkers::Stats& stats,
+                                                unsigned nthreads, uintmax_t bytes)
+{
+    // Only estimate from jobs completed since the last choice, which
+    // are most likely to have been done at the current level.
+    uintmax_t done_bytes = stats.completed_bytes - last_.completed_bytes;
+    std::chrono::microseconds done_time = stats.total_time - last_.total_time;
+    if ( done_bytes > 0 )
+    {
+        us_per_byte_ = static_cast<double>(done_time.count()) / done_bytes;
+        last_ = stats;
+    }
+
+    if ( us_per_byte_ == 0 || min_level_ == max_level_ )
+        return level_;
+
+    double behind = us_per_byte_ * ( stats.queued_bytes + bytes ) / std::max(nthreads, 1u);
+
+    if ( behind > period_.count() )
+    {
+        if ( level_ > min_level_ )
+        {
+            --level_;
+            us_per_byte_ = 0;
+        }
+    }
+    else if ( stats.queue_length == 0 && behind < period_.count() / 4 )
+    {
+        if ( level_ < max_level_ )
+        {
+            ++level_;
+            us_per_byte_ = 0;
+        }
+    }
+
+    return level_;
+}
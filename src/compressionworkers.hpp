@@ -0,0 +1,295 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef COMPRESSIONWORKERS_HPP
+#define COMPRESSIONWORKERS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "channel.hpp"
+
+/**
+ * \class CompressionWorkers
+ * \brief A fixed pool of long-lived threads running file compression jobs.
+ *
+ * Jobs are queued on a bounded queue. Adding a job never blocks; if
+ * the queue is full the job is rejected, and the caller decides what
+ * to do with the file. The pool records the number of jobs completed
+ * and rejected and the time taken by jobs.
+ *
+ * Several writer pools, each with their own compression type and level,
+ * can share one set of workers.
+ */
+class CompressionWorkers
+{
+public:
+    /**
+     * \brief A job.
+     */
+    using Job = std::function<void ()>;
+
+    /**
+     * \struct Stats
+     * \brief Compression worker statistics.
+     */
+    struct Stats
+    {
+        /**
+         * \brief the number of jobs waiting to start.
+         */
+        unsigned queue_length;
+
+        /**
+         * \brief the number of jobs running.
+         */
+        unsigned running;
+
+        /**
+         * \brief the number of jobs completed.
+         */
+        uint64_t completed;
+
+        /**
+         * \brief the number of jobs rejected because the queue was full.
+         */
+        uint64_t rejected;
+
+        /**
+         * \brief the total time taken by completed jobs.
+         */
+        std::chrono::microseconds total_time;
+
+        /**
+         * \brief the longest time taken by a completed job.
+         */
+        std::chrono::microseconds max_time;
+
+        /**
+         * \brief the input bytes of jobs waiting or running.
+         */
+        uintmax_t queued_bytes;
+
+        /**
+         * \brief the input bytes of completed jobs.
+         */
+        uintmax_t completed_bytes;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * \param nthreads  the number of worker threads.
+     * \param max_queue the maximum number of jobs waiting to start.
+     *                  0 means no maximum.
+     */
+    CompressionWorkers(unsigned nthreads, unsigned max_queue);
+
+    /**
+     * \brief Destructor.
+     *
+     * Complete all queued jobs and stop the worker threads.
+     */
+    ~CompressionWorkers();
+
+    /**
+     * \brief Add a job to the queue.
+     *
+     * \param job   the job.
+     * \param bytes the size of the job input, if known.
+     * \returns `false` if the queue is full and the job was rejected.
+     */
+    bool submit(Job job, uintmax_t bytes = 0);
+
+    /**
+     * \brief Return the number of worker threads.
+     */
+    unsigned threads() const
+    {
+        return threads_.size();
+    }
+
+    /**
+     * \brief Request abort of all ongoing compressions.
+     */
+    void abort();
+
+    /**
+     * \brief Return `true` if compressions should abort.
+     */
+    bool aborted() const
+    {
+        return abort_;
+    }
+
+    /**
+     * \brief Return the current statistics.
+     */
+    Stats stats();
+
+    /**
+     * \brief Copy and assignment deleted.
+     */
+    CompressionWorkers(const CompressionWorkers& other) = delete;
+    CompressionWorkers(CompressionWorkers&& other) = delete;
+    CompressionWorkers& operator=(const CompressionWorkers& other) = delete;
+    CompressionWorkers& operator=(CompressionWorkers&& other) = delete;
+
+private:
+    /**
+     * \struct QueuedJob
+     * \brief A job and the size of its input.
+     */
+    struct QueuedJob
+    {
+        /**
+         * \brief the job.
+         */
+        Job job;
+
+        /**
+         * \brief the size of the job input.
+         */
+        uintmax_t bytes;
+    };
+
+    /**
+     * \brief Main function for worker threads.
+     */
+    void worker_main();
+
+    /**
+     * \brief the job queue.
+     */
+    Channel<QueuedJob> jobs_;
+
+    /**
+     * \brief the worker threads.
+     */
+    std::vector<std::thread> threads_;
+
+    /**
+     * \brief flag indicating whether compression should abort.
+     */
+    std::atomic_bool abort_;
+
+    /**
+     * \brief mutex guarding statistics.
+     */
+    std::mutex m_;
+
+    /**
+     * \brief the statistics, excluding queue length.
+     */
+    Stats stats_;
+};
+
+/**
+ * \class CompressionLevelController
+ * \brief Choose a compression level from the compression backlog.
+ *
+ * The time to compress a byte is estimated from recently completed
+ * jobs. From this, estimate the time to compress the new file and
+ * everything queued ahead of it. If this is more than the rotation
+ * period, compression is falling behind, and the level is lowered.
+ * If nothing is waiting and the estimate is well within the rotation
+ * period, the level is raised. The level changes by one step at a
+ * time, and stays within the configured bounds.
+ */
+class CompressionLevelController
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * Initially the level is fixed.
+     *
+     * \param level the initial level.
+     */
+    explicit CompressionLevelController(unsigned level);
+
+    /**
+     * \brief Set the highest level to use.
+     *
+     * The current level is set to this level.
+     *
+     * \param level the highest level to use.
+     */
+    void set_max_level(unsigned level);
+
+    /**
+     * \brief Set the lowest level to use.
+     *
+     * \param level  the lowest level to use.
+     * \param period the output file rotation period.
+     */
+    void set_min_level(unsigned level, std::chrono::seconds period);
+
+    /**
+     * \brief Return the current level.
+     */
+    unsigned level() const
+    {
+        return level_;
+    }
+
+    /**
+     * \brief Choose the level for a new file.
+     *
+     * \param stats    the current compression worker statistics.
+     * \param nthreads the number of compression threads.
+     * \param bytes    the size of the new file.
+     * \returns the level to use.
+     */
+    unsigned next_level(const CompressionWorkers::Stats& stats,
+                        unsigned nthreads, uintmax_t bytes);
+
+private:
+    /**
+     * \brief the lowest level to use.
+     */
+    unsigned min_level_;
+
+    /**
+     * \brief the highest level to use.
+     */
+    unsigned max_level_;
+
+    /**
+     * \brief the current level.
+     */
+    unsigned level_;
+
+    /**
+     * \brief the output file rotation period.
+     */
+    std::chrono::microseconds period_;
+
+    /**
+     * \brief the statistics at the last choice.
+     */
+    CompressionWorkers::Stats last_;
+
+    /**
+     * \brief the estimated time to compress a byte, in microseconds.
+     *
+     * 0 if not yet known.
+     */
+    double us_per_byte_;
+};
+
+#endif
@@ -13,7 +13,9 @@
 #include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 
 #include <boost/algorithm/string.hpp>
@@ -24,6 +26,8 @@
 
 #include "configuration.hpp"
 #include "log.hpp"
+#include "sketch.hpp"
+#include "util.hpp"
 
 namespace po = boost::program_options;
 
@@ -162,6 +166,115 @@ namespace {
         { "NSEC3PARAMS", 51 }
     };
 
+    /**
+     * \brief thread roles that can be given CPUs.
+     */
+    const std::set<std::string> THREAD_ROLES = {
+        "main",
+        "sniffer",
+        "worker",
+        "cdns-write",
+        "raw-pcap",
+        "ign-pcap",
+        "compress",
+        "sender",
+        "metrics",
+        "retention",
+        "control",
+        "signal-handler"
+    };
+
+    /**
+     * \brief options that can be changed without a restart.
+     */
+    const std::set<std::string> RELOADABLE_OPTIONS = {
+        "filter",
+        "include",
+        "accept-opcode",
+        "ignore-opcode",
+        "accept-rr-type",
+        "ignore-rr-type",
+        "vlan-id",
+        "rotation-period",
+        "gzip-level",
+        "xz-preset",
+        "min-compression-level",
+        "block-sketches",
+        "block-sketch-qnames"
+    };
+
+    /**
+     * \brief configuration file options that may be given in an output definition file.
+     */
+    const std::set<std::string> OUTPUT_DEFINITION_OPTIONS = {
+        "output",
+        "rotation-period",
+        "include",
+        "max-block-items",
+        "max-output-size",
+        "block-sketches",
+        "block-sketch-qnames",
+        "client-address-prefix-ipv4",
+        "client-address-prefix-ipv6",
+        "server-address-prefix-ipv4",
+        "server-address-prefix-ipv6",
+        "gzip-output",
+        "gzip-level",
+        "xz-output",
+        "xz-preset",
+        "pseudo-anonymise",
+        "pseudo-anonymisation-key",
+        "pseudo-anonymisation-passphrase"
+    };
+
+    /**
+     * \brief Add option values from one source to those in effect.
+     *
+     * As with boost::program_options::store(), an option given by
+     * an earlier source takes precedence over the same option given
+     * by a later source.
+     *
+     * \param options the options from the source.
+     * \param items   the option values in effect.
+     */
+    void add_option_items(const std::vector<po::option>& options,
+                          std::map<std::string, std::vector<std::string>>& items)
+    {
+        std::set<std::string> added;
+        for ( const auto& o : options )
+        {
+            if ( o.string_key.empty() )
+                continue;
+            if ( items.count(o.string_key) && !added.count(o.string_key) )
+                continue;
+            added.insert(o.string_key);
+            std::vector<std::string>& vals = items[o.string_key];
+            vals.insert(vals.end(), o.value.begin(), o.value.end());
+        }
+    }
+
+    /**
+     * \brief Check whether any non-reloadable items in one set of
+     * option items are different or missing in another.
+     *
+     * \param a the first set of items.
+     * \param b the second set of items.
+     * \returns `true` if there are differences.
+     */
+    bool non_reloadable_changes(const std::map<std::string, std::vector<std::string>>& a,
+                                const std::map<std::string, std::vector<std::string>>& b)
+    {
+        for ( const auto& item : a )
+        {
+            if ( RELOADABLE_OPTIONS.count(item.first) )
+                continue;
+            auto other = b.find(item.first);
+            if ( other == b.end() || other->second != item.second )
+                return true;
+        }
+        return false;
+    }
+
     void set_opcode_config(std::vector<unsigned>& config, const std::vector<std::string>& names)
     {
         for ( const auto& s : names )
@@ -287,14 +400,21 @@ void validate(boost::any& v, const std::vector<std::string>& values,
 }
 
 Configuration::Configuration()
-    : gzip_output(false), gzip_level(6),
+    : retention_period(10), retention_size(64ull*1024*1024),
+      retention_malformed_rate(0),
+      output_queue(10),
+      gzip_output(false), gzip_level(6),
       xz_output(false), xz_preset(6),
       gzip_pcap(false), gzip_level_pcap(6),
       xz_pcap(false), xz_preset_pcap(6),
-      max_compression_threads(2),
+      max_compression_threads(2), max_compression_queue(100),
       rotation_period(300),
       dns_port(53),
       query_timeout(5000), skew_timeout(10),
+      tcp_max_flows(50000), tcp_memory_limit(256ull*1024*1024),
+      tcp_idle_timeout(60),
+      fragment_memory_limit(64ull*1024*1024), fragment_timeout(30),
+      worker_threads(0),
       snaplen(65535),
       promisc_mode(false),
 #if ENABLE_DNSTAP
@@ -303,10 +423,13 @@ Configuration::Configuration()
       output_options_queries(0), output_options_responses(0),
       max_block_items(5000),
       max_output_size(0),
+      block_sketches(false), block_sketch_qnames(HeavyHitters::DEFAULT_CAPACITY),
       report_info(false), relaxed_mode(false), log_network_stats_period(0),
       log_file_handling(false),
       sampling_threshold(10), sampling_rate(0), sampling_time(100),
-      debug_dns(false), debug_qr(false),
+      shed_threshold(0),
+      debug_dns(false), debug_qr(false), perf_counters(false),
+      replay_rate(0), replay_ramp(0), replay_speedup(1), replay_duration(0),
       omit_hostid(false), omit_sysid(false), start_end_times_from_data(false),
       max_channel_size(30000),
       client_address_prefix_ipv4(DEFAULT_IPV4_PREFIX_LENGTH),
@@ -318,6 +441,7 @@ Configuration::Configuration()
       cmdline_options_("Command options"),
       cmdline_hidden_options_("Hidden command options"),
       config_file_options_("Configuration"),
+      output_file_options_("Output definition"),
       positional_options_(),
       read_from_block_(false)
 {
@@ -342,7 +466,30 @@ Configuration::Configuration()
         ("debug-qr",
          po::value<bool>(&debug_qr)->implicit_value(true),
          "print Query/Response match details.")
+        ("perf-counters",
+         po::value<bool>(&perf_counters)->implicit_value(true),
+         "count hardware events in each pipeline stage.")
         ("list-interfaces,l", "list all network interfaces.")
+        ("replay-file",
+         po::value<std::string>(&replay_file),
+         "replay capture file through the network capture pipeline, "
+         "to measure throughput.")
+        ("replay-rate",
+         po::value<double>(&replay_rate)->default_value(0),
+         "replay rate in packets/s. 0 to use capture file timing.")
+        ("replay-ramp",
+         po::value<double>(&replay_ramp)->default_value(0),
+         "increase replay rate by this many packets/s each second.")
+        ("replay-speedup",
+         po::value<double>(&replay_speedup)->default_value(1),
+         "with capture file timing, replay this many times faster.")
+        ("replay-duration",
+         po::value<unsigned int>(&replay_duration)->default_value(0),
+         "replay for this many seconds, repeating the capture file. "
+         "0 to replay the file once.")
+        ("replay-report",
+         po::value<std::string>(&replay_report),
+         "write per-second replay throughput to this CSV file.")
         ;
 
     cmdline_hidden_options_.add_options()
@@ -375,6 +522,27 @@ Configuration::Configuration()
         ("dns-port",
          po::value<unsigned int>(&dns_port)->default_value(53),
          "traffic to/from this port is DNS traffic.")
+        ("tcp-max-flows",
+         po::value<unsigned int>(&tcp_max_flows)->default_value(50000),
+         "maximum number of TCP flows to track, 0 for no limit.")
+        ("tcp-memory-limit",
+         po::value<Size>(&tcp_memory_limit),
+         "maximum memory used for TCP reassembly, 0 for no limit.")
+        ("tcp-idle-timeout",
+         po::value<unsigned int>(),
+         "timeout period for idle TCP flows, in seconds.")
+        ("fragment-memory-limit",
+         po::value<Size>(&fragment_memory_limit),
+         "maximum memory used for IP fragment reassembly, 0 for no limit.")
+        ("fragment-timeout",
+         po::value<unsigned int>(),
+         "timeout period for IP fragment reassembly, in seconds.")
+        ("worker-threads",
+         po::value<unsigned int>(&worker_threads)->default_value(0),
+         "number of packet processing threads, 0 to process on the capture thread.")
+        ("thread-cpus",
+         po::value<std::vector<std::string>>(),
+         "run threads with the given role on the given CPUs, as ROLE:CPULIST.")
         ("snaplen,s",
          po::value<unsigned int>(&snaplen)->default_value(65535),
          "capture this many bytes per packet.")
@@ -431,6 +599,12 @@ Configuration::Configuration()
         ("max-output-size",
          po::value<Size>(&max_output_size),
          "maximum size of output (uncompressed) before rotation.")
+        ("block-sketches",
+         po::value<bool>(&block_sketches)->implicit_value(true),
+         "record distinct client and top query name sketches in each block.")
+        ("block-sketch-qnames",
+         po::value<unsigned int>(&block_sketch_qnames)->default_value(HeavyHitters::DEFAULT_CAPACITY),
+         "number of query names kept in each block sketch.")
         ("client-address-prefix-ipv4",
          po::value<unsigned int>(&client_address_prefix_ipv4)->default_value(32),
          "prefix length to store for client IPv4 addresses.")
@@ -446,12 +620,47 @@ Configuration::Configuration()
         ("output,o",
          po::value<std::string>(&output_pattern),
          "filename pattern for storing C-DNS output.")
+        ("output-socket",
+         po::value<std::string>(&output_socket),
+         "Unix socket path or host:port to send C-DNS output to instead of files.")
+        ("output-spool",
+         po::value<std::string>(&output_spool),
+         "directory in which to spool C-DNS output that can't be sent.")
+        ("output-queue",
+         po::value<unsigned int>(&output_queue)->default_value(10),
+         "maximum number of C-DNS blocks waiting to be sent.")
+        ("output-definition",
+         po::value<std::vector<std::string>>(),
+         "file giving the settings for an additional C-DNS output.")
+#if ENABLE_PSEUDOANONYMISATION
+        ("pseudo-anonymise",
+         po::value<bool>()->implicit_value(true),
+         "pseudo-anonymise C-DNS output.")
+        ("pseudo-anonymisation-key",
+         po::value<std::string>(),
+         "pseudo-anonymisation key.")
+        ("pseudo-anonymisation-passphrase",
+         po::value<std::string>(),
+         "pseudo-anonymisation passphrase.")
+#endif
         ("raw-pcap,w",
          po::value<std::string>(&raw_pcap_pattern),
          "filename pattern for storing raw PCAP output.")
         ("ignored-pcap,m",
          po::value<std::string>(&ignored_pcap_pattern),
          "filename pattern for storing ignored and malformed packets.")
+        ("retention-pcap",
+         po::value<std::string>(&retention_pcap_pattern),
+         "filename pattern for dumps of recently captured packets kept in memory.")
+        ("retention-period",
+         po::value<unsigned int>(),
+         "period for which captured packets are kept for dumps, in seconds, 0 for no limit.")
+        ("retention-size",
+         po::value<Size>(&retention_size),
+         "maximum memory used by captured packets kept for dumps, 0 for no limit.")
+        ("retention-malformed-rate",
+         po::value<unsigned int>(&retention_malformed_rate)->default_value(0),
+         "dump kept packets when malformed messages per second exceed this, 0 to disable.")
         ("gzip-output,z",
          po::value<bool>(&gzip_output)->implicit_value(true),
          "compress C-DNS data using gzip. Adds .gz extension to output file.")
@@ -479,9 +688,21 @@ Configuration::Configuration()
         ("max-compression-threads",
          po::value<unsigned int>(&max_compression_threads)->default_value(2),
          "maximum number of compression threads.")
+        ("max-compression-queue",
+         po::value<unsigned int>(&max_compression_queue)->default_value(100),
+         "maximum number of files waiting for compression, 0 for no limit.")
+        ("min-compression-level",
+         po::value<unsigned int>(),
+         "lowest compression level or preset to use if compression falls behind.")
         ("log-network-stats-period,L",
          po::value<unsigned int>(&log_network_stats_period)->default_value(0),
          "log network collection stats period.")
+        ("metrics-socket",
+         po::value<std::string>(&metrics_socket),
+         "Unix socket path on which to serve pipeline metrics.")
+        ("control-socket",
+         po::value<std::string>(&control_socket),
+         "Unix socket path on which to accept control commands.")
          ("log-file-handling,F",
           po::value<bool>(&log_file_handling)->implicit_value(true),
           "log details of file handling on rotation.")
@@ -494,6 +715,21 @@ Configuration::Configuration()
          ("sampling-time",
          po::value<unsigned int>(&sampling_time)->default_value(100),
          "time to sample for before checking for drops.")
+         ("shed-threshold",
+         po::value<unsigned int>(&shed_threshold)->default_value(0),
+         "percentage of C-DNS output queue in use above which to shed low priority traffic.")
+         ("shed-common-rr-type",
+         po::value<std::vector<std::string>>(),
+         "RR types not given priority when shedding.")
+        ;
+
+    for ( const auto& o : config_file_options_.options() )
+        if ( OUTPUT_DEFINITION_OPTIONS.count(o->long_name()) )
+            output_file_options_.add(o);
+    output_file_options_.add_options()
+        ("excludesfile",
+         po::value<std::string>(),
+         "exclude hints file.")
         ;
 }
 
@@ -506,6 +742,7 @@ po::variables_map Configuration::parse_command_line(int ac, char *av[])
 
     po::parsed_options parsed = po::command_line_parser(ac, av).options(all).positional(positional_options_).allow_unregistered().run();
     po::store(parsed, cmdline_vars_);
+    cmdline_items_ = parsed.options;
     if (!cmdline_vars_.count("relaxed-mode") || !cmdline_vars_["relaxed-mode"].as<bool>()) {
         po::store(po::command_line_parser(ac, av).options(all).positional(positional_options_).run(), cmdline_vars_);
     } else {
@@ -547,7 +784,43 @@ po::variables_map Configuration::reread_config_file()
      * items must replace any existing values for those items that came
      * from the config file first read.
      */
-    po::variables_map res = cmdline_vars_;
+    po::variables_map res;
+
+    option_items_.clear();
+    if ( output_definition_file_.empty() )
+    {
+        res = cmdline_vars_;
+        add_option_items(cmdline_items_, option_items_);
+    }
+    else
+    {
+        /*
+         * Output definition items take precedence over both the
+         * command line and the config file. So store them first,
+         * followed by the command line.
+         */
+        std::ifstream def(output_definition_file_);
+        if ( def.fail() )
+            throw po::error("Can't open output definition file " + output_definition_file_);
+
+        po::parsed_options parsed = po::parse_config_file(def, output_file_options_);
+        po::store(parsed, res);
+        add_option_items(parsed.options, option_items_);
+
+        if ( res.count("excludesfile") )
+        {
+            excludes_file_ = res["excludesfile"].as<std::string>();
+            if ( !boost::filesystem::exists(excludes_file_) )
+                throw po::error("Exclude hints file " + excludes_file_ + " not found.");
+        }
+
+        po::options_description all("Options");
+        all.add(cmdline_options_).add(cmdline_hidden_options_).add(config_file_options_);
+        po::parsed_options cmdline(&all);
+        cmdline.options = cmdline_items_;
+        po::store(cmdline, res);
+        add_option_items(cmdline_items_, option_items_);
+    }
 
     if ( boost::filesystem::exists(config_file_) )
     {
@@ -557,6 +830,7 @@ po::variables_map Configuration::reread_config_file()
         
         po::parsed_options parsed = po::parse_config_file(conf, config_file_options_, true);
         po::store(parsed, res);
+        add_option_items(parsed.options, option_items_);
         for (const auto& o : parsed.options) {
             if (o.unregistered == true) {
                 if (!cmdline_vars_.count("relaxed-mode")  || !cmdline_vars_["relaxed-mode"].as<bool>()) {
@@ -569,6 +843,15 @@ po::variables_map Configuration::reread_config_file()
     }
 
     po::notify(res);
+
+    // Additional outputs always write files.
+    if ( !output_definition_file_.empty() )
+    {
+        output_socket.clear();
+        if ( output_pattern.empty() )
+            throw po::error("No output given in output definition file " + output_definition_file_ + ".");
+    }
+
     set_config_items(res);
     if ( exclude_hints.read_excludes_file(excludes_file_) )
     {
@@ -579,6 +862,74 @@ po::variables_map Configuration::reread_config_file()
         exclude_hints.set_section_excludes(output_options_queries, output_options_responses);
     exclude_hints.check_config(*this);
 
+    output_definitions.clear();
+    if ( output_definition_file_.empty() && res.count("output-definition") )
+    {
+        if ( output_pattern.empty() )
+            throw po::error("Output definitions need C-DNS output to be given with 'output'.");
+
+        std::set<std::string> patterns = { output_pattern };
+        for ( const auto& file : res["output-definition"].as<std::vector<std::string>>() )
+        {
+            std::shared_ptr<const Configuration> def = read_output_definition(file);
+            if ( !patterns.insert(def->output_pattern).second )
+                throw po::error("Output definition file " + file + " repeats the output " + def->output_pattern + ".");
+            output_definitions.push_back(def);
+        }
+    }
+
+    return res;
+}
+
+std::shared_ptr<const Configuration> Configuration::read_output_definition(const std::string& file) const
+{
+    if ( !boost::filesystem::exists(file) )
+        throw po::error("Output definition file " + file + " not found.");
+
+    // Start from the same command line, config and exclude hints files,
+    // and re-read with this file's settings applied on top.
+    std::shared_ptr<Configuration> res = std::make_shared<Configuration>();
+    po::options_description all("Options");
+    all.add(res->cmdline_options_).add(res->cmdline_hidden_options_).add(res->config_file_options_);
+    po::parsed_options cmdline(&all);
+    cmdline.options = cmdline_items_;
+    po::store(cmdline, res->cmdline_vars_);
+
+    res->config_file_ = config_file_;
+    res->excludes_file_ = excludes_file_;
+    res->defaults_file_ = defaults_file_;
+    res->cmdline_items_ = cmdline_items_;
+    res->output_definition_file_ = file;
+    res->reread_config_file();
+    return res;
+}
+
+bool Configuration::needs_restart(const Configuration& config) const
+{
+    if ( non_reloadable_changes(option_items_, config.option_items_) ||
+         non_reloadable_changes(config.option_items_, option_items_) ||
+         output_definitions.size() != config.output_definitions.size() )
+        return true;
+
+    for ( std::size_t i = 0; i < output_definitions.size(); ++i )
+        if ( output_definitions[i]->needs_restart(*config.output_definitions[i]) )
+            return true;
+    return false;
+}
+
+std::vector<unsigned> Configuration::thread_cpu_list(const std::string& role) const
+{
+    auto t = thread_cpus.find(role);
+    if ( t == thread_cpus.end() )
+        return {};
+    if ( t->second != "nic" )
+        return parse_cpu_list(t->second);
+
+    std::vector<unsigned> res;
+    if ( !network_interfaces.empty() )
+        res = interface_local_cpus(network_interfaces[0]);
+    if ( res.empty() )
+        throw po::error("CPUs local to the capture interface are not known.");
     return res;
 }
 
@@ -606,6 +957,24 @@ void Configuration::dump_config(std::ostream& os) const
         if ( max_output_size.size > 0 )
             os << "  Max output size      : " << max_output_size.size << "\n";
         os << "  File rotation period : " << rotation_period.count() << "\n";
+        if ( pseudo_anon )
+            os << "  Pseudo-anonymised    : Yes\n";
+        if ( block_sketches )
+            os << "  Block sketches       : " << block_sketch_qnames << " query names\n";
+        if ( !output_definitions.empty() )
+        {
+            os << "  Additional outputs   : ";
+            for ( const auto& def : output_definitions )
+            {
+                if ( first )
+                    first = false;
+                else
+                    os << ", ";
+                os << def->output_pattern;
+            }
+            os << "\n";
+            first = true;
+        }
     }
     os << "  Promiscuous mode     : " << (promisc_mode ? "On" : "Off") << "\n"
        << "  Capture interfaces   : ";
@@ -640,8 +1009,38 @@ void Configuration::dump_config(std::ostream& os) const
         os << v;
     }
     os << "\n"
-       << "  Filter               : " << filter << "\n"
-       << "  Query options        : ";
+       << "  Filter               : " << filter << "\n";
+    if ( !thread_cpus.empty() )
+    {
+        os << "  Thread CPUs          : ";
+        first = true;
+        for ( const auto& t : thread_cpus )
+        {
+            if ( first )
+                first = false;
+            else
+                os << ", ";
+            os << t.first << ":" << t.second;
+        }
+        os << "\n"
+           << "  Interface NUMA nodes : ";
+        first = true;
+        for ( const auto& i : network_interfaces )
+        {
+            int node = interface_numa_node(i);
+            if ( first )
+                first = false;
+            else
+                os << ", ";
+            os << i << ":";
+            if ( node < 0 )
+                os << "unknown";
+            else
+                os << node;
+        }
+        os << "\n";
+    }
+    os << "  Query options        : ";
     dump_output_option(os, true);
     os << "  Response options     : ";
     dump_output_option(os, false);
@@ -704,6 +1103,14 @@ void Configuration::set_config_items(const po::variables_map& vm)
     if ( xz_preset > 9 || xz_preset_pcap > 9 )
         throw po::error("xz preset level must be in the range 0-9.");
 
+    min_compression_level = boost::none;
+    if ( vm.count("min-compression-level") )
+    {
+        min_compression_level = vm["min-compression-level"].as<unsigned int>();
+        if ( *min_compression_level > 9 )
+            throw po::error("minimum compression level must be in the range 0-9.");
+    }
+
     if ( max_compression_threads < 1 )
         throw po::error("number of compression threads must be at least 1.");
 
@@ -713,6 +1120,34 @@ void Configuration::set_config_items(const po::variables_map& vm)
     if ( gzip_output && xz_output )
         throw po::error("You cannot select more than one C-DNS compression method.");
 
+    if ( !output_socket.empty() && ( gzip_output || xz_output ) )
+        throw po::error("C-DNS output sent to a socket can't be compressed.");
+
+    if ( output_queue < 1 )
+        throw po::error("output queue must be at least 1.");
+
+    if ( block_sketch_qnames < 1 )
+        throw po::error("block sketch query names must be at least 1.");
+
+    pseudo_anon = boost::none;
+#if ENABLE_PSEUDOANONYMISATION
+    if ( vm.count("pseudo-anonymisation-key") &&
+         vm.count("pseudo-anonymisation-passphrase") )
+        throw po::error("specify pseudo-anonymisation key or passphrase, but not both.");
+    if ( vm.count("pseudo-anonymisation-key") &&
+         vm["pseudo-anonymisation-key"].as<std::string>().size() != 16 )
+        throw po::error("pseudo-anonymisation key must be exactly 16 bytes long.");
+    if ( vm.count("pseudo-anonymise") && vm["pseudo-anonymise"].as<bool>() )
+    {
+        if ( vm.count("pseudo-anonymisation-key") )
+            pseudo_anon = PseudoAnonymise(to_byte_string(vm["pseudo-anonymisation-key"].as<std::string>()));
+        else if ( vm.count("pseudo-anonymisation-passphrase") )
+            pseudo_anon = PseudoAnonymise(vm["pseudo-anonymisation-passphrase"].as<std::string>());
+        else
+            throw po::error("to pseudo-anonymise output you must specify a passphrase or key.");
+    }
+#endif
+
     if ( gzip_pcap && xz_pcap )
         throw po::error("You cannot select more than one PCAP compression method.");
 
@@ -736,6 +1171,51 @@ void Configuration::set_config_items(const po::variables_map& vm)
     if ( vm.count("accept-rr-type") )
         set_rr_type_config(accept_rr_types, vm["accept-rr-type"].as<std::vector<std::string>>());
 
+    thread_cpus.clear();
+    if ( vm.count("thread-cpus") )
+    {
+        for ( const auto& s : vm["thread-cpus"].as<std::vector<std::string>>() )
+        {
+            std::string::size_type colon = s.find(':');
+            std::string role = s.substr(0, colon);
+            if ( colon == std::string::npos || !THREAD_ROLES.count(role) )
+            {
+                std::string roles;
+                for ( const auto& r : THREAD_ROLES )
+                {
+                    if ( !roles.empty() )
+                        roles += ", ";
+                    roles += r;
+                }
+                throw po::error("invalid thread-cpus value " + s + ". Valid roles are:\n  " + roles);
+            }
+            std::string cpus = s.substr(colon + 1);
+            if ( cpus != "nic" )
+            {
+                try
+                {
+                    parse_cpu_list(cpus);
+                }
+                catch (const std::invalid_argument& err)
+                {
+                    throw po::error(err.what());
+                }
+            }
+            thread_cpus[role] = cpus;
+        }
+    }
+
+    shed_common_rr_types.clear();
+    if ( vm.count("shed-common-rr-type") )
+        set_rr_type_config(shed_common_rr_types, vm["shed-common-rr-type"].as<std::vector<std::string>>());
+    else
+        shed_common_rr_types = {
+            CaptureDNS::A, CaptureDNS::NS, CaptureDNS::CNAME,
+            CaptureDNS::SOA, CaptureDNS::PTR, CaptureDNS::MX,
+            CaptureDNS::TXT, CaptureDNS::AAAA, CaptureDNS::SRV,
+            CaptureDNS::DS, CaptureDNS::DNSKEY
+        };
+
     if ( vm.count("rotation-period") )
         rotation_period = std::chrono::seconds(vm["rotation-period"].as<unsigned int>());
     if ( vm.count("query-timeout") )
@@ -744,6 +1224,20 @@ void Configuration::set_config_items(const po::variables_map& vm)
         skew_timeout = std::chrono::microseconds(vm["skew-timeout"].as<unsigned int>());
     if (skew_timeout > query_timeout)
         throw po::error("query-timeout must be greater than skew-timeout.");
+    if ( vm.count("tcp-idle-timeout") )
+        tcp_idle_timeout = std::chrono::seconds(vm["tcp-idle-timeout"].as<unsigned int>());
+    if ( tcp_idle_timeout.count() == 0 )
+        throw po::error("tcp-idle-timeout must be at least 1 second.");
+
+    if ( vm.count("retention-period") )
+        retention_period = std::chrono::seconds(vm["retention-period"].as<unsigned int>());
+    if ( !retention_pcap_pattern.empty() &&
+         retention_period.count() == 0 && retention_size.size == 0 )
+        throw po::error("retention-period and retention-size can't both be 0.");
+    if ( vm.count("fragment-timeout") )
+        fragment_timeout = std::chrono::seconds(vm["fragment-timeout"].as<unsigned int>());
+    if ( fragment_timeout.count() == 0 )
+        throw po::error("fragment-timeout must be at least 1 second.");
 
     for ( const auto& ifname : network_interfaces )
         check_network_interface(ifname);
@@ -918,10 +1412,20 @@ void Configuration::populate_block_parameters(block_cbor::BlockParameters& bp) c
         if ( output_rr_type(rr) )
             sp.rr_types.push_back(rr);
 
-    // Compactor currently doesn't support anonymisation,
-    // sampling or name normalisation, so we don't give
-    // storage flags or sampling or anonymisation methods.
-    // Set collection parameter items from configuration.
+    // If sampling is configured, data may be sampled when the
+    // compactor is overloaded. Record how.
+    if ( sampling_rate > 1 )
+    {
+        sp.storage_flags = block_cbor::StorageFlags(sp.storage_flags | block_cbor::SAMPLED_DATA);
+        sp.sampling_method = "When dropping above " +
+            std::to_string(sampling_threshold) + "%, keep 1 in " +
+            std::to_string(sampling_rate) +
+            " transactions by keyed hash of client address, client port and DNS ID"
+            " for " + std::to_string(sampling_time) + "s. TCP connections are sampled whole.";
+    }
+
+    // Compactor currently doesn't support anonymisation or
+    // name normalisation, so we don't give anonymisation methods.
 
     // Compactor currently doesn't support client or server address
     // prefix length setting, so we don't give that parameter.
@@ -1626,7 +2130,7 @@ HintsExcluded::HintsExcluded()
       address_events(false),
       query_type(true),
       response_processing(true),
-      malformed_messages(true)
+      malformed_messages(false)
 
 {
     excludes_file_options_.add_options()
@@ -1742,6 +2246,9 @@ HintsExcluded::HintsExcluded()
         ("storage-meta-data.address-events",
          po::value<bool>(&address_events)->implicit_value(true)->default_value(false),
          "exclude address events.")
+        ("storage-meta-data.malformed-messages",
+         po::value<bool>(&malformed_messages)->implicit_value(true)->default_value(false),
+         "exclude malformed messages.")
         ;
 }
 
@@ -1974,7 +2481,8 @@ block_cbor::OtherDataHintFlags HintsExcluded::get_other_data_hints() const
 {
     unsigned res = 0;
 
-    // Malformed messages not currently supported.
+    if ( !malformed_messages )
+        res |= block_cbor::MALFORMED_MESSAGES;
     if ( !address_events )
         res |= block_cbor::ADDRESS_EVENT_COUNTS;
 
@@ -1983,6 +2491,7 @@ block_cbor::OtherDataHintFlags HintsExcluded::get_other_data_hints() const
 
 void HintsExcluded::set_other_data_hints(block_cbor::OtherDataHintFlags hints)
 {
+    malformed_messages = !( hints & block_cbor::MALFORMED_MESSAGES );
     address_events = !( hints & block_cbor::ADDRESS_EVENT_COUNTS );
 }
 
@@ -2081,4 +2590,6 @@ void HintsExcluded::dump_config(std::ostream& os) const
     os << "\n[storage-meta-data]\n";
     if ( address_events )
         os << "address-events\n";
+    if ( malformed_messages )
+        os << "malformed-messages\n";
 }
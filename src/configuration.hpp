@@ -15,6 +15,8 @@
 
 #include <chrono>
 #include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,6 +27,7 @@
 
 #include "blockcbordata.hpp"
 #include "ipaddress.hpp"
+#include "pseudoanonymise.hpp"
 
 class Configuration;
 
@@ -490,9 +493,7 @@ public:
     bool response_processing;
 
     /**
-     * \brief malformed messages?
-     *
-     * NOT IMPLEMENTED.
+     * \brief output malformed messages?
      */
     bool malformed_messages;
 
@@ -652,6 +653,32 @@ public:
      */
     std::string ignored_pcap_pattern;
 
+    /**
+     * \brief output filename pattern for retained packet dumps.
+     *
+     * If not empty, recently captured packets are kept in memory, and
+     * written to this file in PCAP format when a dump is requested.
+     *
+     * The filename pattern is run through strftime() to generate the filename.
+     */
+    std::string retention_pcap_pattern;
+
+    /**
+     * \brief how long captured packets are retained. 0 = no limit.
+     */
+    std::chrono::seconds retention_period;
+
+    /**
+     * \brief the maximum captured packet data retained. 0 = no limit.
+     */
+    Size retention_size;
+
+    /**
+     * \brief malformed messages per second above which retained
+     * packets are dumped. 0 = never.
+     */
+    unsigned int retention_malformed_rate;
+
     /**
      * \brief output filename pattern for query/response pairs.
      *
@@ -662,6 +689,27 @@ public:
      */
     std::string output_pattern;
 
+    /**
+     * \brief socket address of a C-DNS stream receiver.
+     *
+     * If not empty, C-DNS output is sent to the receiver instead of
+     * being written to files. The address is a Unix socket path or
+     * `host:port`.
+     */
+    std::string output_socket;
+
+    /**
+     * \brief directory for spooling C-DNS output not yet sent.
+     *
+     * If empty, output that can't be sent is dropped.
+     */
+    std::string output_spool;
+
+    /**
+     * \brief maximum number of C-DNS blocks waiting to be sent.
+     */
+    unsigned int output_queue;
+
     /**
      * \brief compress output data using gzip.
      */
@@ -707,6 +755,22 @@ public:
      */
     unsigned int max_compression_threads;
 
+    /**
+     * \brief maximum number of files waiting for compression.
+     *
+     * 0 = no limit.
+     */
+    unsigned int max_compression_queue;
+
+    /**
+     * \brief lowest compression level or preset to use.
+     *
+     * If set, compression levels are lowered towards this level
+     * when compression falls behind, and raised back towards the
+     * configured level when it catches up.
+     */
+    boost::optional<unsigned int> min_compression_level;
+
     /**
      * \brief rotation period for all output files.
      */
@@ -731,6 +795,48 @@ public:
      */
     std::chrono::microseconds skew_timeout;
 
+    /**
+     * \brief the maximum number of TCP flows to track. 0 = no limit.
+     */
+    unsigned int tcp_max_flows;
+
+    /**
+     * \brief the maximum memory used for TCP reassembly. 0 = no limit.
+     */
+    Size tcp_memory_limit;
+
+    /**
+     * \brief period after which an idle TCP flow is forgotten.
+     */
+    std::chrono::seconds tcp_idle_timeout;
+
+    /**
+     * \brief the maximum memory used for IP fragment reassembly. 0 = no limit.
+     */
+    Size fragment_memory_limit;
+
+    /**
+     * \brief period allowed for all fragments of an IP datagram to arrive.
+     */
+    std::chrono::seconds fragment_timeout;
+
+    /**
+     * \brief the number of packet processing worker threads.
+     *
+     * Packets are shared between workers by flow. 0 = process packets
+     * on the capture thread.
+     */
+    unsigned int worker_threads;
+
+    /**
+     * \brief the CPUs for each thread role.
+     *
+     * The key is the role, the thread name without the `comp:`
+     * prefix. The value is a CPU list, or `nic` for the CPUs local to
+     * the first capture interface.
+     */
+    std::map<std::string, std::string> thread_cpus;
+
     /**
      * \brief packet capture snap length. See `tcpdump` documentation for more.
      */
@@ -842,6 +948,16 @@ public:
      */
     Size max_output_size;
 
+    /**
+     * \brief record sketches of clients and query names in each block.
+     */
+    bool block_sketches;
+
+    /**
+     * \brief number of query names kept in each block's query name sketch.
+     */
+    unsigned int block_sketch_qnames;
+
     /**
      * \brief report statistics on exit
      */
@@ -857,6 +973,16 @@ public:
      */
     unsigned int log_network_stats_period;
 
+    /**
+     * \brief Unix socket on which to serve pipeline metrics.
+     */
+    std::string metrics_socket;
+
+    /**
+     * \brief Unix socket on which to accept control commands.
+     */
+    std::string control_socket;
+
    /**
     * \brief log detailed file handling
     */
@@ -877,6 +1003,17 @@ public:
      */
     unsigned int sampling_time;
 
+    /**
+     * \brief percentage of the C-DNS output queue in use above which
+     * to shed low priority query/responses. 0 = no shedding.
+     */
+    unsigned int shed_threshold;
+
+    /**
+     * \brief RR types not given priority when shedding.
+     */
+    std::vector<unsigned> shed_common_rr_types;
+
     /**
      * \brief output text summary of individual DNS messages.
      */
@@ -887,6 +1024,41 @@ public:
      */
     bool debug_qr;
 
+    /**
+     * \brief count hardware events in each pipeline stage.
+     */
+    bool perf_counters;
+
+    /**
+     * \brief capture file to replay through the capture pipeline.
+     */
+    std::string replay_file;
+
+    /**
+     * \brief replay rate, packets/s. 0 = use capture file timing.
+     */
+    double replay_rate;
+
+    /**
+     * \brief replay rate increase each second, packets/s.
+     */
+    double replay_ramp;
+
+    /**
+     * \brief replay time compression with capture file timing.
+     */
+    double replay_speedup;
+
+    /**
+     * \brief replay duration, seconds. 0 = replay file once.
+     */
+    unsigned int replay_duration;
+
+    /**
+     * \brief file for per-second replay throughput.
+     */
+    std::string replay_report;
+
     /**
      * \brief don't write host identifier info to CBOR output.
      *
@@ -953,6 +1125,19 @@ public:
      */
     HintsExcluded exclude_hints;
 
+    /**
+     * \brief pseudo-anonymisation of C-DNS output, if to use.
+     */
+    boost::optional<PseudoAnonymise> pseudo_anon;
+
+    /**
+     * \brief configurations for additional C-DNS outputs.
+     *
+     * Each output definition file gives the output settings that
+     * differ from this configuration for one additional output.
+     */
+    std::vector<std::shared_ptr<const Configuration>> output_definitions;
+
     /**
      * \brief Default constructor.
      */
@@ -977,6 +1162,32 @@ public:
      */
     boost::program_options::variables_map reread_config_file();
 
+    /**
+     * \brief Determine whether changing to a new configuration needs a restart.
+     *
+     * Filters, exclude hints, included sections, accepted and ignored
+     * OPCODEs and RR types, VLAN IDs, rotation period and C-DNS
+     * compression levels can be changed while running. Changes to
+     * the value in effect of any other option need a restart. A
+     * configuration file change to an option also given on the
+     * command line is not a change, as the command line value
+     * still applies.
+     *
+     * \param config the new configuration.
+     * \returns `true` if a restart is needed.
+     */
+    bool needs_restart(const Configuration& config) const;
+
+    /**
+     * \brief Get the CPUs for a thread role.
+     *
+     * \param role the thread role.
+     * \returns the CPU numbers. Empty if the role has no CPUs set.
+     * \throws po::error if the CPUs local to the capture interface
+     *         are requested but are not known.
+     */
+    std::vector<unsigned> thread_cpu_list(const std::string& role) const;
+
     /**
      * \brief Return the options for usage output.
      *
@@ -1076,11 +1287,28 @@ private:
      */
     std::string defaults_file_;
 
+    /**
+     * \brief the output definition file, if this is an additional output.
+     */
+    std::string output_definition_file_;
+
+    /**
+     * \brief the options given on the command line.
+     */
+    std::vector<boost::program_options::option> cmdline_items_;
+
     /**
      * \brief variable map from command line only parse.
      */
     boost::program_options::variables_map cmdline_vars_;
 
+    /**
+     * \brief the option values in effect, from whichever of the
+     * command line, configuration file or output definition file
+     * gave them.
+     */
+    std::map<std::string, std::vector<std::string>> option_items_;
+
     /**
      * \brief Command line only visible options.
      */
@@ -1096,6 +1324,11 @@ private:
      */
     boost::program_options::options_description config_file_options_;
 
+    /**
+     * \brief Output definition file options.
+     */
+    boost::program_options::options_description output_file_options_;
+
     /**
      * \brief Positional options.
      */
@@ -1106,6 +1339,15 @@ private:
      */
     bool read_from_block_;
 
+    /**
+     * \brief Read the configuration for an additional output.
+     *
+     * \param file the output definition file.
+     * \returns the configuration.
+     * \throws boost::program_options::error on error.
+     */
+    std::shared_ptr<const Configuration> read_output_definition(const std::string& file) const;
+
     /**
      * \brief Helper method to print output options
      */
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cstdio>
+#include <istream>
+
+#include "log.hpp"
+#include "util.hpp"
+
+#include "controlserver.hpp"
+
+const boost::posix_time::seconds ControlServer::CONNECTION_TIMEOUT(5);
+
+ControlServer::ControlServer(const std::string& path)
+    : path_(path), acceptor_(service_), socket_(service_), timer_(service_)
+{
+    std::remove(path_.c_str());
+    boost::asio::local::stream_protocol::endpoint endpoint(path_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+
+    thread_ = std::thread(
+        [this]()
+        {
+            set_thread_name("comp:control");
+            service_.run();
+        });
+}
+
+ControlServer::~ControlServer()
+{
+    service_.stop();
+    if ( thread_.joinable() )
+        thread_.join();
+
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+    socket_.close(ec);
+    std::remove(path_.c_str());
+}
+
+void ControlServer::add_command(const std::string& name, Command command)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_[name] = command;
+}
+
+std::string ControlServer::run_command(const std::string& line)
+{
+    const char* const SPACE = " \t\r\n";
+    std::string::size_type start = line.find_first_not_of(SPACE);
+    std::string name;
+    if ( start != std::string::npos )
+        name = line.substr(start, line.find_last_not_of(SPACE) - start + 1);
+
+    Command command;
+    std::string known;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto c = commands_.find(name);
+        if ( c != commands_.end() )
+            command = c->second;
+        else
+            for ( const auto& k : commands_ )
+                known += " " + k.first;
+    }
+
+    if ( !command )
+        return "Unknown command '" + name + "'. Commands are:" + known + "\n";
+
+    LOG_INFO << "Control: " << name;
+    return command() + "\n";
+}
+
+void ControlServer::accept()
+{
+    acceptor_.async_accept(
+        socket_,
+        [this](const boost::system::error_code& err)
+        {
+            if ( err == boost::asio::error::operation_aborted )
+                return;
+
+            if ( err )
+            {
+                LOG_ERROR << "Control: " << err.message();
+                accept();
+                return;
+            }
+
+            timer_.expires_from_now(CONNECTION_TIMEOUT);
+            timer_.async_wait(
+                [this](const boost::system::error_code& terr)
+                {
+                    // Ignore a timer for an earlier connection.
+                    if ( terr != boost::asio::error::operation_aborted &&
+                         timer_.expires_at() <= boost::asio::deadline_timer::traits_type::now() )
+                    {
+                        boost::system::error_code ec;
+                        socket_.close(ec);
+                    }
+                });
+            read_command();
+        });
+}
+
+void ControlServer::read_command()
+{
+    buf_.consume(buf_.size());
+    boost::asio::async_read_until(
+        socket_, buf_, '\n',
+        [this](const boost::system::error_code& err, std::size_t)
+        {
+            if ( err && err != boost::asio::error::eof )
+            {
+                if ( err == boost::asio::error::operation_aborted )
+                    LOG_ERROR << "Control: Timed out waiting for command";
+                else
+                    LOG_ERROR << "Control: " << err.message();
+                next_connection();
+                return;
+            }
+
+            try
+            {
+                std::istream is(&buf_);
+                std::string line;
+                std::getline(is, line);
+                reply_ = run_command(line);
+            }
+            catch (const std::exception& e)
+            {
+                LOG_ERROR << "Control: " << e.what();
+                next_connection();
+                return;
+            }
+
+            boost::asio::async_write(
+                socket_, boost::asio::buffer(reply_),
+                [this](const boost::system::error_code& werr, std::size_t)
+                {
+                    if ( werr )
+                        LOG_ERROR << "Control: " << werr.message();
+                    next_connection();
+                });
+        });
+}
+
+void ControlServer::next_connection()
+{
+    // Moving the expiry time also cancels the timer, and stops a
+    // timer handler that has already been queued closing the next
+    // connection.
+    boost::system::error_code ec;
+    timer_.expires_at(boost::posix_time::pos_infin, ec);
+    socket_.close(ec);
+    accept();
+}
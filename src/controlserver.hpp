@@ -0,0 +1,151 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef CONTROLSERVER_HPP
+#define CONTROLSERVER_HPP
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+/**
+ * \class ControlServer
+ * \brief Accept commands on a local (UNIX domain) socket.
+ *
+ * A thread waits for connections on the socket. Each connection
+ * sends one command on a line, is sent the command's reply, and
+ * is then closed. A connection that does not complete within
+ * CONNECTION_TIMEOUT is closed.
+ */
+class ControlServer
+{
+public:
+    /**
+     * \typedef Command
+     * \brief A command. Returns the reply to send.
+     */
+    using Command = std::function<std::string ()>;
+
+    /**
+     * \brief the time allowed for a connection to send its command
+     * and receive the reply.
+     */
+    static const boost::posix_time::seconds CONNECTION_TIMEOUT;
+
+    /**
+     * \brief Constructor.
+     *
+     * Any existing file at the socket path is removed.
+     *
+     * \param path the socket path.
+     * \throws boost::system::system_error if the socket can't be created.
+     */
+    explicit ControlServer(const std::string& path);
+
+    /**
+     * \brief Destructor.
+     *
+     * Stop the server thread, close any current connection and
+     * remove the socket.
+     */
+    ~ControlServer();
+
+    /**
+     * \brief Add a command.
+     *
+     * \param name    the command name.
+     * \param command the command.
+     */
+    void add_command(const std::string& name, Command command);
+
+    /**
+     * \brief Run a command.
+     *
+     * Leading and trailing white space is ignored.
+     *
+     * \param line the command line received.
+     * \returns the reply, ending with a newline.
+     */
+    std::string run_command(const std::string& line);
+
+private:
+    /**
+     * \brief Wait for the next connection.
+     */
+    void accept();
+
+    /**
+     * \brief Read the command from the current connection.
+     */
+    void read_command();
+
+    /**
+     * \brief Close the current connection and wait for the next.
+     */
+    void next_connection();
+
+    /**
+     * \brief mutex guarding the commands.
+     */
+    std::mutex mutex_;
+
+    /**
+     * \brief the commands, by name.
+     */
+    std::map<std::string, Command> commands_;
+
+    /**
+     * \brief the socket path.
+     */
+    std::string path_;
+
+    /**
+     * \brief the I/O service.
+     */
+    boost::asio::io_service service_;
+
+    /**
+     * \brief the socket acceptor.
+     */
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+
+    /**
+     * \brief the socket for the current connection.
+     */
+    boost::asio::local::stream_protocol::socket socket_;
+
+    /**
+     * \brief timer limiting the time for the current connection.
+     */
+    boost::asio::deadline_timer timer_;
+
+    /**
+     * \brief buffer for the command line received.
+     */
+    boost::asio::streambuf buf_;
+
+    /**
+     * \brief the reply being sent.
+     */
+    std::string reply_;
+
+    /**
+     * \brief the server thread.
+     */
+    std::thread thread_;
+};
+
+#endif
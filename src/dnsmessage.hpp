@@ -97,6 +97,12 @@ struct DNSMessage
      */
     std::chrono::system_clock::time_point timestamp;
 
+    /**
+     * \brief when the packet completing the message entered the
+     * compactor, if measuring latency.
+     */
+    std::chrono::steady_clock::time_point received;
+
     /**
      * \brief IP address of client.
      *
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cstring>
+#include <random>
+
+#include "flowsampler.hpp"
+
+namespace {
+    /**
+     * \brief Rotate a 64 bit value left.
+     *
+     * \param x the value.
+     * \param b the number of bits to rotate.
+     * \returns the rotated value.
+     */
+    inline uint64_t rotl(uint64_t x, int b)
+    {
+        return (x << b) | (x >> (64 - b));
+    }
+
+    /**
+     * \brief Read a little-endian 64 bit value.
+     *
+     * \param p pointer to the value.
+     * \returns the value.
+     */
+    inline uint64_t get64le(const uint8_t* p)
+    {
+        uint64_t res = 0;
+        for ( int i = 7; i >= 0; --i )
+            res = (res << 8) | p[i];
+        return res;
+    }
+
+    /**
+     * \brief Perform a SipHash round.
+     */
+    inline void sipround(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+    {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    }
+
+    /**
+     * \brief Generate a random 64 bit value.
+     *
+     * \param rd the random device.
+     * \returns the value.
+     */
+    uint64_t random64(std::random_device& rd)
+    {
+        return (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+}
+
+FlowSampler::FlowSampler(unsigned rate)
+    : rate_(rate)
+{
+    std::random_device rd;
+    k0_ = random64(rd);
+    k1_ = random64(rd);
+}
+
+FlowSampler::FlowSampler(unsigned rate, uint64_t k0, uint64_t k1)
+    : rate_(rate), k0_(k0), k1_(k1)
+{
+}
+
+bool FlowSampler::keep(const uint8_t* addr, std::size_t addr_len,
+                       uint16_t port, uint16_t id) const
+{
+    if ( rate_ <= 1 )
+        return true;
+
+    uint8_t buf[20];
+    if ( addr_len > 16 )
+        addr_len = 16;
+    std::memcpy(buf, addr, addr_len);
+    buf[addr_len] = static_cast<uint8_t>(port >> 8);
+    buf[addr_len + 1] = static_cast<uint8_t>(port);
+    buf[addr_len + 2] = static_cast<uint8_t>(id >> 8);
+    buf[addr_len + 3] = static_cast<uint8_t>(id);
+    return siphash24(k0_, k1_, buf, addr_len + 4) % rate_ == 0;
+}
+
+uint64_t FlowSampler::siphash24(uint64_t k0, uint64_t k1,
+                                const uint8_t* data, std::size_t len)
+{
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+
+    const uint8_t* end = data + (len & ~static_cast<std::size_t>(7));
+    for ( ; data != end; data += 8 )
+    {
+        uint64_t m = get64le(data);
+        v3 ^= m;
+        sipround(v0, v1, v2, v3);
+        sipround(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    for ( std::size_t i = 0; i < ( len & 7 ); ++i )
+        b |= static_cast<uint64_t>(data[i]) << (8 * i);
+
+    v3 ^= b;
+    sipround(v0, v1, v2, v3);
+    sipround(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for ( int i = 0; i < 4; ++i )
+        sipround(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef FLOWSAMPLER_HPP
+#define FLOWSAMPLER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * \class FlowSampler
+ * \brief Decide which DNS transactions to keep when sampling.
+ *
+ * The decision is made from a keyed hash of the client address, client
+ * port and DNS message ID. A query and its response share all three,
+ * so both are either kept or discarded.
+ *
+ * The hash is SipHash-2-4 with a random key chosen on construction,
+ * so a client cannot arrange for its traffic to always be kept
+ * or always discarded.
+ */
+class FlowSampler
+{
+public:
+    /**
+     * \brief Constructor, using a random key.
+     *
+     * \param rate keep 1 in `rate` transactions.
+     */
+    explicit FlowSampler(unsigned rate);
+
+    /**
+     * \brief Constructor, using a given key.
+     *
+     * \param rate keep 1 in `rate` transactions.
+     * \param k0   the first 64 bits of the key.
+     * \param k1   the second 64 bits of the key.
+     */
+    FlowSampler(unsigned rate, uint64_t k0, uint64_t k1);
+
+    /**
+     * \brief Decide whether to keep a DNS transaction.
+     *
+     * \param addr     the client address, in network format.
+     * \param addr_len the client address length, 4 or 16.
+     * \param port     the client port.
+     * \param id       the DNS message ID.
+     * \returns `true` if the transaction should be kept.
+     */
+    bool keep(const uint8_t* addr, std::size_t addr_len,
+              uint16_t port, uint16_t id) const;
+
+    /**
+     * \brief Return the sampling rate.
+     */
+    unsigned rate() const
+    {
+        return rate_;
+    }
+
+    /**
+     * \brief Calculate SipHash-2-4.
+     *
+     * \param k0   the first 64 bits of the key.
+     * \param k1   the second 64 bits of the key.
+     * \param data the data to hash.
+     * \param len  the data length.
+     * \returns the hash value.
+     */
+    static uint64_t siphash24(uint64_t k0, uint64_t k1,
+                              const uint8_t* data, std::size_t len);
+
+private:
+    /**
+     * \brief the sampling rate.
+     */
+    unsigned rate_;
+
+    /**
+     * \brief the first 64 bits of the key.
+     */
+    uint64_t k0_;
+
+    /**
+     * \brief the second 64 bits of the key.
+     */
+    uint64_t k1_;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+
+#include "makeunique.hpp"
+#include "util.hpp"
+
+#include "flowworkers.hpp"
+
+const std::chrono::milliseconds FlowWorkers::FLUSH_TIMEOUT(100);
+const unsigned FlowWorkers::BATCH_SIZE = 64;
+
+FlowWorkers::FlowWorkers(unsigned nworkers,
+                         unsigned max_channel_size,
+                         bool live_capture,
+                         ProcessorFactory make_processor)
+    : wait_(!live_capture)
+{
+    unsigned max_batches = std::max(max_channel_size / BATCH_SIZE, 1u);
+
+    for ( unsigned i = 0; i < nworkers; ++i )
+    {
+        workers_.emplace_back(make_unique<Worker>(i + 1));
+        Worker& w = *workers_.back();
+        w.packets.set_max_items(max_batches);
+        w.batch.reserve(BATCH_SIZE);
+        w.thread = std::thread(worker_main, std::ref(w), make_processor);
+    }
+}
+
+FlowWorkers::~FlowWorkers()
+{
+    close();
+}
+
+void FlowWorkers::flush(PacketStatistics& stats)
+{
+    for ( auto& w : workers_ )
+        send_batch(*w, stats);
+}
+
+void FlowWorkers::add_published_stats(PacketStatistics& total)
+{
+    for ( auto& w : workers_ )
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        total += w->published;
+    }
+}
+
+unsigned FlowWorkers::matcher_length()
+{
+    unsigned res = 0;
+    for ( auto& w : workers_ )
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        res += w->published_length;
+    }
+    return res;
+}
+
+unsigned FlowWorkers::queue_length()
+{
+    unsigned res = 0;
+    for ( auto& w : workers_ )
+        res += w->packets.get_length();
+    return res;
+}
+
+void FlowWorkers::close()
+{
+    for ( auto& w : workers_ )
+    {
+        if ( w->packets.is_closed() )
+            continue;
+        if ( !w->batch.empty() )
+        {
+            w->packets.put(std::move(w->batch), true);
+            w->batch.clear();
+        }
+        w->packets.close();
+    }
+    for ( auto& w : workers_ )
+        if ( w->thread.joinable() )
+            w->thread.join();
+}
+
+void FlowWorkers::add_stats(PacketStatistics& total)
+{
+    for ( auto& w : workers_ )
+        total += w->stats;
+}
+
+void FlowWorkers::send_batch(Worker& w, PacketStatistics& stats)
+{
+    if ( w.batch.empty() )
+        return;
+
+    std::size_t n = w.batch.size();
+    if ( !w.packets.put(std::move(w.batch), wait_) )
+        stats.matcher_drop_count += n;
+    w.batch.clear();
+    w.batch.reserve(BATCH_SIZE);
+}
+
+void FlowWorkers::worker_main(Worker& w, ProcessorFactory make_processor)
+{
+    set_thread_name("comp:worker");
+
+    std::unique_ptr<Processor> processor = make_processor(w.source, w.stats);
+
+    auto publish =
+        [&]()
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.published = w.stats;
+            w.published_length = processor->length();
+        };
+
+    PacketBatch batch;
+    while ( w.packets.get(batch) )
+    {
+        processor->process(batch);
+        publish();
+    }
+
+    processor->finish();
+    publish();
+}
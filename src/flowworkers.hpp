@@ -0,0 +1,273 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef FLOWWORKERS_HPP
+#define FLOWWORKERS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "channel.hpp"
+#include "packetstream.hpp"
+
+/**
+ * \class FlowWorkers
+ * \brief Packet processing worker threads.
+ *
+ * The capture thread distributes packets to workers by flow hash, so
+ * that all packets needed to decode and match a DNS exchange arrive
+ * at the same worker, in the order they were dispatched. Packets are
+ * passed to workers in batches, to keep inter-thread overhead per
+ * packet low. The capture thread should flush partly filled batches
+ * periodically, and when no packets have arrived for FLUSH_TIMEOUT.
+ *
+ * Each worker keeps its own statistics, and publishes a copy after
+ * each batch for the capture thread to read.
+ */
+class FlowWorkers
+{
+public:
+    /**
+     * \typedef PacketBatch
+     * \brief A batch of packets for a worker.
+     */
+    using PacketBatch = std::vector<std::shared_ptr<PcapItem>>;
+
+    /**
+     * \class Processor
+     * \brief Process the packets sent to a worker.
+     *
+     * Each worker has its own processor, which is only used on
+     * the worker thread.
+     */
+    class Processor
+    {
+    public:
+        /**
+         * \brief Destructor.
+         */
+        virtual ~Processor() {}
+
+        /**
+         * \brief Process a batch of packets.
+         *
+         * \param batch the packets.
+         */
+        virtual void process(PacketBatch& batch) = 0;
+
+        /**
+         * \brief Finish processing. No more packets will arrive.
+         */
+        virtual void finish() = 0;
+
+        /**
+         * \brief Return the number of items held by the processor.
+         */
+        virtual unsigned length() = 0;
+    };
+
+    /**
+     * \typedef ProcessorFactory
+     * \brief Create the processor for a worker.
+     *
+     * This is called on the worker thread. The first parameter is the
+     * worker statistics source number, and the second the worker
+     * statistics for the processor to update.
+     */
+    using ProcessorFactory = std::function<std::unique_ptr<Processor> (unsigned, PacketStatistics&)>;
+
+    /**
+     * \brief the time without packets after which partly filled
+     * batches should be flushed.
+     */
+    static const std::chrono::milliseconds FLUSH_TIMEOUT;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param nworkers         the number of workers. May be 0.
+     * \param max_channel_size the maximum number of packets waiting for all workers.
+     * \param live_capture     `true` if capturing from the network.
+     * \param make_processor   create the processor for a worker.
+     */
+    FlowWorkers(unsigned nworkers,
+                unsigned max_channel_size,
+                bool live_capture,
+                ProcessorFactory make_processor);
+
+    /**
+     * \brief Destructor.
+     */
+    ~FlowWorkers();
+
+    /**
+     * \brief Return `true` if there are no workers.
+     */
+    bool empty() const
+    {
+        return workers_.empty();
+    }
+
+    /**
+     * \brief Send a packet to the worker for its flow.
+     *
+     * \param hash  the packet flow hash.
+     * \param pcap  the packet.
+     * \param stats capture thread statistics to update.
+     */
+    void dispatch(std::size_t hash, const std::shared_ptr<PcapItem>& pcap,
+                  PacketStatistics& stats)
+    {
+        Worker& w = *workers_[hash % workers_.size()];
+        w.batch.push_back(pcap);
+        if ( w.batch.size() >= BATCH_SIZE )
+            send_batch(w, stats);
+    }
+
+    /**
+     * \brief Send any partly filled batches to workers.
+     *
+     * \param stats capture thread statistics to update.
+     */
+    void flush(PacketStatistics& stats);
+
+    /**
+     * \brief Add the latest published worker statistics to a total.
+     *
+     * \param total the total.
+     */
+    void add_published_stats(PacketStatistics& total);
+
+    /**
+     * \brief Return the total length of the worker processors.
+     */
+    unsigned matcher_length();
+
+    /**
+     * \brief Return the total number of batches waiting for workers.
+     *
+     * This may be called from any thread.
+     */
+    unsigned queue_length();
+
+    /**
+     * \brief Process all outstanding packets and stop the workers.
+     */
+    void close();
+
+    /**
+     * \brief Add the final worker statistics to a total.
+     *
+     * Only valid once the workers have been closed.
+     *
+     * \param total the total.
+     */
+    void add_stats(PacketStatistics& total);
+
+private:
+    /**
+     * \brief the number of packets in a batch.
+     */
+    static const unsigned BATCH_SIZE;
+
+    /**
+     * \struct Worker
+     * \brief A single worker.
+     */
+    struct Worker
+    {
+        /**
+         * \brief Constructor.
+         *
+         * \param src the worker statistics source number.
+         */
+        explicit Worker(unsigned src)
+            : source(src), stats(), published(), published_length(0) {}
+
+        /**
+         * \brief the worker statistics source number.
+         */
+        unsigned source;
+
+        /**
+         * \brief channel for sending packet batches to the worker.
+         */
+        Channel<PacketBatch> packets;
+
+        /**
+         * \brief the batch being filled by the capture thread.
+         */
+        PacketBatch batch;
+
+        /**
+         * \brief the worker statistics. Only used by the worker thread
+         * until the worker has stopped.
+         */
+        PacketStatistics stats;
+
+        /**
+         * \brief mutex guarding the published values.
+         */
+        std::mutex mutex;
+
+        /**
+         * \brief latest published worker statistics.
+         */
+        PacketStatistics published;
+
+        /**
+         * \brief latest published worker processor length.
+         */
+        unsigned published_length;
+
+        /**
+         * \brief the worker thread.
+         */
+        std::thread thread;
+    };
+
+    /**
+     * \brief Send a worker its batch.
+     *
+     * If the worker is not keeping up and this is a live capture,
+     * the batch is dropped.
+     *
+     * \param w     the worker.
+     * \param stats capture thread statistics to update.
+     */
+    void send_batch(Worker& w, PacketStatistics& stats);
+
+    /**
+     * \brief Main function for a worker thread.
+     *
+     * \param w              the worker.
+     * \param make_processor create the worker processor.
+     */
+    static void worker_main(Worker& w, ProcessorFactory make_processor);
+
+    /**
+     * \brief the workers.
+     */
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    /**
+     * \brief `true` if the capture thread should wait for a busy worker.
+     */
+    bool wait_;
+};
+
+#endif
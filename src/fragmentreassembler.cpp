@@ -0,0 +1,360 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "fragmentreassembler.hpp"
+
+namespace {
+    /**
+     * \brief the maximum length of an IP datagram or IPv6 payload.
+     */
+    const std::size_t MAX_DATAGRAM_SIZE = 65535;
+
+    /**
+     * \brief the maximum number of fragments in a datagram.
+     *
+     * A legitimate DNS message will never need anything like this many.
+     */
+    const std::size_t MAX_FRAGMENTS = 128;
+
+    /**
+     * \brief estimate of the fixed memory cost of a datagram.
+     */
+    const std::size_t DATAGRAM_OVERHEAD = 256;
+
+    /**
+     * \brief estimate of the fixed memory cost of a fragment.
+     */
+    const std::size_t FRAGMENT_OVERHEAD = 64;
+
+    /**
+     * \brief IPv6 extension headers that may precede the fragment header.
+     */
+    const uint8_t IPV6_HOP_BY_HOP = 0;
+    const uint8_t IPV6_ROUTING = 43;
+    const uint8_t IPV6_FRAGMENT = 44;
+    const uint8_t IPV6_DESTINATION_OPTIONS = 60;
+
+    /**
+     * \brief Read a network order 16 bit value.
+     *
+     * \param p pointer to the value.
+     * \returns the value.
+     */
+    uint16_t get16(const uint8_t* p)
+    {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    /**
+     * \brief Write a network order 16 bit value.
+     *
+     * \param p   pointer to the destination.
+     * \param val the value.
+     */
+    void put16(uint8_t* p, std::size_t val)
+    {
+        p[0] = static_cast<uint8_t>(val >> 8);
+        p[1] = static_cast<uint8_t>(val);
+    }
+}
+
+std::size_t hash_value(const FragmentKey& key)
+{
+    std::size_t seed = boost::hash_range(key.addresses.begin(), key.addresses.end());
+    boost::hash_combine(seed, key.id);
+    boost::hash_combine(seed, key.protocol);
+    return seed;
+}
+
+std::size_t FragmentReassembler::Datagram::memory() const
+{
+    return DATAGRAM_OVERHEAD + header.size() + received +
+        fragments.size() * FRAGMENT_OVERHEAD;
+}
+
+FragmentReassembler::FragmentReassembler(std::size_t memory_limit,
+                                         std::chrono::seconds timeout,
+                                         PacketStatistics& stats)
+    : memory_limit_(memory_limit), timeout_(timeout), stats_(stats),
+      memory_used_(0)
+{
+}
+
+bool FragmentReassembler::process_ipv4(const uint8_t* pkt, std::size_t len,
+                                       const std::chrono::system_clock::time_point& timestamp,
+                                       std::vector<uint8_t>& datagram)
+{
+    expire(timestamp);
+
+    if ( len < 20 )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        return false;
+    }
+
+    // Use the IP total length; the packet may have link layer padding.
+    std::size_t header_len = (pkt[0] & 0x0f) * 4;
+    std::size_t total_len = get16(pkt + 2);
+    uint16_t flags_offset = get16(pkt + 6);
+    bool more = ( flags_offset & 0x2000 );
+    std::size_t offset = (flags_offset & 0x1fff) * 8;
+
+    if ( header_len < 20 || total_len < header_len || total_len > len ||
+         header_len + offset + total_len - header_len > MAX_DATAGRAM_SIZE )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        return false;
+    }
+
+    FragmentKey key;
+    key.addresses.assign(pkt + 12, 8);
+    key.id = get16(pkt + 4);
+    key.protocol = pkt[9];
+
+    auto dgram = find_datagram(key, timestamp);
+    std::size_t mem_before = dgram->memory();
+    bool ok = add_fragment(*dgram, offset, more,
+                           pkt + header_len, total_len - header_len);
+    if ( ok && offset == 0 && dgram->header.empty() )
+        dgram->header.assign(pkt, pkt + header_len);
+    return finish_fragment(dgram, mem_before, ok, datagram);
+}
+
+bool FragmentReassembler::process_ipv6(const uint8_t* pkt, std::size_t len,
+                                       const std::chrono::system_clock::time_point& timestamp,
+                                       std::vector<uint8_t>& datagram)
+{
+    expire(timestamp);
+
+    if ( len < 40 )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        return false;
+    }
+
+    // Find the fragment header. Only the headers that are allowed to
+    // be in the unfragmentable part may come before it.
+    std::size_t end = 40 + get16(pkt + 4);
+    std::size_t next_header_pos = 6;
+    std::size_t pos = 40;
+    uint8_t next_header = pkt[next_header_pos];
+
+    while ( end <= len &&
+            ( next_header == IPV6_HOP_BY_HOP ||
+              next_header == IPV6_ROUTING ||
+              next_header == IPV6_DESTINATION_OPTIONS ) &&
+            pos + 8 <= end )
+    {
+        next_header_pos = pos;
+        next_header = pkt[pos];
+        pos += (pkt[pos + 1] + 1) * 8;
+    }
+
+    if ( end > len || next_header != IPV6_FRAGMENT || pos + 8 > end )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        return false;
+    }
+
+    const uint8_t* frag_header = pkt + pos;
+    uint16_t offset_more = get16(frag_header + 2);
+    bool more = ( offset_more & 0x0001 );
+    std::size_t offset = offset_more & 0xfff8;
+    std::size_t frag_len = end - pos - 8;
+
+    if ( pos - 40 + offset + frag_len > MAX_DATAGRAM_SIZE )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        return false;
+    }
+
+    FragmentKey key;
+    key.addresses.assign(pkt + 8, 32);
+    key.id = (static_cast<uint32_t>(get16(frag_header + 4)) << 16) | get16(frag_header + 6);
+    key.protocol = 0;
+
+    auto dgram = find_datagram(key, timestamp);
+    std::size_t mem_before = dgram->memory();
+    bool ok = add_fragment(*dgram, offset, more, frag_header + 8, frag_len);
+    if ( ok && offset == 0 && dgram->header.empty() )
+    {
+        dgram->header.assign(pkt, pkt + pos);
+        dgram->next_header_pos = next_header_pos;
+        dgram->next_header = frag_header[0];
+        dgram->ipv6 = true;
+    }
+    return finish_fragment(dgram, mem_before, ok, datagram);
+}
+
+void FragmentReassembler::expire(const std::chrono::system_clock::time_point& now)
+{
+    while ( !datagrams_.empty() && datagrams_.front().first_seen + timeout_ <= now )
+    {
+        ++stats_.ip_fragment_timeout_count;
+        remove_datagram(datagrams_.begin());
+    }
+}
+
+FragmentReassembler::DatagramList::iterator FragmentReassembler::find_datagram(const FragmentKey& key,
+                                                                               const std::chrono::system_clock::time_point& timestamp)
+{
+    auto d = datagram_map_.find(key);
+    if ( d != datagram_map_.end() )
+        return d->second;
+
+    auto res = datagrams_.emplace(datagrams_.end(), key, timestamp);
+    datagram_map_.emplace(key, res);
+    memory_used_ += res->memory();
+    return res;
+}
+
+bool FragmentReassembler::add_fragment(Datagram& dgram,
+                                       std::size_t offset, bool more,
+                                       const uint8_t* data, std::size_t len)
+{
+    std::size_t end = offset + len;
+
+    // All but the last fragment must be a non-zero multiple of 8 bytes.
+    if ( more && ( len == 0 || len % 8 != 0 ) )
+        return false;
+
+    if ( more )
+    {
+        if ( dgram.total_known && end >= dgram.total_len )
+            return false;
+    }
+    else
+    {
+        if ( dgram.total_known && dgram.total_len != end )
+            return false;
+        if ( !dgram.fragments.empty() )
+        {
+            auto last = std::prev(dgram.fragments.end());
+            if ( last->first + last->second.size() > end )
+                return false;
+        }
+        dgram.total_known = true;
+        dgram.total_len = end;
+    }
+
+    auto next = dgram.fragments.lower_bound(offset);
+
+    // An exact duplicate is harmless; ignore it.
+    if ( next != dgram.fragments.end() &&
+         next->first == offset &&
+         next->second.size() == len &&
+         std::equal(data, data + len, next->second.begin()) )
+        return true;
+
+    // Any other overlap is not.
+    if ( next != dgram.fragments.end() && next->first < end )
+        return false;
+    if ( next != dgram.fragments.begin() )
+    {
+        auto prev = std::prev(next);
+        if ( prev->first + prev->second.size() > offset )
+            return false;
+    }
+
+    if ( dgram.fragments.size() >= MAX_FRAGMENTS )
+        return false;
+
+    dgram.fragments.emplace_hint(next, offset, std::vector<uint8_t>(data, data + len));
+    dgram.received += len;
+    return true;
+}
+
+bool FragmentReassembler::finish_fragment(DatagramList::iterator dgram,
+                                          std::size_t mem_before, bool ok,
+                                          std::vector<uint8_t>& datagram)
+{
+    memory_used_ = memory_used_ + dgram->memory() - mem_before;
+
+    if ( !ok )
+    {
+        ++stats_.ip_fragment_bad_drop_count;
+        remove_datagram(dgram);
+        return false;
+    }
+
+    if ( dgram->total_known && !dgram->header.empty() &&
+         dgram->received == dgram->total_len )
+    {
+        if ( dgram->ipv6 )
+            build_ipv6(*dgram, datagram);
+        else
+            build_ipv4(*dgram, datagram);
+        ++stats_.ip_fragment_reassembled_count;
+        remove_datagram(dgram);
+        return true;
+    }
+
+    enforce_limit();
+    return false;
+}
+
+void FragmentReassembler::build_ipv4(const Datagram& dgram, std::vector<uint8_t>& datagram)
+{
+    std::size_t header_len = dgram.header.size();
+
+    datagram.clear();
+    datagram.reserve(header_len + dgram.total_len);
+    datagram.insert(datagram.end(), dgram.header.begin(), dgram.header.end());
+    for ( const auto& f : dgram.fragments )
+        datagram.insert(datagram.end(), f.second.begin(), f.second.end());
+
+    // Update total length, clear MF and offset, keeping DF, and
+    // recalculate the header checksum.
+    put16(&datagram[2], datagram.size());
+    datagram[6] &= 0x40;
+    datagram[7] = 0;
+    datagram[10] = datagram[11] = 0;
+    uint32_t sum = 0;
+    for ( std::size_t i = 0; i < header_len; i += 2 )
+        sum += get16(&datagram[i]);
+    while ( sum >> 16 )
+        sum = (sum & 0xffff) + (sum >> 16);
+    put16(&datagram[10], ~sum & 0xffff);
+}
+
+void FragmentReassembler::build_ipv6(const Datagram& dgram, std::vector<uint8_t>& datagram)
+{
+    datagram.clear();
+    datagram.reserve(dgram.header.size() + dgram.total_len);
+    datagram.insert(datagram.end(), dgram.header.begin(), dgram.header.end());
+    for ( const auto& f : dgram.fragments )
+        datagram.insert(datagram.end(), f.second.begin(), f.second.end());
+
+    // The fragment header is dropped, so whatever pointed to it
+    // now points to whatever it pointed to.
+    datagram[dgram.next_header_pos] = dgram.next_header;
+    put16(&datagram[4], datagram.size() - 40);
+}
+
+void FragmentReassembler::remove_datagram(DatagramList::iterator dgram)
+{
+    memory_used_ -= dgram->memory();
+    datagram_map_.erase(dgram->key);
+    datagrams_.erase(dgram);
+}
+
+void FragmentReassembler::enforce_limit()
+{
+    while ( memory_limit_ > 0 && memory_used_ > memory_limit_ && !datagrams_.empty() )
+    {
+        ++stats_.ip_fragment_memory_drop_count;
+        remove_datagram(datagrams_.begin());
+    }
+}
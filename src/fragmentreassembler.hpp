@@ -0,0 +1,340 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef FRAGMENTREASSEMBLER_HPP
+#define FRAGMENTREASSEMBLER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "bytestring.hpp"
+#include "packetstatistics.hpp"
+
+/**
+ * \struct FragmentKey
+ * \brief Identify the datagram a fragment belongs to.
+ */
+struct FragmentKey
+{
+    /**
+     * \brief Equality operator.
+     *
+     * \param rhs the key to compare to.
+     * \returns `true` if the keys are equal.
+     */
+    bool operator==(const FragmentKey& rhs) const
+    {
+        return id == rhs.id && protocol == rhs.protocol &&
+            addresses == rhs.addresses;
+    }
+
+    /**
+     * \brief the source and destination addresses, in network format.
+     */
+    byte_string addresses;
+
+    /**
+     * \brief the fragment identification.
+     */
+    uint32_t id;
+
+    /**
+     * \brief the IPv4 protocol. Always 0 for IPv6.
+     */
+    uint8_t protocol;
+};
+
+/**
+ * \brief Calculate a hash value for the fragment key.
+ *
+ * \param key the fragment key.
+ * \returns hash value.
+ */
+std::size_t hash_value(const FragmentKey& key);
+
+/**
+ * \class FragmentReassembler
+ * \brief Reassemble fragmented IPv4 and IPv6 datagrams.
+ *
+ * Fragments are given to the reassembler as raw IP packets. When all
+ * the fragments of a datagram have been seen, the reassembled datagram
+ * is returned as a raw unfragmented IP packet.
+ *
+ * The reassembler is built to survive hostile traffic:
+ * - A datagram not completed within the timeout is discarded.
+ * - Memory used by all incomplete datagrams is limited. If the limit is
+ *   exceeded, the oldest incomplete datagrams are discarded.
+ * - Any fragment overlapping a fragment already received causes the
+ *   whole datagram to be discarded, as required for IPv6 by RFC 5722.
+ *   Exact duplicates of a fragment are ignored.
+ * - Datagrams with too many fragments, or which would exceed the
+ *   maximum IP datagram size, are discarded.
+ *
+ * Times are packet timestamps, not wall clock time.
+ */
+class FragmentReassembler
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param memory_limit the maximum memory to use for incomplete datagrams,
+     *                     in bytes. 0 for no limit.
+     * \param timeout      the time allowed to receive all fragments.
+     * \param stats        statistics to update.
+     */
+    FragmentReassembler(std::size_t memory_limit,
+                        std::chrono::seconds timeout,
+                        PacketStatistics& stats);
+
+    /**
+     * \brief Process an IPv4 fragment.
+     *
+     * \param pkt       the IPv4 packet.
+     * \param len       the packet length.
+     * \param timestamp the packet timestamp.
+     * \param datagram  the reassembled datagram, if complete.
+     * \returns `true` if the datagram is complete.
+     */
+    bool process_ipv4(const uint8_t* pkt, std::size_t len,
+                      const std::chrono::system_clock::time_point& timestamp,
+                      std::vector<uint8_t>& datagram);
+
+    /**
+     * \brief Process an IPv6 fragment.
+     *
+     * The packet must contain a fragment header.
+     *
+     * \param pkt       the IPv6 packet.
+     * \param len       the packet length.
+     * \param timestamp the packet timestamp.
+     * \param datagram  the reassembled datagram, if complete.
+     * \returns `true` if the datagram is complete.
+     */
+    bool process_ipv6(const uint8_t* pkt, std::size_t len,
+                      const std::chrono::system_clock::time_point& timestamp,
+                      std::vector<uint8_t>& datagram);
+
+    /**
+     * \brief Discard incomplete datagrams that have timed out.
+     *
+     * \param now the current packet time.
+     */
+    void expire(const std::chrono::system_clock::time_point& now);
+
+    /**
+     * \brief Return the number of incomplete datagrams held.
+     */
+    std::size_t datagram_count() const
+    {
+        return datagram_map_.size();
+    }
+
+    /**
+     * \brief Return the memory currently used, in bytes.
+     */
+    std::size_t memory_used() const
+    {
+        return memory_used_;
+    }
+
+protected:
+    /**
+     * \struct Datagram
+     * \brief An incomplete datagram.
+     */
+    struct Datagram
+    {
+        /**
+         * \brief Constructor.
+         *
+         * \param k the datagram key.
+         * \param t the time the first fragment was seen.
+         */
+        Datagram(const FragmentKey& k,
+                 const std::chrono::system_clock::time_point& t)
+            : key(k), first_seen(t), total_len(0), total_known(false),
+              received(0), next_header_pos(0), next_header(0), ipv6(false) {}
+
+        /**
+         * \brief Return the memory used by this datagram, in bytes.
+         */
+        std::size_t memory() const;
+
+        /**
+         * \brief the datagram key.
+         */
+        FragmentKey key;
+
+        /**
+         * \brief time the first fragment was seen.
+         */
+        std::chrono::system_clock::time_point first_seen;
+
+        /**
+         * \brief the fragments received, keyed by offset.
+         */
+        std::map<std::size_t, std::vector<uint8_t>> fragments;
+
+        /**
+         * \brief the length of the fragmentable part, when known.
+         */
+        std::size_t total_len;
+
+        /**
+         * \brief `true` if the last fragment has been seen.
+         */
+        bool total_known;
+
+        /**
+         * \brief bytes of the fragmentable part received.
+         */
+        std::size_t received;
+
+        /**
+         * \brief the header from the first fragment.
+         *
+         * For IPv6, this is the unfragmentable part.
+         */
+        std::vector<uint8_t> header;
+
+        /**
+         * \brief IPv6 only: position of the header field identifying
+         * the fragment header.
+         */
+        std::size_t next_header_pos;
+
+        /**
+         * \brief IPv6 only: next header value in the fragment header.
+         */
+        uint8_t next_header;
+
+        /**
+         * \brief `true` if this is an IPv6 datagram.
+         */
+        bool ipv6;
+    };
+
+    /**
+     * \typedef DatagramList
+     * \brief Incomplete datagrams, oldest first.
+     */
+    using DatagramList = std::list<Datagram>;
+
+    /**
+     * \brief Find the datagram for a key, creating it if necessary.
+     *
+     * \param key       the datagram key.
+     * \param timestamp the packet timestamp.
+     * \returns iterator for the datagram.
+     */
+    DatagramList::iterator find_datagram(const FragmentKey& key,
+                                         const std::chrono::system_clock::time_point& timestamp);
+
+    /**
+     * \brief Add a fragment to its datagram.
+     *
+     * \param dgram     the datagram.
+     * \param offset    offset of the fragment data in the datagram.
+     * \param more      `true` if more fragments follow.
+     * \param data      the fragment data.
+     * \param len       the fragment data length.
+     * \returns `false` if the fragment is invalid and the datagram
+     *          must be discarded.
+     */
+    static bool add_fragment(Datagram& dgram,
+                             std::size_t offset, bool more,
+                             const uint8_t* data, std::size_t len);
+
+    /**
+     * \brief Complete processing of a fragment.
+     *
+     * Update memory use, discard the datagram if the fragment was
+     * invalid, and build the datagram if it is now complete.
+     *
+     * \param dgram      the datagram.
+     * \param mem_before memory used by the datagram before the fragment was added.
+     * \param ok         `false` if the fragment was invalid.
+     * \param datagram   the reassembled datagram, if complete.
+     * \returns `true` if the datagram is complete.
+     */
+    bool finish_fragment(DatagramList::iterator dgram,
+                         std::size_t mem_before, bool ok,
+                         std::vector<uint8_t>& datagram);
+
+    /**
+     * \brief Build the reassembled IPv4 datagram.
+     *
+     * \param dgram    the complete datagram.
+     * \param datagram the reassembled packet.
+     */
+    static void build_ipv4(const Datagram& dgram, std::vector<uint8_t>& datagram);
+
+    /**
+     * \brief Build the reassembled IPv6 datagram.
+     *
+     * \param dgram    the complete datagram.
+     * \param datagram the reassembled packet.
+     */
+    static void build_ipv6(const Datagram& dgram, std::vector<uint8_t>& datagram);
+
+    /**
+     * \brief Remove a datagram.
+     *
+     * \param dgram iterator for the datagram.
+     */
+    void remove_datagram(DatagramList::iterator dgram);
+
+    /**
+     * \brief Discard oldest datagrams until memory is within the limit.
+     */
+    void enforce_limit();
+
+private:
+    /**
+     * \brief the memory limit.
+     */
+    std::size_t memory_limit_;
+
+    /**
+     * \brief the reassembly timeout.
+     */
+    std::chrono::seconds timeout_;
+
+    /**
+     * \brief statistics to update.
+     */
+    PacketStatistics& stats_;
+
+    /**
+     * \brief incomplete datagrams, oldest first.
+     */
+    DatagramList datagrams_;
+
+    /**
+     * \brief lookup from key to datagram.
+     */
+    std::unordered_map<FragmentKey, DatagramList::iterator, boost::hash<FragmentKey>> datagram_map_;
+
+    /**
+     * \brief memory currently used.
+     */
+    std::size_t memory_used_;
+};
+
+#endif
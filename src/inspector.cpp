@@ -10,13 +10,21 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <cstdio>
+#include <ctime>
+#include <map>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -25,6 +33,7 @@
 
 #include "backend.hpp"
 #include "bytestring.hpp"
+#include "capturedns.hpp"
 #include "cbordecoder.hpp"
 #include "blockcborreader.hpp"
 #include "log.hpp"
@@ -37,6 +46,8 @@ const std::string PCAP_EXT = ".pcap";
 const std::string TEMPLATE_EXT = ".txt";
 const std::string INFO_EXT = ".info";
 const std::string EXCLUDEHINTS_EXT = ".excludesfile";
+const std::string IN_PROGRESS_EXT = ".tmp";
+const std::chrono::milliseconds FOLLOW_POLL_INTERVAL(100);
 
 namespace po = boost::program_options;
 
@@ -92,6 +103,11 @@ struct Options
      */
     boost::optional<PseudoAnonymise> pseudo_anon;
 
+    /**
+     * \brief following files being written?
+     */
+    bool following{false};
+
     /**
      * \brief output defaults.
      */
@@ -111,10 +127,9 @@ static void report(std::ostream& os,
     backend->report(os);
 }
 
-static int convert_stream_to_backend(const std::string& fname, std::istream& is, std::unique_ptr<OutputBackend>& backend, std::ofstream& info, Options& options)
+static int convert_stream_to_backend(const std::string& fname, CborBaseDecoder& dec, std::unique_ptr<OutputBackend>& backend, std::ofstream& info, Options& options)
 {
     Configuration config;
-    CborStreamDecoder dec(is);
     BlockCborReader cbr(dec, config, options.defaults, options.pseudo_anon);
 
     backend->check_exclude_hints(config.exclude_hints);
@@ -140,15 +155,27 @@ static int convert_stream_to_backend(const std::string& fname, std::istream& is,
         unsigned long long nrecs = 0;
         bool eof = false;
 
-        for ( QueryResponseData qr = cbr.readQRData(eof);
-              !eof;
-              qr = cbr.readQRData(eof) )
+        try
         {
-            if ( options.debug_qr )
-                std::cout << qr;
+            for ( QueryResponseData qr = cbr.readQRData(eof);
+                  !eof;
+                  qr = cbr.readQRData(eof) )
+            {
+                if ( options.debug_qr )
+                    std::cout << qr;
 
-            backend->output(qr, config);
-            nrecs++;
+                backend->output(qr, config);
+                nrecs++;
+            }
+        }
+        catch (const cbor_end_of_input& e)
+        {
+            // A file being followed may be abandoned part way through
+            // a block, or following may be stopped. Keep the records
+            // already converted.
+            if ( !options.following )
+                throw;
+            std::cerr << PROGNAME << ":  Input ended early: " << fname << std::endl;
         }
 
         if ( options.generate_info )
@@ -178,6 +205,344 @@ static int convert_stream_to_backend(const std::string& fname, std::istream& is,
     return 0;
 }
 
+/**
+ * \class SketchVisitor
+ * \brief Merge the sketches in each block read.
+ */
+class SketchVisitor : public block_cbor::BlockVisitor
+{
+public:
+    /**
+     * \brief Merge the sketches of a block.
+     *
+     * \param stats the block statistics.
+     * \param block the block.
+     */
+    void statistics(const PacketStatistics& stats,
+                    const block_cbor::BlockView& block) override
+    {
+        ++blocks;
+        if ( block.client_sketch() )
+        {
+            if ( clients )
+                clients->merge(*block.client_sketch());
+            else
+                clients = block.client_sketch();
+        }
+        if ( block.qname_sketch() )
+        {
+            if ( qnames )
+                qnames->merge(*block.qname_sketch());
+            else
+                qnames = block.qname_sketch();
+        }
+    }
+
+    /**
+     * \brief the number of blocks read.
+     */
+    unsigned long long blocks{0};
+
+    /**
+     * \brief the merged distinct client sketch.
+     */
+    boost::optional<HyperLogLog> clients;
+
+    /**
+     * \brief the merged query name sketch.
+     */
+    boost::optional<HeavyHitters> qnames;
+};
+
+static int report_sketches(const std::vector<std::string>& fnames, unsigned int nqnames, Options& options)
+{
+    SketchVisitor visitor;
+
+    for ( const auto& fname : fnames )
+    {
+        std::ifstream ifs;
+        ifs.open(fname, std::ifstream::binary);
+        if ( !ifs.is_open() )
+        {
+            std::cerr << PROGNAME << ":  Can't open input: " << fname << std::endl;
+            return 1;
+        }
+
+        try
+        {
+            CborStreamDecoder dec(ifs);
+            Configuration config;
+            BlockCborReader cbr(dec, config, options.defaults, boost::none);
+            cbr.skip_records(true);
+            while ( cbr.visitBlock(visitor) )
+                ;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << PROGNAME << ":  Error while processing: "
+                      << fname << " Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "BLOCKS: " << visitor.blocks << "\n";
+    if ( !visitor.clients && !visitor.qnames )
+    {
+        std::cout << "No sketches found.\n";
+        return 0;
+    }
+
+    if ( visitor.clients )
+        std::cout << "Distinct clients (estimated): "
+                  << static_cast<unsigned long long>(visitor.clients->estimate() + 0.5)
+                  << "\n";
+
+    if ( visitor.qnames )
+    {
+        std::cout << "Query names: " << visitor.qnames->total() << "\n"
+                  << "Top query names (count, maximum overcount, name):\n";
+        for ( const auto& e : visitor.qnames->top(nqnames) )
+            std::cout << "  " << e.count << "\t" << e.error << "\t"
+                      << CaptureDNS::decode_domain_name(e.item) << "\n";
+        std::cout << "Other query names each occurred at most "
+                  << visitor.qnames->floor() << " times.\n";
+    }
+    return 0;
+}
+
+/**
+ * \brief set when following files should stop.
+ */
+static volatile std::sig_atomic_t stop_following = 0;
+
+static void stop_following_handler(int)
+{
+    stop_following = 1;
+}
+
+/**
+ * \brief Return the shape of a file name.
+ *
+ * This is the file name with each run of digits replaced by `#`, and
+ * without any `-N` suffix added to make the name unique. Files from
+ * the same output pattern usually differ only in the date and time in
+ * their names, and so have the same shape.
+ *
+ * \param path the file path.
+ * \returns the shape of the file name.
+ */
+static std::string name_shape(const boost::filesystem::path& path)
+{
+    std::string name = path.filename().string();
+    if ( boost::filesystem::path(name).extension() == IN_PROGRESS_EXT )
+        name.resize(name.size() - IN_PROGRESS_EXT.size());
+
+    std::string res;
+    for ( char c : name )
+    {
+        if ( c < '0' || c > '9' )
+            res += c;
+        else if ( res.empty() || res.back() != '#' )
+            res += '#';
+    }
+    if ( res.size() >= 2 && res.compare(res.size() - 2, 2, "-#") == 0 )
+        res.resize(res.size() - 2);
+    return res;
+}
+
+/**
+ * \class InProgressFiles
+ * \brief Find C-DNS files being written in a directory.
+ *
+ * Files being written have a temporary extension until they are
+ * complete. Files with that extension that are not C-DNS, such as
+ * compressed output being written, are ignored. The start of each
+ * file is only read until it has been identified.
+ */
+class InProgressFiles
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param dir the directory.
+     */
+    explicit InProgressFiles(const boost::filesystem::path& dir)
+        : dir_(dir) {}
+
+    /**
+     * \brief Find C-DNS files being written.
+     *
+     * \returns the paths of the files not ignored and with the
+     *          current name shape, if set, oldest first.
+     */
+    std::vector<boost::filesystem::path> find()
+    {
+        static const std::string CDNS_FILE_START = "\x83\x65" + block_cbor::FILE_FORMAT_ID;
+
+        std::vector<std::pair<std::time_t, boost::filesystem::path>> files;
+        std::map<std::string, bool> is_cdns;
+        boost::system::error_code ec;
+        for ( boost::filesystem::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec) )
+        {
+            const boost::filesystem::path& path = it->path();
+            if ( path.extension() != IN_PROGRESS_EXT )
+                continue;
+
+            // Files too short to identify may be just starting.
+            auto known = is_cdns_.find(path.string());
+            if ( known == is_cdns_.end() )
+            {
+                std::string start(CDNS_FILE_START.size(), '\0');
+                std::ifstream ifs(path.string(), std::ifstream::binary);
+                if ( !ifs.read(&start[0], start.size()) )
+                    continue;
+                known = is_cdns_.emplace(path.string(), start == CDNS_FILE_START).first;
+            }
+            is_cdns.insert(*known);
+
+            if ( !known->second || ignored_.count(path.string()) != 0 ||
+                 ( !shape_.empty() && name_shape(path) != shape_ ) )
+                continue;
+
+            boost::system::error_code time_ec;
+            std::time_t t = boost::filesystem::last_write_time(path, time_ec);
+            if ( !time_ec )
+                files.emplace_back(t, path);
+        }
+
+        // Forget files that have gone.
+        if ( !ec )
+        {
+            is_cdns_.swap(is_cdns);
+            for ( auto it = ignored_.begin(); it != ignored_.end(); )
+            {
+                if ( is_cdns_.count(*it) == 0 )
+                    it = ignored_.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        std::sort(files.begin(), files.end());
+        std::vector<boost::filesystem::path> res;
+        for ( const auto& f : files )
+            res.push_back(f.second);
+        return res;
+    }
+
+    /**
+     * \brief Ignore a file in future.
+     *
+     * \param path the file path.
+     */
+    void ignore(const boost::filesystem::path& path)
+    {
+        ignored_.insert(path.string());
+    }
+
+    /**
+     * \brief Only find files with the same name shape as a file.
+     *
+     * \param path the file path.
+     */
+    void set_shape(const boost::filesystem::path& path)
+    {
+        shape_ = name_shape(path);
+    }
+
+private:
+    /**
+     * \brief the directory.
+     */
+    boost::filesystem::path dir_;
+
+    /**
+     * \brief whether each file identified is C-DNS.
+     */
+    std::map<std::string, bool> is_cdns_;
+
+    /**
+     * \brief paths of files to ignore.
+     */
+    std::set<std::string> ignored_;
+
+    /**
+     * \brief the name shape of files to find, if set.
+     */
+    std::string shape_;
+};
+
+/**
+ * \brief Convert C-DNS files as they are written to a directory.
+ *
+ * Start with the newest file being written. Read each block as
+ * soon as it is complete. When the file is complete, or another
+ * file from the same output is started, move on to the next file
+ * from that output being written. Files from other outputs writing
+ * to the same directory are ignored. Continue until interrupted.
+ */
+static int follow_directory(const std::string& dir, std::unique_ptr<OutputBackend>& backend, std::ofstream& info, Options& options)
+{
+    InProgressFiles in_progress_files(dir);
+    std::vector<boost::filesystem::path> files = in_progress_files.find();
+    if ( !files.empty() )
+        files.pop_back();
+    for ( const auto& f : files )
+        in_progress_files.ignore(f);
+
+    std::signal(SIGINT, stop_following_handler);
+    std::signal(SIGTERM, stop_following_handler);
+
+    while ( !stop_following )
+    {
+        files = in_progress_files.find();
+        if ( files.empty() )
+        {
+            std::this_thread::sleep_for(FOLLOW_POLL_INTERVAL);
+            continue;
+        }
+
+        const boost::filesystem::path in_progress = files.front();
+        boost::filesystem::path current = in_progress;
+        in_progress_files.ignore(in_progress);
+        in_progress_files.set_shape(in_progress);
+
+        // If already renamed, read the completed file.
+        std::ifstream ifs(current.string(), std::ifstream::binary);
+        if ( !ifs.is_open() )
+        {
+            current.replace_extension();
+            ifs.open(current.string(), std::ifstream::binary);
+            if ( !ifs.is_open() )
+                continue;
+        }
+
+        if ( options.report_info )
+            std::cout << " INPUT : " << current.string() << "\n\n";
+
+        auto finished = [&]()
+        {
+            boost::system::error_code ec;
+            return stop_following ||
+                !boost::filesystem::exists(in_progress, ec) ||
+                !in_progress_files.find().empty();
+        };
+        CborFollowDecoder dec(ifs, finished, FOLLOW_POLL_INTERVAL);
+        try
+        {
+            if ( convert_stream_to_backend(current.string(), dec, backend, info, options) != 0 )
+                return 1;
+        }
+        catch (const cbor_end_of_input& e)
+        {
+            std::cerr << PROGNAME << ":  Input ended before file header: " << current.string() << std::endl;
+        }
+    }
+
+    return 0;
+}
+
 static bool open_info_file(const std::string& fname, std::ofstream& info, Options& options)
 {
     if ( !options.generate_info )
@@ -216,6 +581,7 @@ int main(int ac, char *av[])
     bool template_backend = false;
     std::string backend;
     std::vector<std::string> vals;
+    unsigned int nsketch_qnames = 0;
 
     po::options_description visible("Options");
     visible.add_options()
@@ -263,6 +629,11 @@ int main(int ac, char *av[])
          "generate excluded fields file for each input.")
         ("stats,S",
          "report conversion statistics.")
+        ("follow,f",
+         "convert C-DNS files in the input directory as they are written.")
+        ("sketches",
+         po::value<unsigned int>(&nsketch_qnames)->implicit_value(10),
+         "report distinct clients and the top N query names from the block sketches in all inputs, without converting.")
 #if ENABLE_PSEUDOANONYMISATION
         ("pseudo-anonymisation-key,k",
          po::value<std::string>(&pseudo_anon_key),
@@ -407,6 +778,7 @@ int main(int ac, char *av[])
         pcap_options.query_only = ( vm.count("query-only") != 0 );
         options.debug_qr = ( vm.count("debug-qr") != 0 );
         options.generate_stats = ( vm.count("stats") != 0 );
+        options.following = ( vm.count("follow") != 0 );
         options.defaults.read_defaults_file(defaults_file_name);
         pcap_options.defaults = options.defaults;
 
@@ -492,6 +864,16 @@ int main(int ac, char *av[])
 
     try
     {
+        if ( vm.count("sketches") )
+        {
+            if ( !vm.count("cdns-file") )
+            {
+                std::cerr << PROGNAME << ":  Reporting sketches requires input files." << std::endl;
+                return 1;
+            }
+            return report_sketches(vm["cdns-file"].as<std::vector<std::string>>(), nsketch_qnames, options);
+        }
+
         std::unique_ptr<OutputBackend> output_backend;
         std::ofstream info;
         bool output_specified = false;
@@ -532,6 +914,20 @@ int main(int ac, char *av[])
                 output_backend = make_unique<PcapBackend>(pcap_options, output_file_name);
         }
 
+        if ( options.following )
+        {
+            std::vector<std::string> dirs;
+            if ( vm.count("cdns-file") )
+                dirs = vm["cdns-file"].as<std::vector<std::string>>();
+            if ( !output_specified || dirs.size() != 1 ||
+                 !boost::filesystem::is_directory(dirs[0]) )
+            {
+                std::cerr << PROGNAME << ":  Following requires an output file and a single input directory." << std::endl;
+                return 1;
+            }
+            return follow_directory(dirs[0], output_backend, info, options);
+        }
+
         if ( !vm.count("cdns-file") )
         {
             if ( !output_specified )
@@ -539,9 +935,11 @@ int main(int ac, char *av[])
                 std::cerr << PROGNAME << ":  output file must be specified when reading from standard input." << std::endl;
                 return 1;
             }
-            return convert_stream_to_backend(("(stdin)"), std::cin, output_backend, info, options);
+            CborStreamDecoder dec(std::cin);
+            return convert_stream_to_backend(("(stdin)"), dec, output_backend, info, options);
         }
 
+
         for ( auto& fname : vm["cdns-file"].as<std::vector<std::string>>() )
         {
             if ( !output_specified )
@@ -580,7 +978,8 @@ int main(int ac, char *av[])
                 return 1;
             }
 
-            if ( convert_stream_to_backend(fname, ifs, output_backend, info, options) != 0 )
+            CborStreamDecoder dec(ifs);
+            if ( convert_stream_to_backend(fname, dec, output_backend, info, options) != 0 )
                 return 1;
 
             if ( !output_specified )
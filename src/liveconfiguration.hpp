@@ -0,0 +1,102 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef LIVECONFIGURATION_HPP
+#define LIVECONFIGURATION_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "configuration.hpp"
+
+/**
+ * \brief Function reading a new configuration.
+ *
+ * \throws po::error on configuration error.
+ */
+using ConfigurationReader = std::function<std::shared_ptr<const Configuration> ()>;
+
+/**
+ * \class LiveConfiguration
+ * \brief Hold the current configuration while it may be replaced.
+ *
+ * The configuration is held as an immutable snapshot. A new snapshot
+ * replaces the old one as a whole, so a thread using a snapshot
+ * never sees a mix of old and new settings.
+ *
+ * Threads poll the generation, which is a single atomic load, and
+ * only fetch the snapshot when it changes.
+ */
+class LiveConfiguration
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param config the initial configuration.
+     */
+    explicit LiveConfiguration(const Configuration& config)
+        : config_(std::make_shared<const Configuration>(config)), generation_(0)
+    {
+    }
+
+    /**
+     * \brief Return the current configuration snapshot.
+     */
+    std::shared_ptr<const Configuration> get() const
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return config_;
+    }
+
+    /**
+     * \brief Replace the current configuration snapshot.
+     *
+     * \param config the new configuration.
+     */
+    void set(std::shared_ptr<const Configuration> config)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        config_ = std::move(config);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * \brief Return the configuration generation.
+     *
+     * This changes every time the configuration is replaced.
+     */
+    unsigned generation() const
+    {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+private:
+    /**
+     * \brief mutex guarding the snapshot pointer.
+     */
+    mutable std::mutex m_;
+
+    /**
+     * \brief the current snapshot.
+     */
+    std::shared_ptr<const Configuration> config_;
+
+    /**
+     * \brief the configuration generation.
+     */
+    std::atomic<unsigned> generation_;
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include "loadshedder.hpp"
+
+namespace {
+    /**
+     * \brief number of entries in the recent client table.
+     */
+    const std::size_t CLIENT_TABLE_SIZE = 1 << 16;
+}
+
+const unsigned LoadShedder::NEW_CLIENTS_PER_SECOND = 1000;
+
+LoadShedder::LoadShedder(unsigned threshold,
+                         const std::vector<unsigned>& common_rr_types,
+                         PacketStatistics& stats)
+    : threshold_(threshold), common_rr_types_(1 << 16, false),
+      budget_second_(-1), new_clients_left_(0), stats_(stats)
+{
+    for ( auto t : common_rr_types )
+        if ( t < common_rr_types_.size() )
+            common_rr_types_[t] = true;
+
+    if ( threshold_ > 0 )
+        clients_.resize(CLIENT_TABLE_SIZE);
+}
+
+bool LoadShedder::shed(const QueryResponse& qr, std::size_t queue_len, std::size_t max_len)
+{
+    if ( threshold_ == 0 || max_len == 0 )
+        return false;
+
+    // Always rank, so clients are noted as seen before overload starts.
+    Priority pri = priority(qr);
+    std::size_t fill = queue_len * 100 / max_len;
+
+    if ( pri == LOW && fill >= threshold_ )
+    {
+        ++stats_.shed_low_priority_count;
+        return true;
+    }
+
+    if ( pri == NORMAL && fill >= ( threshold_ + 100 ) / 2 )
+    {
+        ++stats_.shed_normal_priority_count;
+        return true;
+    }
+
+    return false;
+}
+
+LoadShedder::Priority LoadShedder::priority(const QueryResponse& qr)
+{
+    const DNSMessage& msg = qr.has_query() ? qr.query() : qr.response();
+    Priority res = LOW;
+
+    if ( msg.clientIP && note_client(*msg.clientIP) )
+        res = take_new_client(msg.timestamp) ? HIGH : NORMAL;
+
+    if ( msg.dns.opcode() != CaptureDNS::OP_QUERY )
+        res = HIGH;
+
+    if ( !msg.dns.queries().empty() &&
+         !common_rr_types_[msg.dns.queries().front().query_type()] )
+        res = HIGH;
+
+    if ( qr.has_response() )
+    {
+        const CaptureDNS& resp = qr.response().dns;
+
+        if ( resp.truncated() )
+            res = HIGH;
+        else if ( resp.rcode() == CaptureDNS::NXDOMAIN )
+        {
+            if ( res == LOW )
+                res = NORMAL;
+        }
+        else if ( resp.rcode() != CaptureDNS::NOERROR )
+            res = HIGH;
+    }
+    else if ( res == LOW )
+        res = NORMAL;
+
+    return res;
+}
+
+bool LoadShedder::note_client(const IPAddress& addr)
+{
+    if ( clients_.empty() )
+        return false;
+
+    std::size_t h = hash_value(addr);
+    std::size_t index = h % CLIENT_TABLE_SIZE;
+    uint32_t tag = static_cast<uint32_t>(h / CLIENT_TABLE_SIZE) | 1;
+
+    if ( clients_[index] == tag )
+        return false;
+
+    clients_[index] = tag;
+    return true;
+}
+
+bool LoadShedder::take_new_client(const std::chrono::system_clock::time_point& timestamp)
+{
+    std::chrono::seconds second =
+        std::chrono::duration_cast<std::chrono::seconds>(timestamp.time_since_epoch());
+    if ( second != budget_second_ )
+    {
+        budget_second_ = second;
+        new_clients_left_ = NEW_CLIENTS_PER_SECOND;
+    }
+
+    if ( new_clients_left_ == 0 )
+        return false;
+
+    --new_clients_left_;
+    return true;
+}
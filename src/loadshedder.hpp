@@ -0,0 +1,152 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef LOADSHEDDER_HPP
+#define LOADSHEDDER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "ipaddress.hpp"
+#include "packetstatistics.hpp"
+#include "queryresponse.hpp"
+
+/**
+ * \class LoadShedder
+ * \brief Discard the least interesting query/responses under overload.
+ *
+ * Each query/response is ranked from its message headers and first
+ * question. A query/response is high priority if it has an unusual
+ * OPCODE, an unusual query type, a truncated response, an error
+ * response other than NXDOMAIN, or a client not seen recently.
+ * Only NEW_CLIENTS_PER_SECOND new clients are made high priority
+ * each second; further new clients are normal priority, so a flood
+ * from random source addresses is still shed. A NXDOMAIN response
+ * or a query without a response is normal priority. Anything else
+ * is low priority.
+ *
+ * When the output queue passes the shedding threshold, low priority
+ * items are discarded. When it is half way from the threshold to
+ * full, normal priority items are also discarded. High priority
+ * items are only lost if the queue is full.
+ *
+ * A shedder is not thread safe; each thread producing output needs
+ * its own.
+ */
+class LoadShedder
+{
+public:
+    /**
+     * \brief Query/response priority.
+     */
+    enum Priority
+    {
+        LOW,
+        NORMAL,
+        HIGH
+    };
+
+    /**
+     * \brief the maximum number of new clients made high priority
+     * in a second of packet time.
+     */
+    static const unsigned NEW_CLIENTS_PER_SECOND;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param threshold       percentage of the output queue in use above
+     *                        which to shed. 0 to disable shedding.
+     * \param common_rr_types query types that are not of special interest.
+     * \param stats           statistics to update.
+     */
+    LoadShedder(unsigned threshold,
+                const std::vector<unsigned>& common_rr_types,
+                PacketStatistics& stats);
+
+    /**
+     * \brief Decide whether to discard a query/response.
+     *
+     * If the query/response is discarded, the shedding statistics
+     * are updated.
+     *
+     * \param qr        the query/response.
+     * \param queue_len the current output queue length.
+     * \param max_len   the maximum output queue length. 0 for no maximum.
+     * \returns `true` if the query/response should be discarded.
+     */
+    bool shed(const QueryResponse& qr, std::size_t queue_len, std::size_t max_len);
+
+    /**
+     * \brief Determine the priority of a query/response.
+     *
+     * This records the client as seen.
+     *
+     * \param qr the query/response.
+     * \returns the priority.
+     */
+    Priority priority(const QueryResponse& qr);
+
+protected:
+    /**
+     * \brief Record a client as seen.
+     *
+     * Clients are held in a fixed size table, so a client is
+     * forgotten when another client takes its place.
+     *
+     * \param addr the client address.
+     * \returns `true` if the client has not been seen recently.
+     */
+    bool note_client(const IPAddress& addr);
+
+    /**
+     * \brief Take a new client from the budget for its second.
+     *
+     * \param timestamp the message timestamp.
+     * \returns `true` if the budget for the second is not used up.
+     */
+    bool take_new_client(const std::chrono::system_clock::time_point& timestamp);
+
+private:
+    /**
+     * \brief the shedding threshold percentage.
+     */
+    unsigned threshold_;
+
+    /**
+     * \brief `true` for each query type not of special interest.
+     */
+    std::vector<bool> common_rr_types_;
+
+    /**
+     * \brief hash tags of recently seen clients.
+     */
+    std::vector<uint32_t> clients_;
+
+    /**
+     * \brief the second the new client budget is for.
+     */
+    std::chrono::seconds budget_second_;
+
+    /**
+     * \brief new clients left in the budget for the current second.
+     */
+    unsigned new_clients_left_;
+
+    /**
+     * \brief statistics to update.
+     */
+    PacketStatistics& stats_;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef MALFORMEDMESSAGE_HPP
+#define MALFORMEDMESSAGE_HPP
+
+#include <chrono>
+#include <cstdint>
+
+#include "bytestring.hpp"
+#include "ipaddress.hpp"
+#include "transporttype.hpp"
+
+/**
+ * \class MalformedMessage
+ * \brief A message sent to or from a DNS port that could not be decoded as DNS.
+ *
+ * A malformed message can't be relied on to say whether it is a query
+ * or a response, so the client and server are those using a port other
+ * than the DNS port and the DNS port respectively.
+ */
+class MalformedMessage
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param timestamp      message reception timestamp.
+     * \param client_address the client address.
+     * \param client_port    the client port.
+     * \param server_address the server address.
+     * \param server_port    the server port.
+     * \param transport_type the transport type the message was received over.
+     * \param payload        the message data.
+     */
+    MalformedMessage(const std::chrono::system_clock::time_point& timestamp,
+                     const IPAddress& client_address, uint16_t client_port,
+                     const IPAddress& server_address, uint16_t server_port,
+                     TransportType transport_type,
+                     const byte_string& payload)
+        : timestamp_(timestamp),
+          client_address_(client_address), client_port_(client_port),
+          server_address_(server_address), server_port_(server_port),
+          transport_type_(transport_type), payload_(payload)
+    {
+    }
+
+    /**
+     * \brief Return the message reception timestamp.
+     */
+    const std::chrono::system_clock::time_point& timestamp() const
+    {
+        return timestamp_;
+    }
+
+    /**
+     * \brief Return the client address.
+     */
+    const IPAddress& client_address() const
+    {
+        return client_address_;
+    }
+
+    /**
+     * \brief Return the client port.
+     */
+    uint16_t client_port() const
+    {
+        return client_port_;
+    }
+
+    /**
+     * \brief Return the server address.
+     */
+    const IPAddress& server_address() const
+    {
+        return server_address_;
+    }
+
+    /**
+     * \brief Return the server port.
+     */
+    uint16_t server_port() const
+    {
+        return server_port_;
+    }
+
+    /**
+     * \brief Return the transport type.
+     */
+    TransportType transport_type() const
+    {
+        return transport_type_;
+    }
+
+    /**
+     * \brief Return `true` if this message is IPv6.
+     */
+    bool is_ipv6() const
+    {
+        return client_address_.is_ipv6();
+    }
+
+    /**
+     * \brief Return the message data.
+     */
+    const byte_string& payload() const
+    {
+        return payload_;
+    }
+
+private:
+    /**
+     * \brief message reception timestamp.
+     */
+    std::chrono::system_clock::time_point timestamp_;
+
+    /**
+     * \brief the client address.
+     */
+    IPAddress client_address_;
+
+    /**
+     * \brief the client port.
+     */
+    uint16_t client_port_;
+
+    /**
+     * \brief the server address.
+     */
+    IPAddress server_address_;
+
+    /**
+     * \brief the server port.
+     */
+    uint16_t server_port_;
+
+    /**
+     * \brief the transport type.
+     */
+    TransportType transport_type_;
+
+    /**
+     * \brief the message data.
+     */
+    byte_string payload_;
+};
+
+#endif
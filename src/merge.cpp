@@ -0,0 +1,241 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <boost/program_options.hpp>
+
+#include "config.h"
+
+#include "blockcbormerger.hpp"
+#include "blockcborrewriter.hpp"
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+#include "configuration.hpp"
+#include "makeunique.hpp"
+#include "pseudoanonymise.hpp"
+#include "streamwriter.hpp"
+#include "util.hpp"
+
+namespace po = boost::program_options;
+
+const std::string PROGNAME = "compactor-merge";
+
+int main(int ac, char *av[])
+{
+    std::vector<std::string> input_files;
+    std::string output_file;
+    std::string start_time;
+    std::string end_time;
+    std::string excludes_file;
+    std::string pseudo_anon_passphrase;
+    std::string pseudo_anon_key;
+    unsigned max_block_items;
+    unsigned max_block_period;
+    unsigned encode_threads;
+    bool gzip;
+    bool xz;
+    unsigned level;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("output,o",
+         po::value<std::string>(&output_file)->default_value(StreamWriter::STDOUT_FILE_NAME),
+         "output file, '-' for standard output.")
+        ("interleave,i",
+         "interleave blocks from the inputs in time order.")
+        ("start-time,s",
+         po::value<std::string>(&start_time),
+         "only write records at or after this time.")
+        ("end-time,e",
+         po::value<std::string>(&end_time),
+         "only write records before this time.")
+        ("excludesfile",
+         po::value<std::string>(&excludes_file),
+         "exclude hints file. Remove the excluded fields from the output.")
+        ("max-block-items",
+         po::value<unsigned>(&max_block_items)->default_value(0),
+         "re-block records with at most this many records per block.")
+        ("max-block-period",
+         po::value<unsigned>(&max_block_period)->default_value(0),
+         "re-block records with at most this many seconds per block.")
+        ("encode-threads",
+         po::value<unsigned>(&encode_threads)->default_value(2),
+         "maximum number of threads encoding re-blocked output.")
+#if ENABLE_PSEUDOANONYMISATION
+        ("pseudo-anonymisation-key,k",
+         po::value<std::string>(&pseudo_anon_key),
+         "pseudo-anonymisation key.")
+        ("pseudo-anonymisation-passphrase,P",
+         po::value<std::string>(&pseudo_anon_passphrase),
+         "pseudo-anonymisation passphrase.")
+        ("pseudo-anonymise,p",
+         "pseudo-anonymise output.")
+#endif
+        ("gzip,z",
+         po::value<bool>(&gzip)->implicit_value(true)->default_value(false),
+         "compress output using gzip.")
+        ("xz,x",
+         po::value<bool>(&xz)->implicit_value(true)->default_value(false),
+         "compress output using xz.")
+        ("level,l",
+         po::value<unsigned>(&level)->default_value(6),
+         "compression level.")
+        ;
+
+    po::options_description positional;
+    positional.add_options()
+        ("input-file",
+         po::value<std::vector<std::string>>(&input_files),
+         "input C-DNS file.")
+        ;
+
+    po::options_description all;
+    all.add(options).add(positional);
+
+    po::positional_options_description positional_options;
+    positional_options.add("input-file", -1);
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::command_line_parser(ac, av).options(all).positional(positional_options).run(), vm);
+        po::notify(vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr << "Usage: " << PROGNAME << " [options] [cdns-file [...]]\n" << options;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        if ( input_files.empty() )
+            throw po::error("no input files given.");
+        if ( gzip && xz )
+            throw po::error("You cannot select more than one compression method.");
+        if ( level > 9 )
+            throw po::error("compression level must be in the range 0-9.");
+        if ( encode_threads < 1 )
+            throw po::error("encode threads must be at least 1.");
+
+        std::chrono::system_clock::time_point start = std::chrono::system_clock::time_point::min();
+        std::chrono::system_clock::time_point end = std::chrono::system_clock::time_point::max();
+        try
+        {
+            if ( vm.count("start-time") )
+                start = parse_time_point(start_time);
+            if ( vm.count("end-time") )
+                end = parse_time_point(end_time);
+        }
+        catch (const std::invalid_argument& err)
+        {
+            throw po::error(err.what());
+        }
+        if ( start >= end )
+            throw po::error("start time must be before end time.");
+
+        HintsExcluded exclude_hints;
+        if ( vm.count("excludesfile") &&
+             !exclude_hints.read_excludes_file(excludes_file) )
+            throw po::error("Exclude hints file " + excludes_file + " not found.");
+
+        boost::optional<PseudoAnonymise> pseudo_anon;
+#if ENABLE_PSEUDOANONYMISATION
+        if ( vm.count("pseudo-anonymisation-key") &&
+             vm.count("pseudo-anonymisation-passphrase") )
+            throw po::error("specify pseudo-anonymisation key or passphrase, but not both.");
+        if ( vm.count("pseudo-anonymisation-key") && pseudo_anon_key.size() != 16 )
+            throw po::error("pseudo-anonymisation key must be exactly 16 bytes long.");
+        if ( vm.count("pseudo-anonymise") )
+        {
+            if ( vm.count("pseudo-anonymisation-key") )
+                pseudo_anon = PseudoAnonymise(to_byte_string(pseudo_anon_key));
+            else if ( vm.count("pseudo-anonymisation-passphrase") )
+                pseudo_anon = PseudoAnonymise(pseudo_anon_passphrase);
+            else
+                throw po::error("to pseudo-anonymise output you must specify a passphrase or key.");
+        }
+#endif
+
+        std::unique_ptr<CborBaseStreamFileEncoder> enc;
+        if ( gzip )
+            enc = make_unique<CborStreamFileEncoder<GzipStreamWriter>>(level);
+        else if ( xz )
+            enc = make_unique<CborStreamFileEncoder<XzStreamWriter>>(level);
+        else
+            enc = make_unique<CborStreamFileEncoder<StreamWriter>>(level);
+
+        std::vector<std::unique_ptr<std::ifstream>> streams;
+        std::vector<std::unique_ptr<CborStreamDecoder>> decoders;
+        BlockCborMerger merger(*enc);
+        if ( vm.count("start-time") || vm.count("end-time") )
+            merger.set_time_range(start, end);
+        if ( vm.count("excludesfile") || pseudo_anon )
+        {
+            block_cbor::StorageHints hints;
+            hints.query_response_hints = exclude_hints.get_query_response_hints();
+            hints.query_response_signature_hints = exclude_hints.get_query_response_signature_hints();
+            hints.rr_hints = exclude_hints.get_rr_hints();
+            hints.other_data_hints = exclude_hints.get_other_data_hints();
+            merger.set_rewriter(BlockCborRewriter(hints, pseudo_anon));
+        }
+        if ( max_block_items > 0 || max_block_period > 0 )
+            merger.set_block_size(max_block_items,
+                                  std::chrono::seconds(max_block_period),
+                                  encode_threads);
+        for ( const auto& fname : input_files )
+        {
+            streams.push_back(make_unique<std::ifstream>(fname, std::ifstream::binary));
+            if ( !streams.back()->is_open() )
+                throw std::runtime_error("Can't open input: " + fname);
+            decoders.push_back(make_unique<CborStreamDecoder>(*streams.back()));
+            merger.add_input(*decoders.back(), fname);
+        }
+
+        enc->open(output_file);
+        merger.merge(vm.count("interleave"));
+        enc->close();
+
+        std::cerr << PROGNAME << ": " << input_files.size() << " files, "
+                  << merger.block_count() << " blocks ("
+                  << merger.trimmed_block_count() << " trimmed), "
+                  << merger.block_parameters_count() << " block parameters\n";
+    }
+    catch (const po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << "\n"
+                  << "Run '" << PROGNAME << " -h' for help.\n";
+        return 1;
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
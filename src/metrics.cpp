@@ -0,0 +1,380 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include "log.hpp"
+#include "util.hpp"
+
+#include "metrics.hpp"
+
+namespace {
+    /**
+     * \brief the names of the pipeline stages.
+     */
+    const char* const STAGE_NAMES[Metrics::STAGES] = {
+        "packet_to_match",
+        "match_to_block",
+        "block_to_disk"
+    };
+
+    /**
+     * \brief the quantiles reported for each stage.
+     */
+    const struct
+    {
+        double q;
+        const char* label;
+    } QUANTILES[] = {
+        { 0.5, "0.5" },
+        { 0.9, "0.9" },
+        { 0.99, "0.99" },
+        { 0.999, "0.999" }
+    };
+
+    /**
+     * \brief Join two label lists.
+     */
+    std::string join_labels(const std::string& a, const std::string& b)
+    {
+        if ( a.empty() )
+            return b;
+        if ( b.empty() )
+            return a;
+        return a + "," + b;
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+    : shards_(new Shard[SHARDS])
+{
+    for ( unsigned s = 0; s < SHARDS; ++s )
+    {
+        for ( auto& c : shards_[s].counts )
+            c.store(0, std::memory_order_relaxed);
+        shards_[s].sum.store(0, std::memory_order_relaxed);
+        shards_[s].max.store(0, std::memory_order_relaxed);
+    }
+}
+
+unsigned LatencyHistogram::thread_shard()
+{
+    static std::atomic<unsigned> next_shard(0);
+    thread_local unsigned shard = next_shard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return shard;
+}
+
+unsigned LatencyHistogram::bucket(uint64_t us)
+{
+    if ( us < SUB_BUCKETS )
+        return us;
+
+    unsigned msb = 63 - __builtin_clzll(us);
+    if ( msb >= VALUE_BITS )
+        return BUCKETS - 1;
+
+    unsigned shift = msb - SUB_BUCKET_BITS;
+    return shift * SUB_BUCKETS + ( us >> shift );
+}
+
+uint64_t LatencyHistogram::bucket_lowest(unsigned b)
+{
+    if ( b < 2 * SUB_BUCKETS )
+        return b;
+
+    unsigned shift = b / SUB_BUCKETS - 1;
+    return static_cast<uint64_t>(b % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::bucket_highest(unsigned b)
+{
+    if ( b < 2 * SUB_BUCKETS )
+        return b;
+
+    unsigned shift = b / SUB_BUCKETS - 1;
+    return bucket_lowest(b) + ( static_cast<uint64_t>(1) << shift ) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::microseconds latency)
+{
+    uint64_t us = ( latency.count() > 0 ) ? latency.count() : 0;
+    Shard& shard = shards_[thread_shard()];
+
+    shard.counts[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = shard.max.load(std::memory_order_relaxed);
+    while ( us > max &&
+            !shard.max.compare_exchange_weak(max, us, std::memory_order_relaxed) )
+        ;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot res;
+    res.counts.assign(BUCKETS, 0);
+    res.count = res.sum = res.max = 0;
+
+    for ( unsigned s = 0; s < SHARDS; ++s )
+    {
+        const Shard& shard = shards_[s];
+        for ( unsigned b = 0; b < BUCKETS; ++b )
+        {
+            uint64_t n = shard.counts[b].load(std::memory_order_relaxed);
+            res.counts[b] += n;
+            res.count += n;
+        }
+        res.sum += shard.sum.load(std::memory_order_relaxed);
+        res.max = std::max(res.max, shard.max.load(std::memory_order_relaxed));
+    }
+    return res;
+}
+
+uint64_t LatencyHistogram::Snapshot::quantile(double q) const
+{
+    if ( count == 0 )
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+    uint64_t seen = 0;
+    for ( unsigned b = 0; b < counts.size(); ++b )
+    {
+        seen += counts[b];
+        if ( seen >= rank )
+            return std::min(bucket_highest(b), max);
+    }
+    return max;
+}
+
+uint64_t LatencyHistogram::Snapshot::count_below(uint64_t us) const
+{
+    uint64_t res = 0;
+    for ( unsigned b = 0; b < counts.size() && bucket_highest(b) < us; ++b )
+        res += counts[b];
+    return res;
+}
+
+template<typename T>
+void MetricsWriter::add_sample(Family& f, const std::string& name,
+                               const std::string& labels, T value)
+{
+    std::ostringstream os;
+    os.precision(15);
+    os << name;
+    if ( !labels.empty() )
+        os << "{" << labels << "}";
+    os << " " << value;
+    f.samples.push_back(os.str());
+}
+
+MetricsWriter::Family& MetricsWriter::family(const std::string& name,
+                                             const char* type,
+                                             const std::string& help)
+{
+    Family& f = families_[name];
+    if ( f.type.empty() )
+    {
+        f.type = type;
+        f.help = help;
+    }
+    return f;
+}
+
+void MetricsWriter::counter(const std::string& name, const std::string& help,
+                            double value, const std::string& labels)
+{
+    add_sample(family(name, "counter", help), name, labels, value);
+}
+
+void MetricsWriter::gauge(const std::string& name, const std::string& help,
+                          double value, const std::string& labels)
+{
+    add_sample(family(name, "gauge", help), name, labels, value);
+}
+
+void MetricsWriter::histogram(const std::string& name, const std::string& help,
+                              const LatencyHistogram::Snapshot& hist,
+                              const std::string& labels)
+{
+    Family& f = family(name, "histogram", help);
+
+    for ( unsigned bit = 0; bit <= LatencyHistogram::VALUE_BITS; ++bit )
+    {
+        uint64_t us = static_cast<uint64_t>(1) << bit;
+        std::ostringstream le;
+        le.precision(15);
+        le << "le=\"" << us / 1e6 << "\"";
+        add_sample(f, name + "_bucket", join_labels(labels, le.str()), hist.count_below(us));
+    }
+    add_sample(f, name + "_bucket", join_labels(labels, "le=\"+Inf\""), hist.count);
+    add_sample(f, name + "_sum", labels, hist.sum / 1e6);
+    add_sample(f, name + "_count", labels, hist.count);
+}
+
+void MetricsWriter::write(std::ostream& os) const
+{
+    for ( const auto& f : families_ )
+    {
+        os << "# HELP " << f.first << " " << f.second.help << "\n"
+           << "# TYPE " << f.first << " " << f.second.type << "\n";
+        for ( const auto& s : f.second.samples )
+            os << s << "\n";
+    }
+}
+
+Metrics::Metrics()
+    : stats_(), next_id_(1)
+{
+}
+
+void Metrics::set_statistics(const PacketStatistics& stats)
+{
+    std::lock_guard<std::mutex> lock(m_);
+    stats_ = stats;
+}
+
+unsigned Metrics::add_source(Source source)
+{
+    std::lock_guard<std::mutex> lock(m_);
+    unsigned id = next_id_++;
+    sources_[id] = source;
+    return id;
+}
+
+void Metrics::remove_source(unsigned id)
+{
+    std::lock_guard<std::mutex> lock(m_);
+    sources_.erase(id);
+}
+
+void Metrics::write(std::ostream& os)
+{
+    MetricsWriter w;
+
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        const PacketStatistics& s = stats_;
+
+        w.counter("compactor_packets_total", "Packets processed.", s.raw_packet_count);
+        w.counter("compactor_out_of_order_packets_total", "Packets received out of time order.", s.out_of_order_packet_count);
+        w.counter("compactor_non_dns_packets_total", "Packets that are not DNS.", s.unhandled_packet_count);
+        w.counter("compactor_dns_messages_total", "DNS messages processed.", s.processed_message_count);
+        w.counter("compactor_malformed_messages_total", "Malformed DNS messages.", s.malformed_message_count);
+        w.counter("compactor_discarded_opcode_messages_total", "DNS messages discarded by OPCODE.", s.discarded_opcode_count);
+        w.counter("compactor_query_responses_total", "Query/responses output.", s.qr_pair_count, "type=\"pair\"");
+        w.counter("compactor_query_responses_total", "Query/responses output.", s.query_without_response_count, "type=\"query_only\"");
+        w.counter("compactor_query_responses_total", "Query/responses output.", s.response_without_query_count, "type=\"response_only\"");
+        w.counter("compactor_pcap_received_total", "Packets received by libpcap.", s.pcap_recv_count);
+        w.counter("compactor_ip_fragments_reassembled_total", "IP datagrams reassembled from fragments.", s.ip_fragment_reassembled_count);
+
+        const std::string drop_name = "compactor_dropped_total";
+        const std::string drop_help = "Items dropped or discarded, by reason.";
+        w.counter(drop_name, drop_help, s.pcap_drop_count, "reason=\"pcap_kernel\"");
+        w.counter(drop_name, drop_help, s.pcap_ifdrop_count, "reason=\"pcap_interface\"");
+        w.counter(drop_name, drop_help, s.sniffer_drop_count, "reason=\"sniffer\"");
+        w.counter(drop_name, drop_help, s.matcher_drop_count, "reason=\"matcher\"");
+        w.counter(drop_name, drop_help, s.output_cbor_drop_count, "reason=\"cdns\"");
+        w.counter(drop_name, drop_help, s.output_raw_pcap_drop_count, "reason=\"raw_pcap\"");
+        w.counter(drop_name, drop_help, s.output_ignored_pcap_drop_count, "reason=\"ignored_pcap\"");
+        w.counter(drop_name, drop_help, s.discarded_sampling_count, "reason=\"sampling\"");
+        w.counter(drop_name, drop_help, s.shed_low_priority_count, "reason=\"shed_low\"");
+        w.counter(drop_name, drop_help, s.shed_normal_priority_count, "reason=\"shed_normal\"");
+        w.counter(drop_name, drop_help, s.tcp_flow_memory_drop_count, "reason=\"tcp_memory\"");
+        w.counter(drop_name, drop_help, s.tcp_flow_limit_drop_count, "reason=\"tcp_flow_limit\"");
+        w.counter(drop_name, drop_help, s.ip_fragment_timeout_count, "reason=\"ip_fragment_timeout\"");
+        w.counter(drop_name, drop_help, s.ip_fragment_memory_drop_count, "reason=\"ip_fragment_memory\"");
+        w.counter(drop_name, drop_help, s.ip_fragment_bad_drop_count, "reason=\"ip_fragment_invalid\"");
+
+        for ( const auto& src : sources_ )
+            src.second(w);
+    }
+
+    for ( unsigned stage = 0; stage < STAGES; ++stage )
+    {
+        LatencyHistogram::Snapshot hist = latency_[stage].snapshot();
+        std::string label = std::string("stage=\"") + STAGE_NAMES[stage] + "\"";
+
+        w.histogram("compactor_stage_latency_seconds",
+                    "Time taken by items to pass through a pipeline stage.",
+                    hist, label);
+        for ( const auto& q : QUANTILES )
+            w.gauge("compactor_stage_latency_quantile_seconds",
+                    "Pipeline stage latency quantiles.",
+                    hist.quantile(q.q) / 1e6,
+                    label + ",quantile=\"" + q.label + "\"");
+        w.gauge("compactor_stage_latency_max_seconds",
+                "Largest pipeline stage latency.", hist.max / 1e6, label);
+    }
+
+    w.write(os);
+}
+
+MetricsServer::MetricsServer(std::shared_ptr<Metrics> metrics, const std::string& path)
+    : metrics_(metrics), path_(path), acceptor_(service_), socket_(service_)
+{
+    std::remove(path_.c_str());
+    boost::asio::local::stream_protocol::endpoint endpoint(path_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+
+    thread_ = std::thread(
+        [this]()
+        {
+            set_thread_name("comp:metrics");
+            service_.run();
+        });
+}
+
+MetricsServer::~MetricsServer()
+{
+    service_.post([this]() { acceptor_.close(); });
+    service_.stop();
+    if ( thread_.joinable() )
+        thread_.join();
+    std::remove(path_.c_str());
+}
+
+void MetricsServer::accept()
+{
+    acceptor_.async_accept(
+        socket_,
+        [this](const boost::system::error_code& err)
+        {
+            if ( err == boost::asio::error::operation_aborted )
+                return;
+
+            if ( !err )
+            {
+                try
+                {
+                    std::ostringstream os;
+                    metrics_->write(os);
+                    boost::system::error_code ec;
+                    boost::asio::write(socket_, boost::asio::buffer(os.str()), ec);
+                }
+                catch (const std::exception& e)
+                {
+                    LOG_ERROR << "Metrics: " << e.what();
+                }
+                boost::system::error_code ec;
+                socket_.close(ec);
+            }
+            else
+                LOG_ERROR << "Metrics: " << err.message();
+
+            accept();
+        });
+}
@@ -0,0 +1,509 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "packetstatistics.hpp"
+
+/**
+ * \class LatencyHistogram
+ * \brief A histogram of latencies with bounded relative error.
+ *
+ * Latencies are recorded in microseconds. As in HDR histograms,
+ * each power of two range is divided into 8 equal buckets, so a
+ * recorded value is known to within 12.5%. Latencies of more than
+ * 2^36 microseconds are counted in the last bucket.
+ *
+ * Recording does not lock. Counts are held in several shards,
+ * and each recording thread uses its own shard, so threads do not
+ * contend for the same counters. Reading a snapshot adds up the shards.
+ */
+class LatencyHistogram
+{
+public:
+    /**
+     * \brief the number of bits in a latency covered by the histogram.
+     */
+    static const unsigned VALUE_BITS = 36;
+
+    /**
+     * \brief the number of bits in a bucket index within a power of two.
+     */
+    static const unsigned SUB_BUCKET_BITS = 3;
+
+    /**
+     * \brief the number of buckets in each power of two.
+     */
+    static const unsigned SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    /**
+     * \brief the total number of buckets.
+     */
+    static const unsigned BUCKETS = SUB_BUCKETS * (VALUE_BITS - SUB_BUCKET_BITS + 1);
+
+    /**
+     * \brief the number of shards.
+     */
+    static const unsigned SHARDS = 16;
+
+    /**
+     * \struct Snapshot
+     * \brief The histogram contents at a point in time.
+     */
+    struct Snapshot
+    {
+        /**
+         * \brief count in each bucket.
+         */
+        std::vector<uint64_t> counts;
+
+        /**
+         * \brief the total number of latencies recorded.
+         */
+        uint64_t count;
+
+        /**
+         * \brief the sum of latencies recorded, in microseconds.
+         */
+        uint64_t sum;
+
+        /**
+         * \brief the largest latency recorded, in microseconds.
+         */
+        uint64_t max;
+
+        /**
+         * \brief Return the latency at a quantile.
+         *
+         * \param q the quantile, 0 to 1.
+         * \returns the highest latency in the bucket containing the
+         *          quantile, in microseconds, or 0 if the histogram is empty.
+         */
+        uint64_t quantile(double q) const;
+
+        /**
+         * \brief Return the number of latencies less than a value.
+         *
+         * \param us the value, in microseconds. Must be a bucket boundary.
+         */
+        uint64_t count_below(uint64_t us) const;
+    };
+
+    /**
+     * \brief Constructor.
+     */
+    LatencyHistogram();
+
+    /**
+     * \brief Record a latency.
+     *
+     * Negative latencies are recorded as 0.
+     *
+     * \param latency the latency.
+     */
+    void record(std::chrono::microseconds latency);
+
+    /**
+     * \brief Take a snapshot of the histogram.
+     */
+    Snapshot snapshot() const;
+
+    /**
+     * \brief Return the bucket for a latency.
+     *
+     * \param us the latency in microseconds.
+     */
+    static unsigned bucket(uint64_t us);
+
+    /**
+     * \brief Return the lowest latency counted in a bucket.
+     *
+     * \param b the bucket.
+     */
+    static uint64_t bucket_lowest(unsigned b);
+
+    /**
+     * \brief Return the highest latency counted in a bucket.
+     *
+     * \param b the bucket.
+     */
+    static uint64_t bucket_highest(unsigned b);
+
+private:
+    /**
+     * \struct Shard
+     * \brief Counts recorded by one or more threads.
+     */
+    struct Shard
+    {
+        /**
+         * \brief bucket counts.
+         */
+        std::atomic<uint64_t> counts[BUCKETS];
+
+        /**
+         * \brief sum of latencies.
+         */
+        std::atomic<uint64_t> sum;
+
+        /**
+         * \brief largest latency.
+         */
+        std::atomic<uint64_t> max;
+
+        /**
+         * \brief padding to keep the next shard off this shard's cache lines.
+         */
+        char pad[64];
+    };
+
+    /**
+     * \brief the shard used by the current thread.
+     */
+    static unsigned thread_shard();
+
+    /**
+     * \brief the shards.
+     */
+    std::unique_ptr<Shard[]> shards_;
+};
+
+/**
+ * \class MetricsWriter
+ * \brief Collect metrics and write them in Prometheus text exposition format.
+ *
+ * Metrics may be added in any order. On output, all samples of a
+ * metric are written together.
+ */
+class MetricsWriter
+{
+public:
+    /**
+     * \brief Add a counter sample.
+     *
+     * \param name   the metric name.
+     * \param help   the metric description.
+     * \param value  the value.
+     * \param labels the sample labels, e.g. `channel="cdns"`. May be empty.
+     */
+    void counter(const std::string& name, const std::string& help,
+                 double value, const std::string& labels = "");
+
+    /**
+     * \brief Add a gauge sample.
+     *
+     * \param name   the metric name.
+     * \param help   the metric description.
+     * \param value  the value.
+     * \param labels the sample labels. May be empty.
+     */
+    void gauge(const std::string& name, const std::string& help,
+               double value, const std::string& labels = "");
+
+    /**
+     * \brief Add a latency histogram.
+     *
+     * Latencies are written in seconds. There is a bucket for each
+     * power of two microseconds.
+     *
+     * \param name   the metric name.
+     * \param help   the metric description.
+     * \param hist   the histogram snapshot.
+     * \param labels the sample labels. May be empty.
+     */
+    void histogram(const std::string& name, const std::string& help,
+                   const LatencyHistogram::Snapshot& hist,
+                   const std::string& labels = "");
+
+    /**
+     * \brief Write the metrics.
+     *
+     * \param os the output stream.
+     */
+    void write(std::ostream& os) const;
+
+private:
+    /**
+     * \struct Family
+     * \brief All samples of one metric.
+     */
+    struct Family
+    {
+        /**
+         * \brief the metric type.
+         */
+        std::string type;
+
+        /**
+         * \brief the metric description.
+         */
+        std::string help;
+
+        /**
+         * \brief the sample lines.
+         */
+        std::vector<std::string> samples;
+    };
+
+    /**
+     * \brief Find or add a metric.
+     *
+     * \param name the metric name.
+     * \param type the metric type.
+     * \param help the metric description.
+     */
+    Family& family(const std::string& name, const char* type, const std::string& help);
+
+    /**
+     * \brief Add a sample line.
+     *
+     * \param f      the metric.
+     * \param name   the sample name.
+     * \param labels the sample labels. May be empty.
+     * \param value  the sample value.
+     */
+    template<typename T>
+    static void add_sample(Family& f, const std::string& name,
+                           const std::string& labels, T value);
+
+    /**
+     * \brief the metrics, by name.
+     */
+    std::map<std::string, Family> families_;
+};
+
+/**
+ * \class Metrics
+ * \brief Pipeline metrics.
+ *
+ * Metrics are held in three forms:
+ *
+ * 1. Latency histograms for each pipeline stage, recorded as items
+ *    pass through the stage.
+ * 2. The latest packet statistics, published periodically by the
+ *    capture thread.
+ * 3. Sources, functions called when the metrics are read that add
+ *    their own values. Sources must be safe to call from any thread.
+ */
+class Metrics
+{
+public:
+    /**
+     * \brief Pipeline stages with latency histograms.
+     */
+    enum Stage
+    {
+        PACKET_TO_MATCH,
+        MATCH_TO_BLOCK,
+        BLOCK_TO_DISK,
+        STAGES
+    };
+
+    /**
+     * \brief A metrics source.
+     */
+    using Source = std::function<void (MetricsWriter&)>;
+
+    /**
+     * \brief Constructor.
+     */
+    Metrics();
+
+    /**
+     * \brief Return the latency histogram for a stage.
+     *
+     * \param stage the stage.
+     */
+    LatencyHistogram& latency(Stage stage)
+    {
+        return latency_[stage];
+    }
+
+    /**
+     * \brief Publish the latest packet statistics.
+     *
+     * \param stats the statistics.
+     */
+    void set_statistics(const PacketStatistics& stats);
+
+    /**
+     * \brief Add a source.
+     *
+     * \param source the source.
+     * \returns an identifier for the source.
+     */
+    unsigned add_source(Source source);
+
+    /**
+     * \brief Remove a source.
+     *
+     * Once this returns, the source will not be called again.
+     *
+     * \param id the source identifier.
+     */
+    void remove_source(unsigned id);
+
+    /**
+     * \brief Write all metrics.
+     *
+     * \param os the output stream.
+     */
+    void write(std::ostream& os);
+
+private:
+    /**
+     * \brief the latency histograms.
+     */
+    LatencyHistogram latency_[STAGES];
+
+    /**
+     * \brief mutex guarding the statistics and sources.
+     */
+    std::mutex m_;
+
+    /**
+     * \brief the latest packet statistics.
+     */
+    PacketStatistics stats_;
+
+    /**
+     * \brief the sources.
+     */
+    std::map<unsigned, Source> sources_;
+
+    /**
+     * \brief the identifier for the next source.
+     */
+    unsigned next_id_;
+};
+
+/**
+ * \class MetricsSource
+ * \brief Add a source to metrics for the lifetime of this object.
+ */
+class MetricsSource
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param metrics the metrics. If `nullptr`, do nothing.
+     * \param source  the source.
+     */
+    MetricsSource(Metrics* metrics, Metrics::Source source)
+        : metrics_(metrics), id_(metrics ? metrics->add_source(source) : 0) {}
+
+    /**
+     * \brief Destructor.
+     */
+    ~MetricsSource()
+    {
+        if ( metrics_ )
+            metrics_->remove_source(id_);
+    }
+
+    MetricsSource(const MetricsSource&) = delete;
+    MetricsSource& operator=(const MetricsSource&) = delete;
+
+private:
+    /**
+     * \brief the metrics.
+     */
+    Metrics* metrics_;
+
+    /**
+     * \brief the source identifier.
+     */
+    unsigned id_;
+};
+
+/**
+ * \class MetricsServer
+ * \brief Serve metrics on a local (UNIX domain) socket.
+ *
+ * A thread waits for connections on the socket. Each connection
+ * is sent the current metrics, and then closed.
+ */
+class MetricsServer
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * Any existing file at the socket path is removed.
+     *
+     * \param metrics the metrics to serve.
+     * \param path    the socket path.
+     * \throws boost::system::system_error if the socket can't be created.
+     */
+    MetricsServer(std::shared_ptr<Metrics> metrics, const std::string& path);
+
+    /**
+     * \brief Destructor.
+     *
+     * Stop the server thread and remove the socket.
+     */
+    ~MetricsServer();
+
+private:
+    /**
+     * \brief Wait for the next connection.
+     */
+    void accept();
+
+    /**
+     * \brief the metrics.
+     */
+    std::shared_ptr<Metrics> metrics_;
+
+    /**
+     * \brief the socket path.
+     */
+    std::string path_;
+
+    /**
+     * \brief the I/O service.
+     */
+    boost::asio::io_service service_;
+
+    /**
+     * \brief the socket acceptor.
+     */
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+
+    /**
+     * \brief the socket for the current connection.
+     */
+    boost::asio::local::stream_protocol::socket socket_;
+
+    /**
+     * \brief the server thread.
+     */
+    std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include "log.hpp"
+#include "util.hpp"
+
+#include "packetretention.hpp"
+
+const std::size_t PacketRetention::PACKET_OVERHEAD = 128;
+const std::size_t PacketRetention::LAYER_OVERHEAD = 128;
+
+PacketRetention::PacketRetention(const std::chrono::seconds& period,
+                                 std::size_t max_bytes,
+                                 const std::string& pattern,
+                                 WriterFactory make_writer,
+                                 const Configuration& config)
+    : period_(period), max_bytes_(max_bytes),
+      fname_(pattern, std::chrono::seconds(0)), make_writer_(make_writer),
+      config_(config), bytes_(0), dumping_(false), stop_(false),
+      dumps_(0), dumped_packets_(0), busy_(0)
+{
+    thread_ = std::thread(&PacketRetention::dump_thread_main, this);
+}
+
+PacketRetention::~PacketRetention()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    if ( thread_.joinable() )
+        thread_.join();
+}
+
+void PacketRetention::add(const std::shared_ptr<PcapItem>& pcap)
+{
+    std::size_t size = retained_size(*pcap);
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    packets_.push_back(Item{pcap, size});
+    bytes_ += size;
+
+    while ( packets_.size() > 1 &&
+            ( ( max_bytes_ > 0 && bytes_ > max_bytes_ ) ||
+              ( period_.count() > 0 &&
+                packets_.front().pcap->timestamp + period_ < pcap->timestamp ) ) )
+    {
+        bytes_ -= packets_.front().size;
+        packets_.pop_front();
+    }
+}
+
+bool PacketRetention::dump(const std::string& reason)
+{
+    std::size_t npackets;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ( dumping_ )
+        {
+            ++busy_;
+            LOG_WARN << "Retained packets not dumped on " << reason
+                     << ", previous dump still being written";
+            return false;
+        }
+
+        if ( packets_.empty() )
+        {
+            LOG_INFO << "No retained packets to dump on " << reason;
+            return false;
+        }
+
+        dump_.clear();
+        dump_.reserve(packets_.size());
+        for ( const auto& item : packets_ )
+            dump_.push_back(item.pcap);
+        npackets = dump_.size();
+        dumping_ = true;
+    }
+
+    cond_.notify_one();
+    LOG_INFO << "Dumping " << npackets << " retained packets on " << reason;
+    return true;
+}
+
+PacketRetention::Stats PacketRetention::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Stats{packets_.size(), bytes_, dumps_, dumped_packets_, busy_};
+}
+
+std::size_t PacketRetention::retained_size(const PcapItem& pcap)
+{
+    // The PDU tree is several times larger than the wire data, so
+    // allow for it and for the packet bookkeeping.
+    std::size_t res = PACKET_OVERHEAD + pcap.pdu->size();
+    for ( const Tins::PDU* pdu = pcap.pdu.get(); pdu; pdu = pdu->inner_pdu() )
+        res += LAYER_OVERHEAD;
+    return res;
+}
+
+void PacketRetention::dump_thread_main()
+{
+    set_thread_name("comp:retention");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        cond_.wait(lock, [this]() { return dumping_ || stop_; });
+        if ( !dumping_ )
+            break;
+
+        std::vector<std::shared_ptr<PcapItem>> packets;
+        packets.swap(dump_);
+        lock.unlock();
+        write_dump(packets);
+        lock.lock();
+
+        ++dumps_;
+        dumped_packets_ += packets.size();
+        dumping_ = false;
+    }
+}
+
+void PacketRetention::write_dump(const std::vector<std::shared_ptr<PcapItem>>& packets)
+{
+    try
+    {
+        std::string filename = fname_.filename(packets.front()->timestamp, config_);
+        std::unique_ptr<PcapBaseWriter> out = make_writer_(filename);
+        for ( const auto& pcap : packets )
+            out->write_packet(*(pcap->pdu), pcap->timestamp);
+        out->close();
+        LOG_INFO << "Wrote " << packets.size() << " retained packets to " << filename;
+    }
+    catch (const std::exception& err)
+    {
+        LOG_ERROR << "Dumping retained packets: " << err.what();
+    }
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef PACKETRETENTION_HPP
+#define PACKETRETENTION_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "configuration.hpp"
+#include "packetstream.hpp"
+#include "pcapwriter.hpp"
+#include "rotatingfilename.hpp"
+
+/**
+ * \class PacketRetention
+ * \brief Keep the most recently captured packets in memory, and write
+ * them to PCAP on request.
+ *
+ * Packets are held until they are older than the retention period,
+ * measured from the newest packet, or until the retained size
+ * exceeds the retention size. The retained size of a packet is its
+ * size on the wire plus an allowance for the memory used to hold it.
+ * Adding a packet does no I/O.
+ *
+ * A dump takes a copy of the packets retained at the time, which is
+ * written by a background thread to a single new file. Only one dump
+ * is written at a time.
+ */
+class PacketRetention
+{
+public:
+    /**
+     * \typedef WriterFactory
+     * \brief Make a writer for a dump, given the dump file name.
+     */
+    using WriterFactory = std::function<std::unique_ptr<PcapBaseWriter> (const std::string&)>;
+
+    /**
+     * \brief allowance for the memory used to retain a packet,
+     * in addition to its protocol layers.
+     */
+    static const std::size_t PACKET_OVERHEAD;
+
+    /**
+     * \brief allowance for the memory used by each protocol layer
+     * of a retained packet, in addition to its data.
+     */
+    static const std::size_t LAYER_OVERHEAD;
+
+    /**
+     * \brief Retention statistics.
+     */
+    struct Stats
+    {
+        /**
+         * \brief the number of packets retained.
+         */
+        std::size_t packets;
+
+        /**
+         * \brief the retained size of the packets.
+         */
+        std::size_t bytes;
+
+        /**
+         * \brief the number of dumps written.
+         */
+        uint64_t dumps;
+
+        /**
+         * \brief the number of packets written by dumps.
+         */
+        uint64_t dumped_packets;
+
+        /**
+         * \brief the number of dumps not started because a dump was being written.
+         */
+        uint64_t busy;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * Start the dump thread.
+     *
+     * \param period      the retention period. 0 = no limit.
+     * \param max_bytes   the maximum retained size. 0 = no limit.
+     * \param pattern     the dump file name pattern, including any extension.
+     * \param make_writer make a writer for each dump.
+     * \param config      the configuration, used to name dump files.
+     */
+    PacketRetention(const std::chrono::seconds& period,
+                    std::size_t max_bytes,
+                    const std::string& pattern,
+                    WriterFactory make_writer,
+                    const Configuration& config);
+
+    /**
+     * \brief Destructor.
+     *
+     * Finish writing any dump requested, and stop the dump thread.
+     */
+    ~PacketRetention();
+
+    /**
+     * \brief Retain a packet.
+     *
+     * Packets older than the retention period, and the oldest packets
+     * over the retention size, are no longer retained.
+     *
+     * \param pcap the packet.
+     */
+    void add(const std::shared_ptr<PcapItem>& pcap);
+
+    /**
+     * \brief Write the retained packets to PCAP.
+     *
+     * \param reason the reason for the dump, for logging.
+     * \returns `false` if no packets are retained or a dump is
+     *          already being written.
+     */
+    bool dump(const std::string& reason);
+
+    /**
+     * \brief Return the retention statistics.
+     */
+    Stats stats() const;
+
+    /**
+     * \brief Return the retained size of a packet.
+     *
+     * This is the packet size on the wire, plus PACKET_OVERHEAD,
+     * plus LAYER_OVERHEAD for each protocol layer.
+     *
+     * \param pcap the packet.
+     */
+    static std::size_t retained_size(const PcapItem& pcap);
+
+    /**
+     * \brief Copy and assignment deleted.
+     */
+    PacketRetention(const PacketRetention& other) = delete;
+    PacketRetention& operator=(const PacketRetention& other) = delete;
+
+private:
+    /**
+     * \brief A retained packet.
+     */
+    struct Item
+    {
+        /**
+         * \brief the packet.
+         */
+        std::shared_ptr<PcapItem> pcap;
+
+        /**
+         * \brief the packet retained size.
+         */
+        std::size_t size;
+    };
+
+    /**
+     * \brief Write dumps as they are requested.
+     */
+    void dump_thread_main();
+
+    /**
+     * \brief Write one dump to a new file.
+     *
+     * The file is named from the pattern and the time of the first
+     * packet. If the file exists, a suffix is added to make the name
+     * unique.
+     *
+     * \param packets the packets to write. Must not be empty.
+     */
+    void write_dump(const std::vector<std::shared_ptr<PcapItem>>& packets);
+
+    /**
+     * \brief the retention period.
+     */
+    std::chrono::seconds period_;
+
+    /**
+     * \brief the maximum retained size.
+     */
+    std::size_t max_bytes_;
+
+    /**
+     * \brief the dump file name. Only used by the dump thread.
+     */
+    RotatingFileName fname_;
+
+    /**
+     * \brief make a writer for each dump.
+     */
+    WriterFactory make_writer_;
+
+    /**
+     * \brief the configuration, used to name dump files.
+     */
+    Configuration config_;
+
+    /**
+     * \brief mutex guarding the retained packets and dump state.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * \brief signal the dump thread.
+     */
+    std::condition_variable cond_;
+
+    /**
+     * \brief the retained packets, oldest first.
+     */
+    std::deque<Item> packets_;
+
+    /**
+     * \brief the retained size of the packets.
+     */
+    std::size_t bytes_;
+
+    /**
+     * \brief the packets for the dump being written.
+     */
+    std::vector<std::shared_ptr<PcapItem>> dump_;
+
+    /**
+     * \brief `true` from a dump being requested until it is written.
+     */
+    bool dumping_;
+
+    /**
+     * \brief `true` when the dump thread should stop.
+     */
+    bool stop_;
+
+    /**
+     * \brief the number of dumps written.
+     */
+    uint64_t dumps_;
+
+    /**
+     * \brief the number of packets written by dumps.
+     */
+    uint64_t dumped_packets_;
+
+    /**
+     * \brief the number of dumps not started because a dump was being written.
+     */
+    uint64_t busy_;
+
+    /**
+     * \brief the dump thread.
+     */
+    std::thread thread_;
+};
+
+#endif
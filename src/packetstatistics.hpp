@@ -129,6 +129,127 @@ using PacketStatistics = struct PacketStatistics_s
 
    uint64_t matcher_drop_count;
 
+    /**
+     * \brief count of TCP flows dropped because reassembly memory was exhausted.
+     */
+    uint64_t tcp_flow_memory_drop_count;
+
+    /**
+     * \brief count of TCP flows dropped because too many flows were active.
+     */
+    uint64_t tcp_flow_limit_drop_count;
+
+    /**
+     * \brief count of fragmented IP datagrams reassembled.
+     */
+    uint64_t ip_fragment_reassembled_count;
+
+    /**
+     * \brief count of fragmented IP datagrams not completed in time.
+     */
+    uint64_t ip_fragment_timeout_count;
+
+    /**
+     * \brief count of fragmented IP datagrams dropped because reassembly
+     * memory was exhausted.
+     */
+    uint64_t ip_fragment_memory_drop_count;
+
+    /**
+     * \brief count of fragmented IP datagrams dropped because of overlapping
+     * or invalid fragments.
+     */
+    uint64_t ip_fragment_bad_drop_count;
+
+    /**
+     * \brief count of low priority query/responses discarded by load shedding.
+     */
+    uint64_t shed_low_priority_count;
+
+    /**
+     * \brief count of normal priority query/responses discarded by load shedding.
+     */
+    uint64_t shed_normal_priority_count;
+
+    /**
+     * \brief Add the counts from another set of statistics.
+     *
+     * Used to combine statistics collected by separate threads.
+     *
+     * \param rhs the statistics to add.
+     * \returns this object.
+     */
+    PacketStatistics_s& operator+=(const PacketStatistics_s& rhs)
+    {
+        raw_packet_count += rhs.raw_packet_count;
+        out_of_order_packet_count += rhs.out_of_order_packet_count;
+        unhandled_packet_count += rhs.unhandled_packet_count;
+        processed_message_count += rhs.processed_message_count;
+        qr_pair_count += rhs.qr_pair_count;
+        query_without_response_count += rhs.query_without_response_count;
+        response_without_query_count += rhs.response_without_query_count;
+        discarded_opcode_count += rhs.discarded_opcode_count;
+        malformed_message_count += rhs.malformed_message_count;
+        pcap_recv_count += rhs.pcap_recv_count;
+        pcap_drop_count += rhs.pcap_drop_count;
+        pcap_ifdrop_count += rhs.pcap_ifdrop_count;
+        output_raw_pcap_drop_count += rhs.output_raw_pcap_drop_count;
+        output_ignored_pcap_drop_count += rhs.output_ignored_pcap_drop_count;
+        output_cbor_drop_count += rhs.output_cbor_drop_count;
+        sniffer_drop_count += rhs.sniffer_drop_count;
+        discarded_sampling_count += rhs.discarded_sampling_count;
+        matcher_drop_count += rhs.matcher_drop_count;
+        tcp_flow_memory_drop_count += rhs.tcp_flow_memory_drop_count;
+        tcp_flow_limit_drop_count += rhs.tcp_flow_limit_drop_count;
+        ip_fragment_reassembled_count += rhs.ip_fragment_reassembled_count;
+        ip_fragment_timeout_count += rhs.ip_fragment_timeout_count;
+        ip_fragment_memory_drop_count += rhs.ip_fragment_memory_drop_count;
+        ip_fragment_bad_drop_count += rhs.ip_fragment_bad_drop_count;
+        shed_low_priority_count += rhs.shed_low_priority_count;
+        shed_normal_priority_count += rhs.shed_normal_priority_count;
+        return *this;
+    }
+
+    /**
+     * \brief Subtract the counts from another set of statistics.
+     *
+     * Used to keep a running total of statistics collected by
+     * separate threads up to date.
+     *
+     * \param rhs the statistics to subtract.
+     * \returns this object.
+     */
+    PacketStatistics_s& operator-=(const PacketStatistics_s& rhs)
+    {
+        raw_packet_count -= rhs.raw_packet_count;
+        out_of_order_packet_count -= rhs.out_of_order_packet_count;
+        unhandled_packet_count -= rhs.unhandled_packet_count;
+        processed_message_count -= rhs.processed_message_count;
+        qr_pair_count -= rhs.qr_pair_count;
+        query_without_response_count -= rhs.query_without_response_count;
+        response_without_query_count -= rhs.response_without_query_count;
+        discarded_opcode_count -= rhs.discarded_opcode_count;
+        malformed_message_count -= rhs.malformed_message_count;
+        pcap_recv_count -= rhs.pcap_recv_count;
+        pcap_drop_count -= rhs.pcap_drop_count;
+        pcap_ifdrop_count -= rhs.pcap_ifdrop_count;
+        output_raw_pcap_drop_count -= rhs.output_raw_pcap_drop_count;
+        output_ignored_pcap_drop_count -= rhs.output_ignored_pcap_drop_count;
+        output_cbor_drop_count -= rhs.output_cbor_drop_count;
+        sniffer_drop_count -= rhs.sniffer_drop_count;
+        discarded_sampling_count -= rhs.discarded_sampling_count;
+        matcher_drop_count -= rhs.matcher_drop_count;
+        tcp_flow_memory_drop_count -= rhs.tcp_flow_memory_drop_count;
+        tcp_flow_limit_drop_count -= rhs.tcp_flow_limit_drop_count;
+        ip_fragment_reassembled_count -= rhs.ip_fragment_reassembled_count;
+        ip_fragment_timeout_count -= rhs.ip_fragment_timeout_count;
+        ip_fragment_memory_drop_count -= rhs.ip_fragment_memory_drop_count;
+        ip_fragment_bad_drop_count -= rhs.ip_fragment_bad_drop_count;
+        shed_low_priority_count -= rhs.shed_low_priority_count;
+        shed_normal_priority_count -= rhs.shed_normal_priority_count;
+        return *this;
+    }
+
     /**
      * \brief Dump the stats to the stream provided
      *
@@ -155,6 +276,27 @@ using PacketStatistics = struct PacketStatistics_s
            << "  Packets received               (libpcap) : " << pcap_recv_count << "\n"
            << "  Packets dropped at i/f         (libpcap) : " << pcap_ifdrop_count << "\n"
            << "  Packets dropped in kernel      (libpcap) : " << pcap_drop_count << "\n\n";
+        // Reassembly counts are not stored in C-DNS, so only show them
+        // if there is something to report.
+        if ( tcp_flow_memory_drop_count > 0 || tcp_flow_limit_drop_count > 0 ||
+             ip_fragment_reassembled_count > 0 || ip_fragment_timeout_count > 0 ||
+             ip_fragment_memory_drop_count > 0 || ip_fragment_bad_drop_count > 0 )
+        {
+            os << "REASSEMBLY STATISTICS:\n"
+               << "  Dropped TCP flows               (memory) : " << tcp_flow_memory_drop_count << "\n"
+               << "  Dropped TCP flows           (flow limit) : " << tcp_flow_limit_drop_count << "\n"
+               << "  Reassembled IP datagrams                 : " << ip_fragment_reassembled_count << "\n"
+               << "  Dropped IP datagrams           (timeout) : " << ip_fragment_timeout_count << "\n"
+               << "  Dropped IP datagrams            (memory) : " << ip_fragment_memory_drop_count << "\n"
+               << "  Dropped IP datagrams  (invalid fragment) : " << ip_fragment_bad_drop_count << "\n\n";
+        }
+        // As are load shedding counts.
+        if ( shed_low_priority_count > 0 || shed_normal_priority_count > 0 )
+        {
+            os << "LOAD SHEDDING STATISTICS:\n"
+               << "  Shed low priority Q/R pairs              : " << shed_low_priority_count << "\n"
+               << "  Shed normal priority Q/R pairs           : " << shed_normal_priority_count << "\n\n";
+        }
     }
 };
 
@@ -14,53 +14,24 @@
 #include <functional>
 #include <iostream>
 
+#include <boost/functional/hash.hpp>
+
 #include "dnsmessage.hpp"
 #include "makeunique.hpp"
-#include "nocopypacket.hpp"
 
 #include "packetstream.hpp"
 
-PacketStream::PacketStream(const Configuration& config, DNSSink dns_sink, AddressEventSink address_event_sink)
-    : config_(config), dns_sink_(dns_sink), address_event_sink_(address_event_sink)
-{
-    tcp_stream_follower_.new_stream_callback(std::bind(&PacketStream::on_new_stream, this, std::placeholders::_1));
-}
-
-void PacketStream::on_new_stream(Tins::TCPIP::Stream& stream)
-{
-    // I will handle clearing the payloads.
-    stream.auto_cleanup_payloads(false);
-
-    stream.client_data_callback(std::bind(&PacketStream::on_new_client_data, this, std::placeholders::_1));
-    stream.server_data_callback(std::bind(&PacketStream::on_new_server_data, this, std::placeholders::_1));
-}
-
-void PacketStream::on_new_client_data(Tins::TCPIP::Stream& stream)
+PacketStream::PacketStream(const Configuration& config, DNSSink dns_sink,
+                           AddressEventSink address_event_sink,
+                           PacketStatistics& stats,
+                           MalformedMessageSink malformed_message_sink)
+    : config_(&config), dns_sink_(dns_sink), address_event_sink_(address_event_sink),
+      malformed_message_sink_(malformed_message_sink),
+      fragment_reassembler_(config.fragment_memory_limit.size,
+                            config.fragment_timeout, stats),
+      tcp_reassembler_(config.tcp_max_flows, config.tcp_memory_limit.size,
+                       config.tcp_idle_timeout, stats)
 {
-    on_new_stream_data(stream.client_payload());
-}
-
-void PacketStream::on_new_server_data(Tins::TCPIP::Stream& stream)
-{
-    on_new_stream_data(stream.server_payload());
-}
-
-void PacketStream::on_new_stream_data(Tins::TCPIP::Stream::payload_type& payload)
-{
-    for (;;)
-    {
-        if ( payload.size() < 2 )
-            break;
-
-        unsigned dns_len = (payload[0] << 8) + payload[1];
-        if ( (dns_len + 2) > payload.size() )
-            break;
-
-        Tins::RawPDU pdu(&(payload.data()[2]), dns_len);
-        dispatch_dns(&pdu, *last_tcp_packet_data_);
-
-        payload.erase(payload.begin(), payload.begin() + dns_len + 2);
-    }
 }
 
 Tins::PDU* PacketStream::find_ip_pdu(Tins::PDU* pdu)
@@ -70,12 +41,12 @@ Tins::PDU* PacketStream::find_ip_pdu(Tins::PDU* pdu)
             pdu->pdu_type() != Tins::PDU::IPv6 )
     {
         if ( pdu->pdu_type() == Tins::PDU::DOT1Q &&
-             !config_.vlan_ids.empty() )
+             !config_->vlan_ids.empty() )
         {
             const Tins::Dot1Q* dot1q = reinterpret_cast<const Tins::Dot1Q*>(pdu);
-            if ( std::find(config_.vlan_ids.begin(),
-                           config_.vlan_ids.end(),
-                           dot1q->id()) == std::end(config_.vlan_ids) )
+            if ( std::find(config_->vlan_ids.begin(),
+                           config_->vlan_ids.end(),
+                           dot1q->id()) == std::end(config_->vlan_ids) )
                 return nullptr;
         }
 
@@ -90,8 +61,25 @@ Tins::PDU* PacketStream::find_ip_pdu(Tins::PDU* pdu)
 
 Tins::PDU* PacketStream::ipv4_packet(Tins::IP* ip, PktData& pkt_data)
 {
-    if ( reassembler_ipv4_.process(*ip) == Tins::IPv4Reassembler::FRAGMENTED )
-        return NULL;
+    if ( ip->is_fragmented() )
+    {
+        std::vector<uint8_t> buf = ip->serialize();
+        if ( !fragment_reassembler_.process_ipv4(buf.data(), buf.size(),
+                                                 pkt_data.timestamp,
+                                                 reassembled_buf_) )
+            return NULL;
+
+        try
+        {
+            reassembled_ = make_unique<Tins::IP>(reassembled_buf_.data(),
+                                                 reassembled_buf_.size());
+        }
+        catch (Tins::malformed_packet&)
+        {
+            throw malformed_packet();
+        }
+        ip = reinterpret_cast<Tins::IP*>(reassembled_.get());
+    }
 
     pkt_data.hoplimit = ip->ttl();
     pkt_data.srcIP = IPAddress(ip->src_addr());
@@ -106,7 +94,26 @@ Tins::PDU* PacketStream::ipv4_packet(Tins::IP* ip, PktData& pkt_data)
 
 Tins::PDU* PacketStream::ipv6_packet(Tins::IPv6* ip6, PktData& pkt_data)
 {
-    // TODO: Add IPv6 fragmentation detection into condition.
+    if ( ip6->search_header(Tins::IPv6::FRAGMENT) )
+    {
+        std::vector<uint8_t> buf = ip6->serialize();
+        if ( !fragment_reassembler_.process_ipv6(buf.data(), buf.size(),
+                                                 pkt_data.timestamp,
+                                                 reassembled_buf_) )
+            return NULL;
+
+        try
+        {
+            reassembled_ = make_unique<Tins::IPv6>(reassembled_buf_.data(),
+                                                   reassembled_buf_.size());
+        }
+        catch (Tins::malformed_packet&)
+        {
+            throw malformed_packet();
+        }
+        ip6 = reinterpret_cast<Tins::IPv6*>(reassembled_.get());
+    }
+
     pkt_data.hoplimit = ip6->hop_limit();
     pkt_data.srcIP = IPAddress(ip6->src_addr());
     pkt_data.dstIP = IPAddress(ip6->dst_addr());
@@ -120,7 +127,7 @@ Tins::PDU* PacketStream::ipv6_packet(Tins::IPv6* ip6, PktData& pkt_data)
 
 void PacketStream::udp_packet(Tins::UDP* udp, PktData& pkt_data)
 {
-    if ( udp->dport() != config_.dns_port && udp->sport() != config_.dns_port )
+    if ( udp->dport() != config_->dns_port && udp->sport() != config_->dns_port )
         throw unhandled_packet();
 
     pkt_data.srcPort = udp->sport();
@@ -134,16 +141,15 @@ void PacketStream::udp_packet(Tins::UDP* udp, PktData& pkt_data)
     dispatch_dns(reinterpret_cast<Tins::RawPDU*>(pdu), pkt_data);
 }
 
-void PacketStream::tcp_packet(Tins::TCP* tcp, Tins::PDU* ip_pdu,
+void PacketStream::tcp_packet(Tins::TCP* tcp, Tins::PDU* /* ip_pdu */,
                               PktData& pkt_data)
 {
-    if ( tcp->dport() != config_.dns_port && tcp->sport() != config_.dns_port )
+    if ( tcp->dport() != config_->dns_port && tcp->sport() != config_->dns_port )
         throw unhandled_packet();
 
     pkt_data.srcPort = tcp->sport();
     pkt_data.dstPort = tcp->dport();
     pkt_data.transport_type = TransportType::TCP;
-    last_tcp_packet_data_ = &pkt_data;
 
     if ( tcp->flags() & Tins::TCP::RST )
     {
@@ -152,14 +158,36 @@ void PacketStream::tcp_packet(Tins::TCP* tcp, Tins::PDU* ip_pdu,
         address_event_sink_(ae);
     }
 
-    // It looks like the TCP stream follower stuff *modifies* the
-    // PDU data fed into it. Since we're sharing the packet with the
-    // PCAP output queues, they can end up writing a modified version
-    // of the packet. What we see especially is zero length TCP packets
-    // at the first data packet in a transaction. So copy the packet before
-    // feeding the copy into the stream follower.
-    Tins::Packet pkt(ip_pdu, NoCopyPacket::tsToTins(pkt_data.timestamp));
-    tcp_stream_follower_.process_packet(pkt);
+    const uint8_t* payload = nullptr;
+    std::size_t payload_size = 0;
+    Tins::RawPDU* raw = tcp->find_pdu<Tins::RawPDU>();
+    if ( raw )
+    {
+        payload = raw->payload().data();
+        payload_size = raw->payload_size();
+    }
+
+    // Malformed messages must not disturb reassembly of the rest of
+    // the stream, so note them and report once the segment is done.
+    bool malformed = false;
+    tcp_reassembler_.process(
+        pkt_data.srcIP, pkt_data.srcPort, pkt_data.dstIP, pkt_data.dstPort,
+        tcp->seq(), tcp->flags(), payload, payload_size, pkt_data.timestamp,
+        [&](const uint8_t* data, std::size_t len)
+        {
+            try
+            {
+                Tins::RawPDU pdu(data, len);
+                dispatch_dns(&pdu, pkt_data);
+            }
+            catch (const malformed_packet&)
+            {
+                malformed = true;
+            }
+        });
+
+    if ( malformed )
+        throw malformed_packet();
 }
 
 void PacketStream::icmp_packet(Tins::ICMP* icmp, Tins::PDU* /* ip_pdu */,
@@ -260,15 +288,220 @@ void PacketStream::icmpv6_packet(Tins::ICMPv6* icmp, Tins::PDU* /* ip_pdu */,
 
 void PacketStream::dispatch_dns(Tins::RawPDU* pdu, PktData& pkt_data)
 {
-    auto dns =
-        make_unique<DNSMessage>(*pdu,
-                                pkt_data.timestamp,
-                                pkt_data.srcIP, pkt_data.dstIP,
-                                pkt_data.srcPort, pkt_data.dstPort,
-                                pkt_data.hoplimit, pkt_data.transport_type);
+    std::unique_ptr<DNSMessage> dns;
+
+    try
+    {
+        dns = make_unique<DNSMessage>(*pdu,
+                                      pkt_data.timestamp,
+                                      pkt_data.srcIP, pkt_data.dstIP,
+                                      pkt_data.srcPort, pkt_data.dstPort,
+                                      pkt_data.hoplimit, pkt_data.transport_type);
+    }
+    catch (const malformed_packet&)
+    {
+        if ( malformed_message_sink_ )
+        {
+            // The message can't be trusted to say which way it was
+            // going, so the server is the end using the DNS port.
+            bool from_server = ( pkt_data.srcPort == config_->dns_port &&
+                                 pkt_data.dstPort != config_->dns_port );
+            const Tins::RawPDU::payload_type& payload = pdu->payload();
+            std::shared_ptr<MalformedMessage> mm;
+
+            if ( from_server )
+                mm = std::make_shared<MalformedMessage>(
+                    pkt_data.timestamp,
+                    pkt_data.dstIP, pkt_data.dstPort,
+                    pkt_data.srcIP, pkt_data.srcPort,
+                    pkt_data.transport_type,
+                    byte_string(payload.begin(), payload.end()));
+            else
+                mm = std::make_shared<MalformedMessage>(
+                    pkt_data.timestamp,
+                    pkt_data.srcIP, pkt_data.srcPort,
+                    pkt_data.dstIP, pkt_data.dstPort,
+                    pkt_data.transport_type,
+                    byte_string(payload.begin(), payload.end()));
+            malformed_message_sink_(mm);
+        }
+        throw;
+    }
+    dns->received = pkt_data.received;
     dns_sink_(dns);
 }
 
+std::size_t PacketStream::flow_hash(std::shared_ptr<PcapItem>& pcap)
+{
+    Tins::PDU* pdu = pcap->pdu.get();
+    uint64_t h = 0;
+
+    if ( pdu->pdu_type() == Tins::PDU::RAW )
+    {
+        const Tins::RawPDU::payload_type& payload =
+            reinterpret_cast<Tins::RawPDU*>(pdu)->payload();
+        if ( payload.size() >= 20 && ( payload[0] >> 4 ) == 4 )
+            h = boost::hash_range(&payload[12], &payload[16]) ^
+                boost::hash_range(&payload[16], &payload[20]);
+        else if ( payload.size() >= 40 && ( payload[0] >> 4 ) == 6 )
+            h = boost::hash_range(&payload[8], &payload[24]) ^
+                boost::hash_range(&payload[24], &payload[40]);
+    }
+    else
+    {
+        try
+        {
+            pdu = find_ip_pdu(pdu);
+        }
+        catch (const unhandled_packet&)
+        {
+            pdu = nullptr;
+        }
+
+        if ( pdu && pdu->pdu_type() == Tins::PDU::IP )
+        {
+            Tins::IP* ip = reinterpret_cast<Tins::IP*>(pdu);
+            h = boost::hash_value(static_cast<uint32_t>(ip->src_addr())) ^
+                boost::hash_value(static_cast<uint32_t>(ip->dst_addr()));
+        }
+        else if ( pdu && pdu->pdu_type() == Tins::PDU::IPv6 )
+        {
+            Tins::IPv6* ip6 = reinterpret_cast<Tins::IPv6*>(pdu);
+            Tins::IPv6Address src = ip6->src_addr();
+            Tins::IPv6Address dst = ip6->dst_addr();
+            h = boost::hash_range(src.begin(), src.end()) ^
+                boost::hash_range(dst.begin(), dst.end());
+        }
+    }
+
+    // XOR keeps the hash symmetric, but leaves it poorly mixed.
+    h *= 0x9e3779b97f4a7c15ull;
+    return static_cast<std::size_t>(h >> 32);
+}
+
+void PacketStream::set_configuration(std::shared_ptr<const Configuration> config)
+{
+    config_snapshot_ = std::move(config);
+    config_ = config_snapshot_.get();
+}
+
+bool PacketStream::sample_packet(std::shared_ptr<PcapItem>& pcap,
+                                 const FlowSampler& sampler)
+{
+    Tins::PDU* pdu = pcap->pdu.get();
+    const uint8_t* src = nullptr;
+    const uint8_t* dst = nullptr;
+    std::size_t addr_len = 0;
+    uint16_t sport = 0;
+    uint16_t dport = 0;
+    uint16_t id = 0;
+    uint8_t v4src[4];
+    uint8_t v4dst[4];
+    Tins::IPv6Address v6src;
+    Tins::IPv6Address v6dst;
+
+    if ( pdu->pdu_type() == Tins::PDU::RAW )
+    {
+        const Tins::RawPDU::payload_type& payload =
+            reinterpret_cast<Tins::RawPDU*>(pdu)->payload();
+        std::size_t len = payload.size();
+        std::size_t pos;
+        uint8_t protocol;
+
+        if ( len >= 20 && ( payload[0] >> 4 ) == 4 )
+        {
+            // Keep fragments; only the first has the ports.
+            if ( ( payload[6] & 0x3f ) != 0 || payload[7] != 0 )
+                return true;
+            pos = ( payload[0] & 0x0f ) * 4;
+            protocol = payload[9];
+            src = &payload[12];
+            dst = &payload[16];
+            addr_len = 4;
+        }
+        else if ( len >= 40 && ( payload[0] >> 4 ) == 6 )
+        {
+            // Extension headers, including fragment headers, are kept.
+            pos = 40;
+            protocol = payload[6];
+            src = &payload[8];
+            dst = &payload[24];
+            addr_len = 16;
+        }
+        else
+            return true;
+
+        if ( protocol == 17 && pos + 10 <= len )
+            id = static_cast<uint16_t>((payload[pos + 8] << 8) | payload[pos + 9]);
+        else if ( protocol != 6 || pos + 4 > len )
+            return true;
+        sport = static_cast<uint16_t>((payload[pos] << 8) | payload[pos + 1]);
+        dport = static_cast<uint16_t>((payload[pos + 2] << 8) | payload[pos + 3]);
+    }
+    else
+    {
+        try
+        {
+            pdu = find_ip_pdu(pdu);
+        }
+        catch (const unhandled_packet&)
+        {
+            return true;
+        }
+
+        if ( !pdu )
+            return true;
+
+        // A fragment has a RawPDU, not a UDP or TCP PDU, so is kept.
+        if ( Tins::UDP* udp = pdu->find_pdu<Tins::UDP>() )
+        {
+            const Tins::RawPDU* raw = udp->find_pdu<Tins::RawPDU>();
+            if ( raw && raw->payload_size() >= 2 )
+                id = static_cast<uint16_t>((raw->payload()[0] << 8) | raw->payload()[1]);
+            sport = udp->sport();
+            dport = udp->dport();
+        }
+        else if ( Tins::TCP* tcp = pdu->find_pdu<Tins::TCP>() )
+        {
+            sport = tcp->sport();
+            dport = tcp->dport();
+        }
+        else
+            return true;
+
+        if ( pdu->pdu_type() == Tins::PDU::IP )
+        {
+            Tins::IP* ip = reinterpret_cast<Tins::IP*>(pdu);
+            uint32_t s = ip->src_addr();
+            uint32_t d = ip->dst_addr();
+            for ( int i = 3; i >= 0; --i, s >>= 8, d >>= 8 )
+            {
+                v4src[i] = static_cast<uint8_t>(s);
+                v4dst[i] = static_cast<uint8_t>(d);
+            }
+            src = v4src;
+            dst = v4dst;
+            addr_len = 4;
+        }
+        else
+        {
+            Tins::IPv6* ip6 = reinterpret_cast<Tins::IPv6*>(pdu);
+            v6src = ip6->src_addr();
+            v6dst = ip6->dst_addr();
+            src = v6src.begin();
+            dst = v6dst.begin();
+            addr_len = 16;
+        }
+    }
+
+    if ( dport == config_->dns_port )
+        return sampler.keep(src, addr_len, sport, id);
+    else if ( sport == config_->dns_port )
+        return sampler.keep(dst, addr_len, dport, id);
+    else
+        return true;
+}
+
 void PacketStream::process_packet(std::shared_ptr<PcapItem>& pcap)
 {
     Tins::PDU* pdu = pcap->pdu.get();
@@ -310,8 +543,10 @@ void PacketStream::process_packet(std::shared_ptr<PcapItem>& pcap)
 
     struct PacketStream::PktData pkt_data;
     pkt_data.timestamp = pcap->timestamp;
+    pkt_data.received = pcap->received;
 
     Tins::PDU* ip_pdu = pdu;
+    reassembled_.reset();
 
     try
     {
@@ -332,6 +567,9 @@ void PacketStream::process_packet(std::shared_ptr<PcapItem>& pcap)
         if ( !pdu )
             return;
 
+        if ( reassembled_ )
+            ip_pdu = reassembled_.get();
+
         switch (pdu->pdu_type())
         {
         case Tins::PDU::UDP:
@@ -18,13 +18,17 @@
 #include <memory>
 
 #include <tins/tins.h>
-#include <tins/tcp_ip/stream_follower.h>
 
 #include "addressevent.hpp"
 #include "channel.hpp"
 #include "configuration.hpp"
+#include "flowsampler.hpp"
+#include "fragmentreassembler.hpp"
+#include "malformedmessage.hpp"
 #include "matcher.hpp"
+#include "packetstatistics.hpp"
 #include "sniffers.hpp"
+#include "tcpreassembler.hpp"
 #include "transporttype.hpp"
 
 /**
@@ -99,6 +103,11 @@ struct PcapItem
      * \brief the packet data.
      */
     std::unique_ptr<Tins::PDU> pdu;
+
+    /**
+     * \brief when the packet entered the compactor, if measuring latency.
+     */
+    std::chrono::steady_clock::time_point received;
 };
 
 /**
@@ -120,14 +129,25 @@ public:
      */
     using AddressEventSink = std::function<void (std::shared_ptr<AddressEvent>&)>;
 
+    /**
+     * \typedef MalformedMessageSink
+     * \brief Sink function for malformed DNS messages.
+     */
+    using MalformedMessageSink = std::function<void (std::shared_ptr<MalformedMessage>&)>;
+
     /**
      * \brief Constructor.
      *
      * \param config             configuration information.
      * \param dns_sink           sink for DNS messages.
      * \param address_event_sink sink for Address Event messages.
+     * \param stats              statistics to update.
+     * \param malformed_message_sink sink for malformed DNS messages, if wanted.
      */
-    PacketStream(const Configuration& config, DNSSink dns_sink, AddressEventSink address_event_sink);
+    PacketStream(const Configuration& config, DNSSink dns_sink,
+                 AddressEventSink address_event_sink,
+                 PacketStatistics& stats,
+                 MalformedMessageSink malformed_message_sink = MalformedMessageSink());
 
     /**
      * \brief Process an incoming packet.
@@ -138,6 +158,45 @@ public:
      */
     void process_packet(std::shared_ptr<PcapItem>& pcap);
 
+    /**
+     * \brief Calculate a flow hash for an incoming packet.
+     *
+     * The hash is calculated from the source and destination IP
+     * addresses only, and is the same for both directions of traffic.
+     * So all packets of a DNS query/response exchange, all segments of
+     * a TCP connection and all fragments of an IP datagram have the
+     * same hash.
+     *
+     * \param pcap the incoming packet.
+     * \returns the hash, or 0 if the packet has no IP or IPv6 PDU.
+     */
+    std::size_t flow_hash(std::shared_ptr<PcapItem>& pcap);
+
+    /**
+     * \brief Decide whether to keep an incoming packet when sampling.
+     *
+     * The decision is made before any DNS decoding, from the client
+     * address and port and, for UDP, the DNS message ID. So a query
+     * and its response are kept or discarded together. TCP packets
+     * use a DNS ID of 0, so a whole TCP connection is kept or
+     * discarded. Packets that are not to or from the DNS port, IP
+     * fragments and packets that cannot be parsed are always kept.
+     *
+     * \param pcap    the incoming packet.
+     * \param sampler the sampler.
+     * \returns `true` if the packet should be kept.
+     */
+    bool sample_packet(std::shared_ptr<PcapItem>& pcap, const FlowSampler& sampler);
+
+    /**
+     * \brief Replace the capture configuration.
+     *
+     * Reassembly limits and timeouts are not changed.
+     *
+     * \param config the new configuration.
+     */
+    void set_configuration(std::shared_ptr<const Configuration> config);
+
 protected:
     /**
      * \struct PktData
@@ -150,6 +209,11 @@ protected:
          */
         std::chrono::system_clock::time_point timestamp;
 
+        /**
+         * \brief when the packet entered the compactor, if measuring latency.
+         */
+        std::chrono::steady_clock::time_point received;
+
         /**
          * \brief Packet source address.
          */
@@ -181,34 +245,6 @@ protected:
         TransportType transport_type;
     };
 
-    /**
-     * \brief Callback when a new TCP stream is created.
-     *
-     * \param stream the new stream.
-     */
-    void on_new_stream(Tins::TCPIP::Stream& stream);
-
-    /**
-     * \brief Callback when a TCP stream has fresh data.
-     *
-     * \param stream the stream.
-     */
-    void on_new_client_data(Tins::TCPIP::Stream& stream);
-
-    /**
-     * \brief Callback when a TCP stream has fresh data.
-     *
-     * \param stream the stream.
-     */
-    void on_new_server_data(Tins::TCPIP::Stream& stream);
-
-    /**
-     * \brief Callback when a TCP stream has fresh data.
-     *
-     * \param payload the stream data payload.
-     */
-    void on_new_stream_data(Tins::TCPIP::Stream::payload_type& payload);
-
     /**
      * \brief Find the IP or IPv6 PDU in the packet.
      *
@@ -222,11 +258,14 @@ protected:
      * \brief Process IPv4 packet.
      *
      * Extract the source and destination addresses and hoplimit.
+     * If the packet is a fragment, pass it to fragment reassembly,
+     * and continue with the reassembled datagram once complete.
      *
      * \param pdu      IPv4 PDU.
      * \param pkt_data the packet data.
      * \returns inner PDU or `null` if nothing to process.
-     * \throws malformed_packet if there is no inner PDU.
+     * \throws malformed_packet if there is no inner PDU, or the
+     *         reassembled datagram cannot be decoded.
      */
     Tins::PDU* ipv4_packet(Tins::IP* pdu, PktData& pkt_data);
 
@@ -234,11 +273,14 @@ protected:
      * \brief Process IPv6 packet.
      *
      * Extract the source and destination addresses and hoplimit.
+     * If the packet is a fragment, pass it to fragment reassembly,
+     * and continue with the reassembled datagram once complete.
      *
      * \param pdu      IPv6 PDU.
      * \param pkt_data the packet data.
      * \returns inner PDU or `null` if nothing to process.
-     * \throws malformed_packet if there is no inner PDU.
+     * \throws malformed_packet if there is no inner PDU, or the
+     *         reassembled datagram cannot be decoded.
      */
     Tins::PDU* ipv6_packet(Tins::IPv6* pdu, PktData& pkt_data);
 
@@ -286,8 +328,12 @@ protected:
     /**
      * \brief Dispatch a DNS message.
      *
+     * If the message can't be decoded, it is passed to the malformed
+     * message sink, if any, before the error is thrown.
+     *
      * \param pdu   the message data.
      * \param pkt_data basic packet data so far.
+     * \throws malformed_packet if the message cannot be decoded.
      */
     void dispatch_dns(Tins::RawPDU* pdu, PktData& pkt_data);
 
@@ -308,7 +354,12 @@ private:
     /**
      * \brief the capture configuration.
      */
-    const Configuration& config_;
+    const Configuration* config_;
+
+    /**
+     * \brief the configuration snapshot in use, if replaced.
+     */
+    std::shared_ptr<const Configuration> config_snapshot_;
 
     /**
      * \brief sink function for completed DNS packets.
@@ -321,19 +372,29 @@ private:
     AddressEventSink address_event_sink_;
 
     /**
-     * \brief IPv4 fragment reassembly.
+     * \brief sink function for malformed DNS messages.
+     */
+    MalformedMessageSink malformed_message_sink_;
+
+    /**
+     * \brief IPv4 and IPv6 fragment reassembly.
+     */
+    FragmentReassembler fragment_reassembler_;
+
+    /**
+     * \brief the most recent reassembled datagram.
      */
-    Tins::IPv4Reassembler reassembler_ipv4_;
+    std::vector<uint8_t> reassembled_buf_;
 
     /**
-     * \brief TCP stream follower.
+     * \brief the PDU for the reassembled datagram being processed, if any.
      */
-    Tins::TCPIP::StreamFollower tcp_stream_follower_;
+    std::unique_ptr<Tins::PDU> reassembled_;
 
     /**
-     * \brief last seen TCP hop limit.
+     * \brief DNS over TCP reassembly.
      */
-    PktData* last_tcp_packet_data_;
+    TcpReassembler tcp_reassembler_;
 };
 
 #endif
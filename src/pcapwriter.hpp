@@ -20,6 +20,7 @@
 #include <pcap/pcap.h>
 #include <tins/tins.h>
 
+#include "cborencoder.hpp"
 #include "configuration.hpp"
 #include "makeunique.hpp"
 #include "nocopypacket.hpp"
@@ -128,6 +129,14 @@ public:
             writer_.reset(nullptr);
     }
 
+    /**
+     * \brief Return `true` if an output file is open.
+     */
+    bool is_open() const
+    {
+        return static_cast<bool>(writer_);
+    }
+
     /**
      * \brief Write a packet to the output file.
      *
@@ -368,4 +377,99 @@ private:
     PcapWriter<Writer> writer_;
 };
 
+/**
+ * \class PcapParallelRotatingWriter
+ * \brief Write packets to an output PCAP file with rotating filename,
+ * compressing completed files with a writer pool.
+ *
+ * Packets are written uncompressed to a temporary file. When the file
+ * is rotated or closed, it is handed to the writer pool for compression,
+ * so compression does not hold up writing packets.
+ */
+class PcapParallelRotatingWriter : public PcapBaseRotatingWriter
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param pattern filename pattern for the output file.
+     * \param period  rotation period for output file.
+     * \param snaplen snap length.
+     * \param pool    the writer pool to compress completed files.
+     */
+    PcapParallelRotatingWriter(const std::string& pattern,
+                               const std::chrono::seconds& period,
+                               unsigned snaplen,
+                               std::shared_ptr<BaseParallelWriterPool> pool,
+                               bool logging = false)
+        : fname_(make_unique<RotatingFileName>(pattern + pool->suggested_extension(), period)),
+          writer_("", 0, snaplen, logging), pool_(pool)
+    {
+    }
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~PcapParallelRotatingWriter()
+    {
+        close();
+    }
+
+    /**
+     * \brief Close the current output, and queue it for compression.
+     */
+    virtual void close()
+    {
+        if ( writer_.is_open() )
+        {
+            writer_.close();
+            pool_->compressFile(filename_ + ".raw", filename_);
+        }
+    }
+
+    /**
+     * \brief Write a packet to the output file.
+     *
+     * Use the timestamp to see if the output file needs rotating, and then
+     * write the packet out to the file.
+     *
+     * \param pdu       the packet data to write.
+     * \param timestamp the packet timestamp.
+     * \param config    the current configuration.
+     */
+    virtual void write_packet(Tins::PDU& pdu,
+                              const std::chrono::system_clock::time_point& timestamp,
+                              const Configuration& config)
+    {
+        if ( fname_->need_rotate(timestamp, config) )
+        {
+            close();
+            filename_ = fname_->filename(timestamp, config);
+            writer_.set_filename(filename_ + ".raw");
+        }
+        writer_.write_packet(pdu, timestamp);
+    }
+
+private:
+    /**
+     * \brief the output file details.
+     */
+    std::unique_ptr<RotatingFileName> fname_;
+
+    /**
+     * \brief the current output filename.
+     */
+    std::string filename_;
+
+    /**
+     * \brief output writer.
+     */
+    PcapWriter<StreamWriter> writer_;
+
+    /**
+     * \brief the writer pool for completed files.
+     */
+    std::shared_ptr<BaseParallelWriterPool> pool_;
+};
+
 #endif
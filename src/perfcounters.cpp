@@ -0,0 +1,287 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "perfcounters.hpp"
+
+std::atomic<unsigned> PerfCounters::next_id_(1);
+thread_local unsigned PerfCounters::thread_owner_ = 0;
+thread_local PerfCounters::ThreadGroups* PerfCounters::thread_groups_ = nullptr;
+thread_local int PerfCounters::thread_stage_ = -1;
+
+namespace {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    /**
+     * \brief the hardware event for each counter.
+     */
+    const uint64_t HW_EVENTS[PerfCounters::COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    /**
+     * \struct GroupReading
+     * \brief The result of reading a counter group.
+     */
+    struct GroupReading
+    {
+        /**
+         * \brief the number of counters in the group.
+         */
+        uint64_t nr;
+
+        /**
+         * \brief the time the group was enabled.
+         */
+        uint64_t time_enabled;
+
+        /**
+         * \brief the time the group was on the hardware.
+         */
+        uint64_t time_running;
+
+        /**
+         * \brief the counter values.
+         */
+        uint64_t values[PerfCounters::COUNTERS];
+    };
+
+    /**
+     * \brief Open a counter for the calling thread.
+     *
+     * \param event    the hardware event.
+     * \param group_fd the group leader, or -1 to open a leader.
+     * \returns the file descriptor, or -1 on error.
+     */
+    int open_counter(uint64_t event, int group_fd)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = event;
+        attr.disabled = ( group_fd == -1 );
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP |
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+#endif
+
+    /**
+     * \brief Return a count scaled to a million packets.
+     */
+    uint64_t per_mpkt(uint64_t count, uint64_t packets)
+    {
+        return static_cast<uint64_t>(count * 1.0e6 / packets + 0.5);
+    }
+}
+
+PerfCounters::Totals PerfCounters::Totals::operator-(const Totals& earlier) const
+{
+    Totals res;
+    for ( unsigned s = 0; s < STAGES; ++s )
+        for ( unsigned c = 0; c < COUNTERS; ++c )
+            res.count[s][c] = count[s][c] - earlier.count[s][c];
+    return res;
+}
+
+PerfCounters::PerfCounters()
+    : id_(next_id_++), packets_(0)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    thread_owner_ = id_;
+    thread_groups_ = open_groups();
+    thread_stage_ = -1;
+    if ( !thread_groups_ )
+        throw std::runtime_error(std::string("hardware performance counters not available: ") + std::strerror(errno));
+#else
+    throw std::runtime_error("hardware performance counters not supported on this platform");
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for ( const auto& g : groups_ )
+        for ( unsigned s = 0; s < STAGES; ++s )
+            for ( unsigned c = 0; c < COUNTERS; ++c )
+                ::close(g->fd[s][c]);
+#endif
+}
+
+PerfCounters::ThreadGroups* PerfCounters::open_groups()
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    std::unique_ptr<ThreadGroups> groups(new ThreadGroups);
+    for ( unsigned s = 0; s < STAGES; ++s )
+        for ( unsigned c = 0; c < COUNTERS; ++c )
+        {
+            int fd = open_counter(HW_EVENTS[c], c == 0 ? -1 : groups->fd[s][0]);
+            if ( fd == -1 )
+            {
+                int err = errno;
+                for ( unsigned os = 0; os <= s; ++os )
+                    for ( unsigned oc = 0; oc < ( os == s ? c : static_cast<unsigned>(COUNTERS) ); ++oc )
+                        ::close(groups->fd[os][oc]);
+                errno = err;
+                return nullptr;
+            }
+            groups->fd[s][c] = fd;
+        }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    groups_.push_back(std::move(groups));
+    return groups_.back().get();
+#else
+    return nullptr;
+#endif
+}
+
+int PerfCounters::enter(Stage stage)
+{
+    if ( thread_owner_ != id_ )
+    {
+        thread_owner_ = id_;
+        thread_groups_ = open_groups();
+        thread_stage_ = -1;
+    }
+
+    int previous = thread_stage_;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if ( thread_groups_ )
+    {
+        if ( previous >= 0 )
+            ioctl(thread_groups_->fd[previous][0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        ioctl(thread_groups_->fd[stage][0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    thread_stage_ = stage;
+    return previous;
+}
+
+void PerfCounters::leave(int previous)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if ( thread_groups_ )
+    {
+        ioctl(thread_groups_->fd[thread_stage_][0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if ( previous >= 0 )
+            ioctl(thread_groups_->fd[previous][0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    thread_stage_ = previous;
+}
+
+PerfCounters::Totals PerfCounters::totals() const
+{
+    Totals res{};
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    std::lock_guard<std::mutex> lock(mutex_);
+    for ( const auto& g : groups_ )
+        for ( unsigned s = 0; s < STAGES; ++s )
+        {
+            GroupReading r;
+            if ( ::read(g->fd[s][0], &r, sizeof(r)) != sizeof(r) ||
+                 r.nr != COUNTERS || r.time_running == 0 )
+                continue;
+
+            // Scale up if the group was not always on the hardware.
+            double scale = static_cast<double>(r.time_enabled) / r.time_running;
+            for ( unsigned c = 0; c < COUNTERS; ++c )
+                res.count[s][c] += ( r.time_enabled == r.time_running )
+                    ? r.values[c]
+                    : static_cast<uint64_t>(r.values[c] * scale);
+        }
+#endif
+    return res;
+}
+
+const char* PerfCounters::stage_name(Stage stage)
+{
+    switch(stage)
+    {
+    case DECODE: return "decode";
+    case MATCH:  return "match";
+    case DEDUP:  return "dedup";
+    case ENCODE: return "encode";
+    default:     return "unknown";
+    }
+}
+
+const char* PerfCounters::counter_name(Counter counter)
+{
+    switch(counter)
+    {
+    case CYCLES:        return "cycles";
+    case INSTRUCTIONS:  return "instructions";
+    case CACHE_MISSES:  return "cache-misses";
+    case BRANCH_MISSES: return "branch-misses";
+    default:            return "unknown";
+    }
+}
+
+void PerfCounters::write_report(std::ostream& os, const Totals& totals, uint64_t packets)
+{
+    if ( packets == 0 )
+    {
+        os << "No packets processed.\n";
+        return;
+    }
+
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::left << std::setw(8) << "Stage" << std::right;
+    for ( unsigned c = 0; c < COUNTERS; ++c )
+        os << std::setw(20) << std::string(counter_name(static_cast<Counter>(c))) + "/Mpkt";
+    os << std::setw(7) << "IPC" << "\n";
+
+    uint64_t sum[COUNTERS] = {};
+    for ( unsigned s = 0; s <= STAGES; ++s )
+    {
+        const uint64_t* count = ( s < STAGES ) ? totals.count[s] : sum;
+        os << std::left << std::setw(8)
+           << ( s < STAGES ? stage_name(static_cast<Stage>(s)) : "total" )
+           << std::right;
+        for ( unsigned c = 0; c < COUNTERS; ++c )
+        {
+            os << std::setw(20) << per_mpkt(count[c], packets);
+            if ( s < STAGES )
+                sum[c] += count[c];
+        }
+        os << std::setw(7) << std::fixed << std::setprecision(2);
+        if ( count[CYCLES] > 0 )
+            os << static_cast<double>(count[INSTRUCTIONS]) / count[CYCLES];
+        else
+            os << "-";
+        os << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
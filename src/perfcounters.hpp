@@ -0,0 +1,269 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * \class PerfCounters
+ * \brief Count hardware events in each pipeline stage.
+ *
+ * Each thread that enters a stage opens, on first use, a group of
+ * hardware counters for each stage: CPU cycles, instructions retired,
+ * cache misses and branch misses. A stage's group counts only while
+ * the thread is in that stage. Stages nest; entering a stage pauses
+ * the counters of the stage it is entered from, and leaving it
+ * resumes them, so time is counted only once.
+ *
+ * Only user space events are counted, so the counters are available
+ * to unprivileged users where `kernel.perf_event_paranoid` is 2 or less.
+ *
+ * Totals are the sum over all threads. If the kernel has to share
+ * hardware counters, counts are scaled up to estimate the full count.
+ */
+class PerfCounters
+{
+public:
+    /**
+     * \enum Stage
+     * \brief The pipeline stages counted.
+     */
+    enum Stage
+    {
+        DECODE,
+        MATCH,
+        DEDUP,
+        ENCODE,
+        STAGES
+    };
+
+    /**
+     * \enum Counter
+     * \brief The events counted in each stage.
+     */
+    enum Counter
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        COUNTERS
+    };
+
+    /**
+     * \struct Totals
+     * \brief Event counts for all stages.
+     */
+    struct Totals
+    {
+        /**
+         * \brief the count for each stage and event.
+         */
+        uint64_t count[STAGES][COUNTERS];
+
+        /**
+         * \brief Return the counts since an earlier total.
+         *
+         * \param earlier the earlier total.
+         */
+        Totals operator-(const Totals& earlier) const;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * Check that counters can be opened.
+     *
+     * \throws std::runtime_error if hardware counters are not available.
+     */
+    PerfCounters();
+
+    /**
+     * \brief Destructor.
+     */
+    ~PerfCounters();
+
+    /**
+     * \brief Enter a stage in the calling thread.
+     *
+     * \param stage the stage.
+     * \returns the stage the thread was in, to pass to leave().
+     */
+    int enter(Stage stage);
+
+    /**
+     * \brief Leave the current stage in the calling thread.
+     *
+     * \param previous the value returned by the matching enter().
+     */
+    void leave(int previous);
+
+    /**
+     * \brief Read the counts so far for all threads.
+     */
+    Totals totals() const;
+
+    /**
+     * \brief Add to the count of packets processed.
+     *
+     * \param packets the number of packets.
+     */
+    void add_packets(uint64_t packets)
+    {
+        packets_ += packets;
+    }
+
+    /**
+     * \brief Return the count of packets processed.
+     */
+    uint64_t packets() const
+    {
+        return packets_;
+    }
+
+    /**
+     * \brief Return the name of a stage.
+     */
+    static const char* stage_name(Stage stage);
+
+    /**
+     * \brief Return the name of an event.
+     */
+    static const char* counter_name(Counter counter);
+
+    /**
+     * \brief Write a report of counts per million packets.
+     *
+     * There is a line for each stage, giving each event per million
+     * packets, and instructions per cycle.
+     *
+     * \param os      the output stream.
+     * \param totals  the counts.
+     * \param packets the number of packets processed for the counts.
+     */
+    static void write_report(std::ostream& os, const Totals& totals, uint64_t packets);
+
+private:
+    /**
+     * \struct ThreadGroups
+     * \brief The counter file descriptors of a thread.
+     */
+    struct ThreadGroups
+    {
+        /**
+         * \brief the counters for each stage. The first in each stage leads the group.
+         */
+        int fd[STAGES][COUNTERS];
+    };
+
+    /**
+     * \brief Open counter groups for the calling thread.
+     *
+     * \returns the groups, or `nullptr` if they can't be opened.
+     */
+    ThreadGroups* open_groups();
+
+    /**
+     * \brief the next counters identifier.
+     */
+    static std::atomic<unsigned> next_id_;
+
+    /**
+     * \brief the identifier of the counters the calling thread last used.
+     */
+    static thread_local unsigned thread_owner_;
+
+    /**
+     * \brief the groups of the calling thread, or `nullptr` if none.
+     */
+    static thread_local ThreadGroups* thread_groups_;
+
+    /**
+     * \brief the stage of the calling thread, or -1 if none.
+     */
+    static thread_local int thread_stage_;
+
+    /**
+     * \brief the identifier of these counters.
+     */
+    unsigned id_;
+
+    /**
+     * \brief serialise access to the groups.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * \brief the groups for all threads.
+     */
+    std::vector<std::unique_ptr<ThreadGroups>> groups_;
+
+    /**
+     * \brief the number of packets processed.
+     */
+    std::atomic<uint64_t> packets_;
+};
+
+/**
+ * \class PerfStageScope
+ * \brief Count hardware events in a stage for the life of the scope.
+ *
+ * If there are no counters this does nothing, and costs only a test.
+ */
+class PerfStageScope
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param perf  the counters, or `nullptr` if not counting.
+     * \param stage the stage.
+     */
+    PerfStageScope(PerfCounters* perf, PerfCounters::Stage stage)
+        : perf_(perf), previous_(0)
+    {
+        if ( perf_ )
+            previous_ = perf_->enter(stage);
+    }
+
+    /**
+     * \brief Destructor.
+     */
+    ~PerfStageScope()
+    {
+        if ( perf_ )
+            perf_->leave(previous_);
+    }
+
+    PerfStageScope(const PerfStageScope&) = delete;
+    PerfStageScope& operator=(const PerfStageScope&) = delete;
+
+private:
+    /**
+     * \brief the counters, if counting.
+     */
+    PerfCounters* perf_;
+
+    /**
+     * \brief the stage on entry to the scope.
+     */
+    int previous_;
+};
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "replayreport.hpp"
+
+namespace {
+    /**
+     * \brief Return the rate of change of a counter between samples.
+     *
+     * \param now   the counter value at the later sample.
+     * \param prev  the counter value at the earlier sample.
+     * \param secs  the time between samples.
+     */
+    double rate(uint64_t now, uint64_t prev, double secs)
+    {
+        return ( secs > 0 ) ? ( now - prev ) / secs : 0;
+    }
+
+    /**
+     * \brief Return the total drops in a sample.
+     *
+     * \param s the sample.
+     */
+    uint64_t drops(const ReplayReport::Sample& s)
+    {
+        return s.sniffer_drops + s.matcher_drops + s.cdns_drops;
+    }
+}
+
+ReplayReport::ReplayReport()
+    : start_(std::chrono::steady_clock::now())
+{
+}
+
+void ReplayReport::sample(uint64_t offered, uint64_t sniffer_drops,
+                          const PacketStatistics& stats,
+                          unsigned sniffer_queue, unsigned worker_queue,
+                          unsigned matcher_queue, unsigned cdns_queue)
+{
+    Sample s;
+    s.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    s.offered = offered;
+    s.received = stats.raw_packet_count;
+    s.sniffer_drops = sniffer_drops;
+    s.matcher_drops = stats.matcher_drop_count;
+    s.cdns_drops = stats.output_cbor_drop_count;
+    s.sniffer_queue = sniffer_queue;
+    s.worker_queue = worker_queue;
+    s.matcher_queue = matcher_queue;
+    s.cdns_queue = cdns_queue;
+    add_sample(s);
+    sample_thread_cpu();
+}
+
+void ReplayReport::add_sample(const Sample& s)
+{
+    samples_.push_back(s);
+}
+
+void ReplayReport::sample_thread_cpu()
+{
+    DIR* dir = opendir("/proc/self/task");
+    if ( !dir )
+        return;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    while ( struct dirent* ent = readdir(dir) )
+    {
+        if ( ent->d_name[0] == '.' )
+            continue;
+
+        std::ifstream ifs(std::string("/proc/self/task/") + ent->d_name + "/stat");
+        std::string line;
+        if ( !std::getline(ifs, line) )
+            continue;
+
+        // The thread name is in brackets, and may contain spaces.
+        // User and system CPU times are the 12th and 13th fields after it.
+        std::string::size_type open = line.find('(');
+        std::string::size_type close = line.rfind(')');
+        if ( open == std::string::npos || close == std::string::npos || close < open )
+            continue;
+
+        std::istringstream fields(line.substr(close + 1));
+        std::string field;
+        unsigned long utime = 0, stime = 0;
+        for ( unsigned i = 1; i <= 13 && fields >> field; ++i )
+        {
+            if ( i == 12 )
+                utime = std::strtoul(field.c_str(), nullptr, 10);
+            else if ( i == 13 )
+                stime = std::strtoul(field.c_str(), nullptr, 10);
+        }
+
+        ThreadCpu& cpu = thread_cpu_[std::atol(ent->d_name)];
+        cpu.name = line.substr(open + 1, close - open - 1);
+        cpu.seconds = double(utime + stime) / ticks;
+    }
+    closedir(dir);
+}
+
+void ReplayReport::write_summary(std::ostream& os) const
+{
+    const int w = 26;
+    std::ios_base::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(1) << std::left;
+    os << "Replay report:\n";
+
+    Sample prev{};
+    double duration = 0;
+    double peak_rate = 0;
+    const Sample* onset = nullptr;
+    const Sample* onset_prev = nullptr;
+    Sample peak{};
+
+    for ( const auto& s : samples_ )
+    {
+        double secs = s.time - prev.time;
+        if ( drops(s) == drops(prev) )
+            peak_rate = std::max(peak_rate, rate(s.received, prev.received, secs));
+        else if ( !onset )
+        {
+            onset = &s;
+            onset_prev = ( &s == &samples_.front() ) ? nullptr : &s - 1;
+        }
+
+        peak.sniffer_queue = std::max(peak.sniffer_queue, s.sniffer_queue);
+        peak.worker_queue = std::max(peak.worker_queue, s.worker_queue);
+        peak.matcher_queue = std::max(peak.matcher_queue, s.matcher_queue);
+        peak.cdns_queue = std::max(peak.cdns_queue, s.cdns_queue);
+        duration = s.time;
+        prev = s;
+    }
+
+    const Sample& last = prev;
+    os << std::setw(w) << "  Duration" << duration << " s\n"
+       << std::setw(w) << "  Packets offered" << last.offered
+       << " (" << rate(last.offered, 0, duration) << " pps)\n"
+       << std::setw(w) << "  Packets received" << last.received
+       << " (" << rate(last.received, 0, duration) << " pps)\n"
+       << std::setw(w) << "  Peak rate without drops" << peak_rate << " pps\n"
+       << std::setw(w) << "  Drops started";
+    if ( onset )
+    {
+        Sample before = onset_prev ? *onset_prev : Sample{};
+        double secs = onset->time - before.time;
+        os << "after " << before.time << " s, offered "
+           << rate(onset->offered, before.offered, secs) << " pps, at";
+        if ( onset->sniffer_drops != before.sniffer_drops )
+            os << " sniffer";
+        if ( onset->matcher_drops != before.matcher_drops )
+            os << " matcher";
+        if ( onset->cdns_drops != before.cdns_drops )
+            os << " C-DNS";
+        os << "\n";
+    }
+    else
+        os << "never\n";
+    os << std::setw(w) << "  Drops"
+       << "sniffer " << last.sniffer_drops
+       << ", matcher " << last.matcher_drops
+       << ", C-DNS " << last.cdns_drops << "\n"
+       << std::setw(w) << "  Peak queue lengths"
+       << "sniffer " << peak.sniffer_queue
+       << ", worker " << peak.worker_queue
+       << ", matcher " << peak.matcher_queue
+       << ", C-DNS " << peak.cdns_queue << "\n";
+
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) == 0 )
+        os << std::setw(w) << "  Peak RSS" << usage.ru_maxrss / 1024.0 << " MB\n";
+
+    if ( !thread_cpu_.empty() )
+    {
+        // Combine threads with the same name, e.g. workers.
+        std::map<std::string, std::pair<unsigned, double>> by_name;
+        for ( const auto& t : thread_cpu_ )
+        {
+            auto& entry = by_name[t.second.name];
+            entry.first++;
+            entry.second += t.second.seconds;
+        }
+
+        os << "  Thread CPU:\n";
+        for ( const auto& n : by_name )
+        {
+            os << "    " << std::setw(w - 4) << n.first
+               << std::right << std::setw(3) << n.second.first << " x "
+               << std::setw(8) << n.second.second << " s "
+               << std::setw(6) << ( duration > 0 ? n.second.second * 100 / duration : 0 ) << "%\n"
+               << std::left;
+        }
+    }
+
+    os.flags(flags);
+}
+
+void ReplayReport::write_samples(std::ostream& os) const
+{
+    std::ios_base::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+    os << "time,offered,received,offered_pps,received_pps,"
+       << "sniffer_drops,matcher_drops,cdns_drops,"
+       << "sniffer_queue,worker_queue,matcher_queue,cdns_queue\n";
+
+    Sample prev{};
+    for ( const auto& s : samples_ )
+    {
+        double secs = s.time - prev.time;
+        os << s.time << ","
+           << s.offered << ","
+           << s.received << ","
+           << rate(s.offered, prev.offered, secs) << ","
+           << rate(s.received, prev.received, secs) << ","
+           << s.sniffer_drops << ","
+           << s.matcher_drops << ","
+           << s.cdns_drops << ","
+           << s.sniffer_queue << ","
+           << s.worker_queue << ","
+           << s.matcher_queue << ","
+           << s.cdns_queue << "\n";
+        prev = s;
+    }
+
+    os.flags(flags);
+}
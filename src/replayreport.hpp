@@ -0,0 +1,181 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef REPLAYREPORT_HPP
+#define REPLAYREPORT_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "packetstatistics.hpp"
+
+/**
+ * \class ReplayReport
+ * \brief Collect and report capture throughput during a replay.
+ *
+ * The capture loop takes a sample once a second. The report gives
+ * the rates achieved, when drops started, the deepest queues, the
+ * CPU used by each thread and the peak memory use.
+ */
+class ReplayReport
+{
+public:
+    /**
+     * \struct Sample
+     * \brief Pipeline counters and queue lengths at a point in time.
+     */
+    struct Sample
+    {
+        /**
+         * \brief time since the replay started, in seconds.
+         */
+        double time;
+
+        /**
+         * \brief packets offered by the sniffer.
+         */
+        uint64_t offered;
+
+        /**
+         * \brief packets received from the sniffer.
+         */
+        uint64_t received;
+
+        /**
+         * \brief packets dropped by the sniffer.
+         */
+        uint64_t sniffer_drops;
+
+        /**
+         * \brief packets dropped because the matcher was full.
+         */
+        uint64_t matcher_drops;
+
+        /**
+         * \brief query/responses dropped because the C-DNS output was full.
+         */
+        uint64_t cdns_drops;
+
+        /**
+         * \brief length of the sniffer queue.
+         */
+        unsigned sniffer_queue;
+
+        /**
+         * \brief length of the worker queues.
+         */
+        unsigned worker_queue;
+
+        /**
+         * \brief length of the matcher queues.
+         */
+        unsigned matcher_queue;
+
+        /**
+         * \brief length of the C-DNS output queue.
+         */
+        unsigned cdns_queue;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * The replay is taken to start now.
+     */
+    ReplayReport();
+
+    /**
+     * \brief Add a sample.
+     *
+     * This also records the CPU used so far by each thread.
+     *
+     * \param offered       packets offered by the sniffer.
+     * \param sniffer_drops packets dropped by the sniffer.
+     * \param stats         the packet statistics, including workers.
+     * \param sniffer_queue length of the sniffer queue.
+     * \param worker_queue  length of the worker queues.
+     * \param matcher_queue length of the matcher queues.
+     * \param cdns_queue    length of the C-DNS output queue.
+     */
+    void sample(uint64_t offered, uint64_t sniffer_drops,
+                const PacketStatistics& stats,
+                unsigned sniffer_queue, unsigned worker_queue,
+                unsigned matcher_queue, unsigned cdns_queue);
+
+    /**
+     * \brief Add a sample.
+     *
+     * \param s the sample.
+     */
+    void add_sample(const Sample& s);
+
+    /**
+     * \brief Write the report summary.
+     *
+     * \param os the output stream.
+     */
+    void write_summary(std::ostream& os) const;
+
+    /**
+     * \brief Write the samples as CSV, with the rates between samples.
+     *
+     * \param os the output stream.
+     */
+    void write_samples(std::ostream& os) const;
+
+private:
+    /**
+     * \struct ThreadCpu
+     * \brief CPU used by a thread.
+     */
+    struct ThreadCpu
+    {
+        /**
+         * \brief the thread name.
+         */
+        std::string name;
+
+        /**
+         * \brief CPU time used, in seconds.
+         */
+        double seconds;
+    };
+
+    /**
+     * \brief Record the CPU used so far by each thread of this process.
+     *
+     * Threads are found in `/proc/self/task`. If it is not
+     * available, nothing is recorded.
+     */
+    void sample_thread_cpu();
+
+    /**
+     * \brief the replay start time.
+     */
+    std::chrono::steady_clock::time_point start_;
+
+    /**
+     * \brief the samples.
+     */
+    std::vector<Sample> samples_;
+
+    /**
+     * \brief the latest CPU used by each thread, by thread ID.
+     */
+    std::map<long, ThreadCpu> thread_cpu_;
+};
+
+#endif
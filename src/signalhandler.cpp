@@ -159,7 +159,7 @@ namespace {
     }
 }
 
-SignalHandler::SignalHandler(std::initializer_list<int> signals)
+SignalHandler::SignalHandler(const std::vector<int>& signals)
     : sinks_()
 {
     if ( signals.size() == 0 )
@@ -14,7 +14,6 @@
 #define SIGNALHANDLER_HPP
 
 #include <functional>
-#include <initializer_list>
 #include <stdexcept>
 #include <vector>
 
@@ -53,7 +52,7 @@ public:
      *
      * \param signals   signals to handle.
      */
-    explicit SignalHandler(std::initializer_list<int> signals);
+    explicit SignalHandler(const std::vector<int>& signals);
 
     /**
      * \brief Destructor.
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "blockcbor.hpp"
+#include "sketch.hpp"
+
+namespace {
+    /**
+     * \brief Return the number of leading zero bits in a non-zero value.
+     *
+     * \param x the value.
+     */
+    inline unsigned leading_zeros(uint64_t x)
+    {
+        return __builtin_clzll(x);
+    }
+
+    /**
+     * \brief Order heavy hitter entries, most frequent first.
+     *
+     * Entries with the same count are ordered by item, so the order
+     * does not depend on the hash table.
+     */
+    bool more_frequent(const HeavyHitters::Entry& a, const HeavyHitters::Entry& b)
+    {
+        if ( a.count != b.count )
+            return a.count > b.count;
+        return a.item < b.item;
+    }
+}
+
+const unsigned HyperLogLog::DEFAULT_PRECISION;
+const unsigned HyperLogLog::MIN_PRECISION;
+const unsigned HyperLogLog::MAX_PRECISION;
+const unsigned HeavyHitters::DEFAULT_CAPACITY;
+
+uint64_t sketch_hash(const uint8_t* data, std::size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while ( len-- > 0 )
+    {
+        h ^= *data++;
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+HyperLogLog::HyperLogLog(unsigned precision)
+    : precision_(precision)
+{
+    if ( precision < MIN_PRECISION || precision > MAX_PRECISION )
+        throw std::invalid_argument("HyperLogLog precision must be in the range "
+                                    + std::to_string(MIN_PRECISION) + "-"
+                                    + std::to_string(MAX_PRECISION));
+    registers_.assign(std::size_t(1) << precision, 0);
+}
+
+void HyperLogLog::add_hash(uint64_t hash)
+{
+    std::size_t index = hash >> (64 - precision_);
+    uint64_t rest = hash << precision_;
+    uint8_t rank = ( rest == 0 )
+        ? 64 - precision_ + 1
+        : leading_zeros(rest) + 1;
+    if ( rank > registers_[index] )
+        registers_[index] = rank;
+}
+
+void HyperLogLog::merge(const HyperLogLog& other)
+{
+    if ( other.precision_ > precision_ )
+    {
+        HyperLogLog folded(other);
+        folded.fold(precision_);
+        merge(folded);
+        return;
+    }
+
+    if ( other.precision_ < precision_ )
+        fold(other.precision_);
+
+    for ( std::size_t i = 0; i < registers_.size(); ++i )
+        registers_[i] = std::max(registers_[i], other.registers_[i]);
+}
+
+void HyperLogLog::fold(unsigned precision)
+{
+    // The hash bits dropped from the register number become the
+    // leading bits of the hash from which the rank is taken.
+    unsigned drop = precision_ - precision;
+    std::size_t drop_mask = ( std::size_t(1) << drop ) - 1;
+    std::vector<uint8_t> registers(std::size_t(1) << precision, 0);
+
+    for ( std::size_t i = 0; i < registers_.size(); ++i )
+    {
+        if ( registers_[i] == 0 )
+            continue;
+
+        std::size_t bits = i & drop_mask;
+        uint8_t rank = ( bits == 0 )
+            ? drop + registers_[i]
+            : leading_zeros(bits) - ( 64 - drop ) + 1;
+        uint8_t& reg = registers[i >> drop];
+        if ( rank > reg )
+            reg = rank;
+    }
+
+    precision_ = precision;
+    registers_.swap(registers);
+}
+
+double HyperLogLog::estimate() const
+{
+    double m = registers_.size();
+    double sum = 0;
+    std::size_t zeros = 0;
+
+    for ( auto r : registers_ )
+    {
+        sum += std::ldexp(1.0, -static_cast<int>(r));
+        if ( r == 0 )
+            ++zeros;
+    }
+
+    double alpha;
+    switch ( precision_ )
+    {
+    case 4:  alpha = 0.673; break;
+    case 5:  alpha = 0.697; break;
+    case 6:  alpha = 0.709; break;
+    default: alpha = 0.7213 / ( 1.0 + 1.079 / m ); break;
+    }
+
+    double res = alpha * m * m / sum;
+
+    // Small cardinalities are better estimated by the number of
+    // registers still unset. A 64 bit hash needs no large range
+    // correction.
+    if ( res <= 2.5 * m && zeros > 0 )
+        res = m * std::log(m / zeros);
+    return res;
+}
+
+bool HyperLogLog::empty() const
+{
+    return std::all_of(registers_.begin(), registers_.end(),
+                       [](uint8_t r) { return r == 0; });
+}
+
+void HyperLogLog::clear()
+{
+    std::fill(registers_.begin(), registers_.end(), 0);
+}
+
+void HyperLogLog::writeCbor(CborBaseEncoder& enc) const
+{
+    std::size_t set = registers_.size() - std::count(registers_.begin(), registers_.end(), 0);
+    byte_string regs;
+
+    if ( set * 3 < registers_.size() )
+    {
+        regs.reserve(set * 3);
+        for ( std::size_t i = 0; i < registers_.size(); ++i )
+            if ( registers_[i] != 0 )
+            {
+                regs.push_back(i >> 8);
+                regs.push_back(i & 0xff);
+                regs.push_back(registers_[i]);
+            }
+    }
+    else
+        regs.assign(registers_.begin(), registers_.end());
+
+    enc.writeArrayHeader(2);
+    enc.write(precision_);
+    enc.write(regs);
+}
+
+void HyperLogLog::readCbor(CborBaseDecoder& dec)
+{
+    bool indef;
+    uint64_t n_elems = dec.readArrayHeader(indef);
+    if ( indef || n_elems != 2 )
+        throw cbor_file_format_error("Unexpected HyperLogLog sketch format");
+
+    uint64_t precision = dec.read_unsigned();
+    if ( precision < MIN_PRECISION || precision > MAX_PRECISION )
+        throw cbor_file_format_error("Unsupported HyperLogLog sketch precision");
+    precision_ = precision;
+    registers_.assign(std::size_t(1) << precision_, 0);
+
+    uint8_t max_rank = 64 - precision_ + 1;
+    byte_string regs = dec.read_binary();
+    if ( regs.size() == registers_.size() )
+    {
+        for ( std::size_t i = 0; i < regs.size(); ++i )
+        {
+            if ( regs[i] > max_rank )
+                throw cbor_file_format_error("Bad HyperLogLog sketch register value");
+            registers_[i] = regs[i];
+        }
+    }
+    else if ( regs.size() % 3 == 0 )
+    {
+        for ( std::size_t i = 0; i < regs.size(); i += 3 )
+        {
+            std::size_t index = ( regs[i] << 8 ) | regs[i + 1];
+            if ( index >= registers_.size() || regs[i + 2] > max_rank )
+                throw cbor_file_format_error("Bad HyperLogLog sketch register value");
+            registers_[index] = regs[i + 2];
+        }
+    }
+    else
+        throw cbor_file_format_error("Bad HyperLogLog sketch register length");
+}
+
+HeavyHitters::HeavyHitters(unsigned capacity)
+    : capacity_(capacity), total_(0), floor_(0)
+{
+    if ( capacity == 0 )
+        throw std::invalid_argument("Heavy hitters capacity must be at least 1");
+}
+
+void HeavyHitters::add(const byte_string& item, uint64_t count)
+{
+    total_ += count;
+
+    auto it = entries_.find(item);
+    if ( it != entries_.end() )
+    {
+        it->second.count += count;
+        return;
+    }
+
+    if ( entries_.size() < capacity_ )
+    {
+        entries_[item] = Entry{item, count, 0};
+        return;
+    }
+
+    // Replace the least frequent item.
+    auto min = std::min_element(entries_.begin(), entries_.end(),
+                                [](const std::pair<const byte_string, Entry>& a,
+                                   const std::pair<const byte_string, Entry>& b)
+                                {
+                                    return more_frequent(b.second, a.second);
+                                });
+    uint64_t min_count = min->second.count;
+    entries_.erase(min);
+    floor_ = std::max(floor_, min_count);
+    entries_[item] = Entry{item, min_count + count, min_count};
+}
+
+void HeavyHitters::add_untracked(uint64_t total, uint64_t max)
+{
+    total_ += total;
+    floor_ = std::max(floor_, max);
+}
+
+void HeavyHitters::merge(const HeavyHitters& other)
+{
+    // An item not tracked by one sketch may have occurred there as
+    // many times as that sketch's floor.
+    for ( auto& e : entries_ )
+    {
+        auto o = other.entries_.find(e.first);
+        if ( o != other.entries_.end() )
+        {
+            e.second.count += o->second.count;
+            e.second.error += o->second.error;
+        }
+        else
+        {
+            e.second.count += other.floor_;
+            e.second.error += other.floor_;
+        }
+    }
+
+    for ( const auto& o : other.entries_ )
+        if ( entries_.find(o.first) == entries_.end() )
+            entries_[o.first] = Entry{o.second.item,
+                                      o.second.count + floor_,
+                                      o.second.error + floor_};
+
+    total_ += other.total_;
+    floor_ += other.floor_;
+    trim();
+}
+
+void HeavyHitters::trim()
+{
+    if ( entries_.size() <= capacity_ )
+        return;
+
+    std::vector<Entry> sorted = top();
+    for ( std::size_t i = capacity_; i < sorted.size(); ++i )
+    {
+        floor_ = std::max(floor_, sorted[i].count);
+        entries_.erase(sorted[i].item);
+    }
+}
+
+std::vector<HeavyHitters::Entry> HeavyHitters::top(std::size_t n) const
+{
+    std::vector<Entry> res;
+    res.reserve(entries_.size());
+    for ( const auto& e : entries_ )
+        res.push_back(e.second);
+    std::sort(res.begin(), res.end(), more_frequent);
+    if ( n > 0 && res.size() > n )
+        res.resize(n);
+    return res;
+}
+
+void HeavyHitters::clear()
+{
+    total_ = 0;
+    floor_ = 0;
+    entries_.clear();
+}
+
+void HeavyHitters::writeCbor(CborBaseEncoder& enc) const
+{
+    enc.writeArrayHeader(3);
+    enc.write(total_);
+    enc.write(floor_);
+    enc.writeArrayHeader(entries_.size());
+    for ( const auto& e : top() )
+    {
+        enc.writeArrayHeader(3);
+        enc.write(e.item);
+        enc.write(e.count);
+        enc.write(e.error);
+    }
+}
+
+void HeavyHitters::readCbor(CborBaseDecoder& dec)
+{
+    bool indef;
+    uint64_t n_elems = dec.readArrayHeader(indef);
+    if ( indef || n_elems != 3 )
+        throw cbor_file_format_error("Unexpected heavy hitters sketch format");
+
+    clear();
+    total_ = dec.read_unsigned();
+    floor_ = dec.read_unsigned();
+
+    n_elems = dec.readArrayHeader(indef);
+    while ( indef || n_elems-- > 0 )
+    {
+        if ( indef && dec.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec.readBreak();
+            break;
+        }
+
+        bool item_indef;
+        if ( dec.readArrayHeader(item_indef) != 3 || item_indef )
+            throw cbor_file_format_error("Unexpected heavy hitters item format");
+        Entry e;
+        e.item = dec.read_binary();
+        e.count = dec.read_unsigned();
+        e.error = dec.read_unsigned();
+        entries_[e.item] = e;
+    }
+
+    if ( entries_.size() > capacity_ )
+        capacity_ = entries_.size();
+}
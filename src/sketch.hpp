@@ -0,0 +1,341 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef SKETCH_HPP
+#define SKETCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "bytestring.hpp"
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+
+/**
+ * \brief Calculate the hash used by the sketches.
+ *
+ * Sketches from different files can only be merged if they use the
+ * same hash, so this must never change. It is 64 bit FNV-1a,
+ * finished with the MurmurHash3 64 bit finalizer to spread the
+ * bits of short inputs.
+ *
+ * \param data the data to hash.
+ * \param len  the data length.
+ * \returns the hash value.
+ */
+uint64_t sketch_hash(const uint8_t* data, std::size_t len);
+
+/**
+ * \class HyperLogLog
+ * \brief Estimate the number of distinct items seen.
+ *
+ * The sketch has 2^precision one byte registers. The standard error
+ * of the estimate is about 1.04 / sqrt(2^precision), so 1.6% with
+ * the default precision.
+ *
+ * Sketches can be merged. The result is the sketch that would have
+ * been produced by adding all the items to one sketch. Merging
+ * sketches of different precision gives a sketch of the lower
+ * precision.
+ */
+class HyperLogLog
+{
+public:
+    /**
+     * \brief the default precision.
+     */
+    static const unsigned DEFAULT_PRECISION = 12;
+
+    /**
+     * \brief the lowest precision supported.
+     */
+    static const unsigned MIN_PRECISION = 4;
+
+    /**
+     * \brief the highest precision supported.
+     */
+    static const unsigned MAX_PRECISION = 16;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param precision the number of hash bits used to pick a register.
+     * \throws std::invalid_argument if the precision is not supported.
+     */
+    explicit HyperLogLog(unsigned precision = DEFAULT_PRECISION);
+
+    /**
+     * \brief Add an item.
+     *
+     * \param item the item.
+     */
+    void add(const byte_string& item)
+    {
+        add_hash(sketch_hash(item.data(), item.size()));
+    }
+
+    /**
+     * \brief Add an item by its hash.
+     *
+     * \param hash the hash of the item from sketch_hash().
+     */
+    void add_hash(uint64_t hash);
+
+    /**
+     * \brief Merge another sketch into this one.
+     *
+     * \param other the other sketch.
+     */
+    void merge(const HyperLogLog& other);
+
+    /**
+     * \brief Return the estimated number of distinct items.
+     */
+    double estimate() const;
+
+    /**
+     * \brief Return the precision.
+     */
+    unsigned precision() const
+    {
+        return precision_;
+    }
+
+    /**
+     * \brief Return `true` if no items have been added.
+     */
+    bool empty() const;
+
+    /**
+     * \brief Remove all items.
+     */
+    void clear();
+
+    /**
+     * \brief Write the sketch.
+     *
+     * The sketch is written as an array of the precision and a byte
+     * string of register values. If fewer than a third of the
+     * registers are set, the byte string holds the set registers as
+     * a 2 byte network order register number followed by a 1 byte
+     * value. Otherwise it holds all the register values. The length
+     * distinguishes the forms, because 2^precision is never a multiple
+     * of 3.
+     *
+     * \param enc CBOR stream to write to.
+     */
+    void writeCbor(CborBaseEncoder& enc) const;
+
+    /**
+     * \brief Read the sketch.
+     *
+     * \param dec CBOR stream to read from.
+     * \throws cbor_file_format_error if the sketch is not valid.
+     */
+    void readCbor(CborBaseDecoder& dec);
+
+private:
+    /**
+     * \brief Reduce the precision of the sketch.
+     *
+     * \param precision the new precision.
+     */
+    void fold(unsigned precision);
+
+    /**
+     * \brief the precision.
+     */
+    unsigned precision_;
+
+    /**
+     * \brief the registers.
+     */
+    std::vector<uint8_t> registers_;
+};
+
+/**
+ * \class HeavyHitters
+ * \brief Find the most frequent items seen.
+ *
+ * This is the Space-Saving algorithm of Metwally, Agrawal and El
+ * Abbadi. At most `capacity` items are tracked. An item not tracked
+ * when the sketch is full replaces the item with the lowest count,
+ * and takes over its count. Each tracked item's count is therefore
+ * an upper bound on its true count, and is too high by at most its
+ * error. An item not tracked has occurred at most floor() times.
+ *
+ * Sketches can be merged, which is how the summaries of blocks are
+ * combined into summaries of files and of collections of files.
+ */
+class HeavyHitters
+{
+public:
+    /**
+     * \brief the default capacity.
+     */
+    static const unsigned DEFAULT_CAPACITY = 32;
+
+    /**
+     * \brief A tracked item.
+     */
+    struct Entry
+    {
+        /**
+         * \brief the item.
+         */
+        byte_string item;
+
+        /**
+         * \brief the item count. This may overestimate the true count.
+         */
+        uint64_t count;
+
+        /**
+         * \brief the most by which the count may overestimate.
+         */
+        uint64_t error;
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * \param capacity the maximum number of items tracked.
+     * \throws std::invalid_argument if the capacity is 0.
+     */
+    explicit HeavyHitters(unsigned capacity = DEFAULT_CAPACITY);
+
+    /**
+     * \brief Add occurrences of an item.
+     *
+     * \param item  the item.
+     * \param count the number of occurrences.
+     */
+    void add(const byte_string& item, uint64_t count = 1);
+
+    /**
+     * \brief Add occurrences of items that are not to be tracked.
+     *
+     * Use this when building a summary from exact counts, after
+     * adding the most frequent items.
+     *
+     * \param total the total occurrences of the items.
+     * \param max   the occurrences of the most frequent of the items.
+     */
+    void add_untracked(uint64_t total, uint64_t max);
+
+    /**
+     * \brief Merge another sketch into this one.
+     *
+     * The capacity of this sketch is unchanged.
+     *
+     * \param other the other sketch.
+     */
+    void merge(const HeavyHitters& other);
+
+    /**
+     * \brief Return the tracked items, most frequent first.
+     *
+     * \param n the maximum number of items to return, or 0 for all.
+     */
+    std::vector<Entry> top(std::size_t n = 0) const;
+
+    /**
+     * \brief Return the total occurrences of all items.
+     */
+    uint64_t total() const
+    {
+        return total_;
+    }
+
+    /**
+     * \brief Return the most occurrences of any item not tracked.
+     */
+    uint64_t floor() const
+    {
+        return floor_;
+    }
+
+    /**
+     * \brief Return the maximum number of items tracked.
+     */
+    unsigned capacity() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * \brief Return `true` if no items have been added.
+     */
+    bool empty() const
+    {
+        return total_ == 0;
+    }
+
+    /**
+     * \brief Remove all items.
+     */
+    void clear();
+
+    /**
+     * \brief Write the sketch.
+     *
+     * The sketch is written as an array of the total, the floor and
+     * an array of tracked items. Each tracked item is an array of
+     * the item, its count and its error.
+     *
+     * \param enc CBOR stream to write to.
+     */
+    void writeCbor(CborBaseEncoder& enc) const;
+
+    /**
+     * \brief Read the sketch.
+     *
+     * The capacity is increased if more items than the capacity
+     * are read.
+     *
+     * \param dec CBOR stream to read from.
+     * \throws cbor_file_format_error if the sketch is not valid.
+     */
+    void readCbor(CborBaseDecoder& dec);
+
+private:
+    /**
+     * \brief Drop the least frequent items until no more than the capacity remain.
+     */
+    void trim();
+
+    /**
+     * \brief the maximum number of items tracked.
+     */
+    unsigned capacity_;
+
+    /**
+     * \brief the total occurrences of all items.
+     */
+    uint64_t total_;
+
+    /**
+     * \brief the most occurrences of any item not tracked.
+     */
+    uint64_t floor_;
+
+    /**
+     * \brief the tracked items.
+     */
+    std::unordered_map<byte_string, Entry, boost::hash<byte_string>> entries_;
+};
+
+#endif
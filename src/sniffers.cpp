@@ -10,6 +10,8 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <cmath>
+
 #include <errno.h>
 
 #include <tins/loopback.h>
@@ -85,11 +87,11 @@ namespace {
             return Tins::Packet(new Tins::EthernetII(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU);
     }
 
-    Tins::Packet make_packet(pcap_t* handle,
+    Tins::Packet make_packet(int datalink,
                              const struct pcap_pkthdr* hdr,
                              const u_char* data)
     {
-        switch(pcap_datalink(handle))
+        switch(datalink)
         {
         case DLT_EN10MB:
             return make_eth_packet(hdr, data);
@@ -140,9 +142,7 @@ BaseSniffers::BaseSniffers(unsigned chan_max_size, bool block)
 
 BaseSniffers::~BaseSniffers()
 {
-    breakloop();
-    if ( t_.joinable() )
-        t_.join();
+    stop_capture();
 
     for ( auto h : handles_ )
         pcap_close(h);
@@ -158,6 +158,19 @@ Tins::Packet BaseSniffers::next_packet()
         return Tins::Packet();
 }
 
+bool BaseSniffers::next_packet(Tins::Packet& pkt, std::chrono::milliseconds timeout)
+{
+    if ( packets_.get(pkt, timeout) )
+        return true;
+    if ( !packets_.is_closed() )
+        return false;
+
+    // Closed. Pick up any packet added just before closing.
+    if ( !packets_.get(pkt, false) )
+        pkt = Tins::Packet();
+    return true;
+}
+
 void BaseSniffers::sniffer_stats(struct Stats& stats)
 {
     stats.pkts_sniffed   = packets_sniffed_;
@@ -196,13 +209,64 @@ void BaseSniffers::breakloop()
         pcap_breakloop(h);
 }
 
-void BaseSniffers::add_handle(pcap_t* handle)
+void BaseSniffers::set_filter(const std::string& filter)
+{
+    std::unique_lock<std::mutex> lock(m_);
+
+    // Check the filter compiles for every sniffer, so an invalid filter
+    // leaves all sniffers unchanged. Compile against a dead handle
+    // with the same link type, so the live handles are only touched
+    // on the packet reading thread.
+    for ( std::size_t i = 0; i < handles_.size(); ++i )
+    {
+        pcap_t* dead = pcap_open_dead(pcap_datalink(handles_[i]), pcap_snapshot(handles_[i]));
+        if ( !dead )
+            throw Tins::invalid_pcap_filter("Can't check PCAP filter");
+
+        bpf_program prog;
+        if ( pcap_compile(dead, &prog, filter.c_str(), 0, netmasks_[i]) != 0 )
+        {
+            std::string err = pcap_geterr(dead);
+            pcap_close(dead);
+            throw Tins::invalid_pcap_filter(err.c_str());
+        }
+        pcap_freecode(&prog);
+        pcap_close(dead);
+    }
+
+    pending_filter_ = filter;
+}
+
+void BaseSniffers::apply_pending_filter()
+{
+    std::unique_lock<std::mutex> lock(m_);
+
+    if ( !pending_filter_ )
+        return;
+
+    for ( std::size_t i = 0; i < handles_.size(); ++i )
+    {
+        bpf_program prog;
+        if ( pcap_compile(handles_[i], &prog, pending_filter_->c_str(), 0, netmasks_[i]) != 0 )
+        {
+            LOG_ERROR << "Invalid PCAP filter: " << pcap_geterr(handles_[i]);
+            continue;
+        }
+        if ( pcap_setfilter(handles_[i], &prog) != 0 )
+            LOG_ERROR << "Setting PCAP filter failed: " << pcap_geterr(handles_[i]);
+        pcap_freecode(&prog);
+    }
+    pending_filter_ = boost::none;
+}
+
+void BaseSniffers::add_handle(pcap_t* handle, bpf_u_int32 netmask)
 {
     int fd = pcap_get_selectable_fd(handle);
     if ( fd < 0 )
         throw Tins::unsupported_function();
 
     handles_.push_back(handle);
+    netmasks_.push_back(netmask);
 
     FD_SET(fd, &fdset_);
     if ( fd > max_fd_ )
@@ -215,15 +279,43 @@ void BaseSniffers::notify_read_timeout(unsigned timeout)
         select_timeout_ = timeout;
 }
 
+void BaseSniffers::deliver_packet(int datalink,
+                                  const struct pcap_pkthdr* hdr,
+                                  const u_char* data)
+{
+    ++packets_sniffed_;
+    try
+    {
+        if ( !packets_.put(make_packet(datalink, hdr, data), block_put_) )
+            ++packets_dropped_;
+    }
+    catch (Tins::exception_base&)
+    {
+        // Unlike libtins, which just ignores them, pass malformed
+        // packets - packets where transport level decode fails -
+        // back to the application as RawPDU. There they will be
+        // treated as ignored and logged if appropriate.
+        if ( !packets_.put(Tins::Packet(new Tins::RawPDU(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU), block_put_) )
+            ++packets_dropped_;
+    }
+}
+
 void BaseSniffers::packet_read_thread()
 {
     set_thread_name("comp:sniffer");
+    read_packets();
+    packets_.close();
+}
 
+void BaseSniffers::read_packets()
+{
     bool finished = false;
     while ( !finished )
     {
         bool read_one;
 
+        apply_pending_filter();
+
         do
         {
             read_one = false;
@@ -240,21 +332,7 @@ void BaseSniffers::packet_read_thread()
                 {
                 case 1:
                     read_one = true;
-                    ++packets_sniffed_;
-                    try
-                    {
-                        if ( !packets_.put(make_packet(h, hdr, data), block_put_) )
-                            ++packets_dropped_;
-                    }
-                    catch (Tins::exception_base&)
-                    {
-                        // Unlike libtins, which just ignores them, pass malformed
-                        // packets - packets where transport level decode fails -
-                        // back to the application as RawPDU. There they will be
-                        // treated as ignored and logged if appropriate.
-                        if ( !packets_.put(Tins::Packet(new Tins::RawPDU(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU), block_put_) )
-                            ++packets_dropped_;
-                    }
+                    deliver_packet(pcap_datalink(h), hdr, data);
                     break;
 
                 case 0:
@@ -313,8 +391,6 @@ void BaseSniffers::packet_read_thread()
             break;
         }
     }
-
-    packets_.close();
 }
 
 void BaseSniffers::capture_init_done()
@@ -322,6 +398,13 @@ void BaseSniffers::capture_init_done()
     t_ = std::thread([=]{ packet_read_thread(); });
 }
 
+void BaseSniffers::stop_capture()
+{
+    breakloop();
+    if ( t_.joinable() )
+        t_.join();
+}
+
 NetworkSniffers::NetworkSniffers(const std::vector<std::string>& interfaces,
                                  const SniffersConfiguration& config)
     : BaseSniffers(config.chan_max_size())
@@ -351,7 +434,7 @@ NetworkSniffers::NetworkSniffers(const std::vector<std::string>& interfaces,
 
         config.apply_filter(handle, netmask);
 
-        add_handle(handle);
+        add_handle(handle, netmask);
     }
 
     capture_init_done();
@@ -371,3 +454,149 @@ FileSniffer::FileSniffer(const std::string& fname,
 
     capture_init_done();
 }
+
+ReplaySniffer::ReplaySniffer(const std::string& fname,
+                             const SniffersConfiguration& config,
+                             double rate, double ramp, double speedup,
+                             std::chrono::seconds duration)
+    : BaseSniffers(config.chan_max_size()),
+      datalink_(0), rate_(rate), ramp_(ramp),
+      speedup_(speedup > 0 ? speedup : 1), duration_(duration),
+      replayed_(0), stop_(false)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* handle = pcap_open_offline(fname.c_str(), errbuf);
+    if ( !handle )
+        throw Tins::pcap_error(errbuf);
+
+    try
+    {
+        config.apply_filter(handle, PCAP_NETMASK_UNKNOWN);
+        datalink_ = pcap_datalink(handle);
+
+        struct pcap_pkthdr* hdr;
+        const u_char* data;
+        int res;
+        while ( ( res = pcap_next_ex(handle, &hdr, &data) ) == 1 )
+        {
+            ReplayPacket pkt;
+            pkt.timestamp = std::chrono::system_clock::time_point(
+                std::chrono::seconds(hdr->ts.tv_sec) +
+                std::chrono::microseconds(hdr->ts.tv_usec));
+            pkt.len = hdr->len;
+            pkt.data.assign(data, data + hdr->caplen);
+            replay_packets_.push_back(std::move(pkt));
+        }
+        if ( res == -1 )
+            throw Tins::pcap_error(pcap_geterr(handle));
+    }
+    catch (...)
+    {
+        pcap_close(handle);
+        throw;
+    }
+    pcap_close(handle);
+
+    if ( replay_packets_.empty() )
+        throw Tins::pcap_error((fname + ": no packets to replay").c_str());
+
+    capture_init_done();
+}
+
+ReplaySniffer::~ReplaySniffer()
+{
+    // Stop the replay thread before this object goes.
+    stop_capture();
+}
+
+bool ReplaySniffer::pcap_stats(struct pcap_stat& stats)
+{
+    stats = { static_cast<u_int>(replayed_), 0, 0 };
+    return true;
+}
+
+void ReplaySniffer::breakloop()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_m_);
+        stop_ = true;
+    }
+    stop_cv_.notify_all();
+}
+
+std::chrono::steady_clock::duration ReplaySniffer::rate_due(uint64_t n) const
+{
+    // With the rate increasing linearly, the packets sent by time t
+    // are rate*t + ramp*t^2/2. Solve for t.
+    double secs;
+    if ( ramp_ > 0 )
+        secs = ( std::sqrt(rate_ * rate_ + 2 * ramp_ * n) - rate_ ) / ramp_;
+    else
+        secs = n / rate_;
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(secs));
+}
+
+bool ReplaySniffer::wait_until(std::chrono::steady_clock::time_point t)
+{
+    if ( stop_ )
+        return false;
+    if ( std::chrono::steady_clock::now() < t )
+    {
+        std::unique_lock<std::mutex> lock(stop_m_);
+        if ( stop_cv_.wait_until(lock, t, [this]{ return stop_.load(); }) )
+            return false;
+    }
+    return true;
+}
+
+void ReplaySniffer::read_packets()
+{
+    using steady = std::chrono::steady_clock;
+
+    bool use_rate = ( rate_ > 0 || ramp_ > 0 );
+    std::chrono::system_clock::time_point first = replay_packets_.front().timestamp;
+
+    // With capture file timing, start each repeat one average
+    // packet interval after the end of the previous one.
+    std::chrono::system_clock::duration span = replay_packets_.back().timestamp - first;
+    if ( replay_packets_.size() > 1 )
+        span += span / ( replay_packets_.size() - 1 );
+    if ( span.count() <= 0 )
+        span = std::chrono::milliseconds(1);
+
+    steady::time_point start = steady::now();
+    uint64_t n = 0;
+
+    for ( int64_t pass = 0; ; ++pass )
+    {
+        for ( const auto& pkt : replay_packets_ )
+        {
+            steady::duration due;
+            if ( use_rate )
+                due = rate_due(n);
+            else
+                due = std::chrono::duration_cast<steady::duration>(
+                    ( pkt.timestamp - first + span * pass ) / speedup_);
+
+            if ( duration_.count() > 0 && due >= duration_ )
+                return;
+            if ( !wait_until(start + due) )
+                return;
+
+            struct pcap_pkthdr hdr;
+            std::chrono::microseconds now =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch());
+            hdr.ts.tv_sec = now.count() / 1000000;
+            hdr.ts.tv_usec = now.count() % 1000000;
+            hdr.caplen = pkt.data.size();
+            hdr.len = pkt.len;
+            deliver_packet(datalink_, &hdr, pkt.data.data());
+            replayed_ = ++n;
+        }
+
+        if ( duration_.count() == 0 )
+            return;
+    }
+}
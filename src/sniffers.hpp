@@ -13,11 +13,16 @@
 #ifndef SNIFFERS_HPP
 #define SNIFFERS_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <boost/optional.hpp>
+
 #include <tins/tins.h>
 
 #include <sys/select.h>
@@ -144,6 +149,7 @@ public:
 protected:
     friend class NetworkSniffers;
     friend class FileSniffer;
+    friend class ReplaySniffer;
 
     /**
      * \brief Flags indicating items are present.
@@ -268,6 +274,16 @@ public:
      */
     Tins::Packet next_packet();
 
+    /**
+     * \brief Get the next packet from the sniffers, waiting a limited time.
+     *
+     * \param pkt     set to the next packet, or if EOF or collection
+     *                interrupted a packet with a null PDU.
+     * \param timeout the longest time to wait for a packet.
+     * \returns `false` if no packet arrived before the timeout.
+     */
+    bool next_packet(Tins::Packet& pkt, std::chrono::milliseconds timeout);
+
     /**
      * \brief Get sniffer stats.
      *
@@ -281,22 +297,34 @@ public:
      * \param stats a PCAP stats structure.
      * \returns `true` if stats updated.
      */
-    bool pcap_stats(struct pcap_stat& stats);
+    virtual bool pcap_stats(struct pcap_stat& stats);
 
     /**
      * \brief Break out of the collection loop.
      *
      * This calls pcap_breakloop() on all underlying sniffers.
      */
-    void breakloop();
+    virtual void breakloop();
+
+    /**
+     * \brief Replace the PCAP filter on all underlying sniffers.
+     *
+     * The filter is checked immediately, but is applied by the packet
+     * reading thread before it next reads packets.
+     *
+     * \param filter the new PCAP filter string. Empty for no filter.
+     * \throws Tins::invalid_pcap_filter if the filter is invalid.
+     */
+    void set_filter(const std::string& filter);
 
 protected:
     /**
      * \brief Add a new PCAP handle to those being monitored.
      *
-     * \param handle handle to add.
+     * \param handle  handle to add.
+     * \param netmask the netmask of the handle network.
      */
-    void add_handle(pcap_t* handle);
+    void add_handle(pcap_t* handle, bpf_u_int32 netmask = PCAP_NETMASK_UNKNOWN);
 
     /**
      * \brief Update the select timeout.
@@ -314,9 +342,45 @@ protected:
      */
     void capture_init_done();
 
+    /**
+     * \brief Stop the packet reading thread and wait for it to finish.
+     *
+     * A derived class that overrides read_packets() must call this
+     * from its destructor.
+     */
+    void stop_capture();
+
+    /**
+     * \brief Read packets until EOF or interrupted.
+     *
+     * This is called on the packet reading thread. The default reads
+     * from all the PCAP handles.
+     */
+    virtual void read_packets();
+
+    /**
+     * \brief Add a packet to the channel.
+     *
+     * If the channel is full and not blocking, the packet is dropped.
+     *
+     * \param datalink the PCAP link type of the packet.
+     * \param hdr      the PCAP packet header.
+     * \param data     the packet data.
+     */
+    void deliver_packet(int datalink,
+                        const struct pcap_pkthdr* hdr,
+                        const u_char* data);
+
+    /**
+     * \brief Apply any filter given to set_filter().
+     *
+     * This is called on the packet reading thread.
+     */
+    void apply_pending_filter();
+
 private:
     /**
-     * \brief Loop reading packets and adding to the channel.
+     * \brief Run the packet reading thread.
      */
     void packet_read_thread();
 
@@ -325,6 +389,16 @@ private:
      */
     std::vector<pcap_t*> handles_;
 
+    /**
+     * \brief netmasks of all input sources, for compiling filters.
+     */
+    std::vector<bpf_u_int32> netmasks_;
+
+    /**
+     * \brief filter waiting to be applied by the packet reading thread.
+     */
+    boost::optional<std::string> pending_filter_;
+
     /**
      * \brief fdset for selecting on all input sources.
      */
@@ -407,5 +481,155 @@ public:
     FileSniffer(const std::string& fname, const SniffersConfiguration& config);
 };
 
+/**
+ * \class ReplaySniffer
+ * \brief A sniffer replaying a capture file as if capturing live.
+ *
+ * This is for measuring capture throughput. The whole capture file is
+ * read into memory first, so reading the file does not limit the
+ * replay rate. Packets are then delivered to the capture pipeline
+ * at a set rate, or with the capture file timing. As with network
+ * capture, packets are dropped if the pipeline does not keep up,
+ * and each packet is timestamped with the time it is delivered.
+ */
+class ReplaySniffer : public BaseSniffers
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * If `rate` and `ramp` are both 0, packets are replayed with the
+     * capture file timing, `speedup` times faster.
+     *
+     * \param fname    pathname of capture file.
+     * \param config   the sniffing configuration.
+     * \param rate     the initial replay rate, in packets per second.
+     * \param ramp     the increase in replay rate each second.
+     * \param speedup  time compression when using capture file timing.
+     * \param duration stop after this time, repeating the capture as
+     *                 necessary. If 0, replay the capture once.
+     * \throws Tins::pcap_error if the file can't be read.
+     */
+    ReplaySniffer(const std::string& fname,
+                  const SniffersConfiguration& config,
+                  double rate, double ramp, double speedup,
+                  std::chrono::seconds duration);
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~ReplaySniffer();
+
+    /**
+     * \brief Get PCAP stats.
+     *
+     * There is no PCAP capture, so report the packets replayed
+     * as received.
+     *
+     * \param stats a PCAP stats structure.
+     * \returns `true`.
+     */
+    virtual bool pcap_stats(struct pcap_stat& stats);
+
+    /**
+     * \brief Stop replaying.
+     */
+    virtual void breakloop();
+
+protected:
+    /**
+     * \brief Replay the packets.
+     */
+    virtual void read_packets();
+
+private:
+    /**
+     * \struct ReplayPacket
+     * \brief A packet read from the capture file.
+     */
+    struct ReplayPacket
+    {
+        /**
+         * \brief the packet timestamp in the capture file.
+         */
+        std::chrono::system_clock::time_point timestamp;
+
+        /**
+         * \brief the original packet length.
+         */
+        uint32_t len;
+
+        /**
+         * \brief the captured packet data.
+         */
+        std::vector<u_char> data;
+    };
+
+    /**
+     * \brief Return when a packet is due at a set rate.
+     *
+     * \param n the number of packets already replayed.
+     * \returns the time from the start of replay.
+     */
+    std::chrono::steady_clock::duration rate_due(uint64_t n) const;
+
+    /**
+     * \brief Wait until a time, unless stopped.
+     *
+     * \param t the time.
+     * \returns `false` if stopped.
+     */
+    bool wait_until(std::chrono::steady_clock::time_point t);
+
+    /**
+     * \brief the packets to replay.
+     */
+    std::vector<ReplayPacket> replay_packets_;
+
+    /**
+     * \brief the PCAP link type of the packets.
+     */
+    int datalink_;
+
+    /**
+     * \brief the initial replay rate, packets/s.
+     */
+    double rate_;
+
+    /**
+     * \brief the replay rate increase each second.
+     */
+    double ramp_;
+
+    /**
+     * \brief time compression with capture file timing.
+     */
+    double speedup_;
+
+    /**
+     * \brief the replay duration.
+     */
+    std::chrono::seconds duration_;
+
+    /**
+     * \brief the number of packets replayed.
+     */
+    std::atomic<uint64_t> replayed_;
+
+    /**
+     * \brief has replay been stopped?
+     */
+    std::atomic<bool> stop_;
+
+    /**
+     * \brief mutex for waiting.
+     */
+    std::mutex stop_m_;
+
+    /**
+     * \brief condition variable signalling stop.
+     */
+    std::condition_variable stop_cv_;
+};
 
 #endif
@@ -69,6 +69,11 @@ void StreamWriter::writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes)
     os_->write(reinterpret_cast<const char *>(p), n_bytes);
 }
 
+void StreamWriter::flush()
+{
+    os_->flush();
+}
+
 GzipStreamWriter::GzipStreamWriter(const std::string& name, unsigned level, bool logging)
     : StreamWriter(name, level, logging)
 {
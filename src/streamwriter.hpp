@@ -76,6 +76,13 @@ public:
      */
     virtual void writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes);
 
+    /**
+     * \brief Write any output buffered by the stream to the file.
+     *
+     * If compressing, output still held by the compressor is not written.
+     */
+    virtual void flush();
+
     /**
      * \brief Return additional extension suggested for output file type.
      */
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "tcpreassembler.hpp"
+
+namespace {
+    /**
+     * \brief the initial capacity of a ring buffer.
+     */
+    const std::size_t MIN_RING_CAPACITY = 512;
+
+    /**
+     * \brief ring buffer capacity retained when the buffer empties.
+     *
+     * Larger buffers are released.
+     */
+    const std::size_t RETAIN_RING_CAPACITY = 4096;
+
+    /**
+     * \brief the maximum out-of-order data held for one flow direction.
+     *
+     * This is enough for a maximum size DNS message and its length prefix.
+     * If a gap is not filled before this much later data arrives, the
+     * flow is assumed to be unrecoverable.
+     */
+    const std::size_t MAX_PENDING_BYTES = 65537;
+
+    /**
+     * \brief estimate of the fixed memory cost of tracking a flow.
+     */
+    const std::size_t FLOW_OVERHEAD = 256;
+}
+
+void TcpRingBuffer::append(const uint8_t* data, std::size_t len)
+{
+    if ( size_ + len > buf_.size() )
+    {
+        std::size_t cap = buf_.empty() ? MIN_RING_CAPACITY : buf_.size();
+        while ( cap < size_ + len )
+            cap <<= 1;
+
+        std::vector<uint8_t> newbuf(cap);
+        copy_out(newbuf.data(), size_);
+        buf_.swap(newbuf);
+        head_ = 0;
+    }
+
+    std::size_t tail = (head_ + size_) & (buf_.size() - 1);
+    std::size_t first = std::min(len, buf_.size() - tail);
+    std::memcpy(&buf_[tail], data, first);
+    if ( first < len )
+        std::memcpy(&buf_[0], data + first, len - first);
+    size_ += len;
+}
+
+const uint8_t* TcpRingBuffer::front(std::size_t len, std::vector<uint8_t>& scratch) const
+{
+    if ( head_ + len <= buf_.size() )
+        return &buf_[head_];
+
+    scratch.resize(len);
+    copy_out(scratch.data(), len);
+    return scratch.data();
+}
+
+void TcpRingBuffer::consume(std::size_t len)
+{
+    if ( len >= size_ )
+    {
+        head_ = size_ = 0;
+        return;
+    }
+
+    head_ = (head_ + len) & (buf_.size() - 1);
+    size_ -= len;
+}
+
+void TcpRingBuffer::clear()
+{
+    std::vector<uint8_t>().swap(buf_);
+    head_ = size_ = 0;
+}
+
+void TcpRingBuffer::copy_out(uint8_t* dst, std::size_t len) const
+{
+    if ( len == 0 )
+        return;
+
+    std::size_t first = std::min(len, buf_.size() - head_);
+    std::memcpy(dst, &buf_[head_], first);
+    if ( first < len )
+        std::memcpy(dst + first, &buf_[0], len - first);
+}
+
+TcpFlowKey::TcpFlowKey(const IPAddress& src_addr, uint16_t src_port,
+                       const IPAddress& dst_addr, uint16_t dst_port,
+                       bool& reversed)
+{
+    reversed = ( dst_addr < src_addr ||
+                 ( dst_addr == src_addr && dst_port < src_port ) );
+    if ( reversed )
+    {
+        addr[0] = dst_addr;
+        port[0] = dst_port;
+        addr[1] = src_addr;
+        port[1] = src_port;
+    }
+    else
+    {
+        addr[0] = src_addr;
+        port[0] = src_port;
+        addr[1] = dst_addr;
+        port[1] = dst_port;
+    }
+}
+
+std::size_t hash_value(const TcpFlowKey& key)
+{
+    std::size_t seed = hash_value(key.addr[0]);
+    boost::hash_combine(seed, key.addr[1]);
+    boost::hash_combine(seed, key.port[0]);
+    boost::hash_combine(seed, key.port[1]);
+    return seed;
+}
+
+std::size_t TcpReassembler::Flow::memory() const
+{
+    return FLOW_OVERHEAD + dir[0].memory() + dir[1].memory();
+}
+
+TcpReassembler::TcpReassembler(std::size_t max_flows,
+                               std::size_t memory_budget,
+                               std::chrono::seconds idle_timeout,
+                               PacketStatistics& stats)
+    : max_flows_(max_flows), memory_budget_(memory_budget),
+      idle_timeout_(idle_timeout), stats_(stats), memory_used_(0)
+{
+}
+
+void TcpReassembler::process(const IPAddress& src_addr, uint16_t src_port,
+                             const IPAddress& dst_addr, uint16_t dst_port,
+                             uint32_t seq, unsigned flags,
+                             const uint8_t* data, std::size_t len,
+                             const std::chrono::system_clock::time_point& timestamp,
+                             const MessageSink& sink)
+{
+    if ( timestamp >= next_expire_check_ )
+    {
+        expire(timestamp);
+        next_expire_check_ = timestamp + std::chrono::seconds(1);
+    }
+
+    bool reversed;
+    TcpFlowKey key(src_addr, src_port, dst_addr, dst_port, reversed);
+
+    if ( flags & RST )
+    {
+        auto f = flow_map_.find(key);
+        if ( f != flow_map_.end() )
+            remove_flow(f->second);
+        return;
+    }
+
+    // Only create state for a flow if it is starting or carries data.
+    // Stray ACKs and FINs for flows we are not tracking are ignored.
+    if ( len == 0 && !( flags & SYN ) && flow_map_.find(key) == flow_map_.end() )
+        return;
+
+    FlowList::iterator flow = find_flow(key, timestamp);
+    Direction& dir = flow->dir[reversed ? 1 : 0];
+    std::size_t mem_before = flow->memory();
+
+    if ( flags & SYN )
+    {
+        // (Re)start of this direction. Any data follows the SYN.
+        dir.data.clear();
+        dir.pending.clear();
+        dir.pending_bytes = 0;
+        dir.fin = false;
+        dir.seq_known = true;
+        dir.next_seq = ++seq;
+    }
+
+    bool ok = true;
+    if ( len > 0 )
+        ok = add_data(dir, seq, data, len, sink);
+
+    if ( flags & FIN )
+        dir.fin = true;
+
+    memory_used_ = memory_used_ + flow->memory() - mem_before;
+
+    if ( !ok )
+    {
+        ++stats_.tcp_flow_memory_drop_count;
+        remove_flow(flow);
+    }
+    else if ( flow->dir[0].fin && flow->dir[1].fin )
+        remove_flow(flow);
+
+    enforce_budget();
+}
+
+void TcpReassembler::expire(const std::chrono::system_clock::time_point& now)
+{
+    while ( !flows_.empty() && flows_.front().last_seen + idle_timeout_ <= now )
+        remove_flow(flows_.begin());
+}
+
+TcpReassembler::FlowList::iterator TcpReassembler::find_flow(const TcpFlowKey& key,
+                                                             const std::chrono::system_clock::time_point& timestamp)
+{
+    FlowList::iterator res;
+    auto f = flow_map_.find(key);
+
+    if ( f != flow_map_.end() )
+    {
+        res = f->second;
+        flows_.splice(flows_.end(), flows_, res);
+    }
+    else
+    {
+        if ( max_flows_ > 0 && flow_map_.size() >= max_flows_ )
+        {
+            ++stats_.tcp_flow_limit_drop_count;
+            remove_flow(flows_.begin());
+        }
+
+        res = flows_.emplace(flows_.end(), key);
+        flow_map_.emplace(key, res);
+        memory_used_ += res->memory();
+    }
+
+    res->last_seen = timestamp;
+    return res;
+}
+
+void TcpReassembler::remove_flow(FlowList::iterator flow)
+{
+    memory_used_ -= flow->memory();
+    flow_map_.erase(flow->key);
+    flows_.erase(flow);
+}
+
+bool TcpReassembler::add_data(Direction& dir, uint32_t seq,
+                              const uint8_t* data, std::size_t len,
+                              const MessageSink& sink)
+{
+    if ( !dir.seq_known )
+    {
+        // We've missed the SYN, so are picking up the flow part way.
+        // The best we can do is assume a message starts here.
+        dir.seq_known = true;
+        dir.next_seq = seq;
+    }
+
+    int32_t offset = static_cast<int32_t>(seq - dir.next_seq);
+    if ( offset > 0 )
+    {
+        // There's a gap before this data. Hold it until the gap is filled.
+        // If overlapping segments arrive for the same position, keep
+        // the longest.
+        std::vector<uint8_t>& seg = dir.pending[seq];
+        if ( seg.size() < len )
+        {
+            if ( dir.pending_bytes + len - seg.size() > MAX_PENDING_BYTES )
+                return false;
+            dir.pending_bytes += len - seg.size();
+            seg.assign(data, data + len);
+        }
+        return true;
+    }
+
+    // Data already seen is discarded; first data received wins, so
+    // an overlapping segment can't rewrite data already delivered.
+    std::size_t skip = static_cast<std::size_t>(-static_cast<int64_t>(offset));
+    if ( skip >= len )
+        return true;
+
+    dir.next_seq += len - skip;
+    extract_messages(dir, data + skip, len - skip, sink);
+
+    // See if any held data can now be used.
+    bool progress = true;
+    while ( progress && !dir.pending.empty() )
+    {
+        progress = false;
+        for ( auto p = dir.pending.begin(); p != dir.pending.end(); ++p )
+        {
+            int32_t pending_offset = static_cast<int32_t>(p->first - dir.next_seq);
+            if ( pending_offset > 0 )
+                continue;
+
+            std::vector<uint8_t> seg(std::move(p->second));
+            dir.pending_bytes -= seg.size();
+            dir.pending.erase(p);
+
+            std::size_t seg_skip = static_cast<std::size_t>(-static_cast<int64_t>(pending_offset));
+            if ( seg_skip < seg.size() )
+            {
+                dir.next_seq += seg.size() - seg_skip;
+                extract_messages(dir, seg.data() + seg_skip, seg.size() - seg_skip, sink);
+            }
+            progress = true;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void TcpReassembler::extract_messages(Direction& dir,
+                                      const uint8_t* data, std::size_t len,
+                                      const MessageSink& sink)
+{
+    if ( dir.data.size() == 0 )
+    {
+        // Nothing buffered, so take complete messages straight from
+        // the new data and only buffer any trailing partial message.
+        while ( len >= 2 )
+        {
+            std::size_t dns_len = (data[0] << 8) + data[1];
+            if ( dns_len + 2 > len )
+                break;
+
+            sink(data + 2, dns_len);
+            data += dns_len + 2;
+            len -= dns_len + 2;
+        }
+
+        if ( len > 0 )
+            dir.data.append(data, len);
+        return;
+    }
+
+    dir.data.append(data, len);
+    while ( dir.data.size() >= 2 )
+    {
+        std::size_t dns_len = (dir.data[0] << 8) + dir.data[1];
+        if ( dns_len + 2 > dir.data.size() )
+            break;
+
+        const uint8_t* msg = dir.data.front(dns_len + 2, scratch_);
+        sink(msg + 2, dns_len);
+        dir.data.consume(dns_len + 2);
+    }
+
+    if ( dir.data.size() == 0 && dir.data.capacity() > RETAIN_RING_CAPACITY )
+        dir.data.clear();
+}
+
+void TcpReassembler::enforce_budget()
+{
+    while ( memory_budget_ > 0 && memory_used_ > memory_budget_ && !flows_.empty() )
+    {
+        ++stats_.tcp_flow_memory_drop_count;
+        remove_flow(flows_.begin());
+    }
+}
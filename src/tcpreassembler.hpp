@@ -0,0 +1,480 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef TCPREASSEMBLER_HPP
+#define TCPREASSEMBLER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "ipaddress.hpp"
+#include "packetstatistics.hpp"
+
+/**
+ * \class TcpRingBuffer
+ * \brief Hold the in-order bytes received on one direction of a TCP flow.
+ *
+ * The buffer capacity is always a power of 2, and grows by doubling.
+ * Consuming data from the front of the buffer is constant time, so
+ * extracting many pipelined messages from a single buffer is linear
+ * in the amount of data.
+ */
+class TcpRingBuffer
+{
+public:
+    /**
+     * \brief Default constructor.
+     *
+     * No memory is allocated until data is appended.
+     */
+    TcpRingBuffer() : head_(0), size_(0) {}
+
+    /**
+     * \brief Return the number of bytes held in the buffer.
+     */
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    /**
+     * \brief Return the number of bytes allocated by the buffer.
+     */
+    std::size_t capacity() const
+    {
+        return buf_.size();
+    }
+
+    /**
+     * \brief Return the byte at an offset from the buffer start.
+     *
+     * \param pos the offset.
+     * \returns the byte.
+     */
+    uint8_t operator[](std::size_t pos) const
+    {
+        return buf_[(head_ + pos) & (buf_.size() - 1)];
+    }
+
+    /**
+     * \brief Append data to the end of the buffer.
+     *
+     * \param data the data to append.
+     * \param len  the length of the data.
+     */
+    void append(const uint8_t* data, std::size_t len);
+
+    /**
+     * \brief Get a contiguous view of data at the start of the buffer.
+     *
+     * If the data is already contiguous in the buffer, a pointer into
+     * the buffer is returned. Otherwise the data is copied into the
+     * scratch area provided and a pointer to that returned. The pointer
+     * remains valid until the buffer is next appended to or cleared.
+     *
+     * \param len     the length of data required.
+     * \param scratch scratch area to use if the data is not contiguous.
+     * \returns pointer to the data.
+     */
+    const uint8_t* front(std::size_t len, std::vector<uint8_t>& scratch) const;
+
+    /**
+     * \brief Remove data from the start of the buffer.
+     *
+     * \param len the length of data to remove.
+     */
+    void consume(std::size_t len);
+
+    /**
+     * \brief Empty the buffer and release its memory.
+     */
+    void clear();
+
+private:
+    /**
+     * \brief Copy data from the start of the buffer.
+     *
+     * \param dst destination for the data.
+     * \param len the length of data to copy.
+     */
+    void copy_out(uint8_t* dst, std::size_t len) const;
+
+    /**
+     * \brief the buffer storage.
+     */
+    std::vector<uint8_t> buf_;
+
+    /**
+     * \brief offset of the first byte in the buffer.
+     */
+    std::size_t head_;
+
+    /**
+     * \brief number of bytes in the buffer.
+     */
+    std::size_t size_;
+};
+
+/**
+ * \struct TcpFlowKey
+ * \brief Identify a TCP flow.
+ *
+ * The key is symmetric; both directions of a flow have the same key.
+ * The endpoint that compares lowest is always held first.
+ */
+struct TcpFlowKey
+{
+    /**
+     * \brief Constructor.
+     *
+     * \param src_addr  the packet source address.
+     * \param src_port  the packet source port.
+     * \param dst_addr  the packet destination address.
+     * \param dst_port  the packet destination port.
+     * \param reversed  set `true` if the packet source is held second.
+     */
+    TcpFlowKey(const IPAddress& src_addr, uint16_t src_port,
+               const IPAddress& dst_addr, uint16_t dst_port,
+               bool& reversed);
+
+    /**
+     * \brief Equality operator.
+     *
+     * \param rhs the key to compare to.
+     * \returns `true` if the keys are equal.
+     */
+    bool operator==(const TcpFlowKey& rhs) const
+    {
+        return port[0] == rhs.port[0] && port[1] == rhs.port[1] &&
+            addr[0] == rhs.addr[0] && addr[1] == rhs.addr[1];
+    }
+
+    /**
+     * \brief the endpoint addresses.
+     */
+    IPAddress addr[2];
+
+    /**
+     * \brief the endpoint ports.
+     */
+    uint16_t port[2];
+};
+
+/**
+ * \brief Calculate a hash value for the flow key.
+ *
+ * \param key the flow key.
+ * \returns hash value.
+ */
+std::size_t hash_value(const TcpFlowKey& key);
+
+/**
+ * \class TcpReassembler
+ * \brief Reassemble DNS messages from TCP flows.
+ *
+ * TCP segments are fed to the reassembler. It keeps a table of active
+ * flows, and for each direction of a flow buffers in-order data until
+ * a complete length-prefixed DNS message is available. That message
+ * is passed to a sink. Segments arriving ahead of a gap in the sequence
+ * space are held until the gap is filled.
+ *
+ * Flows are removed when both sides have sent FIN, when either side
+ * sends RST, or when the flow has been idle for longer than the idle
+ * timeout. Memory used by all flows is limited to a configured budget;
+ * if the budget is exceeded, least recently active flows are dropped
+ * until memory use is back within the budget. The number of flows
+ * tracked is similarly limited.
+ *
+ * Times are packet timestamps, not wall clock time.
+ */
+class TcpReassembler
+{
+public:
+    /**
+     * \typedef MessageSink
+     * \brief Sink function for reassembled DNS messages.
+     *
+     * The data is only valid for the duration of the call.
+     */
+    using MessageSink = std::function<void (const uint8_t* data, std::size_t len)>;
+
+    /**
+     * \brief TCP flag values, as found in the TCP header.
+     */
+    enum Flags
+    {
+        FIN = 0x01,
+        SYN = 0x02,
+        RST = 0x04
+    };
+
+    /**
+     * \brief Constructor.
+     *
+     * \param max_flows     the maximum number of flows to track, 0 for no limit.
+     * \param memory_budget the maximum memory to use for all flows, in bytes,
+     *                      0 for no limit.
+     * \param idle_timeout  the time after which an idle flow is removed.
+     * \param stats         statistics to update.
+     */
+    TcpReassembler(std::size_t max_flows,
+                   std::size_t memory_budget,
+                   std::chrono::seconds idle_timeout,
+                   PacketStatistics& stats);
+
+    /**
+     * \brief Process a TCP segment.
+     *
+     * Any DNS messages completed by the segment are passed to the sink
+     * before the function returns. The sink must not throw.
+     *
+     * \param src_addr  the segment source address.
+     * \param src_port  the segment source port.
+     * \param dst_addr  the segment destination address.
+     * \param dst_port  the segment destination port.
+     * \param seq       the segment sequence number.
+     * \param flags     the segment TCP flags.
+     * \param data      the segment payload.
+     * \param len       the segment payload length.
+     * \param timestamp the segment timestamp.
+     * \param sink      sink for completed DNS messages.
+     */
+    void process(const IPAddress& src_addr, uint16_t src_port,
+                 const IPAddress& dst_addr, uint16_t dst_port,
+                 uint32_t seq, unsigned flags,
+                 const uint8_t* data, std::size_t len,
+                 const std::chrono::system_clock::time_point& timestamp,
+                 const MessageSink& sink);
+
+    /**
+     * \brief Remove flows that have been idle longer than the idle timeout.
+     *
+     * \param now the current packet time.
+     */
+    void expire(const std::chrono::system_clock::time_point& now);
+
+    /**
+     * \brief Return the number of flows currently tracked.
+     */
+    std::size_t flow_count() const
+    {
+        return flow_map_.size();
+    }
+
+    /**
+     * \brief Return the memory currently used by all flows, in bytes.
+     */
+    std::size_t memory_used() const
+    {
+        return memory_used_;
+    }
+
+protected:
+    /**
+     * \struct Direction
+     * \brief The state of one direction of a flow.
+     */
+    struct Direction
+    {
+        /**
+         * \brief Default constructor.
+         */
+        Direction() : seq_known(false), next_seq(0), fin(false), pending_bytes(0) {}
+
+        /**
+         * \brief `true` if the next sequence number is known.
+         */
+        bool seq_known;
+
+        /**
+         * \brief the sequence number of the next in-order byte.
+         */
+        uint32_t next_seq;
+
+        /**
+         * \brief `true` if a FIN has been seen.
+         */
+        bool fin;
+
+        /**
+         * \brief in-order data not yet forming a complete message.
+         */
+        TcpRingBuffer data;
+
+        /**
+         * \brief segments received ahead of a gap, keyed by sequence number.
+         */
+        std::map<uint32_t, std::vector<uint8_t>> pending;
+
+        /**
+         * \brief total bytes held in `pending`.
+         */
+        std::size_t pending_bytes;
+
+        /**
+         * \brief Return the memory used by this direction, in bytes.
+         */
+        std::size_t memory() const
+        {
+            return data.capacity() + pending_bytes;
+        }
+    };
+
+    /**
+     * \struct Flow
+     * \brief The state of a flow.
+     */
+    struct Flow
+    {
+        /**
+         * \brief Constructor.
+         *
+         * \param k the flow key.
+         */
+        explicit Flow(const TcpFlowKey& k) : key(k) {}
+
+        /**
+         * \brief the flow key.
+         */
+        TcpFlowKey key;
+
+        /**
+         * \brief the state of each direction.
+         */
+        Direction dir[2];
+
+        /**
+         * \brief time of the last segment seen.
+         */
+        std::chrono::system_clock::time_point last_seen;
+
+        /**
+         * \brief Return the memory used by this flow, in bytes.
+         */
+        std::size_t memory() const;
+    };
+
+    /**
+     * \typedef FlowList
+     * \brief Flows, ordered from least to most recently active.
+     */
+    using FlowList = std::list<Flow>;
+
+    /**
+     * \brief Find the flow for a key, creating it if necessary.
+     *
+     * Finding a flow makes it the most recently active.
+     *
+     * \param key       the flow key.
+     * \param timestamp the current packet time.
+     * \returns iterator for the flow.
+     */
+    FlowList::iterator find_flow(const TcpFlowKey& key,
+                                 const std::chrono::system_clock::time_point& timestamp);
+
+    /**
+     * \brief Remove a flow.
+     *
+     * \param flow iterator for the flow.
+     */
+    void remove_flow(FlowList::iterator flow);
+
+    /**
+     * \brief Add data to a flow direction, and extract completed messages.
+     *
+     * \param dir  the flow direction.
+     * \param seq  the sequence number of the data.
+     * \param data the data.
+     * \param len  the data length.
+     * \param sink sink for completed DNS messages.
+     * \returns `false` if the flow has exceeded its buffer limit.
+     */
+    bool add_data(Direction& dir, uint32_t seq,
+                  const uint8_t* data, std::size_t len,
+                  const MessageSink& sink);
+
+    /**
+     * \brief Extract all complete messages from in-order data.
+     *
+     * Messages are taken directly from the data given if the direction
+     * buffer is empty. Any trailing incomplete message is added to the
+     * direction buffer.
+     *
+     * \param dir  the flow direction.
+     * \param data the new in-order data.
+     * \param len  the data length.
+     * \param sink sink for completed DNS messages.
+     */
+    void extract_messages(Direction& dir,
+                          const uint8_t* data, std::size_t len,
+                          const MessageSink& sink);
+
+    /**
+     * \brief Drop least recently active flows until memory is within budget.
+     */
+    void enforce_budget();
+
+private:
+    /**
+     * \brief the maximum number of flows.
+     */
+    std::size_t max_flows_;
+
+    /**
+     * \brief the memory budget.
+     */
+    std::size_t memory_budget_;
+
+    /**
+     * \brief the idle timeout.
+     */
+    std::chrono::seconds idle_timeout_;
+
+    /**
+     * \brief statistics to update.
+     */
+    PacketStatistics& stats_;
+
+    /**
+     * \brief the flows, least recently active first.
+     */
+    FlowList flows_;
+
+    /**
+     * \brief lookup from key to flow.
+     */
+    std::unordered_map<TcpFlowKey, FlowList::iterator, boost::hash<TcpFlowKey>> flow_map_;
+
+    /**
+     * \brief memory currently used by all flows.
+     */
+    std::size_t memory_used_;
+
+    /**
+     * \brief time at which the next idle check is due.
+     */
+    std::chrono::system_clock::time_point next_expire_check_;
+
+    /**
+     * \brief scratch area for assembling messages that wrap in a buffer.
+     */
+    std::vector<uint8_t> scratch_;
+};
+
+#endif
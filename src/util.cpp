@@ -10,8 +10,14 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <cerrno>
+#include <ctime>
 #include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
 #include <thread>
 #include <system_error>
 
@@ -24,6 +30,10 @@
 #endif
 #endif
 
+#if HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
 #include <grp.h>
 #include <pwd.h>
 #include <sys/stat.h>
@@ -36,6 +46,104 @@
 
 namespace bf = boost::filesystem;
 
+namespace {
+    /**
+     * \brief mutex guarding thread placements.
+     */
+    std::mutex placement_mutex;
+
+    /**
+     * \brief CPUs for each thread name.
+     */
+    std::map<std::string, std::vector<unsigned>> placements;
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    /**
+     * \brief CPUs available to the process before any placement.
+     */
+    cpu_set_t default_cpus;
+
+    /**
+     * \brief `true` once the CPUs available to the process have been read.
+     */
+    bool have_default_cpus = false;
+
+    /**
+     * \brief running threads that have been named, and their names.
+     */
+    std::vector<std::pair<pthread_t, std::string>> named_threads;
+
+    /**
+     * \struct NamedThread
+     * \brief Record of the current thread in the named thread list.
+     *
+     * Removes the thread from the list when the thread exits.
+     */
+    struct NamedThread
+    {
+        NamedThread() : listed(false) {}
+
+        ~NamedThread()
+        {
+            if ( !listed )
+                return;
+
+            std::lock_guard<std::mutex> lock(placement_mutex);
+            pthread_t self = pthread_self();
+            named_threads.erase(
+                std::remove_if(named_threads.begin(), named_threads.end(),
+                               [self](const std::pair<pthread_t, std::string>& t)
+                               {
+                                   return pthread_equal(t.first, self);
+                               }),
+                named_threads.end());
+        }
+
+        bool listed;
+    };
+
+    /**
+     * \brief the current thread's entry in the named thread list.
+     */
+    thread_local NamedThread named_thread;
+
+    /**
+     * \brief Return the CPUs for a thread name.
+     *
+     * Call with placement_mutex held.
+     *
+     * \param name the thread name.
+     */
+    cpu_set_t placement_cpus(const std::string& name)
+    {
+        auto p = placements.find(name);
+        if ( p == placements.end() )
+            return default_cpus;
+
+        cpu_set_t res;
+        CPU_ZERO(&res);
+        for ( auto cpu : p->second )
+            CPU_SET(cpu, &res);
+        return res;
+    }
+#endif
+
+    /**
+     * \brief Read the first line of a file.
+     *
+     * \param path the file path.
+     * \returns the line, or an empty string if it can't be read.
+     */
+    std::string read_line(const std::string& path)
+    {
+        std::ifstream ifs(path);
+        std::string res;
+        if ( ifs.is_open() )
+            std::getline(ifs, res);
+        return res;
+    }
+}
+
 void set_file_owner_perms(const std::string& path,
                           const std::string& owner,
                           const std::string& group,
@@ -95,7 +203,198 @@ void set_thread_name(const char* name)
   #else
     pthread_setname_np(pthread_self(), name);
   #endif
+#endif
+    place_thread(name);
+}
+
+std::vector<unsigned> parse_cpu_list(const std::string& list)
+{
+    std::vector<unsigned> res;
+    std::string::size_type pos = 0;
+
+    if ( list.empty() )
+        throw std::invalid_argument("empty CPU list");
+
+    while ( pos <= list.size() )
+    {
+        std::string::size_type end = list.find(',', pos);
+        if ( end == std::string::npos )
+            end = list.size();
+        std::string item = list.substr(pos, end - pos);
+        std::string::size_type dash = item.find('-');
+        std::string first = item.substr(0, dash);
+        std::string last = ( dash == std::string::npos ) ? first : item.substr(dash + 1);
+
+        if ( first.empty() || last.empty() ||
+             first.find_first_not_of("0123456789") != std::string::npos ||
+             last.find_first_not_of("0123456789") != std::string::npos )
+            throw std::invalid_argument("invalid CPU list " + list);
+
+        unsigned long from = std::stoul(first);
+        unsigned long to = std::stoul(last);
+        if ( from > to || to >= 65536 )
+            throw std::invalid_argument("invalid CPU list " + list);
+
+        for ( unsigned long cpu = from; cpu <= to; ++cpu )
+            res.push_back(cpu);
+        pos = end + 1;
+    }
+
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+}
+
+bool set_thread_placements(const std::map<std::string, std::vector<unsigned>>& cpus)
+{
+    std::lock_guard<std::mutex> lock(placement_mutex);
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    if ( !have_default_cpus )
+    {
+        if ( cpus.empty() )
+            return true;
+        if ( pthread_getaffinity_np(pthread_self(), sizeof(default_cpus), &default_cpus) != 0 )
+            throw std::invalid_argument("can't read CPU affinity");
+        have_default_cpus = true;
+    }
+
+    for ( const auto& p : cpus )
+    {
+        if ( p.second.empty() )
+            throw std::invalid_argument("no CPUs given for " + p.first);
+        for ( auto cpu : p.second )
+            if ( cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &default_cpus) )
+                throw std::invalid_argument("CPU " + std::to_string(cpu) + " for " + p.first + " is not available");
+    }
+
+    placements = cpus;
+
+    bool res = true;
+    for ( const auto& t : named_threads )
+    {
+        cpu_set_t set = placement_cpus(t.second);
+        if ( pthread_setaffinity_np(t.first, sizeof(set), &set) != 0 )
+            res = false;
+    }
+    return res;
+#else
+    placements = cpus;
+    return true;
+#endif
+}
+
+bool place_thread(const char* name)
+{
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t cpus;
+
+    {
+        std::lock_guard<std::mutex> lock(placement_mutex);
+
+        // Note the thread, so it can be moved if placements change.
+        pthread_t self = pthread_self();
+        if ( named_thread.listed )
+        {
+            for ( auto& t : named_threads )
+                if ( pthread_equal(t.first, self) )
+                    t.second = name;
+        }
+        else
+        {
+            named_threads.emplace_back(self, name);
+            named_thread.listed = true;
+        }
+
+        if ( !have_default_cpus )
+            return true;
+        cpus = placement_cpus(name);
+    }
+
+    return ( pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 );
 #else
     (void) name;
+    return true;
 #endif
 }
+
+std::vector<unsigned> interface_local_cpus(const std::string& iface)
+{
+    std::string list = read_line("/sys/class/net/" + iface + "/device/local_cpulist");
+
+    try
+    {
+        return parse_cpu_list(list);
+    }
+    catch (const std::invalid_argument&)
+    {
+        return {};
+    }
+}
+
+int interface_numa_node(const std::string& iface)
+{
+    std::string node = read_line("/sys/class/net/" + iface + "/device/numa_node");
+
+    if ( node.empty() || node.find_first_not_of("0123456789") != std::string::npos )
+        return -1;
+    return std::stoi(node);
+}
+
+std::chrono::system_clock::time_point parse_time_point(const std::string& str)
+{
+    const std::string DIGITS("0123456789");
+    std::string s = str;
+    std::string frac;
+
+    std::string::size_type dot = s.find('.');
+    if ( dot != std::string::npos )
+    {
+        frac = s.substr(dot + 1);
+        s.erase(dot);
+        if ( !frac.empty() && frac.back() == 'Z' && s.size() > 10 )
+            frac.pop_back();
+        if ( frac.empty() || frac.find_first_not_of(DIGITS) != std::string::npos )
+            throw std::invalid_argument("invalid time " + str);
+    }
+    else if ( !s.empty() && s.back() == 'Z' && s.size() > 10 )
+        s.pop_back();
+
+    std::time_t secs;
+    if ( !s.empty() && s.find_first_not_of(DIGITS) == std::string::npos )
+        secs = std::stoll(s);
+    else
+    {
+        // YYYY-MM-DDTHH:MM:SS
+        const std::string PATTERN("dddd-dd-ddTdd:dd:dd");
+        bool valid = ( s.size() == PATTERN.size() );
+        for ( std::size_t i = 0; valid && i < s.size(); ++i )
+        {
+            if ( PATTERN[i] == 'd' )
+                valid = ( DIGITS.find(s[i]) != std::string::npos );
+            else if ( PATTERN[i] == 'T' )
+                valid = ( s[i] == 'T' || s[i] == ' ' );
+            else
+                valid = ( s[i] == PATTERN[i] );
+        }
+        if ( !valid )
+            throw std::invalid_argument("invalid time " + str);
+
+        struct tm tm = {};
+        tm.tm_year = std::stoi(s.substr(0, 4)) - 1900;
+        tm.tm_mon = std::stoi(s.substr(5, 2)) - 1;
+        tm.tm_mday = std::stoi(s.substr(8, 2));
+        tm.tm_hour = std::stoi(s.substr(11, 2));
+        tm.tm_min = std::stoi(s.substr(14, 2));
+        tm.tm_sec = std::stoi(s.substr(17, 2));
+        if ( tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_mday > 31 ||
+             tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60 )
+            throw std::invalid_argument("invalid time " + str);
+        secs = timegm(&tm);
+    }
+
+    frac.resize(9, '0');
+    std::chrono::nanoseconds ns(std::stol(frac));
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(secs) + ns));
+}
@@ -13,7 +13,10 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <chrono>
+#include <map>
 #include <string>
+#include <vector>
 
 /**
  * \brief Set file ownership and write permissions.
@@ -37,10 +40,82 @@ void set_file_owner_perms(const std::string& path,
  * \brief Set the name of the current thread.
  *
  * The passed name may be truncated, or this may do
- * nothing, depending on the underlying system.
+ * nothing, depending on the underlying system. Any placement
+ * set for the name is applied to the thread.
  *
  * \param name  the name to set.
  */
 void set_thread_name(const char* name);
 
+/**
+ * \brief Parse a list of CPU numbers.
+ *
+ * The list is in the Linux `cpulist` format, comma separated CPU
+ * numbers or ranges of CPU numbers, for example `0-3,8,10-11`.
+ *
+ * \param list the CPU list.
+ * \returns the CPU numbers, in ascending order.
+ * \throws std::invalid_argument if the list is not valid.
+ */
+std::vector<unsigned> parse_cpu_list(const std::string& list);
+
+/**
+ * \brief Set the CPUs on which threads with given names may run.
+ *
+ * Any previous placements are replaced. The placements are applied
+ * to running threads already named by set_thread_name() or
+ * place_thread(), and to threads named later. Once any placement
+ * is set, threads whose name has no placement are allowed to run
+ * on the CPUs available to the process when the first placement
+ * was set.
+ *
+ * If any placement is not valid, no placement is changed.
+ *
+ * \param cpus the CPU numbers for each thread name.
+ * \returns `false` if a running thread could not be moved.
+ * \throws std::invalid_argument if any of the CPUs are not available.
+ */
+bool set_thread_placements(const std::map<std::string, std::vector<unsigned>>& cpus);
+
+/**
+ * \brief Apply any placement for the given name to the current thread.
+ *
+ * This does nothing if no placements are set or if the underlying
+ * system does not support setting thread CPU affinity.
+ *
+ * \param name the thread name.
+ * \returns `false` if the placement could not be applied.
+ */
+bool place_thread(const char* name);
+
+/**
+ * \brief Find the CPUs local to a network interface.
+ *
+ * \param iface the network interface name.
+ * \returns the CPU numbers. Empty if not known.
+ */
+std::vector<unsigned> interface_local_cpus(const std::string& iface);
+
+/**
+ * \brief Find the NUMA node to which a network interface is attached.
+ *
+ * \param iface the network interface name.
+ * \returns the NUMA node, or -1 if not known.
+ */
+int interface_numa_node(const std::string& iface);
+
+/**
+ * \brief Parse a time.
+ *
+ * The time is either an ISO 8601 UTC date and time,
+ * `YYYY-MM-DDTHH:MM:SS` or `YYYY-MM-DD HH:MM:SS`, optionally
+ * followed by fractional seconds and a `Z`, or a number of seconds
+ * since the UNIX epoch, optionally with fractional seconds.
+ *
+ * \param str the time.
+ * \returns the time.
+ * \throws std::invalid_argument if the time is not valid.
+ */
+std::chrono::system_clock::time_point parse_time_point(const std::string& str);
+
 #endif
@@ -0,0 +1,869 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <map>
+
+#include "workload.hpp"
+
+namespace po = boost::program_options;
+
+namespace {
+    /**
+     * \brief DNS RR types used in generated messages.
+     */
+    enum RRType : uint16_t
+    {
+        A = 1,
+        NS = 2,
+        CNAME = 5,
+        SOA = 6,
+        PTR = 12,
+        MX = 15,
+        TXT = 16,
+        AAAA = 28,
+        SRV = 33,
+        OPT = 41,
+        DS = 43,
+        RRSIG = 46,
+        NSEC = 47,
+        DNSKEY = 48,
+        SVCB = 64,
+        HTTPS = 65,
+    };
+
+    /**
+     * \brief Query types that may be given weights.
+     */
+    const std::map<std::string, uint16_t> QTYPES = {
+        { "A", A },
+        { "NS", NS },
+        { "CNAME", CNAME },
+        { "SOA", SOA },
+        { "PTR", PTR },
+        { "MX", MX },
+        { "TXT", TXT },
+        { "AAAA", AAAA },
+        { "SRV", SRV },
+        { "DS", DS },
+        { "DNSKEY", DNSKEY },
+        { "SVCB", SVCB },
+        { "HTTPS", HTTPS },
+    };
+
+    const unsigned NXDOMAIN = 3;
+
+    const uint8_t IPPROTO_UDP_VALUE = 17;
+    const uint8_t IPPROTO_TCP_VALUE = 6;
+    const uint8_t IPV6_FRAGMENT_HEADER = 44;
+
+    const uint8_t TCP_FIN = 0x01;
+    const uint8_t TCP_SYN = 0x02;
+    const uint8_t TCP_PSH = 0x08;
+    const uint8_t TCP_ACK = 0x10;
+
+    const byte_string SERVER_IPV4 = { 192, 0, 2, 53 };
+    const byte_string SERVER_IPV6 = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0, 0, 0x53 };
+    const byte_string SERVER_MAC = { 0x02, 0, 0, 0, 0, 0x53 };
+    const byte_string ROUTER_MAC = { 0x02, 0, 0, 0, 0, 0x01 };
+
+    /**
+     * \brief Mix the bits of a value; SplitMix64's finaliser.
+     *
+     * Used to derive fixed properties of names and clients from their rank.
+     */
+    uint64_t mix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+        return x ^ ( x >> 31 );
+    }
+
+    void put16(byte_string& b, uint16_t v)
+    {
+        b.push_back(v >> 8);
+        b.push_back(v & 0xff);
+    }
+
+    void put32(byte_string& b, uint32_t v)
+    {
+        put16(b, v >> 16);
+        put16(b, v & 0xffff);
+    }
+
+    /**
+     * \brief Append pseudo-random bytes.
+     *
+     * \param b    the output.
+     * \param seed the value determining the bytes.
+     * \param len  the number of bytes.
+     */
+    void put_bytes(byte_string& b, uint64_t seed, std::size_t len)
+    {
+        for ( std::size_t i = 0; i < len; i += 8 )
+        {
+            uint64_t v = mix(seed + i);
+            for ( std::size_t j = 0; j < 8 && i + j < len; ++j, v >>= 8 )
+                b.push_back(v & 0xff);
+        }
+    }
+
+    /**
+     * \brief Append a label.
+     */
+    void put_label(byte_string& b, const std::string& label)
+    {
+        b.push_back(label.size());
+        b.append(label.begin(), label.end());
+    }
+
+    /**
+     * \brief Append a compression pointer.
+     */
+    void put_pointer(byte_string& b, std::size_t offset)
+    {
+        put16(b, 0xc000 | offset);
+    }
+
+    /**
+     * \brief Append a resource record header, returning the RDLENGTH offset.
+     */
+    std::size_t put_rr(byte_string& b, std::size_t owner, uint16_t type, uint32_t ttl)
+    {
+        put_pointer(b, owner);
+        put16(b, type);
+        put16(b, 1);
+        put32(b, ttl);
+        put16(b, 0);
+        return b.size() - 2;
+    }
+
+    /**
+     * \brief Fill in RDLENGTH once the RDATA has been appended.
+     */
+    void end_rr(byte_string& b, std::size_t rdlength)
+    {
+        std::size_t len = b.size() - rdlength - 2;
+        b[rdlength] = len >> 8;
+        b[rdlength + 1] = len & 0xff;
+    }
+
+    /**
+     * \brief Append an RRSIG record.
+     */
+    void put_rrsig(byte_string& b, std::size_t owner, std::size_t zone,
+                   uint16_t covered, uint64_t seed, unsigned sig_size)
+    {
+        std::size_t rdlength = put_rr(b, owner, RRSIG, 300);
+        put16(b, covered);
+        b.push_back(8);         // RSASHA256
+        b.push_back(3);
+        put32(b, 300);
+        put32(b, 1700000000);
+        put32(b, 1600000000);
+        put16(b, seed & 0xffff);
+        put_pointer(b, zone);
+        put_bytes(b, seed, sig_size);
+        end_rr(b, rdlength);
+    }
+
+    /**
+     * \brief Append answer RDATA for a name.
+     */
+    void put_rdata(byte_string& b, uint16_t type, unsigned i, uint64_t seed,
+                   std::size_t zone, unsigned sig_size)
+    {
+        switch(type)
+        {
+        case A:
+            put_bytes(b, seed, 4);
+            break;
+
+        case AAAA:
+            put32(b, 0x20010db8);
+            put_bytes(b, seed, 12);
+            break;
+
+        case NS:
+        case CNAME:
+        case PTR:
+            put_label(b, "ns" + std::to_string(i + 1));
+            put_pointer(b, zone);
+            break;
+
+        case MX:
+            put16(b, 10 * ( i + 1 ));
+            put_label(b, "mx" + std::to_string(i + 1));
+            put_pointer(b, zone);
+            break;
+
+        case TXT:
+            {
+                std::size_t len = 16 + seed % 200;
+                b.push_back(len);
+                for ( std::size_t j = 0; j < len; ++j )
+                    b.push_back('a' + ( seed + j ) % 26);
+            }
+            break;
+
+        case SOA:
+            put_label(b, "ns1");
+            put_pointer(b, zone);
+            put_label(b, "hostmaster");
+            put_pointer(b, zone);
+            put32(b, 2022010100);
+            put32(b, 7200);
+            put32(b, 3600);
+            put32(b, 1209600);
+            put32(b, 300);
+            break;
+
+        case SRV:
+            put16(b, 10);
+            put16(b, 10);
+            put16(b, 5000 + seed % 1000);
+            put_label(b, "srv" + std::to_string(i + 1));
+            put_pointer(b, zone);
+            break;
+
+        case DS:
+            put16(b, seed & 0xffff);
+            b.push_back(8);
+            b.push_back(2);     // SHA-256
+            put_bytes(b, seed, 32);
+            break;
+
+        case DNSKEY:
+            put16(b, ( i == 0 ) ? 257 : 256);
+            b.push_back(3);
+            b.push_back(8);
+            put_bytes(b, seed, sig_size);
+            break;
+
+        case SVCB:
+        case HTTPS:
+            put16(b, 1);
+            b.push_back(0);     // Target is the owner name.
+            put16(b, 1);        // alpn
+            put16(b, 6);
+            put_label(b, "h2");
+            put_label(b, "h3");
+            break;
+
+        default:
+            put_bytes(b, seed, 16);
+            break;
+        }
+    }
+
+    /**
+     * \brief Return the number of answers for a query type.
+     */
+    unsigned answer_count(uint16_t type, uint64_t seed, unsigned max_answers)
+    {
+        switch(type)
+        {
+        case A:
+        case AAAA:
+        case NS:
+        case MX:
+        case TXT:
+        case SRV:
+        case DS:
+        case DNSKEY:
+            return 1 + seed % max_answers;
+
+        default:
+            return 1;
+        }
+    }
+
+    /**
+     * \brief Add data to a ones' complement checksum sum.
+     */
+    uint32_t checksum_add(uint32_t sum, const uint8_t* data, std::size_t len)
+    {
+        for ( std::size_t i = 0; i + 1 < len; i += 2 )
+            sum += ( data[i] << 8 ) | data[i + 1];
+        if ( len % 2 )
+            sum += data[len - 1] << 8;
+        return sum;
+    }
+
+    /**
+     * \brief Complete a ones' complement checksum.
+     */
+    uint16_t checksum_finish(uint32_t sum)
+    {
+        while ( sum >> 16 )
+            sum = ( sum & 0xffff ) + ( sum >> 16 );
+        return ~sum & 0xffff;
+    }
+
+    /**
+     * \brief Calculate a UDP or TCP checksum.
+     *
+     * \param src   the source address.
+     * \param dst   the destination address.
+     * \param proto the transport protocol.
+     * \param l4    the transport header and payload, checksum zero.
+     */
+    uint16_t l4_checksum(const byte_string& src, const byte_string& dst,
+                         uint8_t proto, const byte_string& l4)
+    {
+        uint32_t sum = checksum_add(0, src.data(), src.size());
+        sum = checksum_add(sum, dst.data(), dst.size());
+        sum += proto;
+        sum += l4.size() & 0xffff;
+        sum += l4.size() >> 16;
+        sum = checksum_add(sum, l4.data(), l4.size());
+        uint16_t res = checksum_finish(sum);
+        return ( res == 0 && proto == IPPROTO_UDP_VALUE ) ? 0xffff : res;
+    }
+
+    /**
+     * \brief Make an Ethernet frame for an IP packet.
+     *
+     * \param msg         the message supplying addresses.
+     * \param from_client `true` if sent by the client.
+     * \param proto       the IP protocol of the payload.
+     * \param payload     the IP payload.
+     * \param offset      fragment offset, in bytes.
+     * \param more        `true` if more fragments follow.
+     * \param fragmented  `true` if this is a fragment.
+     */
+    byte_string ip_frame(const WorkloadMessage& msg, bool from_client,
+                         uint8_t proto, const uint8_t* payload, std::size_t len,
+                         std::size_t offset = 0, bool more = false,
+                         bool fragmented = false)
+    {
+        const byte_string& src = from_client ? msg.client_address : msg.server_address;
+        const byte_string& dst = from_client ? msg.server_address : msg.client_address;
+
+        byte_string res;
+        res.reserve(14 + 48 + len);
+        res += from_client ? SERVER_MAC : ROUTER_MAC;
+        res += from_client ? ROUTER_MAC : SERVER_MAC;
+        put16(res, msg.ipv6 ? 0x86dd : 0x0800);
+
+        if ( msg.ipv6 )
+        {
+            put32(res, 0x60000000);
+            put16(res, len + ( fragmented ? 8 : 0 ));
+            res.push_back(fragmented ? IPV6_FRAGMENT_HEADER : proto);
+            res.push_back(64);
+            res += src;
+            res += dst;
+            if ( fragmented )
+            {
+                res.push_back(proto);
+                res.push_back(0);
+                put16(res, offset | ( more ? 1 : 0 ));
+                put32(res, msg.ip_id);
+            }
+        }
+        else
+        {
+            std::size_t hdr = res.size();
+            res.push_back(0x45);
+            res.push_back(0);
+            put16(res, 20 + len);
+            put16(res, msg.ip_id & 0xffff);
+            put16(res, ( more ? 0x2000 : 0 ) | ( offset / 8 ));
+            res.push_back(64);
+            res.push_back(proto);
+            put16(res, 0);
+            res += src;
+            res += dst;
+            uint16_t sum = checksum_finish(checksum_add(0, &res[hdr], 20));
+            res[hdr + 10] = sum >> 8;
+            res[hdr + 11] = sum & 0xff;
+        }
+
+        res.append(payload, len);
+        return res;
+    }
+}
+
+WorkloadParameters::WorkloadParameters()
+    : seed(1), queries(100000), rate(10000), start_time(1640995200),
+      names(1000000), name_skew(1.0),
+      clients(100000), client_skew(0.8), ipv6_fraction(0.3),
+      qtype_weights({ "A=55", "AAAA=25", "HTTPS=8", "PTR=4", "MX=2", "TXT=2",
+                      "NS=1", "DS=1", "DNSKEY=1", "SOA=1" }),
+      max_answers(4), edns_fraction(0.9), dnssec_fraction(0.5),
+      signature_size(256), nxdomain_fraction(0.1), loss(0.02),
+      latency(20), latency_skew(1.0),
+      tcp_fraction(0.03), fragment_fraction(0.01), fragment_size(512)
+{
+}
+
+po::options_description WorkloadParameters::options()
+{
+    po::options_description opts("Workload options");
+    opts.add_options()
+        ("seed",
+         po::value<uint64_t>(&seed)->default_value(seed),
+         "random number seed.")
+        ("queries,n",
+         po::value<uint64_t>(&queries)->default_value(queries),
+         "number of queries.")
+        ("rate",
+         po::value<double>(&rate)->default_value(rate),
+         "mean query rate, in queries per second.")
+        ("start-time",
+         po::value<uint64_t>(&start_time)->default_value(start_time),
+         "time of first query, in seconds since the epoch.")
+        ("names",
+         po::value<uint64_t>(&names)->default_value(names),
+         "number of distinct query names.")
+        ("name-skew",
+         po::value<double>(&name_skew)->default_value(name_skew),
+         "Zipf exponent of query name popularity. 0 for uniform.")
+        ("clients",
+         po::value<uint64_t>(&clients)->default_value(clients),
+         "number of distinct clients.")
+        ("client-skew",
+         po::value<double>(&client_skew)->default_value(client_skew),
+         "Zipf exponent of client activity. 0 for uniform.")
+        ("ipv6-fraction",
+         po::value<double>(&ipv6_fraction)->default_value(ipv6_fraction),
+         "fraction of clients using IPv6.")
+        ("qtype",
+         po::value<std::vector<std::string>>(&qtype_weights)->composing(),
+         "query type weight, TYPE=WEIGHT. May be repeated. "
+         "Defaults to a typical resolver mix.")
+        ("max-answers",
+         po::value<unsigned>(&max_answers)->default_value(max_answers),
+         "maximum number of answers in a response.")
+        ("edns-fraction",
+         po::value<double>(&edns_fraction)->default_value(edns_fraction),
+         "fraction of queries with EDNS.")
+        ("dnssec-fraction",
+         po::value<double>(&dnssec_fraction)->default_value(dnssec_fraction),
+         "fraction of queries with DO set, getting signed answers.")
+        ("signature-size",
+         po::value<unsigned>(&signature_size)->default_value(signature_size),
+         "size of DNSSEC signatures and keys, in bytes.")
+        ("nxdomain-fraction",
+         po::value<double>(&nxdomain_fraction)->default_value(nxdomain_fraction),
+         "fraction of queries for unique non-existent names.")
+        ("loss",
+         po::value<double>(&loss)->default_value(loss),
+         "fraction of queries with no response.")
+        ("latency",
+         po::value<double>(&latency)->default_value(latency),
+         "mean response latency, in milliseconds.")
+        ("latency-skew",
+         po::value<double>(&latency_skew)->default_value(latency_skew),
+         "spread of the log-normal response latency distribution.")
+        ("tcp-fraction",
+         po::value<double>(&tcp_fraction)->default_value(tcp_fraction),
+         "fraction of queries over TCP.")
+        ("fragment-fraction",
+         po::value<double>(&fragment_fraction)->default_value(fragment_fraction),
+         "fraction of UDP responses sent as IP fragments.")
+        ("fragment-size",
+         po::value<unsigned>(&fragment_size)->default_value(fragment_size),
+         "maximum IP fragment payload size, in bytes.")
+        ;
+    return opts;
+}
+
+void WorkloadParameters::check()
+{
+    if ( rate <= 0 )
+        throw po::error("query rate must be positive.");
+    if ( names == 0 || clients == 0 )
+        throw po::error("there must be at least one name and one client.");
+    if ( name_skew < 0 || client_skew < 0 )
+        throw po::error("skew must not be negative.");
+    if ( max_answers == 0 )
+        throw po::error("maximum answers must be at least 1.");
+    if ( latency <= 0 || latency_skew < 0 )
+        throw po::error("latency must be positive.");
+    if ( fragment_size < 16 )
+        throw po::error("fragment size must be at least 16.");
+
+    for ( double f : { ipv6_fraction, edns_fraction, dnssec_fraction,
+                       nxdomain_fraction, loss, tcp_fraction, fragment_fraction } )
+        if ( f < 0 || f > 1 )
+            throw po::error("fractions must be in the range 0-1.");
+
+    qtypes.clear();
+    double total = 0;
+    for ( const auto& w : qtype_weights )
+    {
+        std::string::size_type eq = w.find('=');
+        auto item = QTYPES.find(w.substr(0, eq));
+        if ( item == QTYPES.end() )
+            throw po::error("unknown query type in " + w);
+
+        double weight = 1;
+        if ( eq != std::string::npos )
+        {
+            try
+            {
+                weight = std::stod(w.substr(eq + 1));
+            }
+            catch (const std::exception&)
+            {
+                throw po::error("invalid query type weight in " + w);
+            }
+        }
+        if ( weight < 0 )
+            throw po::error("invalid query type weight in " + w);
+
+        total += weight;
+        qtypes.emplace_back(item->second, total);
+    }
+    if ( total <= 0 )
+        throw po::error("query type weights must not all be zero.");
+}
+
+ZipfDistribution::ZipfDistribution(uint64_t n, double s)
+    : n_(n), s_(s)
+{
+    h_integral_x1_ = h_integral(1.5) - 1;
+    h_integral_n_ = h_integral(n_ + 0.5);
+    threshold_ = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+}
+
+double ZipfDistribution::h(double x) const
+{
+    return std::exp(-s_ * std::log(x));
+}
+
+double ZipfDistribution::h_integral(double x) const
+{
+    // (x^(1-s) - 1)/(1-s), or log(x) when s is 1.
+    double log_x = std::log(x);
+    double t = ( 1 - s_ ) * log_x;
+    double helper = ( std::abs(t) > 1e-8 ) ? std::expm1(t) / t : 1 + t / 2 * ( 1 + t / 3 * ( 1 + t / 4 ) );
+    return helper * log_x;
+}
+
+double ZipfDistribution::h_integral_inverse(double x) const
+{
+    double t = x * ( 1 - s_ );
+    if ( t < -1 )
+        t = -1;
+    double helper = ( std::abs(t) > 1e-8 ) ? std::log1p(t) / t : 1 - t * ( 0.5 - t * ( 1.0 / 3 - 0.25 * t ) );
+    return std::exp(helper * x);
+}
+
+WorkloadGenerator::WorkloadGenerator(const WorkloadParameters& params)
+    : params_(params), rng_(params.seed),
+      names_(params.names, params.name_skew),
+      clients_(params.clients, params.client_skew),
+      next_query_time_(std::chrono::seconds(params.start_time)),
+      query_count_(0), response_count_(0)
+{
+}
+
+byte_string WorkloadGenerator::query_name(uint64_t rank)
+{
+    byte_string res;
+    put_label(res, "n" + std::to_string(rank));
+    put_label(res, "z" + std::to_string(mix(rank) % 1000));
+    put_label(res, "example");
+    res.push_back(0);
+    return res;
+}
+
+bool WorkloadGenerator::next(WorkloadMessage& msg)
+{
+    if ( query_count_ < params_.queries &&
+         ( pending_.empty() || next_query_time_ <= pending_.top().timestamp ) )
+    {
+        make_query(msg);
+        return true;
+    }
+
+    if ( pending_.empty() )
+        return false;
+
+    msg = pending_.top();
+    pending_.pop();
+    return true;
+}
+
+void WorkloadGenerator::make_query(WorkloadMessage& msg)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    uint64_t client = clients_(rng_);
+    uint64_t client_hash = mix(client ^ 0x636c69656e74ULL);
+
+    msg.timestamp = next_query_time_;
+    msg.query = true;
+    msg.ipv6 = ( client_hash % 1000000 ) < params_.ipv6_fraction * 1000000;
+    msg.tcp = uniform(rng_) < params_.tcp_fraction;
+    msg.fragment = false;
+    msg.client_address.clear();
+    if ( msg.ipv6 )
+    {
+        put32(msg.client_address, 0x20010db8);
+        put_bytes(msg.client_address, client_hash, 12);
+        msg.server_address = SERVER_IPV6;
+    }
+    else
+    {
+        put_bytes(msg.client_address, client_hash, 4);
+        msg.server_address = SERVER_IPV4;
+    }
+    msg.client_port = 1024 + rng_() % ( 65536 - 1024 );
+    msg.server_port = 53;
+    msg.client_isn = rng_() & 0xffffffff;
+    msg.server_isn = rng_() & 0xffffffff;
+    msg.ip_id = rng_() & 0xffffffff;
+
+    // Query type, name and flags.
+    double weight = uniform(rng_) * params_.qtypes.back().second;
+    auto qt = std::upper_bound(params_.qtypes.begin(), params_.qtypes.end(), weight,
+                               [](double w, const std::pair<uint16_t, double>& t)
+                               {
+                                   return w < t.second;
+                               });
+    if ( qt == params_.qtypes.end() )
+        --qt;
+    uint16_t qtype = qt->first;
+
+    bool nxdomain = uniform(rng_) < params_.nxdomain_fraction;
+    uint64_t rank = names_(rng_);
+    byte_string qname = query_name(rank);
+    if ( nxdomain )
+    {
+        // A random label under a known zone, so every query is unique.
+        byte_string random;
+        put_label(random, "x" + std::to_string(rng_()));
+        qname = random + qname;
+    }
+
+    double r = uniform(rng_);
+    bool dnssec_ok = r < params_.dnssec_fraction;
+    bool edns = r < std::max(params_.edns_fraction, params_.dnssec_fraction);
+    uint16_t id = rng_() & 0xffff;
+
+    const std::size_t QNAME = 12;
+    std::size_t zone = QNAME + 1 + qname[0];
+    if ( nxdomain )
+        zone += 1 + qname[zone - QNAME];
+
+    byte_string& q = msg.wire;
+    q.clear();
+    put16(q, id);
+    put16(q, 0x0100);
+    put16(q, 1);
+    put16(q, 0);
+    put16(q, 0);
+    put16(q, edns ? 1 : 0);
+    q += qname;
+    put16(q, qtype);
+    put16(q, 1);
+    std::size_t question_end = q.size();
+    if ( edns )
+    {
+        q.push_back(0);
+        put16(q, OPT);
+        put16(q, 1232);
+        put32(q, dnssec_ok ? 0x8000 : 0);
+        put16(q, 0);
+    }
+    msg.query_size = q.size();
+
+    std::chrono::system_clock::time_point query_time = next_query_time_;
+    std::exponential_distribution<double> interval(params_.rate);
+    next_query_time_ += std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::duration<double>(interval(rng_)));
+    ++query_count_;
+
+    if ( uniform(rng_) < params_.loss )
+        return;
+
+    // Build the response.
+    double sigma = params_.latency_skew;
+    std::lognormal_distribution<double> latency(std::log(params_.latency / 1000) - sigma * sigma / 2, sigma);
+
+    WorkloadMessage resp = msg;
+    resp.timestamp = query_time + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::duration<double>(latency(rng_)));
+    resp.query = false;
+    resp.fragment = !msg.tcp && uniform(rng_) < params_.fragment_fraction;
+
+    byte_string& a = resp.wire;
+    a.assign(q, 0, question_end);
+    a[2] = 0x81;
+    a[3] = 0x80 | ( nxdomain ? NXDOMAIN : 0 );
+    unsigned ancount = 0, nscount = 0, arcount = 0;
+    uint64_t seed = mix(rank * 65536 + qtype);
+    if ( nxdomain )
+    {
+        std::size_t rdlength = put_rr(a, zone, SOA, 300);
+        put_rdata(a, SOA, 0, seed, zone, params_.signature_size);
+        end_rr(a, rdlength);
+        ++nscount;
+        if ( dnssec_ok )
+        {
+            put_rrsig(a, zone, zone, SOA, seed + 1, params_.signature_size);
+            rdlength = put_rr(a, zone, NSEC, 300);
+            put_label(a, "n" + std::to_string(rank));
+            put_pointer(a, zone);
+            a.push_back(0);
+            a.push_back(6);
+            a.push_back(0x62);  // A NS SOA
+            a.push_back(0);
+            a.push_back(0);
+            a.push_back(0);
+            a.push_back(0x03);  // RRSIG NSEC
+            a.push_back(0x80);  // DNSKEY
+            end_rr(a, rdlength);
+            put_rrsig(a, zone, zone, NSEC, seed + 2, params_.signature_size);
+            nscount += 3;
+        }
+    }
+    else
+    {
+        ancount = answer_count(qtype, seed, params_.max_answers);
+        for ( unsigned i = 0; i < ancount; ++i )
+        {
+            std::size_t rdlength = put_rr(a, QNAME, qtype, 300);
+            put_rdata(a, qtype, i, mix(seed + i), zone, params_.signature_size);
+            end_rr(a, rdlength);
+        }
+        if ( dnssec_ok )
+        {
+            put_rrsig(a, QNAME, zone, qtype, seed + 1, params_.signature_size);
+            ++ancount;
+        }
+    }
+    if ( edns )
+    {
+        a.push_back(0);
+        put16(a, OPT);
+        put16(a, 1232);
+        put32(a, dnssec_ok ? 0x8000 : 0);
+        put16(a, 0);
+        ++arcount;
+    }
+    a[6] = ancount >> 8;
+    a[7] = ancount & 0xff;
+    a[8] = nscount >> 8;
+    a[9] = nscount & 0xff;
+    a[10] = arcount >> 8;
+    a[11] = arcount & 0xff;
+
+    pending_.push(resp);
+    ++response_count_;
+}
+
+void WorkloadGenerator::packets(const WorkloadMessage& msg, std::vector<WorkloadPacket>& out) const
+{
+    if ( !msg.tcp )
+    {
+        udp_packets(msg, msg.query, out);
+        return;
+    }
+
+    // The query is preceded by the handshake, and the response
+    // followed by the close.
+    const std::chrono::microseconds US(1);
+    const byte_string none;
+    byte_string data;
+    put16(data, msg.wire.size());
+    data += msg.wire;
+
+    uint32_t client_seq = msg.client_isn + 1;
+    uint32_t server_seq = msg.server_isn + 1;
+    if ( msg.query )
+    {
+        tcp_packet(msg, true, msg.client_isn, 0, TCP_SYN, none, msg.timestamp - 3 * US, out);
+        tcp_packet(msg, false, msg.server_isn, client_seq, TCP_SYN | TCP_ACK, none, msg.timestamp - 2 * US, out);
+        tcp_packet(msg, true, client_seq, server_seq, TCP_ACK, none, msg.timestamp - US, out);
+        tcp_packet(msg, true, client_seq, server_seq, TCP_PSH | TCP_ACK, data, msg.timestamp, out);
+    }
+    else
+    {
+        client_seq += 2 + msg.query_size;
+        tcp_packet(msg, false, server_seq, client_seq, TCP_PSH | TCP_ACK, data, msg.timestamp, out);
+        server_seq += data.size();
+        tcp_packet(msg, false, server_seq, client_seq, TCP_FIN | TCP_ACK, none, msg.timestamp + US, out);
+        tcp_packet(msg, true, client_seq, server_seq + 1, TCP_FIN | TCP_ACK, none, msg.timestamp + 2 * US, out);
+        tcp_packet(msg, false, server_seq + 1, client_seq + 1, TCP_ACK, none, msg.timestamp + 3 * US, out);
+    }
+}
+
+void WorkloadGenerator::udp_packets(const WorkloadMessage& msg, bool from_client,
+                                    std::vector<WorkloadPacket>& out) const
+{
+    byte_string udp;
+    udp.reserve(8 + msg.wire.size());
+    put16(udp, from_client ? msg.client_port : msg.server_port);
+    put16(udp, from_client ? msg.server_port : msg.client_port);
+    put16(udp, 8 + msg.wire.size());
+    put16(udp, 0);
+    udp += msg.wire;
+    uint16_t sum = l4_checksum(from_client ? msg.client_address : msg.server_address,
+                               from_client ? msg.server_address : msg.client_address,
+                               IPPROTO_UDP_VALUE, udp);
+    udp[6] = sum >> 8;
+    udp[7] = sum & 0xff;
+
+    if ( !msg.fragment )
+    {
+        out.push_back({msg.timestamp,
+                       ip_frame(msg, from_client, IPPROTO_UDP_VALUE, udp.data(), udp.size())});
+        return;
+    }
+
+    // Always make at least two fragments, each a multiple of 8 bytes
+    // except the last.
+    std::size_t chunk = params_.fragment_size & ~7u;
+    if ( udp.size() <= chunk )
+        chunk = ( udp.size() / 2 + 7 ) & ~7u;
+    for ( std::size_t offset = 0; offset < udp.size(); offset += chunk )
+    {
+        std::size_t len = std::min(chunk, udp.size() - offset);
+        out.push_back({msg.timestamp,
+                       ip_frame(msg, from_client, IPPROTO_UDP_VALUE, &udp[offset], len,
+                                offset, offset + len < udp.size(), true)});
+    }
+}
+
+void WorkloadGenerator::tcp_packet(const WorkloadMessage& msg, bool from_client,
+                                   uint32_t seq, uint32_t ack, uint8_t flags,
+                                   const byte_string& payload,
+                                   std::chrono::system_clock::time_point timestamp,
+                                   std::vector<WorkloadPacket>& out) const
+{
+    byte_string tcp;
+    tcp.reserve(20 + payload.size());
+    put16(tcp, from_client ? msg.client_port : msg.server_port);
+    put16(tcp, from_client ? msg.server_port : msg.client_port);
+    put32(tcp, seq);
+    put32(tcp, ack);
+    tcp.push_back(5 << 4);
+    tcp.push_back(flags);
+    put16(tcp, 65535);
+    put16(tcp, 0);
+    put16(tcp, 0);
+    tcp += payload;
+    uint16_t sum = l4_checksum(from_client ? msg.client_address : msg.server_address,
+                               from_client ? msg.server_address : msg.client_address,
+                               IPPROTO_TCP_VALUE, tcp);
+    tcp[16] = sum >> 8;
+    tcp[17] = sum & 0xff;
+
+    out.push_back({timestamp, ip_frame(msg, from_client, IPPROTO_TCP_VALUE, tcp.data(), tcp.size())});
+}
@@ -0,0 +1,504 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "bytestring.hpp"
+
+/**
+ * \class WorkloadParameters
+ * \brief The distributions used to generate a synthetic DNS workload.
+ */
+class WorkloadParameters
+{
+public:
+    /**
+     * \brief Constructor, setting default values.
+     */
+    WorkloadParameters();
+
+    /**
+     * \brief Return command line options setting the parameters.
+     *
+     * The options are bound to this object, so it must outlive
+     * option parsing. Call check() once options are parsed.
+     */
+    boost::program_options::options_description options();
+
+    /**
+     * \brief Check parameter values, and convert the query type weights.
+     *
+     * \throws boost::program_options::error on invalid values.
+     */
+    void check();
+
+    /**
+     * \brief random number seed.
+     */
+    uint64_t seed;
+
+    /**
+     * \brief number of queries to generate.
+     */
+    uint64_t queries;
+
+    /**
+     * \brief mean query rate, in queries per second.
+     */
+    double rate;
+
+    /**
+     * \brief time of the first query, in seconds since the epoch.
+     */
+    uint64_t start_time;
+
+    /**
+     * \brief number of distinct query names.
+     */
+    uint64_t names;
+
+    /**
+     * \brief Zipf exponent of query name popularity.
+     */
+    double name_skew;
+
+    /**
+     * \brief number of distinct clients.
+     */
+    uint64_t clients;
+
+    /**
+     * \brief Zipf exponent of client activity.
+     */
+    double client_skew;
+
+    /**
+     * \brief fraction of clients using IPv6.
+     */
+    double ipv6_fraction;
+
+    /**
+     * \brief query type weights as given, `TYPE=WEIGHT`.
+     */
+    std::vector<std::string> qtype_weights;
+
+    /**
+     * \brief query types and their cumulative weights.
+     */
+    std::vector<std::pair<uint16_t, double>> qtypes;
+
+    /**
+     * \brief maximum number of answers in a response.
+     */
+    unsigned max_answers;
+
+    /**
+     * \brief fraction of queries with EDNS.
+     */
+    double edns_fraction;
+
+    /**
+     * \brief fraction of queries with the DO bit set, which get signed answers.
+     */
+    double dnssec_fraction;
+
+    /**
+     * \brief size of signatures and keys in signed answers, in bytes.
+     */
+    unsigned signature_size;
+
+    /**
+     * \brief fraction of queries for non-existent names.
+     */
+    double nxdomain_fraction;
+
+    /**
+     * \brief fraction of queries that get no response.
+     */
+    double loss;
+
+    /**
+     * \brief mean response latency, in milliseconds.
+     */
+    double latency;
+
+    /**
+     * \brief spread of response latency, the sigma of its log-normal distribution.
+     */
+    double latency_skew;
+
+    /**
+     * \brief fraction of queries over TCP.
+     */
+    double tcp_fraction;
+
+    /**
+     * \brief fraction of UDP responses that are fragmented.
+     */
+    double fragment_fraction;
+
+    /**
+     * \brief maximum fragment payload size, in bytes.
+     */
+    unsigned fragment_size;
+};
+
+/**
+ * \class ZipfDistribution
+ * \brief Generate integers in the range 1 to n with a Zipf distribution.
+ *
+ * The probability of k is proportional to 1/k^s. Values are
+ * generated by rejection-inversion (Hörmann and Derflinger, 1996),
+ * which takes constant time and memory regardless of n.
+ */
+class ZipfDistribution
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param n the largest value.
+     * \param s the exponent. 0 gives a uniform distribution.
+     */
+    ZipfDistribution(uint64_t n, double s);
+
+    /**
+     * \brief Generate a value.
+     *
+     * \param rng the random number generator.
+     * \returns a value in the range 1 to n.
+     */
+    template<typename RNG>
+    uint64_t operator()(RNG& rng)
+    {
+        std::uniform_real_distribution<double> uniform(0, 1);
+        for (;;)
+        {
+            double u = h_integral_n_ + uniform(rng) * ( h_integral_x1_ - h_integral_n_ );
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if ( k < 1 )
+                k = 1;
+            else if ( k > n_ )
+                k = n_;
+            if ( k - x <= threshold_ || u >= h_integral(k + 0.5) - h(k) )
+                return static_cast<uint64_t>(k);
+        }
+    }
+
+private:
+    /**
+     * \brief the unnormalised density, 1/x^s.
+     */
+    double h(double x) const;
+
+    /**
+     * \brief the integral of h.
+     */
+    double h_integral(double x) const;
+
+    /**
+     * \brief the inverse of h_integral.
+     */
+    double h_integral_inverse(double x) const;
+
+    /**
+     * \brief the largest value.
+     */
+    double n_;
+
+    /**
+     * \brief the exponent.
+     */
+    double s_;
+
+    /**
+     * \brief h_integral(1.5) - 1.
+     */
+    double h_integral_x1_;
+
+    /**
+     * \brief h_integral(n + 0.5).
+     */
+    double h_integral_n_;
+
+    /**
+     * \brief values within this distance of x are always accepted.
+     */
+    double threshold_;
+};
+
+/**
+ * \struct WorkloadMessage
+ * \brief A generated DNS message with its addressing.
+ */
+struct WorkloadMessage
+{
+    /**
+     * \brief the message timestamp.
+     */
+    std::chrono::system_clock::time_point timestamp;
+
+    /**
+     * \brief `true` if a query, `false` if a response.
+     */
+    bool query;
+
+    /**
+     * \brief `true` if carried over IPv6.
+     */
+    bool ipv6;
+
+    /**
+     * \brief `true` if carried over TCP.
+     */
+    bool tcp;
+
+    /**
+     * \brief `true` if a UDP response to be sent as IP fragments.
+     */
+    bool fragment;
+
+    /**
+     * \brief the client address, 4 or 16 bytes in network order.
+     */
+    byte_string client_address;
+
+    /**
+     * \brief the server address, 4 or 16 bytes in network order.
+     */
+    byte_string server_address;
+
+    /**
+     * \brief the client port.
+     */
+    uint16_t client_port;
+
+    /**
+     * \brief the server port.
+     */
+    uint16_t server_port;
+
+    /**
+     * \brief TCP only: the client initial sequence number.
+     */
+    uint32_t client_isn;
+
+    /**
+     * \brief TCP only: the server initial sequence number.
+     */
+    uint32_t server_isn;
+
+    /**
+     * \brief TCP only: the size of the query message.
+     */
+    uint32_t query_size;
+
+    /**
+     * \brief the IP identification for fragments.
+     */
+    uint32_t ip_id;
+
+    /**
+     * \brief the DNS message in wire format.
+     */
+    byte_string wire;
+};
+
+/**
+ * \struct WorkloadPacket
+ * \brief A generated Ethernet frame.
+ */
+struct WorkloadPacket
+{
+    /**
+     * \brief the packet timestamp.
+     */
+    std::chrono::system_clock::time_point timestamp;
+
+    /**
+     * \brief the frame contents.
+     */
+    byte_string data;
+};
+
+/**
+ * \class WorkloadGenerator
+ * \brief Generate a synthetic DNS query/response workload.
+ *
+ * Queries arrive as a Poisson process. Each picks a client and a
+ * query name from Zipf distributions, and a query type by weight.
+ * Responses follow after a log-normally distributed latency, unless
+ * lost. Messages are returned in timestamp order.
+ *
+ * The same parameters, including the seed, always produce the same
+ * workload on the same platform.
+ */
+class WorkloadGenerator
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param params the workload parameters, which must have been checked.
+     */
+    explicit WorkloadGenerator(const WorkloadParameters& params);
+
+    /**
+     * \brief Get the next message.
+     *
+     * \param[out] msg the message.
+     * \returns `false` if the workload is complete.
+     */
+    bool next(WorkloadMessage& msg);
+
+    /**
+     * \brief Convert a message into Ethernet frames.
+     *
+     * A UDP message gives one frame, or several IP fragments.
+     * A TCP query is preceded by the connection handshake, and a TCP
+     * response is followed by the connection close.
+     *
+     * \param msg      the message.
+     * \param[out] out the frames are appended here.
+     */
+    void packets(const WorkloadMessage& msg, std::vector<WorkloadPacket>& out) const;
+
+    /**
+     * \brief Return the number of queries generated so far.
+     */
+    uint64_t query_count() const
+    {
+        return query_count_;
+    }
+
+    /**
+     * \brief Return the number of responses generated so far.
+     */
+    uint64_t response_count() const
+    {
+        return response_count_;
+    }
+
+    /**
+     * \brief Return the name for a query name rank.
+     *
+     * \param rank the name rank, from 1.
+     * \returns the name in wire format.
+     */
+    static byte_string query_name(uint64_t rank);
+
+private:
+    /**
+     * \brief Generate the next query, and queue its response.
+     *
+     * \param[out] msg the query.
+     */
+    void make_query(WorkloadMessage& msg);
+
+    /**
+     * \brief Append a UDP datagram, or its fragments, to the frames.
+     *
+     * \param msg         the message.
+     * \param from_client `true` if sent by the client.
+     * \param[out] out    the frames are appended here.
+     */
+    void udp_packets(const WorkloadMessage& msg, bool from_client,
+                     std::vector<WorkloadPacket>& out) const;
+
+    /**
+     * \brief Append a TCP segment to the frames.
+     *
+     * \param msg         the message supplying addresses and ports.
+     * \param from_client `true` if sent by the client.
+     * \param seq         the sequence number.
+     * \param ack         the acknowledgement number.
+     * \param flags       the TCP flags.
+     * \param payload     the segment payload.
+     * \param timestamp   the segment timestamp.
+     * \param[out] out    the frames are appended here.
+     */
+    void tcp_packet(const WorkloadMessage& msg, bool from_client,
+                    uint32_t seq, uint32_t ack, uint8_t flags,
+                    const byte_string& payload,
+                    std::chrono::system_clock::time_point timestamp,
+                    std::vector<WorkloadPacket>& out) const;
+
+    /**
+     * \struct LaterMessage
+     * \brief Order messages so the earliest is at the top of a priority queue.
+     */
+    struct LaterMessage
+    {
+        /**
+         * \brief Return `true` if `a` is later than `b`.
+         */
+        bool operator()(const WorkloadMessage& a, const WorkloadMessage& b) const
+        {
+            return a.timestamp > b.timestamp;
+        }
+    };
+
+    /**
+     * \brief the parameters.
+     */
+    WorkloadParameters params_;
+
+    /**
+     * \brief the random number generator.
+     */
+    std::mt19937_64 rng_;
+
+    /**
+     * \brief query name popularity.
+     */
+    ZipfDistribution names_;
+
+    /**
+     * \brief client activity.
+     */
+    ZipfDistribution clients_;
+
+    /**
+     * \brief time of the next query.
+     */
+    std::chrono::system_clock::time_point next_query_time_;
+
+    /**
+     * \brief responses not yet returned.
+     */
+    std::priority_queue<WorkloadMessage, std::vector<WorkloadMessage>, LaterMessage> pending_;
+
+    /**
+     * \brief the number of queries generated.
+     */
+    uint64_t query_count_;
+
+    /**
+     * \brief the number of responses generated.
+     */
+    uint64_t response_count_;
+};
+
+#endif
@@ -31,4 +31,15 @@ fi
 
 # Verify compactor output conforms to the CDDL spec.
 cddl $CDDL validate $tmpdir/out.cbor
+if [ $? -ne 0 ]; then
+    cleanup 1
+fi
+
+# And again with block sketches.
+$COMP -c /dev/null --include all --block-sketches -o $tmpdir/sketch.cbor $DATAFILE
+if [ $? -ne 0 ]; then
+    cleanup 1
+fi
+
+cddl $CDDL validate $tmpdir/sketch.cbor
 cleanup $?
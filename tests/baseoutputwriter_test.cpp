@@ -50,6 +50,12 @@ public:
         add_action("writeAE");
     }
 
+    virtual void writeMM(const std::shared_ptr<MalformedMessage>& /* mm */,
+                         const PacketStatistics& /* stats */)
+    {
+        add_action("writeMM");
+    }
+
     virtual void startRecord(const std::shared_ptr<QueryResponse>& qr)
     {
         std::ostringstream ostr;
@@ -254,6 +260,24 @@ SCENARIO("Generating output", "[output]")
                         "endRecord:1989-12-27 00h00m00s");
             }
         }
+
+        AND_WHEN("the configuration changes to ignore the QUERY opcode")
+        {
+            config.exclude_hints.set_section_excludes(0, 0);
+            TestBaseOutputWriter tbow(config);
+            tbow.writeQR(qr, stats);
+
+            std::shared_ptr<Configuration> next = std::make_shared<Configuration>(config);
+            next->ignore_opcodes = { CaptureDNS::OP_QUERY };
+            tbow.set_configuration(next);
+            tbow.actions.clear();
+            tbow.writeQR(qr, stats);
+
+            THEN("no further output is generated")
+            {
+                REQUIRE(tbow.actions.empty());
+            }
+        }
     }
 
     GIVEN("A query/response pair with extra questions")
@@ -45,6 +45,11 @@ namespace {
             bytes.clear();
         }
 
+        const std::vector<uint8_t>& written() const
+        {
+            return bytes;
+        }
+
         bool compareBytes(const uint8_t *buf, std::size_t buflen)
         {
             const uint8_t *p = buf;
@@ -1380,6 +1385,27 @@ SCENARIO("MalformedMessageData can be compared and written", "[block]")
                 REQUIRE(tcbe.compareBytes(EXPECTED, sizeof(EXPECTED)));
             }
         }
+
+        WHEN("values with missing fields are encoded")
+        {
+            TestCborEncoder tcbe;
+            mmd1.server_port = boost::none;
+            mmd1.mm_transport_flags = boost::none;
+            mmd1.writeCbor(tcbe);
+            tcbe.flush();
+
+            THEN("the missing fields are not written")
+            {
+                constexpr uint8_t EXPECTED[] =
+                    {
+                        (5 << 5) | 2,
+                        find_malformed_message_data_index(MalformedMessageDataField::server_address_index), 1,
+                        find_malformed_message_data_index(MalformedMessageDataField::mm_payload), (2 << 5) | 5, 'H', 'e', 'l', 'l', 'o',
+                    };
+
+                REQUIRE(tcbe.compareBytes(EXPECTED, sizeof(EXPECTED)));
+            }
+        }
     }
 }
 
@@ -1709,6 +1735,28 @@ SCENARIO("MalformedMessageItem can be written", "[block]")
                 REQUIRE(tcbe.compareBytes(EXPECTED, sizeof(EXPECTED)));
             }
         }
+
+        WHEN("values with missing fields are encoded")
+        {
+            TestCborEncoder tcbe;
+            BlockParameters bp;
+            mm1.tstamp = boost::none;
+            mm1.client_port = boost::none;
+            mm1.writeCbor(tcbe, std::chrono::system_clock::time_point(std::chrono::microseconds(0)), bp);
+            tcbe.flush();
+
+            THEN("the missing fields are not written")
+            {
+                constexpr uint8_t EXPECTED[] =
+                    {
+                        (5 << 5) | 2,
+                        find_malformed_message_index(MalformedMessageField::client_address_index), 1,
+                        find_malformed_message_index(MalformedMessageField::message_data_index), 3,
+                    };
+
+                REQUIRE(tcbe.compareBytes(EXPECTED, sizeof(EXPECTED)));
+            }
+        }
     }
 }
 
@@ -2801,3 +2849,78 @@ SCENARIO("BlockData items can be read", "[block]")
         }
     }
 }
+
+SCENARIO("BlockData malformed messages can be written and read", "[block]")
+{
+    GIVEN("A sample BlockData with malformed messages")
+    {
+        BlockParameters bp;
+        std::vector<BlockParameters> bpv;
+        bpv.push_back(bp);
+        BlockData cd(bpv);
+        cd.earliest_time = std::chrono::system_clock::time_point(std::chrono::seconds(1));
+
+        MalformedMessageData mmd;
+        mmd.server_address = cd.add_address("\x01\x02\x03\x04"_b);
+        mmd.server_port = 53;
+        mmd.mm_payload = "\x12\x34"_b;
+        for ( unsigned i = 0; i < 2; ++i )
+        {
+            MalformedMessageItem mm;
+            mm.tstamp = cd.earliest_time + std::chrono::microseconds(10 + i);
+            mm.client_address = cd.add_address("\x05\x06\x07\x08"_b);
+            mm.client_port = 1000 + i;
+            mm.message_data = cd.add_malformed_message_data(mmd);
+            cd.malformed_messages.push_back(std::move(mm));
+        }
+
+        WHEN("the block is written and read back")
+        {
+            TestCborEncoder tcbe;
+            cd.writeCbor(tcbe);
+            tcbe.flush();
+
+            TestCborDecoder tcbd(tcbe.written());
+            BlockData cd_r(bpv);
+            block_cbor::FileVersionFields fields;
+            cd_r.readCbor(tcbd, fields);
+
+            THEN("identical message data is stored once")
+            {
+                REQUIRE(cd_r.malformed_message_data.size() == 1);
+                REQUIRE(cd_r.malformed_message_data[0] == mmd);
+            }
+
+            AND_THEN("the malformed messages are unchanged")
+            {
+                REQUIRE(cd_r.malformed_messages.size() == 2);
+                for ( unsigned i = 0; i < 2; ++i )
+                {
+                    const MalformedMessageItem& mm = cd_r.malformed_messages[i];
+                    REQUIRE(*mm.tstamp == *cd.malformed_messages[i].tstamp);
+                    REQUIRE(*mm.client_port == 1000 + i);
+                    REQUIRE(cd_r.ip_addresses[mm.client_address].str == "\x05\x06\x07\x08"_b);
+                    REQUIRE(*mm.message_data == 0);
+                }
+            }
+        }
+
+        WHEN("the block is read without records")
+        {
+            TestCborEncoder tcbe;
+            cd.writeCbor(tcbe);
+            tcbe.flush();
+
+            TestCborDecoder tcbd(tcbe.written());
+            BlockData cd_r(bpv);
+            block_cbor::FileVersionFields fields;
+            cd_r.readCbor(tcbd, fields, false);
+
+            THEN("no malformed messages are read")
+            {
+                REQUIRE(cd_r.malformed_messages.empty());
+                REQUIRE(cd_r.malformed_message_data.size() == 0);
+            }
+        }
+    }
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "blockcbor.hpp"
+#include "blockcbordata.hpp"
+#include "blockcborrewriter.hpp"
+
+#include "blockcbormerger.hpp"
+
+using namespace block_cbor;
+
+namespace {
+    class TestCborEncoder : public CborBaseEncoder
+    {
+    public:
+        TestCborEncoder() : CborBaseEncoder() {}
+
+        std::vector<uint8_t> bytes;
+
+    protected:
+        virtual void writeBytes(const uint8_t *p, std::ptrdiff_t nBytes)
+        {
+            while ( nBytes-- > 0 )
+                bytes.push_back(*p++);
+        }
+    };
+
+    class TestCborDecoder : public CborBaseDecoder
+    {
+    public:
+        explicit TestCborDecoder(const std::vector<uint8_t>& bytes)
+            : CborBaseDecoder(), bytes_(bytes), pos_(0) {}
+
+    protected:
+        virtual unsigned readBytes(uint8_t* p, std::ptrdiff_t n_bytes)
+        {
+            if ( pos_ == bytes_.size() )
+                throw cbor_end_of_input();
+
+            // Return input a bit at a time to test the refill logic.
+            std::size_t res = std::min<std::size_t>(7, bytes_.size() - pos_);
+            if ( res > static_cast<std::size_t>(n_bytes) )
+                res = n_bytes;
+            for ( std::size_t i = 0; i < res; ++i )
+                *p++ = bytes_[pos_++];
+            return res;
+        }
+
+    private:
+        std::vector<uint8_t> bytes_;
+        std::size_t pos_;
+    };
+
+    struct TestBlock
+    {
+        unsigned secs;
+        int64_t ticks_per_second;
+        unsigned items;
+
+        bool operator==(const TestBlock& rhs) const
+        {
+            return secs == rhs.secs && ticks_per_second == rhs.ticks_per_second && items == rhs.items;
+        }
+    };
+
+    std::ostream& operator<<(std::ostream& os, const TestBlock& b)
+    {
+        return os << "{" << b.secs << ", " << b.ticks_per_second << ", " << b.items << "}";
+    }
+
+    /**
+     * \brief Make a C-DNS file.
+     *
+     * Each block is given by its earliest time in seconds and its
+     * block parameters index. Blocks have three records, half a second,
+     * one and a half and two and a half seconds after the time given.
+     */
+    std::vector<uint8_t> make_file(std::vector<int64_t> ticks_per_second,
+                                   std::vector<std::pair<unsigned, unsigned>> blocks)
+    {
+        TestCborEncoder enc;
+        enc.writeArrayHeader(3);
+        enc.write(FILE_FORMAT_ID);
+        enc.writeMapHeader(4);
+        enc.write(find_file_preamble_index(FilePreambleField::major_format_version));
+        enc.write(FILE_FORMAT_10_MAJOR_VERSION);
+        enc.write(find_file_preamble_index(FilePreambleField::minor_format_version));
+        enc.write(FILE_FORMAT_10_MINOR_VERSION);
+        enc.write(find_file_preamble_index(FilePreambleField::private_version));
+        enc.write(FILE_FORMAT_10_PRIVATE_VERSION);
+        enc.write(find_file_preamble_index(FilePreambleField::block_parameters));
+        enc.writeArrayHeader(ticks_per_second.size());
+        for ( auto tps : ticks_per_second )
+        {
+            BlockParameters bp;
+            bp.storage_parameters.ticks_per_second = tps;
+            bp.storage_parameters.storage_hints.query_response_hints = QueryResponseHintFlags(TIME_OFFSET | CLIENT_PORT);
+            bp.writeCbor(enc);
+        }
+
+        enc.writeArrayHeader();
+        for ( const auto& b : blocks )
+        {
+            enc.writeMapHeader();
+            enc.write(find_block_index(BlockField::preamble));
+            enc.writeMapHeader(1 + ( b.second > 0 ));
+            enc.write(find_block_preamble_index(BlockPreambleField::earliest_time));
+            Timestamp ts(std::chrono::system_clock::time_point(std::chrono::seconds(b.first)) + std::chrono::milliseconds(500),
+                         ticks_per_second[b.second]);
+            ts.writeCbor(enc);
+            if ( b.second > 0 )
+            {
+                enc.write(find_block_preamble_index(BlockPreambleField::block_parameters_index));
+                enc.write(b.second);
+            }
+            enc.write(find_block_index(BlockField::tables));
+            enc.writeMapHeader(0);
+            enc.write(find_block_index(BlockField::queries));
+            enc.writeArrayHeader(3);
+            for ( int64_t i = 0; i < 3; ++i )
+            {
+                enc.writeMapHeader(1);
+                enc.write(find_query_response_index(QueryResponseField::time_offset));
+                enc.write(i * ticks_per_second[b.second]);
+            }
+            enc.writeBreak();
+        }
+        enc.writeBreak();
+        enc.flush();
+        return enc.bytes;
+    }
+
+    /**
+     * \brief Read a merged C-DNS file.
+     *
+     * \param bytes            the file contents.
+     * \param block_parameters the block parameters in the file header.
+     * \returns the earliest time in seconds, ticks per second and
+     *          number of records of each block.
+     */
+    std::vector<TestBlock> read_file(const std::vector<uint8_t>& bytes,
+                                     std::vector<BlockParameters>& block_parameters)
+    {
+        TestCborDecoder dec(bytes);
+        FileVersionFields fields;
+        std::vector<TestBlock> res;
+        bool indef;
+
+        REQUIRE(dec.readArrayHeader(indef) == 3);
+        REQUIRE(dec.read_string() == FILE_FORMAT_ID);
+        uint64_t n = dec.readMapHeader(indef);
+        while ( n-- > 0 )
+        {
+            if ( file_preamble_field(dec.read_unsigned(), FileFormatVersion::format_10) == FilePreambleField::block_parameters )
+            {
+                uint64_t n_bp = dec.readArrayHeader(indef);
+                while ( n_bp-- > 0 )
+                {
+                    BlockParameters bp;
+                    bp.readCbor(dec, fields);
+                    block_parameters.push_back(bp);
+                }
+            }
+            else
+                dec.skip();
+        }
+
+        dec.readArrayHeader(indef);
+        REQUIRE(indef);
+        while ( dec.type() != CborBaseDecoder::TYPE_BREAK )
+        {
+            TestBlock block{0, 0, 0};
+            Timestamp ts;
+            unsigned index = 0;
+            dec.readMapHeader(indef);
+            REQUIRE(indef);
+            while ( dec.type() != CborBaseDecoder::TYPE_BREAK )
+            {
+                switch(fields.block_field(dec.read_unsigned()))
+                {
+                case BlockField::preamble:
+                    n = dec.readMapHeader(indef);
+                    while ( n-- > 0 )
+                    {
+                        switch(fields.block_preamble_field(dec.read_signed()))
+                        {
+                        case BlockPreambleField::earliest_time:
+                            ts.readCbor(dec);
+                            break;
+
+                        case BlockPreambleField::block_parameters_index:
+                            index = dec.read_unsigned();
+                            break;
+
+                        default:
+                            dec.skip();
+                            break;
+                        }
+                    }
+                    break;
+
+                case BlockField::queries:
+                    n = dec.readArrayHeader(indef);
+                    block.items = n;
+                    while ( n-- > 0 )
+                        dec.skip();
+                    break;
+
+                default:
+                    dec.skip();
+                    break;
+                }
+            }
+            dec.readBreak();
+            block.secs = ts.secs;
+            block.ticks_per_second = block_parameters.at(index).storage_parameters.ticks_per_second;
+            res.push_back(block);
+        }
+        dec.readBreak();
+        return res;
+    }
+}
+
+SCENARIO("C-DNS files can be merged block by block", "[merge]")
+{
+    GIVEN("Two C-DNS files with some shared block parameters")
+    {
+        std::vector<uint8_t> file1 = make_file({1000000, 1000}, {{10, 0}, {30, 1}, {50, 0}});
+        std::vector<uint8_t> file2 = make_file({1000, 1000000000}, {{20, 1}, {40, 0}});
+
+        TestCborDecoder dec1(file1);
+        TestCborDecoder dec2(file2);
+        TestCborEncoder enc;
+        BlockCborMerger merger(enc);
+        merger.add_input(dec1, "file1");
+        merger.add_input(dec2, "file2");
+
+        WHEN("the files are concatenated")
+        {
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("blocks are in input order and use the merged block parameters")
+            {
+                REQUIRE(merger.block_parameters_count() == 3);
+                REQUIRE(merger.block_count() == 5);
+                REQUIRE(bps.size() == 3);
+                std::vector<TestBlock> expected = {
+                    {10, 1000000, 3}, {30, 1000, 3}, {50, 1000000, 3}, {20, 1000000000, 3}, {40, 1000, 3}
+                };
+                REQUIRE(blocks == expected);
+            }
+        }
+
+        WHEN("the files are interleaved")
+        {
+            merger.merge(true);
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("blocks are in time order")
+            {
+                REQUIRE(merger.block_count() == 5);
+                std::vector<TestBlock> expected = {
+                    {10, 1000000, 3}, {20, 1000000000, 3}, {30, 1000, 3}, {40, 1000, 3}, {50, 1000000, 3}
+                };
+                REQUIRE(blocks == expected);
+            }
+        }
+    }
+
+    GIVEN("A C-DNS file and a time range")
+    {
+        std::vector<uint8_t> file = make_file({1000000}, {{10, 0}, {20, 0}, {30, 0}, {40, 0}});
+        TestCborDecoder dec(file);
+        TestCborEncoder enc;
+        BlockCborMerger merger(enc);
+        merger.add_input(dec, "file");
+
+        WHEN("the range starts and ends part way through blocks")
+        {
+            // From the second record of block 20 to the first of block 30.
+            merger.set_time_range(std::chrono::system_clock::time_point(std::chrono::seconds(21)),
+                                  std::chrono::system_clock::time_point(std::chrono::seconds(31)));
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("only the records in range are written")
+            {
+                REQUIRE(merger.block_count() == 2);
+                REQUIRE(merger.trimmed_block_count() == 2);
+                std::vector<TestBlock> expected = {
+                    {21, 1000000, 2}, {30, 1000000, 1}
+                };
+                REQUIRE(blocks == expected);
+            }
+        }
+
+        WHEN("the range covers whole blocks")
+        {
+            merger.set_time_range(std::chrono::system_clock::time_point(std::chrono::seconds(15)),
+                                  std::chrono::system_clock::time_point(std::chrono::seconds(35)));
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("the blocks are copied")
+            {
+                REQUIRE(merger.block_count() == 2);
+                REQUIRE(merger.trimmed_block_count() == 0);
+                std::vector<TestBlock> expected = {
+                    {20, 1000000, 3}, {30, 1000000, 3}
+                };
+                REQUIRE(blocks == expected);
+            }
+        }
+    }
+
+    GIVEN("A C-DNS file and a rewriter")
+    {
+        std::vector<uint8_t> file = make_file({1000000}, {{10, 0}, {20, 0}});
+        TestCborDecoder dec(file);
+        TestCborEncoder enc;
+        BlockCborMerger merger(enc);
+
+        StorageHints hints;
+        hints.query_response_hints = QueryResponseHintFlags(CLIENT_ADDRESS_INDEX | CLIENT_PORT);
+        merger.set_rewriter(BlockCborRewriter(hints));
+        merger.add_input(dec, "file");
+
+        WHEN("the file is rewritten")
+        {
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("the blocks and block parameters are rewritten")
+            {
+                REQUIRE(merger.block_count() == 2);
+                REQUIRE(merger.trimmed_block_count() == 0);
+                std::vector<TestBlock> expected = {
+                    {10, 1000000, 3}, {20, 1000000, 3}
+                };
+                REQUIRE(blocks == expected);
+                REQUIRE(bps.size() == 1);
+                REQUIRE(bps[0].storage_parameters.storage_hints.query_response_hints == CLIENT_PORT);
+            }
+        }
+
+        THEN("the rewriter can't be changed after adding inputs")
+        {
+            REQUIRE_THROWS_AS(merger.set_rewriter(BlockCborRewriter(hints)), std::logic_error);
+        }
+    }
+
+    GIVEN("A C-DNS file to re-block")
+    {
+        std::vector<uint8_t> file = make_file({1000000}, {{10, 0}, {20, 0}, {30, 0}});
+        TestCborDecoder dec(file);
+        TestCborEncoder enc;
+        BlockCborMerger merger(enc);
+
+        WHEN("blocks are limited to two records")
+        {
+            merger.set_block_size(2, std::chrono::seconds(0), 2);
+            merger.add_input(dec, "file");
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("the records are written in blocks of two")
+            {
+                REQUIRE(merger.block_count() == 5);
+                std::vector<TestBlock> expected = {
+                    {10, 1000000, 2}, {12, 1000000, 2}, {21, 1000000, 2}, {30, 1000000, 2}, {32, 1000000, 1}
+                };
+                REQUIRE(blocks == expected);
+                REQUIRE(bps.size() == 1);
+                REQUIRE(bps[0].storage_parameters.max_block_items == 2);
+                REQUIRE(bps[0].storage_parameters.storage_hints.query_response_hints == ( TIME_OFFSET | CLIENT_PORT ));
+            }
+        }
+
+        WHEN("blocks are limited to fifteen seconds")
+        {
+            merger.set_block_size(0, std::chrono::seconds(15), 1);
+            merger.add_input(dec, "file");
+            merger.merge();
+            std::vector<BlockParameters> bps;
+            auto blocks = read_file(enc.bytes, bps);
+
+            THEN("records within fifteen seconds share a block")
+            {
+                REQUIRE(merger.block_count() == 2);
+                std::vector<TestBlock> expected = {
+                    {10, 1000000, 6}, {30, 1000000, 3}
+                };
+                REQUIRE(blocks == expected);
+            }
+        }
+
+        THEN("the block size can't be changed after adding inputs")
+        {
+            merger.add_input(dec, "file");
+            REQUIRE_THROWS_AS(merger.set_block_size(2, std::chrono::seconds(0)), std::logic_error);
+        }
+    }
+
+    GIVEN("A file that is not C-DNS")
+    {
+        TestCborEncoder file;
+        file.writeArrayHeader(3);
+        file.write("NOT-C-DNS");
+        file.flush();
+        TestCborDecoder dec(file.bytes);
+        TestCborEncoder enc;
+        BlockCborMerger merger(enc);
+
+        THEN("it can't be merged")
+        {
+            REQUIRE_THROWS_AS(merger.add_input(dec, "bad"), cbor_file_format_error);
+        }
+    }
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "config.h"
+
+#include "blockcbordata.hpp"
+#include "pseudoanonymise.hpp"
+
+#include "blockcborrewriter.hpp"
+
+using namespace block_cbor;
+
+namespace {
+    StorageHints all_hints()
+    {
+        StorageHints res;
+        res.query_response_hints = QueryResponseHintFlags((1 << 18) - 1);
+        res.query_response_signature_hints = QueryResponseSignatureHintFlags((1 << 17) - 1);
+        res.rr_hints = RRHintFlags(TTL | RDATA_INDEX);
+        res.other_data_hints = OtherDataHintFlags(MALFORMED_MESSAGES | ADDRESS_EVENT_COUNTS);
+        return res;
+    }
+
+    /**
+     * \brief Make a block with two queries from the same client prefix.
+     */
+    void make_block(BlockData& block)
+    {
+        QueryResponseSignature qs;
+        qs.server_address = block.add_address("\x08\x08\x08\x08"_b);
+        qs.server_port = 53;
+        qs.query_opt_rdata = block.add_name_rdata("\x00\x08\x00\x08\x00\x01\x20\x00\x08\x08\x08\x08"_b);
+        index_t sig = block.add_query_response_signature(qs);
+
+        for ( unsigned i = 0; i < 2; ++i )
+        {
+            QueryResponseItem qri;
+            qri.qr_flags = HAS_QUERY;
+            qri.tstamp = std::chrono::system_clock::time_point(std::chrono::seconds(10 + i));
+            qri.client_address = block.add_address("\x08\x08\x08"_b);
+            qri.client_port = 1000 + i;
+            qri.qname = block.add_name_rdata("\x07" "example" "\x03" "com" "\x00"_b);
+            qri.signature = sig;
+            block.query_response_items.push_back(std::move(qri));
+        }
+        block.earliest_time = std::chrono::system_clock::time_point(std::chrono::seconds(10));
+    }
+
+    /**
+     * \brief Add two identical malformed messages to a block.
+     */
+    void add_malformed_messages(BlockData& block)
+    {
+        MalformedMessageData mmd;
+        mmd.server_address = block.add_address("\x08\x08\x08\x08"_b);
+        mmd.server_port = 53;
+        mmd.mm_transport_flags = UDP;
+        mmd.mm_payload = "\x12\x34\x01"_b;
+
+        for ( unsigned i = 0; i < 2; ++i )
+        {
+            MalformedMessageItem mm;
+            mm.tstamp = std::chrono::system_clock::time_point(std::chrono::seconds(12 + i));
+            mm.client_address = block.add_address("\x08\x08\x08"_b);
+            mm.client_port = 2000 + i;
+            mm.message_data = block.add_malformed_message_data(mmd);
+            block.malformed_messages.push_back(std::move(mm));
+        }
+    }
+}
+
+SCENARIO("C-DNS blocks can be rewritten", "[rewrite]")
+{
+    GIVEN("A block and its block parameters")
+    {
+        std::vector<BlockParameters> bps(1);
+        bps[0].storage_parameters.storage_hints = all_hints();
+        bps[0].storage_parameters.client_address_prefix_ipv4 = 24;
+        bps[0].storage_parameters.server_address_prefix_ipv4 = 32;
+        BlockData in(bps);
+        make_block(in);
+        BlockData out(bps);
+
+        WHEN("client port and query name are excluded")
+        {
+            StorageHints hints = all_hints();
+            hints.query_response_hints = QueryResponseHintFlags(hints.query_response_hints & ~( CLIENT_PORT | QUERY_NAME_INDEX ));
+            BlockCborRewriter rewriter(hints);
+            rewriter.rewriteBlock(in, out, bps[0]);
+            rewriter.rewriteBlockParameters(bps[0]);
+
+            THEN("the fields and unused table entries are removed")
+            {
+                REQUIRE(in.query_response_items.empty());
+                REQUIRE(out.query_response_items.size() == 2);
+                for ( const auto& qri : out.query_response_items )
+                {
+                    REQUIRE(!qri.client_port);
+                    REQUIRE(!qri.qname);
+                    REQUIRE(qri.client_address.is_initialized());
+                    REQUIRE(qri.tstamp.is_initialized());
+                }
+                REQUIRE(out.ip_addresses.size() == 2);
+                REQUIRE(out.names_rdatas.size() == 1);
+                REQUIRE(out.query_response_signatures.size() == 1);
+                REQUIRE(out.earliest_time == in.earliest_time);
+            }
+
+            AND_THEN("the storage hints are reduced")
+            {
+                QueryResponseHintFlags qrh = bps[0].storage_parameters.storage_hints.query_response_hints;
+                REQUIRE(!( qrh & CLIENT_PORT ));
+                REQUIRE(!( qrh & QUERY_NAME_INDEX ));
+                REQUIRE(( qrh & CLIENT_ADDRESS_INDEX ));
+                REQUIRE(!( bps[0].storage_parameters.storage_flags & ANONYMISED_DATA ));
+            }
+        }
+
+        WHEN("records are moved one at a time")
+        {
+            BlockCborRewriter rewriter;
+            rewriter.moveItems(in, 0, 1, out, bps[0]);
+            rewriter.moveItems(in, 1, 2, out, bps[0]);
+
+            THEN("the output tables have no duplicates")
+            {
+                REQUIRE(out.query_response_items.size() == 2);
+                REQUIRE(*out.query_response_items[0].client_port == 1000);
+                REQUIRE(*out.query_response_items[1].client_port == 1001);
+                REQUIRE(out.ip_addresses.size() == 2);
+                REQUIRE(out.names_rdatas.size() == 2);
+                REQUIRE(out.query_response_signatures.size() == 1);
+            }
+        }
+
+        WHEN("the block has malformed messages")
+        {
+            add_malformed_messages(in);
+
+            AND_WHEN("malformed messages and server ports are kept")
+            {
+                BlockCborRewriter rewriter;
+                rewriter.rewriteBlock(in, out, bps[0]);
+
+                THEN("the messages share the message data")
+                {
+                    REQUIRE(in.malformed_messages.empty());
+                    REQUIRE(out.malformed_messages.size() == 2);
+                    REQUIRE(out.malformed_message_data.size() == 1);
+                    REQUIRE(*out.malformed_messages[1].client_port == 2001);
+                    const MalformedMessageData& mmd = out.malformed_message_data[out.malformed_messages[0].message_data];
+                    REQUIRE(*mmd.server_port == 53);
+                    REQUIRE(*mmd.mm_payload == "\x12\x34\x01"_b);
+                    REQUIRE(out.ip_addresses[mmd.server_address].str == "\x08\x08\x08\x08"_b);
+                }
+            }
+
+            AND_WHEN("malformed messages are excluded")
+            {
+                StorageHints hints = all_hints();
+                hints.other_data_hints = ADDRESS_EVENT_COUNTS;
+                BlockCborRewriter rewriter(hints);
+                rewriter.rewriteBlock(in, out, bps[0]);
+
+                THEN("they are removed")
+                {
+                    REQUIRE(in.malformed_messages.empty());
+                    REQUIRE(out.malformed_messages.empty());
+                    REQUIRE(out.malformed_message_data.size() == 0);
+                }
+            }
+
+#if ENABLE_PSEUDOANONYMISATION
+            AND_WHEN("addresses are pseudo-anonymised")
+            {
+                BlockCborRewriter rewriter(all_hints(), PseudoAnonymise("some 16-byte key"_b));
+                rewriter.rewriteBlock(in, out, bps[0]);
+
+                THEN("the addresses are pseudo-anonymised and the payload removed")
+                {
+                    REQUIRE(out.malformed_messages.size() == 2);
+                    const MalformedMessageItem& mm = out.malformed_messages[0];
+                    REQUIRE(out.ip_addresses[mm.client_address].str == "\x47\x2b\xba"_b);
+                    const MalformedMessageData& mmd = out.malformed_message_data[mm.message_data];
+                    REQUIRE(out.ip_addresses[mmd.server_address].str == "\x26\x86\x4f\x6f"_b);
+                    REQUIRE(!mmd.mm_payload);
+                }
+            }
+#endif
+        }
+
+#if ENABLE_PSEUDOANONYMISATION
+        WHEN("addresses are pseudo-anonymised")
+        {
+            BlockCborRewriter rewriter(all_hints(), PseudoAnonymise("some 16-byte key"_b));
+            rewriter.rewriteBlock(in, out, bps[0]);
+            rewriter.rewriteBlockParameters(bps[0]);
+
+            THEN("each address and ECS option is pseudo-anonymised")
+            {
+                REQUIRE(out.ip_addresses.size() == 2);
+                REQUIRE(out.query_response_items.size() == 2);
+                for ( const auto& qri : out.query_response_items )
+                {
+                    REQUIRE(out.ip_addresses[qri.client_address].str == "\x47\x2b\xba"_b);
+                    REQUIRE(*qri.client_port >= 1000);
+                }
+                const QueryResponseSignature& qs = out.query_response_signatures[out.query_response_items[0].signature];
+                REQUIRE(out.ip_addresses[qs.server_address].str == "\x26\x86\x4f\x6f"_b);
+                REQUIRE(out.names_rdatas[qs.query_opt_rdata].str == "\x00\x08\x00\x08\x00\x01\x20\x00\x26\x86\x4f\x6f"_b);
+                REQUIRE(out.names_rdatas[out.query_response_items[0].qname].str == "\x07" "example" "\x03" "com" "\x00"_b);
+            }
+
+            AND_THEN("the data is marked as anonymised")
+            {
+                REQUIRE(( bps[0].storage_parameters.storage_flags & ANONYMISED_DATA ));
+                REQUIRE(!bps[0].storage_parameters.anonymisation_method.empty());
+            }
+        }
+#endif
+    }
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "catch.hpp"
+
+#include "blockcborsender.hpp"
+#include "makeunique.hpp"
+
+namespace {
+    /**
+     * \class TestDirectory
+     * \brief A temporary directory, removed on destruction.
+     */
+    class TestDirectory
+    {
+    public:
+        TestDirectory()
+            : path_(boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path("cdns-sender-%%%%-%%%%"))
+        {
+            boost::filesystem::create_directory(path_);
+        }
+
+        ~TestDirectory()
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove_all(path_, ec);
+        }
+
+        std::string path(const std::string& name = "") const
+        {
+            return name.empty() ? path_.string() : ( path_ / name ).string();
+        }
+
+    private:
+        boost::filesystem::path path_;
+    };
+
+    /**
+     * \class TestReceiver
+     * \brief Accept one connection and acknowledge a number of frames.
+     *
+     * If given a release, the last frame is only acknowledged once
+     * released.
+     */
+    class TestReceiver
+    {
+    public:
+        TestReceiver(const std::string& path, unsigned nframes,
+                     std::shared_future<void> release = std::shared_future<void>())
+            : acceptor_(service_, boost::asio::local::stream_protocol::endpoint(path)),
+              socket_(service_)
+        {
+            thread_ = std::thread(
+                [this, nframes, release]()
+                {
+                    acceptor_.accept(socket_);
+                    for ( unsigned i = 0; i < nframes; ++i )
+                    {
+                        uint8_t prefix[block_cbor::FRAME_PREFIX_SIZE];
+                        std::size_t header_size, block_size;
+                        boost::asio::read(socket_, boost::asio::buffer(prefix, sizeof(prefix)));
+                        block_cbor::read_frame_prefix(prefix, header_size, block_size);
+                        byte_string header(header_size, 0), block(block_size, 0);
+                        boost::asio::read(socket_, boost::asio::buffer(&header[0], header_size));
+                        boost::asio::read(socket_, boost::asio::buffer(&block[0], block_size));
+                        frames.emplace_back(header, block);
+                        if ( i + 1 == nframes && release.valid() )
+                            release.wait();
+                        boost::asio::write(socket_, boost::asio::buffer(&block_cbor::FRAME_ACK, 1));
+                    }
+                });
+        }
+
+        void wait()
+        {
+            thread_.join();
+        }
+
+        std::vector<std::pair<byte_string, byte_string>> frames;
+
+    private:
+        boost::asio::io_service service_;
+        boost::asio::local::stream_protocol::acceptor acceptor_;
+        boost::asio::local::stream_protocol::socket socket_;
+        std::thread thread_;
+    };
+
+    bool wait_for_sent(const BlockCborSender& sender, uint64_t sent)
+    {
+        for ( unsigned i = 0; i < 1000; ++i )
+        {
+            if ( sender.stats().sent >= sent )
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+}
+
+SCENARIO("C-DNS frame lengths are encoded", "[sender]")
+{
+    GIVEN("Some frame lengths")
+    {
+        uint8_t buf[block_cbor::FRAME_PREFIX_SIZE];
+
+        WHEN("they are encoded and decoded")
+        {
+            std::size_t header_size, block_size;
+            block_cbor::write_frame_prefix(buf, 0x123, 0x45678);
+            block_cbor::read_frame_prefix(buf, header_size, block_size);
+
+            THEN("they are in network order and unchanged")
+            {
+                REQUIRE(buf[2] == 0x01);
+                REQUIRE(buf[3] == 0x23);
+                REQUIRE(buf[5] == 0x04);
+                REQUIRE(header_size == 0x123);
+                REQUIRE(block_size == 0x45678);
+            }
+        }
+
+        WHEN("a length is too large")
+        {
+            THEN("it is rejected")
+            {
+                REQUIRE_THROWS_AS(block_cbor::write_frame_prefix(buf, 0x80000000, 1), std::length_error);
+                for ( auto& b : buf )
+                    b = 0xff;
+                std::size_t header_size, block_size;
+                REQUIRE_THROWS_AS(block_cbor::read_frame_prefix(buf, header_size, block_size), std::length_error);
+            }
+        }
+    }
+}
+
+SCENARIO("C-DNS blocks are sent to a receiver", "[sender]")
+{
+    GIVEN("A sender and a receiver")
+    {
+        TestDirectory dir;
+        std::string sock = dir.path("sock");
+
+        WHEN("a file is written with the sender encoder")
+        {
+            TestReceiver receiver(sock, 2);
+            std::shared_ptr<BlockCborSender> sender =
+                std::make_shared<BlockCborSender>(sock, "", 10);
+            CborSenderEncoder enc(sender);
+            enc.open("ignored");
+            enc.writeArrayHeader(3);
+            enc.write("C-DNS");
+            enc.writeArrayHeader();
+            enc.sync();
+            enc.write(1);
+            enc.sync();
+            enc.write(2);
+            enc.sync();
+            enc.writeBreak();
+            enc.close();
+            receiver.wait();
+
+            THEN("each block is sent with the file header")
+            {
+                REQUIRE(receiver.frames.size() == 2);
+                REQUIRE(receiver.frames[0].first == "\x83\x65" "C-DNS" "\x9f"_b);
+                REQUIRE(receiver.frames[1].first == receiver.frames[0].first);
+                REQUIRE(receiver.frames[0].second == "\x01"_b);
+                REQUIRE(receiver.frames[1].second == "\x02"_b);
+                REQUIRE(wait_for_sent(*sender, 2));
+            }
+        }
+    }
+
+    GIVEN("A sender with a spool and no receiver")
+    {
+        TestDirectory dir;
+        std::string sock = dir.path("sock");
+        std::shared_ptr<const byte_string> header = std::make_shared<const byte_string>("\x83"_b);
+        std::unique_ptr<BlockCborSender> sender =
+            make_unique<BlockCborSender>(sock, dir.path(), 1, std::chrono::seconds(1));
+        for ( uint8_t i = 1; i <= 3; ++i )
+            sender->send(header, byte_string(1, i));
+
+        THEN("blocks that don't fit in the queue are spooled")
+        {
+            BlockCborSender::Stats stats = sender->stats();
+            REQUIRE(stats.queued == 1);
+            REQUIRE(stats.spooled == 2);
+            REQUIRE(stats.spooled_bytes == 2 * ( block_cbor::FRAME_PREFIX_SIZE + 2 ));
+        }
+
+        WHEN("a receiver starts")
+        {
+            TestReceiver receiver(sock, 3);
+            receiver.wait();
+
+            THEN("all the blocks are sent in order")
+            {
+                REQUIRE(receiver.frames.size() == 3);
+                for ( uint8_t i = 0; i < 3; ++i )
+                    REQUIRE(receiver.frames[i].second == byte_string(1, i + 1));
+                REQUIRE(wait_for_sent(*sender, 3));
+                REQUIRE(sender->stats().spooled_bytes == 0);
+            }
+        }
+
+        WHEN("the sender stops")
+        {
+            sender.reset();
+
+            THEN("unsent blocks are saved in order for the next sender")
+            {
+                std::ifstream spool(dir.path("cdns-stream.spool"), std::ios::binary);
+                REQUIRE(spool.is_open());
+                for ( uint8_t i = 1; i <= 3; ++i )
+                {
+                    uint8_t prefix[block_cbor::FRAME_PREFIX_SIZE];
+                    std::size_t header_size, block_size;
+                    char frame[2];
+                    REQUIRE(spool.read(reinterpret_cast<char*>(prefix), sizeof(prefix)));
+                    block_cbor::read_frame_prefix(prefix, header_size, block_size);
+                    REQUIRE(header_size == 1);
+                    REQUIRE(block_size == 1);
+                    REQUIRE(spool.read(frame, 2));
+                    REQUIRE(frame[1] == i);
+                }
+                REQUIRE(spool.peek() == std::char_traits<char>::eof());
+            }
+
+            AND_THEN("the next sender sends them")
+            {
+                TestReceiver receiver(sock, 3);
+                BlockCborSender next(sock, dir.path(), 1, std::chrono::seconds(1));
+                receiver.wait();
+                REQUIRE(receiver.frames.size() == 3);
+                REQUIRE(receiver.frames[2].second == "\x03"_b);
+                REQUIRE(wait_for_sent(next, 3));
+            }
+        }
+
+        WHEN("the sender stops while sending to a receiver")
+        {
+            std::promise<void> release;
+            TestReceiver receiver(sock, 2, release.get_future().share());
+            REQUIRE(wait_for_sent(*sender, 1));
+
+            std::thread stop([&]() { sender.reset(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            release.set_value();
+            stop.join();
+            receiver.wait();
+
+            THEN("only the frame being sent is finished, and the rest stay spooled")
+            {
+                REQUIRE(receiver.frames.size() == 2);
+                REQUIRE(receiver.frames[1].second == "\x02"_b);
+
+                std::ifstream spool(dir.path("cdns-stream.spool"), std::ios::binary);
+                REQUIRE(spool.is_open());
+                uint8_t prefix[block_cbor::FRAME_PREFIX_SIZE];
+                std::size_t header_size, block_size;
+                char frame[2];
+                REQUIRE(spool.read(reinterpret_cast<char*>(prefix), sizeof(prefix)));
+                block_cbor::read_frame_prefix(prefix, header_size, block_size);
+                REQUIRE(spool.read(frame, 2));
+                REQUIRE(frame[1] == 3);
+                REQUIRE(spool.peek() == std::char_traits<char>::eof());
+            }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "blockcbordata.hpp"
+
+#include "blockcborview.hpp"
+
+using namespace block_cbor;
+
+SCENARIO("Decoded blocks can be viewed without copying", "[view]")
+{
+    GIVEN("A block with some records")
+    {
+        std::vector<BlockParameters> bps(1);
+        bps[0].storage_parameters.max_block_items = 10;
+        BlockData block(bps);
+
+        for ( unsigned i = 0; i < 3; ++i )
+        {
+            QueryResponseItem qri;
+            qri.qr_flags = HAS_QUERY;
+            qri.client_address = block.add_address(i == 1 ? "\x7f\x00\x00\x02"_b : "\x7f\x00\x00\x01"_b);
+            qri.client_port = 1000 + i;
+            block.query_response_items.push_back(std::move(qri));
+        }
+        block.earliest_time = std::chrono::system_clock::time_point(std::chrono::seconds(10));
+
+        WHEN("the block is viewed")
+        {
+            BlockView view(block, bps[0]);
+
+            THEN("the records are the block records")
+            {
+                Span<QueryResponseItem> items = view.query_response_items();
+                REQUIRE(items.size() == 3);
+                REQUIRE(!items.empty());
+                REQUIRE(items.begin() == block.query_response_items.data());
+                REQUIRE(items.end() - items.begin() == 3);
+                REQUIRE(*items[2].client_port == 1002);
+                REQUIRE(view.malformed_messages().empty());
+                REQUIRE(view.earliest_time() == block.earliest_time);
+                REQUIRE(view.block_parameters().storage_parameters.max_block_items == 10);
+            }
+
+            AND_THEN("table entries can be read by position or reference")
+            {
+                TableSpan<ByteStringItem, byte_string> addresses = view.ip_addresses();
+                REQUIRE(addresses.size() == 2);
+                REQUIRE(addresses[0].str == "\x7f\x00\x00\x01"_b);
+                REQUIRE(addresses[1].str == "\x7f\x00\x00\x02"_b);
+                REQUIRE(&addresses.get(view.query_response_items()[1].client_address) == &addresses[1]);
+                REQUIRE(view.names_rdatas().empty());
+            }
+
+            AND_THEN("bad positions and references are rejected")
+            {
+                REQUIRE_THROWS_AS(view.ip_addresses()[2], std::out_of_range);
+                REQUIRE_THROWS_AS(view.ip_addresses().get(index_t()), std::out_of_range);
+                REQUIRE_THROWS_AS(view.ip_addresses().get(index_t(5)), cbor_file_format_error);
+            }
+        }
+    }
+}
@@ -10,6 +10,8 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <chrono>
+#include <sstream>
 #include <vector>
 
 #include "catch.hpp"
@@ -314,3 +316,76 @@ SCENARIO("Check CBOR decoder decodes correct basic values", "[cbor]")
         }
     }
 }
+
+SCENARIO("Check CBOR decoder reads raw items", "[cbor]")
+{
+    GIVEN("A test CBOR decoder")
+    {
+        TestCborDecoder tcbd;
+
+        WHEN("items are read raw")
+        {
+            const std::vector<uint8_t> INPUT =
+                {
+                    0x82, 0x43, 1, 2, 3, 0x9f, 0x01, 0x62, 'a', 'b', 0xff,
+                    0xa1, 0x01, 0x19, 0x01, 0x00,
+                    0x05
+                };
+            tcbd.set_bytes(INPUT);
+
+            THEN("the item encodings are returned")
+            {
+                byte_string first, second, both;
+                tcbd.readRaw(first);
+                tcbd.readRaw(second);
+                REQUIRE(first == byte_string(INPUT.begin(), INPUT.begin() + 11));
+                REQUIRE(second == byte_string(INPUT.begin() + 11, INPUT.begin() + 16));
+                REQUIRE(tcbd.read_unsigned() == 5);
+            }
+
+            THEN("recording captures items that are decoded")
+            {
+                bool indef;
+                byte_string recorded;
+                tcbd.readArrayHeader(indef);
+                tcbd.startRecording(recorded);
+                REQUIRE(tcbd.read_binary() == byte_string{1, 2, 3});
+                tcbd.skip();
+                tcbd.stopRecording();
+                REQUIRE(recorded == byte_string(INPUT.begin() + 1, INPUT.begin() + 11));
+            }
+        }
+    }
+}
+
+SCENARIO("Check CBOR follow decoder waits for more input", "[cbor]")
+{
+    GIVEN("A stream that is still being written")
+    {
+        std::stringstream ss;
+        ss.write("\x01", 1);
+        unsigned polls = 0;
+        auto finished = [&]()
+        {
+            // Write the second item after the first is read.
+            if ( ++polls == 2 )
+            {
+                ss.clear();
+                ss.write("\x18\x20", 2);
+            }
+            return polls > 3;
+        };
+        CborFollowDecoder dec(ss, finished, std::chrono::milliseconds(1));
+
+        WHEN("items are read")
+        {
+            THEN("items written later are read, until the input is finished")
+            {
+                REQUIRE(dec.read_unsigned() == 1);
+                REQUIRE(dec.read_unsigned() == 32);
+                REQUIRE_THROWS_AS(dec.read_unsigned(), cbor_end_of_input);
+                REQUIRE(polls == 4);
+            }
+        }
+    }
+}
@@ -10,6 +10,7 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <chrono>
 #include <string>
 
 #include "catch.hpp"
@@ -64,6 +65,16 @@ SCENARIO("Channels can have data added, removed and closed", "[channel]")
                 REQUIRE(!str_chan.get(s, false));
                 REQUIRE(!int_chan.get(i, false));
             }
+
+            AND_THEN("timed get() returns false after the timeout")
+            {
+                int i;
+
+                REQUIRE(!int_chan.get(i, std::chrono::milliseconds(10)));
+                int_chan.put(100);
+                REQUIRE(int_chan.get(i, std::chrono::milliseconds(10)));
+                REQUIRE(i == 100);
+            }
         }
 
         WHEN("channels are closed")
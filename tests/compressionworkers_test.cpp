@@ -0,0 +1,205 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "catch.hpp"
+
+#include "compressionworkers.hpp"
+
+SCENARIO("Compression workers run queued jobs", "[compression]")
+{
+    GIVEN("A pool of workers")
+    {
+        std::atomic<unsigned> ran(0);
+
+        WHEN("jobs are submitted")
+        {
+            {
+                CompressionWorkers workers(2, 0);
+                for ( unsigned i = 0; i < 10; ++i )
+                    REQUIRE(workers.submit([&]{ ++ran; }));
+            }
+
+            THEN("all jobs are run before the workers stop")
+            {
+                REQUIRE(ran == 10);
+            }
+        }
+
+        WHEN("jobs have completed")
+        {
+            CompressionWorkers workers(1, 0);
+            std::mutex m;
+            std::condition_variable cv;
+            workers.submit([&]{ std::lock_guard<std::mutex> lock(m); ++ran; cv.notify_one(); });
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&]{ return ran == 1; });
+            }
+
+            THEN("the completed job is eventually counted")
+            {
+                CompressionWorkers::Stats stats;
+                do
+                {
+                    stats = workers.stats();
+                } while ( stats.completed == 0 );
+                REQUIRE(stats.completed == 1);
+                REQUIRE(stats.rejected == 0);
+                REQUIRE(stats.total_time >= stats.max_time);
+            }
+        }
+    }
+
+    GIVEN("A single worker with a queue of one job")
+    {
+        CompressionWorkers workers(1, 1);
+        std::mutex m;
+        std::condition_variable cv;
+        bool started = false;
+        bool release = false;
+
+        WHEN("the worker is busy and the queue is full")
+        {
+            REQUIRE(workers.submit([&]
+                                   {
+                                       std::unique_lock<std::mutex> lock(m);
+                                       started = true;
+                                       cv.notify_all();
+                                       cv.wait(lock, [&]{ return release; });
+                                   }));
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&]{ return started; });
+            }
+            REQUIRE(workers.submit([]{}));
+
+            THEN("further jobs are rejected without waiting")
+            {
+                REQUIRE(!workers.submit([]{}));
+                CompressionWorkers::Stats stats = workers.stats();
+                REQUIRE(stats.rejected == 1);
+                REQUIRE(stats.queue_length == 1);
+                REQUIRE(stats.running == 1);
+            }
+
+            std::lock_guard<std::mutex> lock(m);
+            release = true;
+            cv.notify_all();
+        }
+    }
+
+    GIVEN("Workers that have been asked to abort")
+    {
+        CompressionWorkers workers(1, 0);
+        workers.abort();
+
+        THEN("the abort is reported")
+        {
+            REQUIRE(workers.aborted());
+        }
+    }
+}
+
+SCENARIO("Compression level adapts to the compression backlog", "[compression]")
+{
+    GIVEN("A controller between levels 2 and 6 with a 60 second period")
+    {
+        CompressionLevelController controller(6);
+        controller.set_min_level(2, std::chrono::seconds(60));
+        CompressionWorkers::Stats stats{};
+
+        THEN("the initial level is the highest level")
+        {
+            REQUIRE(controller.level() == 6);
+        }
+
+        WHEN("compression speed is not yet known")
+        {
+            THEN("the level is unchanged")
+            {
+                REQUIRE(controller.next_level(stats, 1, 1000000) == 6);
+            }
+        }
+
+        WHEN("the backlog will take longer than the period to compress")
+        {
+            // 10MB compressed in 10s, 1us per byte. 100MB queued.
+            stats.completed = 1;
+            stats.completed_bytes = 10000000;
+            stats.total_time = std::chrono::seconds(10);
+            stats.queue_length = 5;
+            stats.queued_bytes = 100000000;
+
+            THEN("the level is lowered by one step")
+            {
+                REQUIRE(controller.next_level(stats, 1, 10000000) == 5);
+                REQUIRE(controller.level() == 5);
+            }
+
+            AND_WHEN("compression stays behind")
+            {
+                for ( unsigned i = 0; i < 10; ++i )
+                {
+                    stats.completed += 1;
+                    stats.completed_bytes += 10000000;
+                    stats.total_time += std::chrono::seconds(10);
+                    controller.next_level(stats, 1, 10000000);
+                }
+
+                THEN("the level does not go below the lowest level")
+                {
+                    REQUIRE(controller.level() == 2);
+                }
+            }
+        }
+
+        WHEN("the backlog is small enough to be done well within the period")
+        {
+            controller.set_max_level(6);
+            stats.completed = 1;
+            stats.completed_bytes = 10000000;
+            stats.total_time = std::chrono::seconds(10);
+            stats.queue_length = 0;
+            stats.queued_bytes = 0;
+
+            THEN("the level is not raised above the highest level")
+            {
+                REQUIRE(controller.next_level(stats, 1, 1000000) == 6);
+            }
+        }
+
+        WHEN("the level has been lowered and compression catches up")
+        {
+            stats.completed = 1;
+            stats.completed_bytes = 10000000;
+            stats.total_time = std::chrono::seconds(10);
+            stats.queue_length = 5;
+            stats.queued_bytes = 100000000;
+            REQUIRE(controller.next_level(stats, 1, 10000000) == 5);
+
+            stats.completed += 1;
+            stats.completed_bytes += 10000000;
+            stats.total_time += std::chrono::seconds(10);
+            stats.queue_length = 0;
+            stats.queued_bytes = 0;
+
+            THEN("the level is raised by one step")
+            {
+                REQUIRE(controller.next_level(stats, 2, 1000000) == 6);
+            }
+        }
+    }
+}
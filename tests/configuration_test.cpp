@@ -0,0 +1,221 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "catch.hpp"
+
+#include "configuration.hpp"
+
+namespace {
+    /**
+     * \class TempConfigFiles
+     * \brief Configuration files in a temporary directory.
+     */
+    class TempConfigFiles
+    {
+    public:
+        TempConfigFiles()
+            : dir_(boost::filesystem::temp_directory_path() /
+                   boost::filesystem::unique_path("cdns-config-%%%%-%%%%"))
+        {
+            boost::filesystem::create_directory(dir_);
+        }
+
+        ~TempConfigFiles()
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove_all(dir_, ec);
+        }
+
+        std::string write(const std::string& name, const std::string& contents)
+        {
+            std::string path = ( dir_ / name ).string();
+            std::ofstream(path) << contents;
+            return path;
+        }
+
+    private:
+        boost::filesystem::path dir_;
+    };
+
+    /**
+     * \brief Read a configuration as the compactor does.
+     *
+     * \param args the command line arguments.
+     */
+    std::shared_ptr<Configuration> read_config(std::vector<std::string> args)
+    {
+        std::vector<char*> av;
+        std::string name("compactor");
+        av.push_back(&name[0]);
+        for ( auto& a : args )
+            av.push_back(&a[0]);
+
+        std::shared_ptr<Configuration> res = std::make_shared<Configuration>();
+        res->parse_command_line(av.size(), av.data());
+        return res;
+    }
+}
+
+SCENARIO("Configuration changes are classified as live or needing restart", "[configuration]")
+{
+    TempConfigFiles files;
+    std::string conf = files.write("compactor.conf",
+                                   "output=out-%H.cdns\n"
+                                   "rotation-period=300\n"
+                                   "filter=udp\n"
+                                   "max-block-items=5000\n");
+    std::shared_ptr<Configuration> current = read_config({ "-c", conf, "in.pcap" });
+
+    GIVEN("An unchanged configuration")
+    {
+        std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+        THEN("no restart is needed")
+        {
+            REQUIRE(!current->needs_restart(*next));
+        }
+    }
+
+    GIVEN("A change to reloadable settings")
+    {
+        files.write("compactor.conf",
+                    "output=out-%H.cdns\n"
+                    "rotation-period=60\n"
+                    "filter=tcp\n"
+                    "max-block-items=5000\n"
+                    "vlan-id=10\n");
+        std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+        THEN("no restart is needed")
+        {
+            REQUIRE(next->rotation_period.count() == 60);
+            REQUIRE(!current->needs_restart(*next));
+        }
+    }
+
+    GIVEN("A change to a setting that is not reloadable")
+    {
+        files.write("compactor.conf",
+                    "output=out-%H.cdns\n"
+                    "rotation-period=300\n"
+                    "filter=udp\n"
+                    "max-block-items=1000\n");
+        std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+        THEN("a restart is needed")
+        {
+            REQUIRE(current->needs_restart(*next));
+        }
+    }
+
+    GIVEN("A setting that is not reloadable is removed")
+    {
+        files.write("compactor.conf",
+                    "output=out-%H.cdns\n"
+                    "rotation-period=300\n"
+                    "filter=udp\n");
+        std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+        THEN("a restart is needed")
+        {
+            REQUIRE(current->needs_restart(*next));
+        }
+    }
+
+    GIVEN("A setting given on the command line")
+    {
+        current = read_config({ "-c", conf, "--max-block-items", "2000", "in.pcap" });
+
+        WHEN("the configuration file setting changes")
+        {
+            files.write("compactor.conf",
+                        "output=out-%H.cdns\n"
+                        "rotation-period=300\n"
+                        "filter=udp\n"
+                        "max-block-items=1000\n");
+            std::shared_ptr<Configuration> next = read_config({ "-c", conf, "--max-block-items", "2000", "in.pcap" });
+
+            THEN("the command line value still applies and no restart is needed")
+            {
+                REQUIRE(next->max_block_items == 2000);
+                REQUIRE(!current->needs_restart(*next));
+            }
+        }
+
+        WHEN("the command line setting changes")
+        {
+            std::shared_ptr<Configuration> next = read_config({ "-c", conf, "--max-block-items", "3000", "in.pcap" });
+
+            THEN("a restart is needed")
+            {
+                REQUIRE(current->needs_restart(*next));
+            }
+        }
+    }
+
+    GIVEN("An additional output")
+    {
+        std::string def = files.write("extra.conf",
+                                      "output=extra-%H.cdns\n"
+                                      "max-block-items=100\n");
+        files.write("compactor.conf",
+                    "output=out-%H.cdns\n"
+                    "output-definition=" + def + "\n");
+        current = read_config({ "-c", conf, "in.pcap" });
+
+        WHEN("a reloadable output definition setting changes")
+        {
+            files.write("extra.conf",
+                        "output=extra-%H.cdns\n"
+                        "max-block-items=100\n"
+                        "rotation-period=60\n");
+            std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+            THEN("no restart is needed")
+            {
+                REQUIRE(!current->needs_restart(*next));
+            }
+        }
+
+        WHEN("an output definition setting that is not reloadable changes")
+        {
+            files.write("extra.conf",
+                        "output=extra-%H.cdns\n"
+                        "max-block-items=200\n");
+            std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+            THEN("a restart is needed")
+            {
+                REQUIRE(current->needs_restart(*next));
+            }
+        }
+
+        WHEN("the output is removed")
+        {
+            files.write("compactor.conf",
+                        "output=out-%H.cdns\n");
+            std::shared_ptr<Configuration> next = read_config({ "-c", conf, "in.pcap" });
+
+            THEN("a restart is needed")
+            {
+                REQUIRE(current->needs_restart(*next));
+            }
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "catch.hpp"
+
+#include "makeunique.hpp"
+
+#include "controlserver.hpp"
+
+namespace {
+    std::string socket_path()
+    {
+        return ( boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path("cdns-control-%%%%-%%%%") ).string();
+    }
+}
+
+SCENARIO("Control commands are run", "[control]")
+{
+    GIVEN("A control server with a command")
+    {
+        std::string path = socket_path();
+        ControlServer server(path);
+        unsigned runs = 0;
+        server.add_command("test", [&runs]() { ++runs; return "Tested"; });
+
+        WHEN("the command is run")
+        {
+            std::string reply = server.run_command(" test\r\n");
+
+            THEN("the command runs and its reply is returned")
+            {
+                REQUIRE(runs == 1);
+                REQUIRE(reply == "Tested\n");
+            }
+        }
+
+        WHEN("an unknown command is run")
+        {
+            std::string reply = server.run_command("other");
+
+            THEN("the known commands are listed")
+            {
+                REQUIRE(runs == 0);
+                REQUIRE(reply == "Unknown command 'other'. Commands are: test\n");
+            }
+        }
+
+        WHEN("the command is sent to the socket")
+        {
+            boost::asio::io_service service;
+            boost::asio::local::stream_protocol::socket socket(service);
+            socket.connect(boost::asio::local::stream_protocol::endpoint(path));
+            boost::asio::write(socket, boost::asio::buffer(std::string("test\n")));
+
+            boost::asio::streambuf buf;
+            boost::system::error_code ec;
+            boost::asio::read(socket, buf, ec);
+            std::string reply(boost::asio::buffers_begin(buf.data()),
+                              boost::asio::buffers_end(buf.data()));
+
+            THEN("the reply is sent and the connection closed")
+            {
+                REQUIRE(ec == boost::asio::error::eof);
+                REQUIRE(runs == 1);
+                REQUIRE(reply == "Tested\n");
+            }
+        }
+    }
+}
+
+SCENARIO("Idle control connections don't block the server", "[control]")
+{
+    GIVEN("A control server with a client that sends nothing")
+    {
+        std::string path = socket_path();
+        std::unique_ptr<ControlServer> server = make_unique<ControlServer>(path);
+        server->add_command("test", []() { return "Tested"; });
+
+        boost::asio::io_service service;
+        boost::asio::local::stream_protocol::socket idle(service);
+        idle.connect(boost::asio::local::stream_protocol::endpoint(path));
+
+        WHEN("the server is stopped")
+        {
+            std::future<void> stopped = std::async(std::launch::async,
+                                                   [&server]() { server.reset(); });
+
+            THEN("it stops promptly and closes the idle connection")
+            {
+                REQUIRE(stopped.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+
+                char c;
+                boost::system::error_code ec;
+                idle.read_some(boost::asio::buffer(&c, 1), ec);
+                REQUIRE(ec == boost::asio::error::eof);
+            }
+        }
+
+        WHEN("another client sends a command")
+        {
+            boost::asio::local::stream_protocol::socket socket(service);
+            socket.connect(boost::asio::local::stream_protocol::endpoint(path));
+            boost::asio::write(socket, boost::asio::buffer(std::string("test\n")));
+
+            boost::asio::streambuf buf;
+            boost::system::error_code ec;
+            boost::asio::read(socket, buf, ec);
+            std::string reply(boost::asio::buffers_begin(buf.data()),
+                              boost::asio::buffers_end(buf.data()));
+
+            THEN("the idle connection is closed and the command runs")
+            {
+                char c;
+                boost::system::error_code idle_ec;
+                idle.read_some(boost::asio::buffer(&c, 1), idle_ec);
+                REQUIRE(idle_ec == boost::asio::error::eof);
+                REQUIRE(reply == "Tested\n");
+            }
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <vector>
+
+#include "catch.hpp"
+
+#include "flowsampler.hpp"
+
+SCENARIO("SipHash-2-4 matches the reference implementation", "[sampling]")
+{
+    GIVEN("The reference key and a 15 byte message")
+    {
+        const uint64_t k0 = 0x0706050403020100ull;
+        const uint64_t k1 = 0x0f0e0d0c0b0a0908ull;
+        std::vector<uint8_t> msg;
+        for ( uint8_t i = 0; i < 15; ++i )
+            msg.push_back(i);
+
+        THEN("the hash is the reference value")
+        {
+            REQUIRE(FlowSampler::siphash24(k0, k1, msg.data(), msg.size()) == 0xa129ca6149be45e5ull);
+        }
+
+        THEN("the hash of the empty message is the reference value")
+        {
+            REQUIRE(FlowSampler::siphash24(k0, k1, msg.data(), 0) == 0x726fdb47dd0e0e31ull);
+        }
+    }
+}
+
+SCENARIO("FlowSampler keeps about 1 in rate transactions", "[sampling]")
+{
+    GIVEN("A sampler with a rate of 10")
+    {
+        FlowSampler sampler(10, 1, 2);
+        const uint8_t addr[] = { 192, 168, 1, 77 };
+
+        WHEN("many transactions are sampled")
+        {
+            unsigned kept = 0;
+            for ( unsigned id = 0; id < 10000; ++id )
+                if ( sampler.keep(addr, sizeof(addr), 12345, static_cast<uint16_t>(id)) )
+                    ++kept;
+
+            THEN("about 1 in 10 are kept")
+            {
+                REQUIRE(kept > 800);
+                REQUIRE(kept < 1200);
+            }
+        }
+
+        WHEN("the same transaction is sampled twice")
+        {
+            THEN("the decision is the same")
+            {
+                for ( uint16_t id = 0; id < 100; ++id )
+                    REQUIRE(sampler.keep(addr, sizeof(addr), 53000, id) ==
+                            sampler.keep(addr, sizeof(addr), 53000, id));
+            }
+        }
+    }
+
+    GIVEN("A sampler with a rate of 1")
+    {
+        FlowSampler sampler(1);
+        const uint8_t addr[16] = { 0x20, 0x01 };
+
+        THEN("everything is kept")
+        {
+            for ( uint16_t id = 0; id < 100; ++id )
+                REQUIRE(sampler.keep(addr, sizeof(addr), 1024, id));
+        }
+    }
+}
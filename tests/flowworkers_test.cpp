@@ -0,0 +1,172 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "makeunique.hpp"
+
+#include "flowworkers.hpp"
+
+namespace {
+    /**
+     * \struct Processed
+     * \brief Record of packets processed by each worker.
+     */
+    struct Processed
+    {
+        std::mutex mutex;
+        std::map<unsigned, std::vector<std::chrono::system_clock::time_point>> by_source;
+    };
+
+    /**
+     * \class TestProcessor
+     * \brief Record the timestamps of packets processed.
+     */
+    class TestProcessor : public FlowWorkers::Processor
+    {
+    public:
+        TestProcessor(unsigned source, PacketStatistics& stats, Processed& processed)
+            : source_(source), stats_(stats), processed_(processed) {}
+
+        virtual void process(FlowWorkers::PacketBatch& batch)
+        {
+            std::lock_guard<std::mutex> lock(processed_.mutex);
+            for ( const auto& pcap : batch )
+            {
+                processed_.by_source[source_].push_back(pcap->timestamp);
+                ++stats_.processed_message_count;
+            }
+        }
+
+        virtual void finish()
+        {
+        }
+
+        virtual unsigned length()
+        {
+            return 0;
+        }
+
+    private:
+        unsigned source_;
+        PacketStatistics& stats_;
+        Processed& processed_;
+    };
+
+    /**
+     * \brief Make a packet.
+     *
+     * \param secs the packet timestamp, in seconds.
+     */
+    std::shared_ptr<PcapItem> make_packet(unsigned secs)
+    {
+        const uint8_t data[20] = {};
+        Tins::Packet pkt(Tins::RawPDU(data, sizeof(data)),
+                         std::chrono::microseconds(secs * 1000000ull));
+        return std::make_shared<PcapItem>(pkt);
+    }
+
+    std::chrono::system_clock::time_point seconds(unsigned secs)
+    {
+        return std::chrono::system_clock::time_point(std::chrono::seconds(secs));
+    }
+}
+
+SCENARIO("Packets are distributed to flow workers", "[workers]")
+{
+    Processed processed;
+    FlowWorkers::ProcessorFactory make_processor =
+        [&](unsigned source, PacketStatistics& stats)
+        {
+            return make_unique<TestProcessor>(source, stats, processed);
+        };
+
+    GIVEN("Several workers")
+    {
+        FlowWorkers workers(3, 1000, false, make_processor);
+        PacketStatistics stats{};
+
+        WHEN("packets from several flows are dispatched")
+        {
+            const unsigned NFLOWS = 5;
+            const unsigned NPACKETS = 500;
+            for ( unsigned i = 0; i < NPACKETS; ++i )
+                workers.dispatch(i % NFLOWS, make_packet(i), stats);
+            workers.close();
+
+            THEN("all packets of a flow go to the same worker in order")
+            {
+                std::map<unsigned, unsigned> flow_source;
+                unsigned total = 0;
+                for ( const auto& src : processed.by_source )
+                {
+                    std::map<unsigned, unsigned> last;
+                    for ( const auto& t : src.second )
+                    {
+                        unsigned i = std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count();
+                        unsigned flow = i % NFLOWS;
+                        auto fs = flow_source.insert(std::make_pair(flow, src.first));
+                        REQUIRE(fs.first->second == src.first);
+                        if ( last.count(flow) )
+                            REQUIRE(last[flow] < i);
+                        last[flow] = i;
+                        ++total;
+                    }
+                }
+                REQUIRE(total == NPACKETS);
+                REQUIRE(flow_source.size() == NFLOWS);
+                REQUIRE(processed.by_source.size() > 1);
+            }
+
+            AND_THEN("worker statistics add up")
+            {
+                PacketStatistics total{};
+                workers.add_stats(total);
+                REQUIRE(total.processed_message_count == NPACKETS);
+
+                PacketStatistics published{};
+                workers.add_published_stats(published);
+                REQUIRE(published.processed_message_count == NPACKETS);
+                REQUIRE(stats.matcher_drop_count == 0);
+            }
+        }
+
+        WHEN("a partly filled batch is flushed")
+        {
+            workers.dispatch(0, make_packet(1), stats);
+            workers.flush(stats);
+
+            PacketStatistics published{};
+            for ( unsigned i = 0; i < 1000 && published.processed_message_count == 0; ++i )
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                published = PacketStatistics{};
+                workers.add_published_stats(published);
+            }
+
+            THEN("the packet is processed without closing the workers")
+            {
+                REQUIRE(published.processed_message_count == 1);
+                std::lock_guard<std::mutex> lock(processed.mutex);
+                REQUIRE(processed.by_source.size() == 1);
+                REQUIRE(processed.by_source.begin()->second[0] == seconds(1));
+            }
+        }
+    }
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "fragmentreassembler.hpp"
+
+namespace {
+    std::vector<uint8_t> ipv4_fragment(uint16_t id, std::size_t offset, bool more,
+                                       const std::vector<uint8_t>& payload)
+    {
+        std::vector<uint8_t> res = {
+            0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x40, 0x11, 0x00, 0x00,
+            192, 168, 1, 77,
+            192, 168, 1, 254
+        };
+        std::size_t len = res.size() + payload.size();
+        uint16_t flags_offset = static_cast<uint16_t>((more ? 0x2000 : 0) | (offset / 8));
+        res[2] = static_cast<uint8_t>(len >> 8);
+        res[3] = static_cast<uint8_t>(len);
+        res[4] = static_cast<uint8_t>(id >> 8);
+        res[5] = static_cast<uint8_t>(id);
+        res[6] = static_cast<uint8_t>(flags_offset >> 8);
+        res[7] = static_cast<uint8_t>(flags_offset);
+        res.insert(res.end(), payload.begin(), payload.end());
+        return res;
+    }
+
+    std::vector<uint8_t> ipv6_fragment(uint32_t id, std::size_t offset, bool more,
+                                       const std::vector<uint8_t>& payload)
+    {
+        std::vector<uint8_t> res(40 + 8);
+        res[0] = 0x60;
+        std::size_t plen = 8 + payload.size();
+        res[4] = static_cast<uint8_t>(plen >> 8);
+        res[5] = static_cast<uint8_t>(plen);
+        res[6] = 44;
+        res[7] = 64;
+        res[8] = 0x20;
+        res[9] = 0x01;
+        res[39] = 0x01;
+        uint8_t* frag = &res[40];
+        uint16_t offset_more = static_cast<uint16_t>(offset | (more ? 1 : 0));
+        frag[0] = 17;
+        frag[2] = static_cast<uint8_t>(offset_more >> 8);
+        frag[3] = static_cast<uint8_t>(offset_more);
+        frag[4] = static_cast<uint8_t>(id >> 24);
+        frag[5] = static_cast<uint8_t>(id >> 16);
+        frag[6] = static_cast<uint8_t>(id >> 8);
+        frag[7] = static_cast<uint8_t>(id);
+        res.insert(res.end(), payload.begin(), payload.end());
+        return res;
+    }
+
+    std::vector<uint8_t> payload(std::size_t from, std::size_t len)
+    {
+        std::vector<uint8_t> res(len);
+        for ( std::size_t i = 0; i < len; ++i )
+            res[i] = static_cast<uint8_t>(from + i);
+        return res;
+    }
+}
+
+SCENARIO("FragmentReassembler reassembles IPv4 datagrams", "[fragment]")
+{
+    PacketStatistics stats{};
+    std::chrono::system_clock::time_point t(std::chrono::seconds(100));
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> f1 = ipv4_fragment(1234, 0, true, payload(0, 16));
+    std::vector<uint8_t> f2 = ipv4_fragment(1234, 16, true, payload(16, 16));
+    std::vector<uint8_t> f3 = ipv4_fragment(1234, 32, false, payload(32, 5));
+
+    GIVEN("A fragment reassembler")
+    {
+        FragmentReassembler fr(0, std::chrono::seconds(30), stats);
+
+        WHEN("fragments arrive out of order with a duplicate")
+        {
+            REQUIRE(!fr.process_ipv4(f3.data(), f3.size(), t, out));
+            REQUIRE(!fr.process_ipv4(f1.data(), f1.size(), t, out));
+            REQUIRE(!fr.process_ipv4(f1.data(), f1.size(), t, out));
+            REQUIRE(fr.datagram_count() == 1);
+            REQUIRE(fr.process_ipv4(f2.data(), f2.size(), t, out));
+
+            THEN("the complete datagram is returned")
+            {
+                REQUIRE(out.size() == 20 + 37);
+                REQUIRE(out[2] == 0);
+                REQUIRE(out[3] == 57);
+                REQUIRE(out[6] == 0);
+                REQUIRE(out[7] == 0);
+                REQUIRE(std::vector<uint8_t>(out.begin() + 20, out.end()) == payload(0, 37));
+                REQUIRE(fr.datagram_count() == 0);
+                REQUIRE(fr.memory_used() == 0);
+                REQUIRE(stats.ip_fragment_reassembled_count == 1);
+                REQUIRE(stats.ip_fragment_bad_drop_count == 0);
+            }
+
+            THEN("the header checksum is correct")
+            {
+                uint32_t sum = 0;
+                for ( std::size_t i = 0; i < 20; i += 2 )
+                    sum += (out[i] << 8) | out[i + 1];
+                while ( sum >> 16 )
+                    sum = (sum & 0xffff) + (sum >> 16);
+                REQUIRE(sum == 0xffff);
+            }
+        }
+
+        WHEN("a fragment overlaps another")
+        {
+            std::vector<uint8_t> overlap = ipv4_fragment(1234, 8, true, payload(8, 16));
+            REQUIRE(!fr.process_ipv4(f1.data(), f1.size(), t, out));
+            REQUIRE(!fr.process_ipv4(overlap.data(), overlap.size(), t, out));
+            REQUIRE(!fr.process_ipv4(f2.data(), f2.size(), t, out));
+            REQUIRE(!fr.process_ipv4(f3.data(), f3.size(), t, out));
+
+            THEN("the datagram is discarded")
+            {
+                REQUIRE(stats.ip_fragment_bad_drop_count == 1);
+                REQUIRE(stats.ip_fragment_reassembled_count == 0);
+            }
+        }
+
+        WHEN("not all fragments arrive before the timeout")
+        {
+            REQUIRE(!fr.process_ipv4(f1.data(), f1.size(), t, out));
+            fr.expire(t + std::chrono::seconds(29));
+            REQUIRE(fr.datagram_count() == 1);
+            fr.expire(t + std::chrono::seconds(30));
+
+            THEN("the datagram is discarded")
+            {
+                REQUIRE(fr.datagram_count() == 0);
+                REQUIRE(fr.memory_used() == 0);
+                REQUIRE(stats.ip_fragment_timeout_count == 1);
+            }
+        }
+    }
+
+    GIVEN("A fragment reassembler with a small memory limit")
+    {
+        FragmentReassembler fr(1024, std::chrono::seconds(30), stats);
+
+        WHEN("many datagrams are incomplete")
+        {
+            for ( uint16_t id = 0; id < 10; ++id )
+            {
+                std::vector<uint8_t> f = ipv4_fragment(id, 0, true, payload(0, 16));
+                REQUIRE(!fr.process_ipv4(f.data(), f.size(), t, out));
+            }
+
+            THEN("the oldest datagrams are dropped")
+            {
+                REQUIRE(fr.memory_used() <= 1024);
+                REQUIRE(fr.datagram_count() < 10);
+                REQUIRE(stats.ip_fragment_memory_drop_count == 10 - fr.datagram_count());
+            }
+        }
+    }
+}
+
+SCENARIO("FragmentReassembler reassembles IPv6 datagrams", "[fragment]")
+{
+    PacketStatistics stats{};
+    std::chrono::system_clock::time_point t(std::chrono::seconds(100));
+    std::vector<uint8_t> out;
+
+    GIVEN("A fragment reassembler")
+    {
+        FragmentReassembler fr(0, std::chrono::seconds(30), stats);
+
+        WHEN("all fragments arrive")
+        {
+            std::vector<uint8_t> f1 = ipv6_fragment(0x12345678, 0, true, payload(0, 24));
+            std::vector<uint8_t> f2 = ipv6_fragment(0x12345678, 24, false, payload(24, 3));
+            REQUIRE(!fr.process_ipv6(f2.data(), f2.size(), t, out));
+            REQUIRE(fr.process_ipv6(f1.data(), f1.size(), t, out));
+
+            THEN("the fragment header is removed")
+            {
+                REQUIRE(out.size() == 40 + 27);
+                REQUIRE(out[4] == 0);
+                REQUIRE(out[5] == 27);
+                REQUIRE(out[6] == 17);
+                REQUIRE(std::vector<uint8_t>(out.begin() + 40, out.end()) == payload(0, 27));
+                REQUIRE(stats.ip_fragment_reassembled_count == 1);
+            }
+        }
+
+        WHEN("fragments with different IDs arrive")
+        {
+            std::vector<uint8_t> f1 = ipv6_fragment(1, 0, true, payload(0, 24));
+            std::vector<uint8_t> f2 = ipv6_fragment(2, 24, false, payload(24, 3));
+            REQUIRE(!fr.process_ipv6(f1.data(), f1.size(), t, out));
+            REQUIRE(!fr.process_ipv6(f2.data(), f2.size(), t, out));
+
+            THEN("they are held as separate datagrams")
+            {
+                REQUIRE(fr.datagram_count() == 2);
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <memory>
+
+#include "catch.hpp"
+
+#include "configuration.hpp"
+#include "liveconfiguration.hpp"
+
+SCENARIO("Live configuration snapshots are replaced as a whole", "[configuration]")
+{
+    GIVEN("A live configuration")
+    {
+        Configuration config;
+        config.max_block_items = 100;
+        config.filter = "udp";
+        LiveConfiguration live(config);
+        unsigned generation = live.generation();
+        std::shared_ptr<const Configuration> before = live.get();
+
+        WHEN("the configuration is not replaced")
+        {
+            THEN("the same snapshot and generation are returned")
+            {
+                REQUIRE(live.get() == before);
+                REQUIRE(live.generation() == generation);
+                REQUIRE(before->max_block_items == 100);
+            }
+        }
+
+        WHEN("the configuration is replaced")
+        {
+            std::shared_ptr<Configuration> next = std::make_shared<Configuration>(config);
+            next->max_block_items = 200;
+            next->filter = "tcp";
+            live.set(next);
+
+            THEN("the new snapshot is returned with a new generation")
+            {
+                REQUIRE(live.generation() != generation);
+                REQUIRE(live.get() == next);
+                REQUIRE(live.get()->max_block_items == 200);
+                REQUIRE(live.get()->filter == "tcp");
+            }
+
+            AND_THEN("a snapshot already held is unchanged")
+            {
+                REQUIRE(before->max_block_items == 100);
+                REQUIRE(before->filter == "udp");
+            }
+        }
+    }
+}
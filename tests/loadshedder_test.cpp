@@ -0,0 +1,163 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <vector>
+
+#include "catch.hpp"
+#include "makeunique.hpp"
+
+#include "loadshedder.hpp"
+
+namespace {
+    QueryResponse make_qr(const DNSMessage& query, const DNSMessage* response)
+    {
+        QueryResponse res(make_unique<DNSMessage>(query));
+        if ( response )
+            res.set_response(make_unique<DNSMessage>(*response));
+        return res;
+    }
+}
+
+SCENARIO("LoadShedder ranks query/responses", "[shedding]")
+{
+    PacketStatistics stats{};
+    std::vector<unsigned> common = { CaptureDNS::A, CaptureDNS::AAAA };
+    LoadShedder shedder(50, common, stats);
+
+    DNSMessage query, response;
+    query.timestamp = std::chrono::system_clock::time_point(std::chrono::hours(24*365*20));
+    query.clientIP = IPAddress(Tins::IPv4Address("192.168.1.2"));
+    query.serverIP = IPAddress(Tins::IPv4Address("192.168.1.3"));
+    query.clientPort = 12345;
+    query.serverPort = 53;
+    query.dns.type(CaptureDNS::QUERY);
+    query.dns.id(54321);
+    query.dns.add_query(CaptureDNS::query("one", CaptureDNS::AAAA, CaptureDNS::IN));
+    response = query;
+    response.dns.type(CaptureDNS::RESPONSE);
+
+    GIVEN("A client that has been seen before")
+    {
+        REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::HIGH);
+
+        THEN("a common query with a NOERROR response is low priority")
+        {
+            REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::LOW);
+        }
+
+        THEN("a query with a NXDOMAIN response is normal priority")
+        {
+            response.dns.rcode(CaptureDNS::NXDOMAIN);
+            REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::NORMAL);
+        }
+
+        THEN("a query without a response is normal priority")
+        {
+            REQUIRE(shedder.priority(make_qr(query, nullptr)) == LoadShedder::NORMAL);
+        }
+
+        THEN("an error response is high priority")
+        {
+            response.dns.rcode(CaptureDNS::SERVFAIL);
+            REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::HIGH);
+        }
+
+        THEN("a truncated response is high priority")
+        {
+            response.dns.truncated(1);
+            REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::HIGH);
+        }
+
+        THEN("an unusual query type is high priority")
+        {
+            DNSMessage q2 = query;
+            q2.dns = CaptureDNS();
+            q2.dns.add_query(CaptureDNS::query("one", CaptureDNS::TYPE_ANY, CaptureDNS::IN));
+            REQUIRE(shedder.priority(make_qr(q2, &response)) == LoadShedder::HIGH);
+        }
+
+        THEN("an unusual OPCODE is high priority")
+        {
+            query.dns.opcode(CaptureDNS::OP_NOTIFY);
+            REQUIRE(shedder.priority(make_qr(query, &response)) == LoadShedder::HIGH);
+        }
+    }
+
+    GIVEN("A low priority query/response")
+    {
+        shedder.priority(make_qr(query, &response));
+        QueryResponse qr = make_qr(query, &response);
+
+        THEN("it is only shed above the threshold")
+        {
+            REQUIRE(!shedder.shed(qr, 49, 100));
+            REQUIRE(shedder.shed(qr, 50, 100));
+            REQUIRE(!shedder.shed(qr, 100, 0));
+            REQUIRE(stats.shed_low_priority_count == 1);
+        }
+    }
+
+    GIVEN("A normal priority query/response")
+    {
+        shedder.priority(make_qr(query, &response));
+        QueryResponse qr = make_qr(query, nullptr);
+
+        THEN("it is only shed half way from the threshold to full")
+        {
+            REQUIRE(!shedder.shed(qr, 74, 100));
+            REQUIRE(shedder.shed(qr, 75, 100));
+            REQUIRE(stats.shed_normal_priority_count == 1);
+        }
+    }
+
+    GIVEN("Many new clients arriving in one second under overload")
+    {
+        const unsigned NCLIENTS = 4 * LoadShedder::NEW_CLIENTS_PER_SECOND;
+        unsigned kept = 0;
+        for ( unsigned i = 0; i < NCLIENTS; ++i )
+        {
+            DNSMessage q = query;
+            q.clientIP = IPAddress(Tins::IPv4Address(0x0a000000 + i));
+            if ( !shedder.shed(make_qr(q, &response), 80, 100) )
+                ++kept;
+        }
+
+        THEN("only the new client budget is kept and the rest are shed")
+        {
+            REQUIRE(kept <= LoadShedder::NEW_CLIENTS_PER_SECOND);
+            REQUIRE(kept > 0);
+            REQUIRE(stats.shed_low_priority_count + stats.shed_normal_priority_count == NCLIENTS - kept);
+        }
+
+        AND_THEN("a new client in the next second is high priority")
+        {
+            DNSMessage q = query;
+            q.timestamp += std::chrono::seconds(1);
+            q.clientIP = IPAddress(Tins::IPv4Address("172.16.1.1"));
+            REQUIRE(shedder.priority(make_qr(q, &response)) == LoadShedder::HIGH);
+        }
+    }
+
+    GIVEN("A high priority query/response")
+    {
+        response.dns.rcode(CaptureDNS::REFUSED);
+        QueryResponse qr = make_qr(query, &response);
+
+        THEN("it is never shed")
+        {
+            REQUIRE(!shedder.shed(qr, 99, 100));
+            REQUIRE(stats.shed_low_priority_count == 0);
+            REQUIRE(stats.shed_normal_priority_count == 0);
+        }
+    }
+}
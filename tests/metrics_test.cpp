@@ -0,0 +1,239 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "metrics.hpp"
+
+SCENARIO("Latency histogram buckets have bounded error", "[metrics]")
+{
+    GIVEN("Some latencies")
+    {
+        THEN("small latencies have their own bucket")
+        {
+            for ( uint64_t us = 0; us < 16; ++us )
+            {
+                unsigned b = LatencyHistogram::bucket(us);
+                REQUIRE(LatencyHistogram::bucket_lowest(b) == us);
+                REQUIRE(LatencyHistogram::bucket_highest(b) == us);
+            }
+        }
+
+        THEN("larger latencies are in a bucket no wider than 1/8 of its lowest value")
+        {
+            for ( uint64_t us = 16; us < 100000; us += 7 )
+            {
+                unsigned b = LatencyHistogram::bucket(us);
+                uint64_t lo = LatencyHistogram::bucket_lowest(b);
+                uint64_t hi = LatencyHistogram::bucket_highest(b);
+                REQUIRE(lo <= us);
+                REQUIRE(us <= hi);
+                REQUIRE(hi - lo + 1 <= lo / 8);
+            }
+        }
+
+        THEN("buckets are contiguous")
+        {
+            for ( unsigned b = 1; b < LatencyHistogram::BUCKETS; ++b )
+                REQUIRE(LatencyHistogram::bucket_lowest(b) == LatencyHistogram::bucket_highest(b - 1) + 1);
+        }
+
+        THEN("very large latencies are in the last bucket")
+        {
+            REQUIRE(LatencyHistogram::bucket(UINT64_MAX) == LatencyHistogram::BUCKETS - 1);
+        }
+    }
+}
+
+SCENARIO("Latency histograms record latencies", "[metrics]")
+{
+    GIVEN("A histogram")
+    {
+        LatencyHistogram hist;
+
+        WHEN("nothing is recorded")
+        {
+            LatencyHistogram::Snapshot s = hist.snapshot();
+
+            THEN("the histogram is empty")
+            {
+                REQUIRE(s.count == 0);
+                REQUIRE(s.sum == 0);
+                REQUIRE(s.quantile(0.5) == 0);
+            }
+        }
+
+        WHEN("latencies from 1 to 1000us are recorded")
+        {
+            for ( unsigned us = 1; us <= 1000; ++us )
+                hist.record(std::chrono::microseconds(us));
+            LatencyHistogram::Snapshot s = hist.snapshot();
+
+            THEN("count, sum and maximum are correct")
+            {
+                REQUIRE(s.count == 1000);
+                REQUIRE(s.sum == 500500);
+                REQUIRE(s.max == 1000);
+            }
+
+            THEN("quantiles are within the bucket error")
+            {
+                REQUIRE(s.quantile(0.5) >= 500);
+                REQUIRE(s.quantile(0.5) <= 500 + 500 / 8);
+                REQUIRE(s.quantile(0.99) >= 990);
+                REQUIRE(s.quantile(1.0) == 1000);
+            }
+
+            THEN("counts below power of two boundaries are correct")
+            {
+                REQUIRE(s.count_below(1) == 0);
+                REQUIRE(s.count_below(2) == 1);
+                REQUIRE(s.count_below(512) == 511);
+                REQUIRE(s.count_below(1024) == 1000);
+            }
+        }
+
+        WHEN("a negative latency is recorded")
+        {
+            hist.record(std::chrono::microseconds(-5));
+            LatencyHistogram::Snapshot s = hist.snapshot();
+
+            THEN("it is recorded as 0")
+            {
+                REQUIRE(s.count == 1);
+                REQUIRE(s.counts[0] == 1);
+            }
+        }
+
+        WHEN("latencies are recorded from several threads")
+        {
+            std::vector<std::thread> threads;
+            for ( unsigned t = 0; t < 4; ++t )
+                threads.emplace_back(
+                    [&hist]()
+                    {
+                        for ( unsigned i = 0; i < 10000; ++i )
+                            hist.record(std::chrono::microseconds(100));
+                    });
+            for ( auto& t : threads )
+                t.join();
+
+            THEN("all are counted")
+            {
+                LatencyHistogram::Snapshot s = hist.snapshot();
+                REQUIRE(s.count == 40000);
+                REQUIRE(s.sum == 4000000);
+            }
+        }
+    }
+}
+
+SCENARIO("Metrics are written in text exposition format", "[metrics]")
+{
+    GIVEN("A metrics writer with samples added out of order")
+    {
+        MetricsWriter w;
+        w.gauge("test_queue_length", "Queue length.", 3, "queue=\"a\"");
+        w.counter("test_packets_total", "Packets.", 1234567890);
+        w.gauge("test_queue_length", "Queue length.", 0.5, "queue=\"b\"");
+
+        THEN("samples of each metric are written together")
+        {
+            std::ostringstream os;
+            w.write(os);
+            REQUIRE(os.str() ==
+                    "# HELP test_packets_total Packets.\n"
+                    "# TYPE test_packets_total counter\n"
+                    "test_packets_total 1234567890\n"
+                    "# HELP test_queue_length Queue length.\n"
+                    "# TYPE test_queue_length gauge\n"
+                    "test_queue_length{queue=\"a\"} 3\n"
+                    "test_queue_length{queue=\"b\"} 0.5\n");
+        }
+    }
+
+    GIVEN("A metrics writer with a histogram")
+    {
+        MetricsWriter w;
+        LatencyHistogram hist;
+        hist.record(std::chrono::microseconds(3));
+        hist.record(std::chrono::microseconds(1500000));
+        w.histogram("test_latency_seconds", "Latency.", hist.snapshot(), "stage=\"x\"");
+
+        std::ostringstream os;
+        w.write(os);
+        std::string out = os.str();
+
+        THEN("cumulative buckets, sum and count are written")
+        {
+            REQUIRE(out.find("# TYPE test_latency_seconds histogram\n") != std::string::npos);
+            REQUIRE(out.find("test_latency_seconds_bucket{stage=\"x\",le=\"2e-06\"} 0\n") != std::string::npos);
+            REQUIRE(out.find("test_latency_seconds_bucket{stage=\"x\",le=\"4e-06\"} 1\n") != std::string::npos);
+            REQUIRE(out.find("test_latency_seconds_bucket{stage=\"x\",le=\"+Inf\"} 2\n") != std::string::npos);
+            REQUIRE(out.find("test_latency_seconds_sum{stage=\"x\"} 1.500003\n") != std::string::npos);
+            REQUIRE(out.find("test_latency_seconds_count{stage=\"x\"} 2\n") != std::string::npos);
+        }
+    }
+}
+
+SCENARIO("Metrics include statistics and sources", "[metrics]")
+{
+    GIVEN("Metrics with published statistics")
+    {
+        Metrics metrics;
+        PacketStatistics stats{};
+        stats.raw_packet_count = 42;
+        stats.output_cbor_drop_count = 7;
+        metrics.set_statistics(stats);
+
+        WHEN("a source is added")
+        {
+            unsigned calls = 0;
+            {
+                MetricsSource source(&metrics,
+                                     [&](MetricsWriter& w)
+                                     {
+                                         ++calls;
+                                         w.gauge("test_value", "Test.", 99);
+                                     });
+
+                std::ostringstream os;
+                metrics.write(os);
+
+                THEN("statistics and source values are written")
+                {
+                    REQUIRE(os.str().find("compactor_packets_total 42\n") != std::string::npos);
+                    REQUIRE(os.str().find("compactor_dropped_total{reason=\"cdns\"} 7\n") != std::string::npos);
+                    REQUIRE(os.str().find("test_value 99\n") != std::string::npos);
+                    REQUIRE(os.str().find("compactor_stage_latency_seconds_count{stage=\"block_to_disk\"} 0\n") != std::string::npos);
+                }
+            }
+
+            AND_WHEN("the source is removed")
+            {
+                std::ostringstream os;
+                metrics.write(os);
+
+                THEN("it is no longer called")
+                {
+                    REQUIRE(calls == 1);
+                    REQUIRE(os.str().find("test_value") == std::string::npos);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "catch.hpp"
+
+#include "configuration.hpp"
+#include "makeunique.hpp"
+
+#include "packetretention.hpp"
+
+namespace {
+    /**
+     * \class TestPcapWriter
+     * \brief Record the timestamps of packets written, and create
+     * the output file on close.
+     */
+    class TestPcapWriter : public PcapBaseWriter
+    {
+    public:
+        TestPcapWriter(const std::string& filename,
+                       std::vector<std::chrono::system_clock::time_point>& written,
+                       unsigned& closed,
+                       std::shared_future<void> go)
+            : filename_(filename), written_(written), closed_(closed), go_(go) {}
+
+        virtual void close()
+        {
+            std::ofstream out(filename_);
+            ++closed_;
+        }
+
+        virtual void write_packet(Tins::PDU& /* pdu */,
+                                  const std::chrono::system_clock::time_point& timestamp)
+        {
+            go_.wait();
+            written_.push_back(timestamp);
+        }
+
+    private:
+        std::string filename_;
+        std::vector<std::chrono::system_clock::time_point>& written_;
+        unsigned& closed_;
+        std::shared_future<void> go_;
+    };
+
+    /**
+     * \class TempDir
+     * \brief A temporary directory, removed on destruction.
+     */
+    class TempDir
+    {
+    public:
+        TempDir()
+            : path_(boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path())
+        {
+            boost::filesystem::create_directory(path_);
+        }
+
+        ~TempDir()
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove_all(path_, ec);
+        }
+
+        std::string path(const std::string& name) const
+        {
+            return (path_ / name).string();
+        }
+
+    private:
+        boost::filesystem::path path_;
+    };
+
+    /**
+     * \brief Make a 100 byte packet.
+     *
+     * \param secs the packet timestamp, in seconds.
+     */
+    std::shared_ptr<PcapItem> make_packet(unsigned secs)
+    {
+        const uint8_t data[100] = {};
+        Tins::Packet pkt(Tins::RawPDU(data, sizeof(data)),
+                         std::chrono::microseconds(secs * 1000000ull));
+        return std::make_shared<PcapItem>(pkt);
+    }
+
+    bool wait_for_dumps(const PacketRetention& retention, uint64_t dumps)
+    {
+        for ( unsigned i = 0; i < 1000; ++i )
+        {
+            if ( retention.stats().dumps >= dumps )
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+}
+
+SCENARIO("Captured packets are retained", "[retention]")
+{
+    Configuration config;
+    TempDir dir;
+    std::string pattern = dir.path("dump.pcap");
+    std::vector<std::string> filenames;
+    std::vector<std::chrono::system_clock::time_point> written;
+    unsigned closed = 0;
+    std::promise<void> go_promise;
+    std::shared_future<void> go(go_promise.get_future());
+    PacketRetention::WriterFactory make_writer =
+        [&](const std::string& filename)
+        {
+            filenames.push_back(filename);
+            return make_unique<TestPcapWriter>(filename, written, closed, go);
+        };
+    const std::size_t PACKET_SIZE = PacketRetention::retained_size(*make_packet(0));
+
+    GIVEN("A retention period")
+    {
+        PacketRetention retention(std::chrono::seconds(10), 0, pattern, make_writer, config);
+
+        WHEN("packets are added over a longer period")
+        {
+            for ( unsigned secs : { 0, 5, 10, 15, 20 } )
+                retention.add(make_packet(secs));
+
+            THEN("packets older than the period are not retained")
+            {
+                PacketRetention::Stats stats = retention.stats();
+                REQUIRE(stats.packets == 3);
+                REQUIRE(stats.bytes == 3 * PACKET_SIZE);
+            }
+        }
+    }
+
+    GIVEN("A retention size")
+    {
+        const std::size_t MAX_BYTES = 2 * PACKET_SIZE + PACKET_SIZE / 2;
+        PacketRetention retention(std::chrono::seconds(0), MAX_BYTES, pattern, make_writer, config);
+
+        WHEN("more packet data is added")
+        {
+            for ( unsigned secs = 0; secs < 5; ++secs )
+            {
+                retention.add(make_packet(secs));
+                REQUIRE(retention.stats().bytes <= MAX_BYTES);
+            }
+
+            THEN("the oldest packets over the size are not retained")
+            {
+                PacketRetention::Stats stats = retention.stats();
+                REQUIRE(stats.packets == 2);
+                REQUIRE(stats.bytes == 2 * PACKET_SIZE);
+            }
+
+            AND_THEN("the retained size allows for more than the packet data")
+            {
+                REQUIRE(PACKET_SIZE > 100 + PacketRetention::PACKET_OVERHEAD);
+            }
+        }
+    }
+
+    GIVEN("Retained packets")
+    {
+        PacketRetention retention(std::chrono::seconds(10), 0, pattern, make_writer, config);
+        for ( unsigned secs = 1; secs <= 3; ++secs )
+            retention.add(make_packet(secs));
+
+        WHEN("they are dumped")
+        {
+            REQUIRE(retention.dump("test"));
+            go_promise.set_value();
+            REQUIRE(wait_for_dumps(retention, 1));
+
+            THEN("they are written in order to one output")
+            {
+                REQUIRE(written.size() == 3);
+                REQUIRE(written[0] == std::chrono::system_clock::time_point(std::chrono::seconds(1)));
+                REQUIRE(written[2] == std::chrono::system_clock::time_point(std::chrono::seconds(3)));
+                REQUIRE(closed == 1);
+                REQUIRE(filenames.size() == 1);
+                REQUIRE(filenames[0] == pattern);
+                REQUIRE(retention.stats().dumped_packets == 3);
+            }
+
+            AND_THEN("they are still retained")
+            {
+                REQUIRE(retention.stats().packets == 3);
+            }
+        }
+
+        WHEN("they are dumped while a dump is being written")
+        {
+            REQUIRE(retention.dump("first"));
+            bool second = retention.dump("second");
+            go_promise.set_value();
+            REQUIRE(wait_for_dumps(retention, 1));
+
+            THEN("only the first dump is written")
+            {
+                REQUIRE(!second);
+                REQUIRE(retention.stats().busy == 1);
+                REQUIRE(written.size() == 3);
+            }
+        }
+
+        WHEN("they are dumped twice")
+        {
+            go_promise.set_value();
+            REQUIRE(retention.dump("first"));
+            REQUIRE(wait_for_dumps(retention, 1));
+            REQUIRE(retention.dump("second"));
+            REQUIRE(wait_for_dumps(retention, 2));
+
+            THEN("each dump is written to a different file")
+            {
+                REQUIRE(filenames.size() == 2);
+                REQUIRE(filenames[0] != filenames[1]);
+                REQUIRE(closed == 2);
+                REQUIRE(written.size() == 6);
+            }
+        }
+    }
+
+    GIVEN("No retained packets")
+    {
+        PacketRetention retention(std::chrono::seconds(10), 0, pattern, make_writer, config);
+
+        WHEN("they are dumped")
+        {
+            THEN("no dump is written")
+            {
+                REQUIRE(!retention.dump("test"));
+                REQUIRE(retention.stats().dumps == 0);
+            }
+        }
+    }
+}
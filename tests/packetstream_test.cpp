@@ -25,6 +25,7 @@
 SCENARIO("PacketStream correctly parses packet", "[parse]")
 {
     Configuration config;
+    PacketStatistics stats{};
     std::vector<std::unique_ptr<DNSMessage>> dns_msgs;
     std::vector<std::shared_ptr<AddressEvent>> addr_events;
     PacketStream::DNSSink dns_sink =
@@ -38,7 +39,7 @@ SCENARIO("PacketStream correctly parses packet", "[parse]")
             addr_events.push_back(ae);
         };
 
-    PacketStream pkt_stream(config, dns_sink, address_event_sink);
+    PacketStream pkt_stream(config, dns_sink, address_event_sink, stats);
 
     GIVEN("A sample raw query DNS message")
     {
@@ -344,6 +345,26 @@ SCENARIO("PacketStream correctly parses packet", "[parse]")
             oss << *(dns_msgs[0]) << *(dns_msgs[1]);
             REQUIRE(oss.str() == expected);
         }
+
+        THEN("Both directions of the flow have the same flow hash")
+        {
+            std::shared_ptr<PcapItem> pcap_query = std::make_shared<PcapItem>(query);
+            std::shared_ptr<PcapItem> pcap_response = std::make_shared<PcapItem>(response);
+            REQUIRE(pkt_stream.flow_hash(pcap_query) == pkt_stream.flow_hash(pcap_response));
+            REQUIRE(pkt_stream.flow_hash(pcap_query) != 0);
+        }
+
+        THEN("Both directions of the flow get the same sampling decision")
+        {
+            std::shared_ptr<PcapItem> pcap_query = std::make_shared<PcapItem>(query);
+            std::shared_ptr<PcapItem> pcap_response = std::make_shared<PcapItem>(response);
+            for ( uint64_t k = 0; k < 20; ++k )
+            {
+                FlowSampler sampler(2, k, ~k);
+                REQUIRE(pkt_stream.sample_packet(pcap_query, sampler) ==
+                        pkt_stream.sample_packet(pcap_response, sampler));
+            }
+        }
     }
 
     GIVEN("A UDP query to non-DNS ports")
@@ -369,6 +390,13 @@ SCENARIO("PacketStream correctly parses packet", "[parse]")
             REQUIRE_THROWS_AS(pkt_stream.process_packet(pcap),
                               unhandled_packet);
         }
+
+        THEN("Packet is always kept when sampling")
+        {
+            std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+            FlowSampler sampler(1000000, 1, 2);
+            REQUIRE(pkt_stream.sample_packet(pcap, sampler));
+        }
     }
 
     GIVEN("A packet that is not IPv4 or IPv6")
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "catch.hpp"
+
+#include "perfcounters.hpp"
+
+SCENARIO("Performance counter reports are per million packets", "[perf]")
+{
+    GIVEN("Counts for two stages")
+    {
+        PerfCounters::Totals totals{};
+        totals.count[PerfCounters::DECODE][PerfCounters::CYCLES] = 3000;
+        totals.count[PerfCounters::DECODE][PerfCounters::INSTRUCTIONS] = 6000;
+        totals.count[PerfCounters::MATCH][PerfCounters::CYCLES] = 1000;
+        totals.count[PerfCounters::MATCH][PerfCounters::BRANCH_MISSES] = 3;
+
+        WHEN("a report for 1000 packets is written")
+        {
+            std::ostringstream os;
+            PerfCounters::write_report(os, totals, 1000);
+            std::string out = os.str();
+
+            THEN("counts are scaled and instructions per cycle given")
+            {
+                REQUIRE(out.find("Stage            cycles/Mpkt   instructions/Mpkt") == 0);
+                REQUIRE(out.find("\ndecode               3000000             6000000                   0                   0   2.00\n") != std::string::npos);
+                REQUIRE(out.find("\nmatch                1000000                   0                   0                3000   0.00\n") != std::string::npos);
+                REQUIRE(out.find("\nencode                     0                   0                   0                   0      -\n") != std::string::npos);
+                REQUIRE(out.find("\ntotal                4000000             6000000                   0                3000   1.50\n") != std::string::npos);
+            }
+        }
+
+        WHEN("an earlier total is subtracted")
+        {
+            PerfCounters::Totals earlier{};
+            earlier.count[PerfCounters::DECODE][PerfCounters::CYCLES] = 1000;
+            PerfCounters::Totals diff = totals - earlier;
+
+            THEN("the counts are the differences")
+            {
+                REQUIRE(diff.count[PerfCounters::DECODE][PerfCounters::CYCLES] == 2000);
+                REQUIRE(diff.count[PerfCounters::MATCH][PerfCounters::CYCLES] == 1000);
+            }
+        }
+
+        WHEN("a report for no packets is written")
+        {
+            std::ostringstream os;
+            PerfCounters::write_report(os, totals, 0);
+
+            THEN("no counts are given")
+            {
+                REQUIRE(os.str() == "No packets processed.\n");
+            }
+        }
+    }
+}
+
+SCENARIO("Performance counters count stages", "[perf]")
+{
+    GIVEN("Performance counters, if the system allows them")
+    {
+        std::unique_ptr<PerfCounters> perf;
+        try
+        {
+            perf.reset(new PerfCounters);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+
+        if ( perf )
+        {
+            WHEN("work is done in nested stages")
+            {
+                volatile uint64_t sum = 0;
+                {
+                    PerfStageScope decode(perf.get(), PerfCounters::DECODE);
+                    for ( unsigned i = 0; i < 100000; ++i )
+                        sum = sum + i;
+                    {
+                        PerfStageScope match(perf.get(), PerfCounters::MATCH);
+                        for ( unsigned i = 0; i < 100000; ++i )
+                            sum = sum + i;
+                    }
+                }
+                PerfCounters::Totals totals = perf->totals();
+
+                THEN("only the stages entered count")
+                {
+                    REQUIRE(totals.count[PerfCounters::DECODE][PerfCounters::INSTRUCTIONS] > 100000);
+                    REQUIRE(totals.count[PerfCounters::MATCH][PerfCounters::INSTRUCTIONS] > 100000);
+                    REQUIRE(totals.count[PerfCounters::DEDUP][PerfCounters::INSTRUCTIONS] == 0);
+                    REQUIRE(totals.count[PerfCounters::ENCODE][PerfCounters::INSTRUCTIONS] == 0);
+                }
+            }
+        }
+    }
+
+    GIVEN("No performance counters")
+    {
+        THEN("a stage scope does nothing")
+        {
+            PerfStageScope scope(nullptr, PerfCounters::DECODE);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "catch.hpp"
+
+#include "replayreport.hpp"
+
+namespace {
+    ReplayReport::Sample make_sample(double time, uint64_t offered, uint64_t received,
+                                     uint64_t sniffer_drops, uint64_t cdns_drops,
+                                     unsigned sniffer_queue)
+    {
+        ReplayReport::Sample s{};
+        s.time = time;
+        s.offered = offered;
+        s.received = received;
+        s.sniffer_drops = sniffer_drops;
+        s.cdns_drops = cdns_drops;
+        s.sniffer_queue = sniffer_queue;
+        return s;
+    }
+}
+
+SCENARIO("Replay reports find peak rate and drop onset", "[replay]")
+{
+    GIVEN("A replay with a rising rate that starts dropping")
+    {
+        ReplayReport report;
+        report.add_sample(make_sample(1, 1000, 1000, 0, 0, 10));
+        report.add_sample(make_sample(2, 3000, 3000, 0, 0, 50));
+        report.add_sample(make_sample(3, 6000, 5500, 500, 0, 1000));
+        report.add_sample(make_sample(4, 10000, 8000, 2000, 7, 1000));
+
+        WHEN("the summary is written")
+        {
+            std::ostringstream os;
+            report.write_summary(os);
+            std::string out = os.str();
+
+            THEN("totals, peak rate, onset and queues are reported")
+            {
+                REQUIRE(out.find("Packets offered         10000 (2500.0 pps)") != std::string::npos);
+                REQUIRE(out.find("Packets received        8000 (2000.0 pps)") != std::string::npos);
+                REQUIRE(out.find("Peak rate without drops 2000.0 pps") != std::string::npos);
+                REQUIRE(out.find("Drops started           after 2.0 s, offered 3000.0 pps, at sniffer\n") != std::string::npos);
+                REQUIRE(out.find("Drops                   sniffer 2000, matcher 0, C-DNS 7") != std::string::npos);
+                REQUIRE(out.find("Peak queue lengths      sniffer 1000,") != std::string::npos);
+            }
+        }
+
+        WHEN("the samples are written")
+        {
+            std::ostringstream os;
+            report.write_samples(os);
+            std::string out = os.str();
+
+            THEN("there is a header and a line per sample with rates")
+            {
+                REQUIRE(out.find("time,offered,received,offered_pps,received_pps,") == 0);
+                REQUIRE(out.find("\n2.000,3000,3000,2000.000,2000.000,0,0,0,50,0,0,0\n") != std::string::npos);
+                REQUIRE(std::count(out.begin(), out.end(), '\n') == 5);
+            }
+        }
+    }
+
+    GIVEN("A replay without drops")
+    {
+        ReplayReport report;
+        report.add_sample(make_sample(1, 1000, 1000, 0, 0, 0));
+
+        THEN("no drop onset is reported")
+        {
+            std::ostringstream os;
+            report.write_summary(os);
+            REQUIRE(os.str().find("Drops started           never\n") != std::string::npos);
+        }
+    }
+}
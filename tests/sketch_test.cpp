@@ -0,0 +1,412 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "blockcbor.hpp"
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+
+#include "sketch.hpp"
+
+namespace {
+    class TestCborEncoder : public CborBaseEncoder
+    {
+    public:
+        TestCborEncoder() : CborBaseEncoder() {}
+
+        std::vector<uint8_t> bytes;
+
+    protected:
+        virtual void writeBytes(const uint8_t *p, std::ptrdiff_t nBytes)
+        {
+            while ( nBytes-- > 0 )
+                bytes.push_back(*p++);
+        }
+    };
+
+    class TestCborDecoder : public CborBaseDecoder
+    {
+    public:
+        TestCborDecoder(const std::vector<uint8_t>& bytes)
+            : CborBaseDecoder(), bytes_(bytes) {}
+
+    protected:
+        virtual unsigned readBytes(uint8_t* p, std::ptrdiff_t n_bytes)
+        {
+            if ( bytes_.empty() )
+                throw cbor_end_of_input();
+
+            unsigned res = 0;
+            while ( res < n_bytes && !bytes_.empty() )
+            {
+                *p++ = bytes_.front();
+                bytes_.erase(bytes_.begin());
+                ++res;
+            }
+            return res;
+        }
+
+    private:
+        std::vector<uint8_t> bytes_;
+    };
+
+    byte_string item(const std::string& prefix, unsigned n)
+    {
+        return to_byte_string(prefix + std::to_string(n));
+    }
+
+    std::vector<uint8_t> encode(const HyperLogLog& hll)
+    {
+        TestCborEncoder enc;
+        hll.writeCbor(enc);
+        enc.flush();
+        return enc.bytes;
+    }
+
+    std::vector<uint8_t> encode(const HeavyHitters& hh)
+    {
+        TestCborEncoder enc;
+        hh.writeCbor(enc);
+        enc.flush();
+        return enc.bytes;
+    }
+}
+
+SCENARIO("HyperLogLog estimates distinct items", "[sketch]")
+{
+    GIVEN("An empty sketch")
+    {
+        HyperLogLog hll;
+
+        THEN("it is empty and estimates no items")
+        {
+            REQUIRE(hll.empty());
+            REQUIRE(hll.precision() == HyperLogLog::DEFAULT_PRECISION);
+            REQUIRE(hll.estimate() == 0.0);
+        }
+
+        WHEN("a few items are added, some repeatedly")
+        {
+            for ( unsigned i = 0; i < 3; ++i )
+                for ( unsigned j = 0; j < 10; ++j )
+                    hll.add(item("client", j));
+
+            THEN("the estimate is close to exact")
+            {
+                REQUIRE(!hll.empty());
+                REQUIRE(hll.estimate() > 9.5);
+                REQUIRE(hll.estimate() < 10.5);
+            }
+        }
+
+        WHEN("many items are added")
+        {
+            for ( unsigned i = 0; i < 100000; ++i )
+                hll.add(item("client", i));
+
+            THEN("the estimate is within a few standard errors")
+            {
+                REQUIRE(hll.estimate() > 95000);
+                REQUIRE(hll.estimate() < 105000);
+            }
+
+            AND_WHEN("the sketch is cleared")
+            {
+                hll.clear();
+
+                THEN("it is empty")
+                {
+                    REQUIRE(hll.empty());
+                }
+            }
+        }
+    }
+
+    GIVEN("An unsupported precision")
+    {
+        THEN("construction fails")
+        {
+            REQUIRE_THROWS_AS(HyperLogLog(HyperLogLog::MIN_PRECISION - 1), std::invalid_argument);
+            REQUIRE_THROWS_AS(HyperLogLog(HyperLogLog::MAX_PRECISION + 1), std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("HyperLogLog sketches merge", "[sketch]")
+{
+    GIVEN("Two sketches with overlapping items")
+    {
+        HyperLogLog a, b, all;
+        for ( unsigned i = 0; i < 30000; ++i )
+        {
+            a.add(item("client", i));
+            all.add(item("client", i));
+        }
+        for ( unsigned i = 20000; i < 50000; ++i )
+        {
+            b.add(item("client", i));
+            all.add(item("client", i));
+        }
+
+        WHEN("they are merged")
+        {
+            a.merge(b);
+
+            THEN("the result is the sketch of all the items")
+            {
+                REQUIRE(encode(a) == encode(all));
+                REQUIRE(a.estimate() > 47500);
+                REQUIRE(a.estimate() < 52500);
+            }
+        }
+    }
+
+    GIVEN("Sketches of different precision")
+    {
+        HyperLogLog high(14), low(10), low_all(10);
+        for ( unsigned i = 0; i < 20000; ++i )
+        {
+            high.add(item("client", i));
+            low_all.add(item("client", i));
+        }
+        for ( unsigned i = 10000; i < 40000; ++i )
+        {
+            low.add(item("client", i));
+            low_all.add(item("client", i));
+        }
+
+        WHEN("the higher precision sketch is merged into the lower")
+        {
+            low.merge(high);
+
+            THEN("the result is the lower precision sketch of all the items")
+            {
+                REQUIRE(low.precision() == 10);
+                REQUIRE(encode(low) == encode(low_all));
+            }
+        }
+
+        WHEN("the lower precision sketch is merged into the higher")
+        {
+            high.merge(low);
+
+            THEN("the result is the lower precision sketch of all the items")
+            {
+                REQUIRE(high.precision() == 10);
+                REQUIRE(encode(high) == encode(low_all));
+            }
+        }
+    }
+}
+
+SCENARIO("HyperLogLog sketches can be written and read", "[sketch]")
+{
+    GIVEN("A sketch with few registers set")
+    {
+        HyperLogLog hll;
+        for ( unsigned i = 0; i < 100; ++i )
+            hll.add(item("client", i));
+
+        WHEN("it is written")
+        {
+            std::vector<uint8_t> bytes = encode(hll);
+
+            THEN("it is written in the sparse form")
+            {
+                REQUIRE(bytes.size() < 400);
+            }
+
+            AND_WHEN("it is read")
+            {
+                TestCborDecoder dec(bytes);
+                HyperLogLog hll2(HyperLogLog::MIN_PRECISION);
+                hll2.readCbor(dec);
+
+                THEN("the sketch is unchanged")
+                {
+                    REQUIRE(hll2.precision() == hll.precision());
+                    REQUIRE(encode(hll2) == bytes);
+                    REQUIRE(hll2.estimate() == hll.estimate());
+                }
+            }
+        }
+    }
+
+    GIVEN("A sketch with most registers set")
+    {
+        HyperLogLog hll(8);
+        for ( unsigned i = 0; i < 10000; ++i )
+            hll.add(item("client", i));
+
+        WHEN("it is written and read")
+        {
+            std::vector<uint8_t> bytes = encode(hll);
+            TestCborDecoder dec(bytes);
+            HyperLogLog hll2;
+            hll2.readCbor(dec);
+
+            THEN("it is written in the dense form")
+            {
+                REQUIRE(bytes.size() > 256);
+                REQUIRE(bytes.size() < 270);
+            }
+
+            THEN("the sketch is unchanged")
+            {
+                REQUIRE(hll2.precision() == 8);
+                REQUIRE(encode(hll2) == bytes);
+            }
+        }
+    }
+
+    GIVEN("A sketch with a bad precision")
+    {
+        std::vector<uint8_t> bytes = { 0x82, 0x02, 0x40 };
+        TestCborDecoder dec(bytes);
+        HyperLogLog hll;
+
+        THEN("reading it fails")
+        {
+            REQUIRE_THROWS_AS(hll.readCbor(dec), cbor_file_format_error);
+        }
+    }
+}
+
+SCENARIO("HeavyHitters finds the most frequent items", "[sketch]")
+{
+    GIVEN("A sketch with space for all items")
+    {
+        HeavyHitters hh(4);
+        hh.add(item("name", 1), 5);
+        hh.add(item("name", 2), 2);
+        hh.add(item("name", 3));
+        hh.add(item("name", 2), 4);
+
+        THEN("the counts are exact")
+        {
+            std::vector<HeavyHitters::Entry> top = hh.top();
+            REQUIRE(top.size() == 3);
+            REQUIRE(top[0].item == item("name", 2));
+            REQUIRE(top[0].count == 6);
+            REQUIRE(top[0].error == 0);
+            REQUIRE(top[1].item == item("name", 1));
+            REQUIRE(top[1].count == 5);
+            REQUIRE(top[2].item == item("name", 3));
+            REQUIRE(top[2].count == 1);
+            REQUIRE(hh.total() == 12);
+            REQUIRE(hh.floor() == 0);
+        }
+
+        THEN("the number of items returned can be limited")
+        {
+            REQUIRE(hh.top(1).size() == 1);
+        }
+    }
+
+    GIVEN("A full sketch")
+    {
+        HeavyHitters hh(2);
+        hh.add(item("name", 1), 10);
+        hh.add(item("name", 2), 3);
+
+        WHEN("a new item is added")
+        {
+            hh.add(item("name", 3));
+
+            THEN("it replaces the least frequent item")
+            {
+                std::vector<HeavyHitters::Entry> top = hh.top();
+                REQUIRE(top.size() == 2);
+                REQUIRE(top[0].item == item("name", 1));
+                REQUIRE(top[1].item == item("name", 3));
+                REQUIRE(top[1].count == 4);
+                REQUIRE(top[1].error == 3);
+                REQUIRE(hh.floor() == 3);
+                REQUIRE(hh.total() == 14);
+            }
+        }
+    }
+
+    GIVEN("A zero capacity")
+    {
+        THEN("construction fails")
+        {
+            REQUIRE_THROWS_AS(HeavyHitters(0), std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("HeavyHitters sketches merge", "[sketch]")
+{
+    GIVEN("Two sketches built from exact counts")
+    {
+        HeavyHitters a(2), b(2);
+        a.add(item("name", 1), 100);
+        a.add(item("name", 2), 50);
+        a.add_untracked(30, 10);
+        b.add(item("name", 2), 80);
+        b.add(item("name", 3), 20);
+        b.add_untracked(5, 5);
+
+        WHEN("they are merged")
+        {
+            a.merge(b);
+
+            THEN("the counts are upper bounds with error bounds")
+            {
+                std::vector<HeavyHitters::Entry> top = a.top();
+                REQUIRE(top.size() == 2);
+                REQUIRE(top[0].item == item("name", 2));
+                REQUIRE(top[0].count == 130);
+                REQUIRE(top[0].error == 0);
+                REQUIRE(top[1].item == item("name", 1));
+                REQUIRE(top[1].count == 105);
+                REQUIRE(top[1].error == 5);
+                REQUIRE(a.total() == 285);
+                REQUIRE(a.floor() == 30);
+                REQUIRE(a.capacity() == 2);
+            }
+        }
+    }
+}
+
+SCENARIO("HeavyHitters sketches can be written and read", "[sketch]")
+{
+    GIVEN("A sketch")
+    {
+        HeavyHitters hh(3);
+        hh.add(item("name", 1), 7);
+        hh.add(item("name", 2), 3);
+        hh.add_untracked(4, 2);
+
+        WHEN("it is written and read into a smaller sketch")
+        {
+            std::vector<uint8_t> bytes = encode(hh);
+            TestCborDecoder dec(bytes);
+            HeavyHitters hh2(1);
+            hh2.add(item("name", 9));
+            hh2.readCbor(dec);
+
+            THEN("the sketch is unchanged")
+            {
+                REQUIRE(hh2.total() == 14);
+                REQUIRE(hh2.floor() == 2);
+                REQUIRE(hh2.capacity() == 2);
+                REQUIRE(encode(hh2) == bytes);
+            }
+        }
+    }
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "tcpreassembler.hpp"
+
+SCENARIO("TcpRingBuffer holds data across wraps", "[tcp]")
+{
+    GIVEN("A ring buffer with data consumed from the front")
+    {
+        TcpRingBuffer rb;
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> data(400);
+        for ( std::size_t i = 0; i < data.size(); ++i )
+            data[i] = static_cast<uint8_t>(i);
+
+        rb.append(data.data(), data.size());
+        rb.consume(300);
+        rb.append(data.data(), data.size());
+
+        THEN("data wrapping the end of the buffer is read correctly")
+        {
+            REQUIRE(rb.size() == 500);
+            REQUIRE(rb.capacity() == 512);
+            REQUIRE(rb[0] == 44);
+            REQUIRE(rb[100] == 0);
+            const uint8_t* p = rb.front(300, scratch);
+            REQUIRE(p == scratch.data());
+            REQUIRE(p[99] == 143);
+            REQUIRE(p[100] == 0);
+            REQUIRE(p[299] == 199);
+        }
+
+        WHEN("more data than the capacity is added")
+        {
+            rb.append(data.data(), data.size());
+
+            THEN("the buffer grows and keeps the data in order")
+            {
+                REQUIRE(rb.size() == 900);
+                REQUIRE(rb.capacity() == 1024);
+                REQUIRE(rb[0] == 44);
+                REQUIRE(rb[100] == 0);
+                REQUIRE(rb[500] == 0);
+                REQUIRE(rb.front(900, scratch) != scratch.data());
+            }
+        }
+    }
+}
+
+SCENARIO("TcpReassembler extracts DNS messages from TCP flows", "[tcp]")
+{
+    PacketStatistics stats{};
+    std::vector<std::vector<uint8_t>> msgs;
+    TcpReassembler::MessageSink sink =
+        [&](const uint8_t* data, std::size_t len)
+        {
+            msgs.emplace_back(data, data + len);
+        };
+
+    IPAddress client("192.168.1.77");
+    IPAddress server("192.168.1.254");
+    std::chrono::system_clock::time_point t(std::chrono::seconds(100));
+    const uint32_t cseq = 1000;
+    const uint8_t two_msgs[] = { 0x00, 0x03, 0x01, 0x02, 0x03,
+                                 0x00, 0x02, 0x04, 0x05 };
+
+    GIVEN("A reassembler with a flow started by SYN")
+    {
+        TcpReassembler tr(10, 0, std::chrono::seconds(60), stats);
+        tr.process(client, 2000, server, 53, cseq - 1, TcpReassembler::SYN,
+                   nullptr, 0, t, sink);
+        REQUIRE(tr.flow_count() == 1);
+
+        WHEN("a segment holds two complete messages")
+        {
+            tr.process(client, 2000, server, 53, cseq, 0,
+                       two_msgs, sizeof(two_msgs), t, sink);
+
+            THEN("both messages are output")
+            {
+                REQUIRE(msgs.size() == 2);
+                REQUIRE(msgs[0] == std::vector<uint8_t>({ 0x01, 0x02, 0x03 }));
+                REQUIRE(msgs[1] == std::vector<uint8_t>({ 0x04, 0x05 }));
+            }
+        }
+
+        WHEN("messages are split across segments")
+        {
+            tr.process(client, 2000, server, 53, cseq, 0,
+                       two_msgs, 1, t, sink);
+            REQUIRE(msgs.size() == 0);
+            tr.process(client, 2000, server, 53, cseq + 1, 0,
+                       two_msgs + 1, 5, t, sink);
+            REQUIRE(msgs.size() == 1);
+            tr.process(client, 2000, server, 53, cseq + 6, 0,
+                       two_msgs + 6, 3, t, sink);
+
+            THEN("both messages are output")
+            {
+                REQUIRE(msgs.size() == 2);
+                REQUIRE(msgs[0] == std::vector<uint8_t>({ 0x01, 0x02, 0x03 }));
+                REQUIRE(msgs[1] == std::vector<uint8_t>({ 0x04, 0x05 }));
+            }
+        }
+
+        WHEN("segments arrive out of order and retransmitted")
+        {
+            tr.process(client, 2000, server, 53, cseq + 4, 0,
+                       two_msgs + 4, 5, t, sink);
+            REQUIRE(msgs.size() == 0);
+            tr.process(client, 2000, server, 53, cseq, 0,
+                       two_msgs, 6, t, sink);
+            tr.process(client, 2000, server, 53, cseq, 0,
+                       two_msgs, 9, t, sink);
+
+            THEN("each message is output once in order")
+            {
+                REQUIRE(msgs.size() == 2);
+                REQUIRE(msgs[0] == std::vector<uint8_t>({ 0x01, 0x02, 0x03 }));
+                REQUIRE(msgs[1] == std::vector<uint8_t>({ 0x04, 0x05 }));
+            }
+        }
+
+        WHEN("both sides send FIN")
+        {
+            tr.process(client, 2000, server, 53, cseq, TcpReassembler::FIN,
+                       nullptr, 0, t, sink);
+            REQUIRE(tr.flow_count() == 1);
+            tr.process(server, 53, client, 2000, 5000, TcpReassembler::FIN,
+                       nullptr, 0, t, sink);
+
+            THEN("the flow is removed")
+            {
+                REQUIRE(tr.flow_count() == 0);
+                REQUIRE(tr.memory_used() == 0);
+            }
+        }
+
+        WHEN("either side sends RST")
+        {
+            tr.process(server, 53, client, 2000, 5000, TcpReassembler::RST,
+                       nullptr, 0, t, sink);
+
+            THEN("the flow is removed")
+            {
+                REQUIRE(tr.flow_count() == 0);
+                REQUIRE(tr.memory_used() == 0);
+            }
+        }
+
+        WHEN("the flow is idle past the timeout")
+        {
+            tr.expire(t + std::chrono::seconds(59));
+            REQUIRE(tr.flow_count() == 1);
+            tr.expire(t + std::chrono::seconds(60));
+
+            THEN("the flow is removed")
+            {
+                REQUIRE(tr.flow_count() == 0);
+                REQUIRE(stats.tcp_flow_memory_drop_count == 0);
+            }
+        }
+    }
+
+    GIVEN("A reassembler with a small flow limit")
+    {
+        TcpReassembler tr(2, 0, std::chrono::seconds(60), stats);
+
+        WHEN("more flows than the limit start")
+        {
+            for ( uint16_t port = 2000; port < 2003; ++port )
+                tr.process(client, port, server, 53, cseq - 1, TcpReassembler::SYN,
+                           nullptr, 0, t, sink);
+
+            THEN("the oldest flow is dropped and counted")
+            {
+                REQUIRE(tr.flow_count() == 2);
+                REQUIRE(stats.tcp_flow_limit_drop_count == 1);
+                REQUIRE(stats.tcp_flow_memory_drop_count == 0);
+            }
+        }
+    }
+
+    GIVEN("A reassembler with a small memory budget")
+    {
+        TcpReassembler tr(0, 2048, std::chrono::seconds(60), stats);
+        const uint8_t partial[] = { 0x01, 0x00, 0x01 };
+
+        WHEN("flows buffer more data than the budget")
+        {
+            for ( uint16_t port = 2000; port < 2004; ++port )
+                tr.process(client, port, server, 53, cseq, 0,
+                           partial, sizeof(partial), t, sink);
+
+            THEN("least recently active flows are dropped and counted")
+            {
+                REQUIRE(tr.memory_used() <= 2048);
+                REQUIRE(tr.flow_count() < 4);
+                REQUIRE(stats.tcp_flow_memory_drop_count == 4 - tr.flow_count());
+            }
+        }
+
+        WHEN("a gap is never filled")
+        {
+            std::vector<uint8_t> big(1400);
+            TcpReassembler tr2(0, 0, std::chrono::seconds(60), stats);
+            tr2.process(client, 2000, server, 53, cseq - 1, TcpReassembler::SYN,
+                        nullptr, 0, t, sink);
+            for ( uint32_t seg = 1; seg < 48; ++seg )
+                tr2.process(client, 2000, server, 53, cseq + seg * 1400, 0,
+                            big.data(), big.size(), t, sink);
+
+            THEN("the flow is dropped when too much data is held")
+            {
+                REQUIRE(tr2.flow_count() == 0);
+                REQUIRE(stats.tcp_flow_memory_drop_count == 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "catch.hpp"
+
+#include "util.hpp"
+
+SCENARIO("CPU lists can be parsed", "[util]")
+{
+    GIVEN("Valid CPU lists")
+    {
+        THEN("single CPUs and ranges are expanded")
+        {
+            REQUIRE(parse_cpu_list("5") == std::vector<unsigned>({5}));
+            REQUIRE(parse_cpu_list("0-3,8,10-11") == std::vector<unsigned>({0, 1, 2, 3, 8, 10, 11}));
+        }
+
+        THEN("CPUs are sorted and duplicates removed")
+        {
+            REQUIRE(parse_cpu_list("3,1,1-2") == std::vector<unsigned>({1, 2, 3}));
+        }
+    }
+
+    GIVEN("Invalid CPU lists")
+    {
+        THEN("an exception is thrown")
+        {
+            REQUIRE_THROWS_AS(parse_cpu_list(""), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_cpu_list("1-"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_cpu_list("3-1"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_cpu_list("1,,2"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_cpu_list("one"), std::invalid_argument);
+        }
+    }
+}
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+SCENARIO("Running threads follow placement changes", "[util]")
+{
+    GIVEN("A named thread")
+    {
+        cpu_set_t all;
+        REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(all), &all) == 0);
+        unsigned first = 0;
+        while ( !CPU_ISSET(first, &all) )
+            ++first;
+
+        std::promise<void> named;
+        std::promise<void> done;
+        std::shared_future<void> done_future(done.get_future());
+        std::thread t(
+            [&]()
+            {
+                set_thread_name("test:placed");
+                named.set_value();
+                done_future.wait();
+            });
+        named.get_future().wait();
+
+        WHEN("a placement is set for the thread name")
+        {
+            REQUIRE(set_thread_placements({{"test:placed", {first}}}));
+
+            THEN("the thread is moved to the CPUs")
+            {
+                cpu_set_t cpus;
+                REQUIRE(pthread_getaffinity_np(t.native_handle(), sizeof(cpus), &cpus) == 0);
+                REQUIRE(CPU_COUNT(&cpus) == 1);
+                REQUIRE(CPU_ISSET(first, &cpus));
+            }
+
+            AND_WHEN("the placement is removed")
+            {
+                REQUIRE(set_thread_placements({}));
+
+                THEN("the thread may run on any CPU again")
+                {
+                    cpu_set_t cpus;
+                    REQUIRE(pthread_getaffinity_np(t.native_handle(), sizeof(cpus), &cpus) == 0);
+                    REQUIRE(CPU_EQUAL(&cpus, &all));
+                }
+            }
+        }
+
+        REQUIRE(set_thread_placements({}));
+        done.set_value();
+        t.join();
+    }
+}
+#endif
+
+SCENARIO("Times can be parsed", "[util]")
+{
+    GIVEN("Valid times")
+    {
+        std::chrono::system_clock::time_point t(std::chrono::seconds(1650000000));
+
+        THEN("ISO 8601 and epoch times are parsed")
+        {
+            REQUIRE(parse_time_point("2022-04-15T05:20:00") == t);
+            REQUIRE(parse_time_point("2022-04-15 05:20:00Z") == t);
+            REQUIRE(parse_time_point("1650000000") == t);
+        }
+
+        THEN("fractional seconds are parsed")
+        {
+            REQUIRE(parse_time_point("2022-04-15T05:20:00.25Z") == t + std::chrono::milliseconds(250));
+            REQUIRE(parse_time_point("1650000000.000001") == t + std::chrono::microseconds(1));
+        }
+    }
+
+    GIVEN("Invalid times")
+    {
+        THEN("an exception is thrown")
+        {
+            REQUIRE_THROWS_AS(parse_time_point(""), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_time_point("2022-04-15"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_time_point("2022-13-15T05:20:00"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_time_point("2022-04-15T05:20"), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_time_point("1650000000."), std::invalid_argument);
+            REQUIRE_THROWS_AS(parse_time_point("yesterday"), std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2022 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "catch.hpp"
+#include "configuration.hpp"
+#include "packetstatistics.hpp"
+#include "packetstream.hpp"
+
+#include "workload.hpp"
+
+SCENARIO("Zipf distribution favours low ranks", "[workload]")
+{
+    GIVEN("A Zipf distribution over 1000 values")
+    {
+        std::mt19937_64 rng(1);
+        ZipfDistribution zipf(1000, 1.0);
+        std::map<uint64_t, unsigned> counts;
+        const unsigned N = 100000;
+        for ( unsigned i = 0; i < N; ++i )
+            counts[zipf(rng)]++;
+
+        THEN("values are in range and rank 1 has the expected frequency")
+        {
+            REQUIRE(counts.begin()->first >= 1);
+            REQUIRE(counts.rbegin()->first <= 1000);
+            REQUIRE(counts[1] > counts[2]);
+            REQUIRE(counts[2] > counts[10]);
+            // 1/H(1000) is about 0.134.
+            REQUIRE(counts[1] > N * 0.12);
+            REQUIRE(counts[1] < N * 0.15);
+        }
+    }
+
+    GIVEN("A Zipf distribution with exponent 0")
+    {
+        std::mt19937_64 rng(1);
+        ZipfDistribution zipf(100, 0);
+        double sum = 0;
+        const unsigned N = 100000;
+        for ( unsigned i = 0; i < N; ++i )
+            sum += zipf(rng);
+
+        THEN("it is uniform")
+        {
+            REQUIRE(sum / N > 49);
+            REQUIRE(sum / N < 52);
+        }
+    }
+}
+
+SCENARIO("Workload generator produces ordered, repeatable messages", "[workload]")
+{
+    GIVEN("Workload parameters")
+    {
+        WorkloadParameters params;
+        params.queries = 2000;
+        params.loss = 0.1;
+        params.check();
+
+        WHEN("two workloads are generated with the same seed")
+        {
+            WorkloadGenerator gen1(params);
+            WorkloadGenerator gen2(params);
+            WorkloadMessage m1, m2;
+            bool same = true, ordered = true;
+            unsigned messages = 0;
+            std::chrono::system_clock::time_point last;
+            while ( gen1.next(m1) )
+            {
+                if ( !gen2.next(m2) || m1.wire != m2.wire || m1.timestamp != m2.timestamp )
+                    same = false;
+                if ( messages > 0 && m1.timestamp < last )
+                    ordered = false;
+                last = m1.timestamp;
+                messages++;
+            }
+
+            THEN("they are identical and in time order")
+            {
+                REQUIRE(same);
+                REQUIRE(ordered);
+                REQUIRE(!gen2.next(m2));
+                REQUIRE(gen1.query_count() == 2000);
+                REQUIRE(messages == gen1.query_count() + gen1.response_count());
+                REQUIRE(gen1.response_count() > 1700);
+                REQUIRE(gen1.response_count() < 1900);
+            }
+        }
+    }
+
+    GIVEN("Workload parameters with all queries lost")
+    {
+        WorkloadParameters params;
+        params.queries = 100;
+        params.loss = 1;
+        params.check();
+        WorkloadGenerator gen(params);
+        WorkloadMessage msg;
+        unsigned queries = 0;
+        while ( gen.next(msg) )
+            if ( msg.query )
+                queries++;
+
+        THEN("there are only queries")
+        {
+            REQUIRE(queries == 100);
+            REQUIRE(gen.response_count() == 0);
+        }
+    }
+
+    GIVEN("Invalid query type weights")
+    {
+        WorkloadParameters params;
+        params.qtype_weights = { "A=1", "BOGUS=2" };
+
+        THEN("checking throws")
+        {
+            REQUIRE_THROWS_AS(params.check(), boost::program_options::error);
+        }
+    }
+}
+
+SCENARIO("Workload packets can be parsed", "[workload]")
+{
+    GIVEN("A workload with TCP, fragments, IPv6 and DNSSEC")
+    {
+        WorkloadParameters params;
+        params.queries = 500;
+        params.loss = 0;
+        params.tcp_fraction = 0.2;
+        params.fragment_fraction = 0.2;
+        params.ipv6_fraction = 0.5;
+        params.dnssec_fraction = 0.5;
+        params.check();
+
+        Configuration config;
+        PacketStatistics stats{};
+        unsigned queries = 0, responses = 0;
+        PacketStream pkt_stream(
+            config,
+            [&](std::unique_ptr<DNSMessage>& dns)
+            {
+                if ( dns->dns.type() == CaptureDNS::RESPONSE )
+                    responses++;
+                else
+                    queries++;
+            },
+            [](std::shared_ptr<AddressEvent>) {},
+            stats);
+
+        WorkloadGenerator gen(params);
+        WorkloadMessage msg;
+        std::vector<WorkloadPacket> packets;
+        while ( gen.next(msg) )
+            gen.packets(msg, packets);
+
+        WHEN("the packets are processed")
+        {
+            for ( const auto& p : packets )
+            {
+                Tins::Packet pkt(Tins::EthernetII(p.data.data(), p.data.size()),
+                                 std::chrono::duration_cast<std::chrono::microseconds>(p.timestamp.time_since_epoch()));
+                auto item = std::make_shared<PcapItem>(pkt);
+                pkt_stream.process_packet(item);
+            }
+
+            THEN("every message is found")
+            {
+                REQUIRE(packets.size() > 1000);
+                REQUIRE(queries == 500);
+                REQUIRE(responses == 500);
+            }
+        }
+    }
+}